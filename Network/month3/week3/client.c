@@ -190,7 +190,11 @@ int validate_submission(int argc, char **argv){
 
     if (cmd_id == JOBSUBMITID){
         if (argc < 4){
-            printf("usage: ./client submit [JOBTYPE] [FILEPATH]\n");
+            printf("usage: ./client submit [JOBTYPE] [FILEPATH] [PRIORITY]\n");
+        }
+        if (argc >= 5 && (is_all_digits(argv[4]) == 0 || atoi(argv[4]) >= SCHED_LEVELS)){
+            printf("Priority must be a number from 0 (most urgent) to %d.\n", SCHED_LEVELS - 1);
+            exit(1);
         }
     }
 
@@ -214,9 +218,20 @@ void validate_file_path(char *path){
     //printf("valid file path\n");
 }
 
+/*
+ * handle_send_id() -- send the job id as [id len 2][id digits] so the server knows where it ends
+ */
 int handle_send_id(int sockfd, unsigned char *metadata){
-    int rv = send_packet(sockfd, metadata, strlen(metadata));
+    unsigned char id_packet[MAXBUFSIZE];
+    int len = strlen(metadata);
+    if (len > MAXBUFSIZE - 2) len = MAXBUFSIZE - 2;
+
+    packi16(id_packet, len);
+    memcpy(id_packet+2, metadata, len);
+
+    int rv = send_packet(sockfd, id_packet, len + 2);
     if (rv > 0) return 1;
+    return -1;
 }
 
 int handle_job_metadata(int sockfd, int job_type, unsigned char *metadata){
@@ -251,11 +266,15 @@ int main(int argc, char **argv){
     packi16(job_header+offset, cmd_id); offset += 2;
     send_packet(sockfd, job_header, offset);
 
-    // Send job specs
+    // Send job specs: [priority][uid][spec len][spec]
     if (cmd_id == JOBSUBMITID){
         offset = 0;
-        
+        int priority = SCHED_DEFAULT_PRIORITY;
+        if (argc >= 5) priority = atoi(argv[4]);
+
         memset(job_header, 0, MAXBUFSIZE);
+        packi16(job_header+offset, priority); offset += 2;
+        packi32(job_header+offset, getuid()); offset += 4;
         packi16(job_header+offset, strlen(argv[2])); offset += 2;
         strcpy(job_header+offset, argv[2]); offset += strlen(argv[2]);
 
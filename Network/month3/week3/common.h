@@ -10,6 +10,7 @@
 #define MAXBUFSIZE  4096
 #define MAXFILEPATH 100
 #define MAXFILEREAD 100  // chunk size for streaming file reads
+#define TEXT_BLOCK_BYTES (1 << 20)  // block size for text jobs reading an input they can't mmap()
 #define MAXFILEEXT 5
 
 // worker status
@@ -28,6 +29,85 @@
 #define CLIENT_PORT "1209"
 #define WORKER_PORT "1205"
 
+// job retention -- terminal jobs are evicted after this age (ms) or once more than this many are kept (-1 disables either)
+#define JOB_RETENTION_MS 600000
+#define JOB_RETENTION_MAX 10000
+
+// scheduler -- priority 0 is most urgent; each client gets SCHED_QUANTUM jobs per round-robin turn within a level
+#define SCHED_LEVELS 3
+#define SCHED_DEFAULT_PRIORITY 1
+#define SCHED_QUANTUM 4
+// 1 = a retried job goes to the front of its client's queue instead of the back
+#define RETRY_TO_FRONT 1
+
+// server event loop -- epoll_wait() blocks; periodic work (timeouts, eviction, stats) runs on a SERVER_TICK_MS timerfd
+#define SERVER_TICK_MS 1000
+#define JOB_TIMEOUT_MS 60000    // a worker running a job that sends nothing, not even a keepalive, for this long is dropped and its jobs retried (-1 disables)
+#define STATS_INTERVAL_MS -1    // print stats this often (-1 disables)
+
+// worker -- how often a worker with a job running tells the server it's still alive (well under JOB_TIMEOUT_MS)
+#define WORKER_KEEPALIVE_MS 5000
+// jobs a worker runs at once unless started with -s (0 = one per CPU)
+#define WORKER_DEFAULT_SLOTS 1
+// extra jobs the server streams to a worker ahead of time so the next one is on disk when a slot frees up (-p)
+#define WORKER_DEFAULT_PREFETCH 1
+// inputs a worker keeps by content hash so later jobs on the same file are sent without it (-c, 0 disables)
+#define WORKER_DEFAULT_INPUT_CACHE_MB 256
+// threads a worker splits charcoal, stencil and resize/scale across, on images of at least TILE_MIN_PIXELS (-t, 0 = one per CPU).
+// 1 (off) by default: with tiling on, ImageMagick's own threads get only the CPUs the tile threads leave over
+#define WORKER_DEFAULT_TILE_THREADS 1
+#define TILE_MIN_PIXELS (4L << 20)
+#define TILES_PER_THREAD 2  // strips per thread, so one slow strip doesn't leave the other threads idle
+#define TILE_MIN_SPAN 64    // rows (or columns) per strip at least
+// memory one csvsort may use before it sorts in runs spilled to its job directory and merges them (-m, 0 = never spill)
+#define WORKER_DEFAULT_SORT_MEMORY_MB 1024
+// 1 = image jobs made only of flipx/flipy/grayscale_filter/filter/rotate by 90s skip ImageMagick (stb_image decode, SIMD kernels, own JPEG encoder)
+#define NATIVE_IMAGE_KERNELS 1
+#define NATIVE_JPEG_QUALITY 90  // quality the native path encodes its results at
+
+// how a WPACKET_NEWJOB carries its input
+#define INPUT_SENT 0         // the input follows; the worker caches it
+#define INPUT_CACHED 1       // the worker advertised this key, only the file type follows
+#define INPUT_UNCACHED 2     // the input follows but isn't worth caching (a chunk of a split job)
+
+// map-reduce -- wordcount/charcount/capitalize inputs of at least SPLIT_MIN_BYTES are cut into ~SPLIT_CHUNK_BYTES sub-jobs (-1 disables)
+#define SPLIT_MIN_BYTES (64L << 20)
+#define SPLIT_CHUNK_BYTES (16L << 20)
+#define SPLIT_MAX_CHUNKS 256    // chunks grow past SPLIT_CHUNK_BYTES rather than exceed this
+
+// result cache -- results are kept by hash of (spec, input) so an identical resubmission skips the workers (0 disables)
+#define RESULT_CACHE_BYTES (256L << 20)  // LRU entries are evicted to stay under this
+
+// blob store -- server_storage holds every input/result once, named by content hash
+#define STORAGE_DIR "./server_storage"
+#define STAGING_DIR "./server_storage/incoming"  // uploads and worker results land here until they're hashed and stored
+#define BLOB_DIR "./server_storage/blobs"        // blobs over BLOB_SMALL_MAX, one file each
+#define PACK_DIR "./server_storage/packs"        // smaller blobs, appended to BLOB_PACK_BYTES pack files
+#define BLOB_SMALL_MAX (64 << 10)
+#define BLOB_PACK_BYTES (16L << 20)
+#define BLOB_COMPACT_PCT 50                      // a sealed pack this % dead is rewritten by the compactor thread
+
+// journal -- job lifecycle records are logged (group commit) so a restart recovers every job and its blobs (0 = memory only, storage wiped on start)
+#define JOURNAL 1
+#define JOURNAL_PATH "./server_storage/journal.log"
+#define JOURNAL_SNAPSHOT_PATH "./server_storage/journal.snap"
+#define JOURNAL_SNAPSHOT_RECORDS 100000  // snapshot every job's state, and start the log over, after this many records
+
+// journal record types
+#define JREC_JOB 1       // a job's whole state: on submission, and for each job in a snapshot
+#define JREC_ASSIGN 2    // [job_id 4][worker 4]
+#define JREC_RETRY 3     // [job_id 4]
+#define JREC_COMPLETE 4  // [job_id 4][result key 32]
+#define JREC_FAIL 5      // [job_id 4]
+#define JREC_EVICT 6     // [job_id 4]
+#define JREC_NEXT_ID 7   // [next job id 4], in snapshots
+
+// file transfer -- 1 = sendfile()/splice() between files and sockets, falling back to read/send if the kernel refuses
+#define ZERO_COPY 1
+#define ZERO_COPY_CHUNK (1 << 20)  // max bytes moved per sendfile()/splice() call
+#define RECV_BUF_MIN (1 << 16)     // buffered receive path: first read size, doubled while reads fill it...
+#define RECV_BUF_MAX (1 << 20)     // ...up to this
+
 // ids
 #define APPID 4379
 #define JOBSUBMITID 808
@@ -49,6 +129,12 @@
 #define WPACKET_STATUS 903
 #define WPACKET_CANCELJOB 904
 #define WPACKET_RESULTS 905
+#define WPACKET_INPUT_CACHE 906  // worker -> server: [op 2][key 32], an input added to or dropped from its cache
+#define WPACKET_KEEPALIVE 907    // worker -> server: no body, every WORKER_KEEPALIVE_MS while a slot is running a job
+
+// WPACKET_INPUT_CACHE ops
+#define ICACHE_ADDED 1
+#define ICACHE_DROPPED 2
 
 // text + CSV job types
 #define JTYPE_WORDCOUNT 2500
@@ -76,5 +162,6 @@
 #define WERR_UNKNOWN -1
 #define WERR_INVALIDJOB -2
 #define WERR_WORKERQUIT -3
+#define WERR_INPUTMISSING -4  // sent INPUT_CACHED for a key the worker no longer has
 
 #endif
\ No newline at end of file
@@ -25,12 +25,12 @@ int is_all_digits(const char *str) {
 /*
  * main() -- fork N worker processes using execl
  *
- * Each child process replaces itself with ./worker. Parent waits for all children.
+ * Each child process replaces itself with ./worker (passing -s SLOTS and -p PREFETCH if given). Parent waits for all children.
  */
 int main(int argc, char **argv) {
 
-    if (argc != 2 || is_all_digits(argv[1]) != 1){
-        printf("usage: ./create_workers [NUMWORKERS]\n");
+    if (argc < 2 || argc > 4 || is_all_digits(argv[1]) != 1 || (argc >= 3 && is_all_digits(argv[2]) != 1) || (argc == 4 && is_all_digits(argv[3]) != 1)){
+        printf("usage: ./create_workers [NUMWORKERS] [SLOTS] [PREFETCH]\n");
         exit(1);
     } 
 
@@ -43,7 +43,9 @@ int main(int argc, char **argv) {
 
         if (pid == 0) {
             // Child process
-            execl("./worker", "./worker", NULL);
+            if (argc == 4) execl("./worker", "./worker", "-s", argv[2], "-p", argv[3], NULL);
+            else if (argc == 3) execl("./worker", "./worker", "-s", argv[2], NULL);
+            else execl("./worker", "./worker", NULL);
             perror("execl failed");  // Only reached if execl fails
             exit(1);
         } else if (pid < 0) {
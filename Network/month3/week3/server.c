@@ -12,15 +12,24 @@
 #include <netinet/in.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
 
 // Custom imports
 #include "./utils/jobs.h"
 #include "./utils/buffer_manipulation.h"
 #include "./utils/time_custom.h"
 #include "./utils/workers.h"
-#include "./utils/job_queue.h"
+#include "./utils/scheduler.h"
 #include "./utils/file_transfer.h"
 #include "./utils/epoll_helper.h"
+#include "./utils/client_conn.h"
+#include "./utils/split_jobs.h"
+#include "./utils/result_cache.h"
+#include "./utils/blob_store.h"
+#include "./utils/journal.h"
 #include "./common.h"
 
 /*
@@ -32,6 +41,10 @@
  * success_rate -- percentage of successful jobs
  * workers_ct -- current number of connected workers
  * jobs_in_queue -- current number of jobs waiting for assignment
+ * jobs_evicted -- terminal jobs dropped by the retention policy
+ * cache_hits, cache_misses -- submissions completed from the result cache vs. sent on to the workers
+ * inputs_reused -- jobs sent to a worker that already had their input cached, with the spec only
+ * input_bytes_saved -- input bytes those jobs didn't have to send
  */
 struct Stats {
     int jobs_processed;
@@ -40,6 +53,11 @@ struct Stats {
     int success_rate;
     int workers_ct;
     int jobs_in_queue;
+    int jobs_evicted;
+    int cache_hits;
+    int cache_misses;
+    int inputs_reused;
+    long long input_bytes_saved;
 };
 
 /*
@@ -48,23 +66,42 @@ struct Stats {
  * epoll_fd -- epoll instance for event monitoring
  * worker_listener -- socket listening for worker connections
  * client_listener -- socket listening for client connections
+ * timer_fd -- SERVER_TICK_MS timerfd driving periodic work (timeouts, eviction, stats)
+ * dispatch_pending -- set when a job is queued or a worker frees up; the loop dispatches once per wakeup
+ * drop_pending -- set when a worker is marked for dropping; the loop drops it once the current batch of events is done
+ * last_stats_ms -- when stats were last printed (STATS_INTERVAL_MS)
  * job_id_ct -- incrementing counter for assigning unique job IDs
  * *stats -- pointer to server statistics
- * *queue -- pointer to job queue (FIFO)
- * *jobs -- pointer to jobs linked list
- * *workers -- pointer to workers linked list
+ * *sched -- pointer to the job scheduler (priority levels, fair share per client)
+ * *jobs -- pointer to jobs table (list + hash index on job_id)
+ * *workers -- pointer to workers (fd-indexed, with a ready list for dispatch)
+ * *conns -- open client connections, each with its own protocol state
+ * *store -- every job input and result, stored once per distinct content
+ * *cache -- results of past jobs keyed by (spec, input) hash, NULL if RESULT_CACHE_BYTES is 0
+ * *journal -- write-ahead log of job lifecycle records, NULL if JOURNAL is 0
+ * *commit_waits -- fds of connections in CONN_COMMIT, in the order (and so lsn order) they started waiting
  */
 struct Server {
     int epoll_fd;
     int worker_listener; // socket listening for worker connections
     int client_listener; // socket listening for client connections
+    int timer_fd;
+
+    int dispatch_pending;
+    int drop_pending;
+    int last_stats_ms;
 
     int job_id_ct;
 
     struct Stats *stats;
-    struct JobQueue *queue;
+    struct Scheduler *sched;
     struct Jobs *jobs;
     struct Workers *workers;
+    struct ClientConns *conns;
+    struct BlobStore *store;
+    struct ResultCache *cache;
+    struct Journal *journal;
+    struct JobQueue *commit_waits;
 };
 
 /*
@@ -132,38 +169,200 @@ int get_file_type_id(char *fname){
     return -1;
 }
 
+/*
+ * get_staging_path() -- where an upload ("job") or a worker's result ("result") lands before it goes into the blob store
+ */
+void get_staging_path(char *kind, int job_id, int file_type, char path[MAXFILEPATH]){
+    snprintf(path, MAXFILEPATH, "%s/%s-%d%s", STAGING_DIR, kind, job_id, file_type == IMG_FILE ? ".jpg" : ".txt");
+}
+
+/*
+ * get_split_part_path() -- where a split capitalize job's chunks are assembled before it completes
+ */
+void get_split_part_path(int job_id, char path[MAXFILEPATH]){
+    snprintf(path, MAXFILEPATH, "%s/job-%d.part", STAGING_DIR, job_id);
+}
+
+/*
+ * get_split_parent() -- the split job a chunk sub-job belongs to, NULL if that job is gone or already finished
+ */
+struct Job *get_split_parent(struct Server *server, struct Job *job){
+    struct Job *parent = get_job_by_id(server->jobs, job->parent_id);
+    if (parent == NULL || parent->status != J_IN_PROGRESS) return NULL;
+    return parent;
+}
+
+/*
+ * encode_job_state() -- a job as a JREC_JOB payload, returns its length
+ *
+ * [job_id 4][status 2][retry_ct 2][priority 2][client_key 8][file_type 2][has input 1][has result 1]
+ * [input key 32][result key 32][spec len 2][spec]
+ */
+int encode_job_state(struct Job *job, unsigned char *buf){
+    int offset = 0;
+    int spec_len = strlen(job->job_spec);
+
+    packi32(buf+offset, job->job_id); offset += 4;
+    packi16(buf+offset, job->status); offset += 2;
+    packi16(buf+offset, job->retry_ct); offset += 2;
+    packi16(buf+offset, job->priority); offset += 2;
+    packi64(buf+offset, job->client_key); offset += 8;
+    packi16(buf+offset, job->file_type); offset += 2;
+    buf[offset++] = job->input != NULL;
+    buf[offset++] = job->result != NULL;
+
+    memset(buf+offset, 0, 2 * SHA256_LEN);
+    if (job->input != NULL) memcpy(buf+offset, job->input->key, SHA256_LEN);
+    offset += SHA256_LEN;
+    if (job->result != NULL) memcpy(buf+offset, job->result->key, SHA256_LEN);
+    offset += SHA256_LEN;
+
+    packi16(buf+offset, spec_len); offset += 2;
+    memcpy(buf+offset, job->job_spec, spec_len); offset += spec_len;
+    return offset;
+}
+
+/*
+ * sync_blob() -- make sure a blob a journal record is about to refer to hits the disk first
+ */
+void sync_blob(struct Server *server, struct Blob *blob){
+    char path[MAXFILEPATH];
+    if (server->journal == NULL || blob == NULL) return;
+
+    blob_path(blob, path);
+    journal_sync_file(server->journal, path);
+}
+
+/*
+ * log_job_state() -- journal a job's whole state, returns the record's lsn (0 without a journal)
+ */
+unsigned long long log_job_state(struct Server *server, struct Job *job){
+    unsigned char buf[MAXJOBCOMMANDSIZE + 128];
+    if (server->journal == NULL) return 0;
+
+    sync_blob(server, job->input);
+    sync_blob(server, job->result);
+    return journal_append(server->journal, JREC_JOB, buf, encode_job_state(job, buf));
+}
+
+/*
+ * log_job_event() -- journal [job_id 4] plus extra for a job the client submitted; chunk sub-jobs aren't journaled
+ */
+void log_job_event(struct Server *server, int type, struct Job *job, unsigned char *extra, int extra_len){
+    unsigned char buf[64];
+    if (server->journal == NULL || job->parent_id != -1) return;
+
+    packi32(buf, job->job_id);
+    if (extra_len > 0) memcpy(buf+4, extra, extra_len);
+    journal_append(server->journal, type, buf, 4 + extra_len);
+}
+
+/*
+ * log_job_complete() -- journal a job's success along with its result blob
+ */
+void log_job_complete(struct Server *server, struct Job *job){
+    sync_blob(server, job->result);
+    log_job_event(server, JREC_COMPLETE, job, job->result->key, SHA256_LEN);
+}
+
+/*
+ * mark_worker_dropping() -- take a worker out of dispatch and have the loop drop it after the current epoll batch
+ *
+ * Closing it on the spot could leave an event for its fd (or for a new connection reusing the fd) later in the
+ * same batch, and callers in the middle of dispatch would have its jobs requeued under them.
+ */
+void mark_worker_dropping(struct Server *server, struct Worker *worker){
+    if (worker->dropping) return;
+
+    worker->dropping = 1;
+    set_worker_status(server->workers, worker, W_BUSY);
+    server->drop_pending = 1;
+}
+
+/*
+ * flush_worker() -- push what's queued for the worker; watch for EPOLLOUT while anything is left over
+ */
+void flush_worker(struct Server *server, struct Worker *worker){
+    int rv = wconn_flush(&worker->conn);
+    if (rv == -1){
+        printf("worker %d: send failed\n", worker->id);
+        mark_worker_dropping(server, worker);
+        return;
+    }
+
+    int want_out = rv == 0;
+    if (want_out != worker->conn.want_out){
+        mod_epoll_fd(server->epoll_fd, worker->id, want_out ? EPOLLIN | EPOLLOUT : EPOLLIN);
+        worker->conn.want_out = want_out;
+    }
+}
+
 /*
  * assign_to_worker() -- find available worker and assign job to them
  *
- * Sends WPACKET_NEWJOB packet with job_id and metadata. Returns worker ID on success, -1 if no workers available.
+ * A ready worker that has the job's input in its input cache and a slot free is preferred, and then only gets the spec.
+ * A holder whose slots are all busy only gets it when no worker at all has a slot free: saving the transfer
+ * isn't worth the job waiting behind another one while some other worker sits idle.
+ * Queues WPACKET_NEWJOB as [APPID 2][WPACKET_NEWJOB 2][job_id 4][spec len 2][spec][input mode 2][input key 32],
+ * then [file type 2] for INPUT_CACHED or the whole input blob ([file type 2][size 8][bytes]) otherwise, and sends
+ * as much as the socket takes; the rest goes out on EPOLLOUT. A chunk sub-job's input is its range of the
+ * parent's blob, sent as if it were a whole file and never cached.
+ * Returns worker ID on success, -1 if no workers available or the input can't be read.
  */
 int assign_to_worker(struct Server *server, unsigned char metadata[MAXJOBMETADATASIZE], struct Job *job){
-    struct Worker *worker = get_available_worker(server->workers);
+    struct Job *owner = job->parent_id != -1 ? get_job_by_id(server->jobs, job->parent_id) : job;
+    int input_mode = job->parent_id != -1 ? INPUT_UNCACHED : INPUT_SENT;
+
+    struct Worker *worker = NULL;
+    if (input_mode == INPUT_SENT){
+        worker = get_worker_holding(server->workers, owner->input->key, 1);
+        if (worker == NULL && get_idle_worker(server->workers) == NULL) worker = get_worker_holding(server->workers, owner->input->key, 0);
+    }
+    if (worker != NULL) input_mode = INPUT_CACHED;
+    else worker = get_available_worker(server->workers);
+
     if (worker == NULL){
         return -1;
     }
 
+    off_t base;
+    int fd = -1;
+    if (input_mode != INPUT_CACHED && (fd = blob_open(owner->input, &base)) == -1){
+        printf("ERROR: input of job %d is unreadable\n", job->job_id);
+        return -1;
+    }
+
     unsigned char job_packet[MAXBUFSIZE];
     memset(job_packet, 0, MAXBUFSIZE);
     int offset = 0;
     packi16(job_packet+offset, APPID); offset += 2;
     packi16(job_packet+offset, WPACKET_NEWJOB); offset += 2;
-    packi16(job_packet+offset, job->job_id); offset += 2;
+    packi32(job_packet+offset, job->job_id); offset += 4;
     packi16(job_packet+offset, strlen(metadata)); offset += 2;
     memcpy(job_packet+offset, metadata, MAXJOBMETADATASIZE); offset += strlen(metadata);
+    packi16(job_packet+offset, input_mode); offset += 2;
+    memcpy(job_packet+offset, owner->input->key, SHA256_LEN); offset += SHA256_LEN;
+
+    printf("assigning job %d to worker %d%s\n\n", job->job_id, worker->id, input_mode == INPUT_CACHED ? " (input cached there)" : "");
+
+    if (input_mode == INPUT_CACHED){
+        packi16(job_packet+offset, job->file_type); offset += 2;
+        wconn_queue(&worker->conn, job_packet, offset, -1, 0, 0);
+        server->stats->inputs_reused++;
+        server->stats->input_bytes_saved += job->input->size;
+    } else if (job->parent_id != -1){
+        packi16(job_packet+offset, TXT_FILE); offset += 2;
+        packi64(job_packet+offset, job->chunk_len); offset += 8;
+        wconn_queue(&worker->conn, job_packet, offset, fd, base + job->chunk_off, job->chunk_len);
+    } else {
+        packi16(job_packet+offset, job->file_type); offset += 2;
+        packi64(job_packet+offset, job->input->size); offset += 8;
+        wconn_queue(&worker->conn, job_packet, offset, fd, base, job->input->size);
+    }
 
-    char ext[MAXFILEPATH];
-
-    printf("assigning job %d to worker %d\n\n", job->job_id, worker->id);
-    send(worker->id, job_packet, offset, 0);
-
-    get_file_extension(job->file_path, ext);
-
-    if (strcmp(ext, ".txt") == 0) send_file_text_based(worker->id, job->file_path);
-    if (strcmp(ext, ".jpg") == 0) send_file_img_based(worker->id, job->file_path);
-
-    worker->cur_job_id = job->job_id;
-    worker->status = W_BUSY;
+    // in flight from here on, so a worker dropped before it's all out gets the job retried
+    worker_add_job(server->workers, worker, job->job_id);
+    flush_worker(server, worker);
     return worker->id;
 }
 
@@ -182,6 +381,10 @@ void get_status_msg(unsigned char msg[MAXBUFSIZE-10], struct Server *server, int
         sprintf(msg, "Job in queue.");
         return;
     }
+    if (status_id == J_IN_PROGRESS && job->chunks_total > 0){
+        sprintf(msg, "Job in progress. %d/%d chunks done.", job->chunks_done, job->chunks_total);
+        return;
+    }
     if (status_id == J_IN_PROGRESS){
         sprintf(msg, "Job in progress. Worker: %d", job->worker_id);
         return;
@@ -201,160 +404,351 @@ void get_status_msg(unsigned char msg[MAXBUFSIZE-10], struct Server *server, int
     }
 }
 
-void handle_file_transfer(struct Job *job, int sockfd){
-    char fname[MAXFILEPATH];
-    char buf[MAXBUFSIZE];
+/*
+ * handle_job_spec() -- parse the spec header [priority 2][client uid 4][spec len 2] and create the job
+ *
+ * The job gets its id now (the upload is named after it) but only joins the jobs table once the upload is in.
+ */
+int handle_job_spec(struct Server *server, struct ClientConn *conn){
+    int priority = unpacki16(conn->buf);
+    unsigned int uid = unpacki32(conn->buf+2);
+    int spec_size = unpacki16(conn->buf+6);
 
-    read(sockfd, buf, 2);
-    int file_type = unpacki16(buf);
-    printf("file type: %d\n", file_type);
+    if (spec_size < 0 || spec_size >= MAXJOBCOMMANDSIZE){
+        return -1;
+    }
 
-    if (file_type == TXT_FILE){
-        sprintf(fname, "./server_storage/job-%d.txt", job->job_id);
-        receive_file_text_based(fname, sockfd);
-    } else if (file_type == IMG_FILE) {
-        sprintf(fname, "./server_storage/job-%d.jpg", job->job_id);
-        receive_file_img_based(sockfd, fname);
+    struct Job *job = create_blank_job();
+    job->job_id = server->job_id_ct++;
+    job->job_type = 0; // TODO: determine job types
+    job->status = J_IN_QUEUE;
+    job->priority = priority;
+    job->client_key = make_client_key(ntohl(conn->addr.sin_addr.s_addr), uid);
+    job->job_spec[0] = '\0';
+    strncpy(job->results, "Job in progress.", 17);
+    conn->job = job;
+
+    if (spec_size == 0) conn_expect(conn, CONN_FILE_HEADER, 10);
+    else conn_expect(conn, CONN_SPEC, spec_size);
+    return 1;
+}
+
+/*
+ * handle_file_transfer() -- parse the file header [file type 2][file size 8] and open the upload's staging file
+ */
+int handle_file_transfer(struct ClientConn *conn){
+    int file_type = unpacki16(conn->buf);
+    long file_size = unpacki64(conn->buf+2);
+    printf("file type: %d, %ld bytes\n", file_type, file_size);
+
+    struct Job *job = conn->job;
+
+    if (file_type != TXT_FILE && file_type != IMG_FILE) return -1;
+    if (file_size < 0) return -1;
+
+    job->file_type = file_type;
+    get_staging_path("job", job->job_id, file_type, job->file_path);
+
+    conn->file_fd = open_recv_file(job->file_path, file_size);
+    if (conn->file_fd == -1){
+        return -1;
     }
 
-    strcpy(job->file_path, fname);
+    conn->file_off = 0;
+    conn->file_remaining = file_size;
+    conn->state = CONN_FILE_BODY;
+
+    sha256_init(&conn->hash);
+    conn->hashing = 1;
+    return 1;
 }
 
-void handle_job_spec(struct Job *job, int sockfd){
-    // receive job spec packet
-    int bytes_read;
-    unsigned char buf[MAXBUFSIZE];
-    memset(buf, 0, MAXBUFSIZE);
+/*
+ * split_job() -- cut a large wordcount/charcount/capitalize upload into chunk sub-jobs and queue those in its place
+ *
+ * Sub-jobs inherit the parent's spec, priority and client, so they share the client's fair-share turn
+ * like any other jobs it submitted. Returns 1 if the job was split, 0 if it should be queued whole.
+ */
+int split_job(struct Server *server, struct Job *job, long size){
+    if (SPLIT_MIN_BYTES < 0 || size < SPLIT_MIN_BYTES) return 0;
+
+    int job_type = split_job_type(job->job_spec);
+    if (job_type == -1) return 0;
+
+    off_t base;
+    int fd = blob_open(job->input, &base);
+    if (fd == -1) return 0;
+
+    off_t offs[SPLIT_MAX_CHUNKS];
+    long lens[SPLIT_MAX_CHUNKS];
+    int n = plan_split(fd, base, size, job_type, offs, lens, SPLIT_MAX_CHUNKS);
+    close(fd);
+    if (n <= 1) return 0;
+
+    if (job_type == JTYPE_CAPITALIZE){
+        char part[MAXFILEPATH];
+        get_split_part_path(job->job_id, part);
+
+        int fd = open_recv_file(part, size);
+        if (fd == -1) return 0;
+        close(fd);
+    }
+
+    job->job_type = job_type;
+    job->status = J_IN_PROGRESS;
+    job->time_start = get_time_ms();
+    job->chunks_total = n;
+
+    for (int i = 0; i < n; i++){
+        struct Job *sub = create_blank_job();
+        sub->job_id = server->job_id_ct++;
+        sub->parent_id = job->job_id;
+        sub->chunk_off = offs[i];
+        sub->chunk_len = lens[i];
+        sub->priority = job->priority;
+        sub->client_key = job->client_key;
+        strcpy(sub->job_spec, job->job_spec);
+        strncpy(sub->results, "Job in progress.", 17);
+
+        add_job(server->jobs, sub);
+        sched_add(server->sched, sub->job_id, sub->priority, sub->client_key);
+        server->stats->jobs_in_queue++;
+    }
 
-    bytes_read = read(sockfd, buf, 2);
-    int header_size = unpacki16(buf);
+    printf("job %d: split into %d chunks (jobs %d-%d)\n", job->job_id, n, server->job_id_ct - n, server->job_id_ct - 1);
+    server->dispatch_pending = 1;
+    return 1;
+}
 
-    memset(buf, 0, MAXBUFSIZE);
-    bytes_read = read(sockfd, buf, header_size);
+/*
+ * release_input() -- a finished job is never sent to a worker again, so its input blob can go
+ */
+void release_input(struct Server *server, struct Job *job){
+    blob_unref(server->store, job->input);
+    job->input = NULL;
+}
 
-    strncpy(job->job_spec, buf, header_size);
+/*
+ * release_job_blobs() -- job_release_fn for retention: journal the eviction and drop the job's blob references
+ */
+void release_job_blobs(struct Job *job, void *arg){
+    struct Server *server = arg;
+    log_job_event(server, JREC_EVICT, job, NULL, 0);
+    release_input(server, job);
+    blob_unref(server->store, job->result);
+    job->result = NULL;
 }
 
 /*
- * handle_job_submission() -- create new job from metadata and add to queue
+ * complete_from_cache() -- finish a freshly stored job on the spot if an identical job's result is cached
+ *
+ * The job just takes a reference to the cached result blob, as if a worker had produced it.
  */
-void handle_job_submission(struct Server *server, int sockfd){
-    char results[MAXBUFSIZE];
+int complete_from_cache(struct Server *server, struct Job *job){
+    if (server->cache == NULL || !job->cache_keyed) return 0;
+
+    job->result = cache_fetch(server->cache, job->cache_key);
+    if (job->result == NULL){
+        server->stats->cache_misses++;
+        return 0;
+    }
+
+    printf("job %d: result served from cache\n", job->job_id);
+    release_input(server, job);
+    job->status = J_SUCCESS;
+    job->time_start = get_time_ms();
+    mark_job_done(server->jobs, job, job->time_start);
+
+    server->stats->cache_hits++;
+    server->stats->jobs_succeeded++;
+    server->stats->jobs_processed++;
+    return 1;
+}
+
+/*
+ * cache_result() -- offer a successful job's result to the cache
+ */
+void cache_result(struct Server *server, struct Job *job){
+    if (server->cache == NULL || !job->cache_keyed) return;
+    cache_insert(server->cache, job->cache_key, job->result);
+}
+
+/*
+ * handle_job_submission() -- upload finished: move it into the blob store, add the job to the table and either
+ * complete it from the cache or queue it (split first if it's big), then reply with its id
+ */
+void handle_job_submission(struct Server *server, struct ClientConn *conn){
+    unsigned char results[MAXBUFSIZE];
     memset(results, 0, MAXBUFSIZE);
     int offset = 0;
 
     packi16(results, SERVER_MSG); offset += 2;
 
-    struct Job *job = create_blank_job();
-    job->job_id = server->job_id_ct++;
-    job->job_type = 0; // TODO: determine job types
-    job->status = J_IN_QUEUE;
-
-    strncpy(job->results, "Job in progress.", 17);
+    struct Job *job = conn->job;
+    conn->job = NULL;
+    close(conn->file_fd);
+    conn->file_fd = -1;
+
+    unsigned char key[SHA256_LEN];
+    int hashed = conn->hashing;
+    if (hashed) sha256_final(&conn->hash, key);
+    conn->hashing = 0;
+
+    job->input = blob_put_file(server->store, job->file_path, hashed ? key : NULL);
+    job->file_path[0] = '\0';
+    if (job->input == NULL){
+        sprintf(results+offset, "ERROR: could not store upload for job %d\n", job->job_id); offset += strlen(results+offset);
+        free(job);
+        conn_reply(conn, results, offset, -1, 0, 0);
+        return;
+    }
 
-    handle_job_spec(job, sockfd);
-    handle_file_transfer(job, sockfd);
+    if (server->cache != NULL){
+        cache_make_key(job->job_spec, job->file_type, job->input->key, job->cache_key);
+        job->cache_keyed = 1;
+    }
 
     add_job(server->jobs, job);
-    add_to_queue(server->queue, job->job_id);
-    server->stats->jobs_in_queue++;
+    if (!complete_from_cache(server, job) && !split_job(server, job, job->input->size)){
+        sched_add(server->sched, job->job_id, job->priority, job->client_key);
+        server->stats->jobs_in_queue++;
+        server->dispatch_pending = 1;
+    }
     sprintf(results+offset, "Job ID: %d\n", job->job_id); offset += strlen(results+offset);
 
-    send(sockfd, results, offset, 0);
+    conn_reply(conn, results, offset, -1, 0, 0);
+
+    // the client only gets its job id once the job would survive a restart
+    unsigned long long lsn = log_job_state(server, job);
+    if (lsn > 0){
+        conn->state = CONN_COMMIT;
+        conn->commit_lsn = lsn;
+        add_to_queue(server->commit_waits, conn->fd);
+    }
 }
 
 /*
- * check_queue() -- if worker available and jobs in queue, pop job and assign to worker
+ * fail_job() -- permanently mark job as failed, update stats, set failure message
+ *
+ * A chunk sub-job that fails takes its split job down with it; the chunk itself is just dropped.
  */
-void check_queue(struct Server *server){
-    struct Worker *worker = get_available_worker(server->workers);
-    if (worker == NULL) return;
-
-    int job_id = pop_queue(server->queue);
-    if (job_id == -1) return;
-    server->stats->jobs_in_queue--;
+void fail_job(struct Server *server, struct Job *job){
+    if (job->parent_id != -1){
+        struct Job *parent = get_split_parent(server, job);
+        remove_job(server->jobs, job->job_id);
+        if (parent != NULL) fail_job(server, parent);
+        return;
+    }
 
-    struct Job *job = get_job_by_id(server->jobs, job_id);
-    if (job == NULL) return;
-    job->time_start = get_time_ms();
+    if (job->chunks_total > 0){
+        char part[MAXFILEPATH];
+        get_split_part_path(job->job_id, part);
+        remove(part);
+    }
 
-    int rv = assign_to_worker(server, job->job_spec, job);
-    printf("job spec - %s\n", job->job_spec);
-    job->worker_id = rv;
-    job->status = J_IN_PROGRESS;
+    log_job_event(server, JREC_FAIL, job, NULL, 0);
+    release_input(server, job);
+    job->status = J_FAILURE;
+    server->stats->jobs_failed++;
+    server->stats->jobs_processed++;
+    strcpy(job->results, "job failed.");
+    mark_job_done(server->jobs, job, get_time_ms());
 }
 
-int handle_job_id_packet(int sockfd){
-    unsigned char buf[MAXBUFSIZE];
-    memset(buf, 0, MAXBUFSIZE);
+/*
+ * check_queue() -- hand queued jobs to ready workers until we run out of one or the other
+ *
+ * Only called when dispatch_pending says something changed (a job was queued or a worker became ready).
+ */
+void check_queue(struct Server *server){
+    server->dispatch_pending = 0;
+
+    while (server->sched->count > 0 && get_available_worker(server->workers) != NULL){
+        int job_id = sched_pop(server->sched);
+        if (job_id == -1) return;
+        server->stats->jobs_in_queue--;
 
-    int bytes_received = recv(sockfd, buf, MAXBUFSIZE, 0);
-    if (bytes_received <= 0) return -1;
+        struct Job *job = get_job_by_id(server->jobs, job_id);
+        if (job == NULL) continue;
 
-    printf("%d bytes received\n", bytes_received);
-    printf("job id - %s\n", buf);
+        // a chunk whose split job already failed has nothing left to contribute
+        if (job->parent_id != -1 && get_split_parent(server, job) == NULL){
+            remove_job(server->jobs, job_id);
+            continue;
+        }
+        job->time_start = get_time_ms();
+
+        int rv = assign_to_worker(server, job->job_spec, job);
+        printf("job spec - %s\n", job->job_spec);
+        if (rv == -1){
+            fail_job(server, job);
+            continue;
+        }
+        job->worker_id = rv;
+        job->status = J_IN_PROGRESS;
 
-    return atoi(buf);
+        unsigned char worker_id[4];
+        packi32(worker_id, rv);
+        log_job_event(server, JREC_ASSIGN, job, worker_id, 4);
+    }
 }
 
 /*
- * handle_job_status() -- retrieve and return status message for requested job_id
+ * handle_job_status() -- reply with the status message for the requested job_id
  */
-void handle_job_status(struct Server *server, int sockfd){
-    char return_msg[MAXBUFSIZE];
+void handle_job_status(struct Server *server, struct ClientConn *conn, int job_id){
+    unsigned char return_msg[MAXBUFSIZE];
     memset(return_msg, 0, MAXBUFSIZE);
     int offset = 0;
 
     packi16(return_msg, SERVER_MSG); offset += 2;
-
-    int job_id = handle_job_id_packet(sockfd);
     get_status_msg(return_msg+offset, server, job_id); offset += strlen(return_msg+offset);
 
-    send(sockfd, return_msg, offset, 0);
+    conn_reply(conn, return_msg, offset, -1, 0, 0);
 }
 
 /*
- * handle_job_get_results() -- retrieve and return job results for requested job_id
+ * handle_job_get_results() -- reply with the result file for job_id, or its status message if it isn't done
+ *
+ * The result blob goes out as [SERVER_FILE_TRANSFER 2][file type 2][file size 8][bytes], streamed as the socket drains.
  */
-void handle_job_get_results(struct Server *server, int sockfd){
-    char return_msg[MAXBUFSIZE];
+void handle_job_get_results(struct Server *server, struct ClientConn *conn, int job_id){
+    unsigned char return_msg[MAXBUFSIZE];
     memset(return_msg, 0, MAXBUFSIZE);
     int offset = 0;
 
-    int job_id = handle_job_id_packet(sockfd);
-    int status = get_job_status(server->jobs, job_id);
     struct Job *job = get_job_by_id(server->jobs, job_id);
 
-    if (status == J_SUCCESS){
-        packi16(return_msg, SERVER_FILE_TRANSFER); offset += 2;
-        send(sockfd, return_msg, offset, 0);
-        
-        int file_type = get_file_type_id(job->file_path);
+    if (job != NULL && job->status == J_SUCCESS && job->result != NULL){
+        off_t base;
+        int fd = blob_open(job->result, &base);
 
-        if (file_type == TXT_FILE){
-            send_file_text_based(sockfd, job->file_path);
-            return;
-        }
-        if (file_type == IMG_FILE){
-            send_file_img_based(sockfd, job->file_path);
+        if (fd != -1){
+            packi16(return_msg+offset, SERVER_FILE_TRANSFER); offset += 2;
+            packi16(return_msg+offset, job->file_type); offset += 2;
+            packi64(return_msg+offset, job->result->size); offset += 8;
+
+            conn_reply(conn, return_msg, offset, fd, base, job->result->size);
             return;
         }
-
-    } else {
-        packi16(return_msg, SERVER_MSG); offset += 2;
-        get_status_msg(return_msg+offset, server, job_id); offset += strlen(return_msg+offset);
-        send(sockfd, return_msg, offset, 0);
     }
+
+    packi16(return_msg, SERVER_MSG); offset += 2;
+    get_status_msg(return_msg+offset, server, job_id); offset += strlen(return_msg+offset);
+    conn_reply(conn, return_msg, offset, -1, 0, 0);
 }
 
 /*
- * fail_job() -- permanently mark job as failed, update stats, set failure message
+ * requeue_job() -- put a job that never started back at the front of its client's queue, without counting a retry
+ *
+ * Used for prefetched jobs stranded on a worker that went away: they'd have been dispatched next anyway.
  */
-void fail_job(struct Job *job, struct Stats *stats){
-    job->status = J_FAILURE;
-    stats->jobs_failed++;
-    stats->jobs_processed++;
-    strcpy(job->results, "job failed.");
+void requeue_job(struct Server *server, struct Job *job){
+    sched_add_front(server->sched, job->job_id, job->priority, job->client_key);
+    server->stats->jobs_in_queue++;
+    server->dispatch_pending = 1;
+    job->status = J_IN_QUEUE;
+    job->worker_id = -1;
 }
 
 /*
@@ -362,29 +756,42 @@ void fail_job(struct Job *job, struct Stats *stats){
  */
 void retry_job(struct Server *server, struct Job *job){
     if (job->retry_ct++ >= 3){
-        fail_job(job, server->stats);
+        fail_job(server, job);
         return;
     }
+    log_job_event(server, JREC_RETRY, job, NULL, 0);
 
-    add_to_queue(server->queue, job->job_id);
+    if (RETRY_TO_FRONT) sched_add_front(server->sched, job->job_id, job->priority, job->client_key);
+    else sched_add(server->sched, job->job_id, job->priority, job->client_key);
+    server->stats->jobs_in_queue++;
+    server->dispatch_pending = 1;
     job->status = J_IN_QUEUE;
     job->worker_id = -1;
 }
 
 /*
- * handle_worker_disconnection() -- clean up when worker disconnects, retry their current job if any
+ * handle_worker_disconnection() -- clean up when worker disconnects, put every job it had in flight back in the queue
+ *
+ * Jobs that were running count as a retry; prefetched jobs that never started are requeued for free.
+ * Walking newest-first means front-of-queue inserts leave them in their original dispatch order.
  */
 void handle_worker_disconnection(struct Server *server, int worker_fd){
+    struct Worker *worker = get_worker_by_id(server->workers, worker_fd);
+    if (worker == NULL) return; // already dropped, and the fd may belong to someone else by now
+
     printf("Worker %d disconnected.\n", worker_fd);
     close(worker_fd);
 
-    struct Worker *worker = get_worker_by_id(server->workers, worker_fd);
+    for (int i = worker->inflight_count - 1; i >= 0; i--){
+        struct Job *job = get_job_by_id(server->jobs, worker->inflight[i]);
+        if (job == NULL) continue;
 
-    if (worker->cur_job_id >= 0){
-        struct Job *job = get_job_by_id(server->jobs, worker->cur_job_id);
-        if (job != NULL){
-            printf("retrying job...\n");
+        if (i < worker->slots){
+            printf("retrying job %d...\n", job->job_id);
             retry_job(server, job);
+        } else {
+            printf("requeueing prefetched job %d...\n", job->job_id);
+            requeue_job(server, job);
         }
     }
     server->stats->workers_ct--;
@@ -392,188 +799,609 @@ void handle_worker_disconnection(struct Server *server, int worker_fd){
 }
 
 /*
- * handle_worker_data() -- read and process incoming data from worker
+ * merge_chunk_results() -- fold a chunk sub-job's received results into its split job
  *
- * Handles WPACKET_STATUS (worker status updates) and WPACKET_RESULTS (job completion) packets
+ * Capitalized text already went straight to the chunk's offset in the split job's .part file; counts are a few
+ * bytes left in the connection's buffer, parsed and summed here. Returns 1 if it was merged, -1 otherwise.
  */
-void handle_worker_data(struct Server *server, int worker_fd){
-    int rv;
-    unsigned char buf[MAXBUFSIZE];
-    memset(buf, 0, MAXBUFSIZE);
+int merge_chunk_results(struct WorkerConn *conn, struct Job *parent){
+    if (parent == NULL || !conn->result_ok) return -1;
+    if (parent->job_type == JTYPE_CAPITALIZE) return 1;
+
+    long long count = parse_split_count(conn->buf, conn->need);
+    if (count < 0) return -1;
+    parent->split_count += count;
+    return 1;
+}
 
-    rv = read(worker_fd, buf, 4);
-    if (rv == 0){
-        handle_worker_disconnection(server, worker_fd);
-    }
+/*
+ * finish_split() -- every chunk is in: store the merged result as the split job's result blob
+ */
+void finish_split(struct Server *server, struct Job *job){
+    char path[MAXFILEPATH];
 
-    int offset = 0;
-    int appid = unpacki16(buf+offset); offset += 2;
-    int msg_type = unpacki16(buf+offset); offset += 2;
+    if (job->job_type == JTYPE_CAPITALIZE){
+        get_split_part_path(job->job_id, path);
+    } else {
+        get_staging_path("result", job->job_id, TXT_FILE, path);
+        if (write_split_count(path, job->job_type, job->split_count) == -1) remove(path);
+    }
 
-    if (appid != APPID){
+    job->result = blob_put_file(server->store, path, NULL);
+    if (job->result == NULL){
+        fail_job(server, job);
         return;
     }
 
-    struct Worker *worker = get_worker_by_id(server->workers, worker_fd);
+    printf("job %d: all %d chunks merged\n", job->job_id, job->chunks_total);
+    log_job_complete(server, job);
+    release_input(server, job);
+    job->status = J_SUCCESS;
+    mark_job_done(server->jobs, job, get_time_ms());
+    cache_result(server, job);
+    server->stats->jobs_succeeded++;
+    server->stats->jobs_processed++;
+}
 
-    if (msg_type == WPACKET_STATUS){
-        memset(buf, 0, MAXBUFSIZE);
-        offset = 0;
-        
-        read(worker_fd, buf, 4);
-        int status = unpacki16(buf+offset); offset += 2;
-        int errcode = unpacki16(buf+offset); offset += 2;
-        printf("worker %d status: [ %d ] | err [ %d ]\n", worker_fd, status, errcode);
-        worker->errcode = errcode;
-        worker->status = status;
+/*
+ * handle_chunk_result() -- a worker finished a chunk sub-job: merge it into its split job, or retry it
+ *
+ * Only the split job counts toward the job stats; a merged chunk is removed straight away.
+ */
+void handle_chunk_result(struct Server *server, struct Worker *worker, struct Job *job, int status, int errcode){
+    if (status == W_FAILURE){
+        if (errcode == WERR_INVALIDJOB) fail_job(server, job);
+        else retry_job(server, job);
+        return;
     }
 
-    if (msg_type == WPACKET_RESULTS){
-        return; // switching to file transfer
+    struct Job *parent = get_split_parent(server, job);
+    int rv = merge_chunk_results(&worker->conn, parent);
+
+    if (parent == NULL){
+        remove_job(server->jobs, job->job_id);
+        return;
     }
+    if (rv == -1){
+        retry_job(server, job);
+        return;
+    }
+
+    worker->jobs_completed++;
+    remove_job(server->jobs, job->job_id);
+
+    if (++parent->chunks_done == parent->chunks_total) finish_split(server, parent);
 }
 
 /*
- * receive_worker_results() -- receive the file-based results of a given worker (triggered when a job is successfully completed)
+ * handle_job_result() -- a worker finished job_id: record the outcome and free the slot
  *
- * TODO: enhance file transfer failure mechanisms. Currently has no protection against a disconnection mid-file transfer.
- * Unlikely to happen right now, but under real-world network conditions, could happen.
+ * Called on a W_FAILURE status, or once a W_SUCCESS status's results are all in (see open_worker_results()).
  */
-void receive_worker_results(struct Worker *worker, struct Job *job){
-    char fname[MAXFILEPATH];
-    memset(fname, 0, MAXFILEPATH);
+void handle_job_result(struct Server *server, struct Worker *worker, int job_id, int status, int errcode){
+    struct Job *job = get_job_by_id(server->jobs, job_id);
+
+    if (job == NULL || !worker_remove_job(server->workers, worker, job_id)){
+        printf("worker %d: result for unknown job %d\n", worker->id, job_id);
+        return;
+    }
+    server->dispatch_pending = 1;
 
-    get_file_extension(job->file_path, fname);
+    // the oldest prefetched job just took the freed slot; its timeout starts now
+    if (worker->inflight_count >= worker->slots){
+        struct Job *next = get_job_by_id(server->jobs, worker->inflight[worker->slots - 1]);
+        if (next != NULL) next->time_start = get_time_ms();
+    }
+
+    if (job->parent_id != -1){
+        handle_chunk_result(server, worker, job, status, errcode);
+        return;
+    }
+
+    // the worker evicted the input before our INPUT_CACHED job got there: send it again, with the input, for free
+    if (status == W_FAILURE && errcode == WERR_INPUTMISSING){
+        worker_cache_drop(server->workers, worker, job->input->key);
+        server->stats->inputs_reused--;
+        server->stats->input_bytes_saved -= job->input->size;
+        requeue_job(server, job);
+        return;
+    }
 
-    char buf[MAXBUFSIZE];
-    memset(buf, 0, MAXBUFSIZE);
+    if (status == W_FAILURE){
+        if (errcode == WERR_INVALIDJOB){
+            fail_job(server, job);
+        } else {
+            retry_job(server, job);
+        }
+        return;
+    }
 
-    read(worker->id, buf, 2);
-    int file_type = unpacki16(buf);
-    printf("file type: %d\n", file_type);
-    
-    if (strcmp(fname, ".txt") == 0){
-        receive_file_text_based(job->file_path, worker->id);
-    } else if (strcmp(fname, ".jpg") == 0){
-        receive_file_img_based(worker->id, job->file_path);
+    struct WorkerConn *conn = &worker->conn;
+    if (!conn->result_ok || (job->result = blob_put_file(server->store, conn->result_path, NULL)) == NULL){
+        retry_job(server, job);
+        return;
     }
+    conn->result_path[0] = '\0'; // the blob store has it now
+
+    log_job_complete(server, job);
+    release_input(server, job);
+    job->status = J_SUCCESS;
+    cache_result(server, job);
+    mark_job_done(server->jobs, job, get_time_ms());
 
-    // strcpy(job->file_path, fname);
+    worker->jobs_completed++;
+    server->stats->jobs_succeeded++;
+    server->stats->jobs_processed++;
 }
 
 /*
- * manage_worker() -- handle worker state transitions for completed or failed jobs
+ * open_worker_results() -- the [file type 2][file size 8] in front of a W_SUCCESS status's results: pick where the body goes
+ *
+ * A job's results go to a staging file for the blob store, a capitalized chunk's straight to its offset in the
+ * split job's .part file, a counting chunk's few bytes into the connection's buffer. Results nobody can use
+ * (unknown job, split job gone, wrong size) are still read, into /dev/null, so the stream stays in sync.
  */
-void manage_worker(struct Server *server, struct Worker *worker){
-    if (worker->status == W_FAILURE){
-        struct Job *job = get_job_by_id(server->jobs, worker->cur_job_id);
-        if (job == NULL) return;
+int open_worker_results(struct Server *server, struct Worker *worker){
+    struct WorkerConn *conn = &worker->conn;
+    long size = unpacki64(conn->buf+2);
+    struct Job *job = conn->result_job != -1 ? get_job_by_id(server->jobs, conn->result_job) : NULL;
+    if (size < 0) return -1;
+
+    conn->result_ok = 0;
+    conn->file_off = 0;
+    conn->file_remaining = size;
+
+    if (job != NULL && job->parent_id != -1){
+        struct Job *parent = get_split_parent(server, job);
+
+        if (parent != NULL && parent->job_type != JTYPE_CAPITALIZE && size < MAXBUFSIZE){
+            conn->result_ok = 1;
+            wconn_expect(conn, WCONN_RESULT_COUNT, size);
+            return 1;
+        }
+        if (parent != NULL && parent->job_type == JTYPE_CAPITALIZE && size == job->chunk_len){
+            char part[MAXFILEPATH];
+            get_split_part_path(parent->job_id, part);
+            conn->file_fd = open(part, O_WRONLY);
+            conn->file_off = job->chunk_off;
+            conn->result_ok = conn->file_fd != -1;
+        }
+    } else if (job != NULL){
+        get_staging_path("result", job->job_id, job->file_type, conn->result_path);
+        conn->file_fd = open_recv_file(conn->result_path, size);
+        conn->result_ok = conn->file_fd != -1;
+        if (!conn->result_ok) conn->result_path[0] = '\0';
+    }
 
-        if (worker->errcode == WERR_INVALIDJOB){
-            fail_job(job, server->stats);
-        } else {
-            retry_job(server, job);
+    if (conn->file_fd == -1){
+        conn->file_fd = open("/dev/null", O_WRONLY);
+        conn->file_off = 0;
+    }
+    wconn_expect(conn, WCONN_RESULT_BODY, 0);
+    return 1;
+}
+
+/*
+ * finish_worker_results() -- the whole result body is in: settle its job, then wait for the next packet
+ */
+void finish_worker_results(struct Server *server, struct Worker *worker){
+    struct WorkerConn *conn = &worker->conn;
+    if (conn->file_fd != -1) close(conn->file_fd);
+    conn->file_fd = -1;
+
+    if (conn->result_job != -1) handle_job_result(server, worker, conn->result_job, W_SUCCESS, WERR_NONE);
+
+    // whatever handle_job_result() didn't hand to the blob store is of no use now
+    if (conn->result_path[0] != '\0') remove(conn->result_path);
+    conn->result_path[0] = '\0';
+    conn->result_job = -1;
+    wconn_expect(conn, WCONN_HEADER, 4);
+}
+
+/*
+ * handle_worker_status() -- a [status 2][errcode 2][job_id 4] status packet
+ *
+ * W_FAILURE settles the job now. W_SUCCESS has the results right behind it, and the job stays in flight on
+ * the worker until they're all in, so a worker lost mid-transfer has it retried.
+ */
+void handle_worker_status(struct Server *server, struct Worker *worker){
+    struct WorkerConn *conn = &worker->conn;
+    int status = unpacki16(conn->buf);
+    int errcode = unpacki16(conn->buf+2);
+    int job_id = unpacki32(conn->buf+4);
+    printf("worker %d status: [ %d ] | err [ %d ] | job %d\n", worker->id, status, errcode, job_id);
+    worker->errcode = errcode;
+
+    if (status == W_SUCCESS){
+        conn->result_job = job_id;
+        if (get_job_by_id(server->jobs, job_id) == NULL || !worker_has_job(worker, job_id)){
+            printf("worker %d: result for unknown job %d\n", worker->id, job_id);
+            conn->result_job = -1;
         }
-        worker->cur_job_id = -1;
-        worker->status = W_READY;
+        wconn_expect(conn, WCONN_RESULT_HEADER, 10);
         return;
     }
 
-    if (worker->status == W_SUCCESS){
-        struct Job *job = get_job_by_id(server->jobs, worker->cur_job_id);
-        if (job == NULL) return;
-        job->status = J_SUCCESS;
+    if (status == W_FAILURE) handle_job_result(server, worker, job_id, status, errcode);
+    wconn_expect(conn, WCONN_HEADER, 4);
+}
 
-        receive_worker_results(worker, job);
+/*
+ * handle_worker_header() -- check the app id and branch on the packet type
+ *
+ * WPACKET_CONNECTED carries [slots 2][prefetch 2] (the worker's reply to its handshake), WPACKET_STATUS
+ * [status 2][errcode 2][job_id 4] (one per finished job), WPACKET_INPUT_CACHE [op 2][key 32] (an input added
+ * to or evicted from its input cache). WPACKET_KEEPALIVE has no body: hearing from the worker at all is the point.
+ */
+int handle_worker_header(struct WorkerConn *conn){
+    int appid = unpacki16(conn->buf);
+    int msg_type = unpacki16(conn->buf+2);
+
+    if (appid == APPID && msg_type == WPACKET_CONNECTED) wconn_expect(conn, WCONN_CONNECTED, 4);
+    else if (appid == APPID && msg_type == WPACKET_STATUS) wconn_expect(conn, WCONN_STATUS, 8);
+    else if (appid == APPID && msg_type == WPACKET_INPUT_CACHE) wconn_expect(conn, WCONN_INPUT_CACHE, 2 + SHA256_LEN);
+    else wconn_expect(conn, WCONN_HEADER, 4);
+    return 1;
+}
 
-        worker->cur_job_id = -1;
-        worker->status = W_READY;
-        worker->jobs_completed++;
-        server->stats->jobs_succeeded++;
-        server->stats->jobs_processed++;
-        return;
+/*
+ * advance_worker() -- run one step of the worker connection's state machine
+ *
+ * Returns 1 if the connection moved to a new state, 0 if it's waiting on the socket, -1 to drop the worker.
+ */
+int advance_worker(struct Server *server, struct Worker *worker){
+    struct WorkerConn *conn = &worker->conn;
+    int rv;
+
+    if (conn->state == WCONN_RESULT_BODY){
+        rv = wconn_recv_body(conn);
+        if (rv == 1) finish_worker_results(server, worker);
+        return rv;
+    }
+
+    if ((rv = wconn_fill(conn)) != 1) return rv;
+
+    switch (conn->state){
+        case WCONN_HEADER:
+            return handle_worker_header(conn);
+
+        case WCONN_CONNECTED:
+            set_worker_slots(server->workers, worker, unpacki16(conn->buf), unpacki16(conn->buf+2));
+            printf("worker %d: %d slots, prefetch %d\n", worker->id, worker->slots, worker->prefetch);
+            server->dispatch_pending = 1;
+            wconn_expect(conn, WCONN_HEADER, 4);
+            return 1;
+
+        case WCONN_STATUS:
+            handle_worker_status(server, worker);
+            return 1;
+
+        case WCONN_INPUT_CACHE:
+            if (unpacki16(conn->buf) == ICACHE_ADDED) worker_cache_add(server->workers, worker, conn->buf+2);
+            else worker_cache_drop(server->workers, worker, conn->buf+2);
+            wconn_expect(conn, WCONN_HEADER, 4);
+            return 1;
+
+        case WCONN_RESULT_HEADER:
+            return open_worker_results(server, worker);
+
+        case WCONN_RESULT_COUNT:
+            finish_worker_results(server, worker);
+            return 1;
     }
+
+    return -1;
+}
+
+/*
+ * handle_worker_event() -- drain the worker's queue on EPOLLOUT and advance its packets on EPOLLIN, without blocking
+ *
+ * Fixed-size fields are chained within one event, but a result body only gets one read per event so
+ * results from several workers (and client uploads) take turns. A worker marked for dropping is left
+ * alone until the loop drops it.
+ */
+void handle_worker_event(struct Server *server, struct Worker *worker, unsigned int events){
+    if (worker->dropping) return;
+
+    if (events & EPOLLOUT){
+        flush_worker(server, worker);
+        if (worker->dropping) return;
+    }
+
+    if (!(events & (EPOLLIN | EPOLLHUP | EPOLLERR))) return;
+
+    int rv;
+    for (int steps = 0; steps < 8; steps++){
+        int body = worker->conn.state == WCONN_RESULT_BODY;
+        rv = advance_worker(server, worker);
+        if (rv != 1 || body) break;
+    }
+
+    if (rv == -1) handle_worker_disconnection(server, worker->id);
+}
+
+/*
+ * print_stats() -- display formatted server statistics to stdout
+ */
+void print_stats(struct Stats *stats){
+    if (stats->jobs_processed > 0){
+        stats->success_rate = stats->jobs_succeeded * 100 / stats->jobs_processed;
+    }
+    printf("\n\n===== CURRENT STATS =====\n\n");
+
+    printf("Jobs Processed: %d\n", stats->jobs_processed);
+    printf("Successful Jobs : %d\n", stats->jobs_succeeded);
+    printf("Failed Jobs: %d\n", stats->jobs_failed);
+    printf("Jobs In Queue: %d\n", stats->jobs_in_queue);
+    printf("Success Rate: %d%%\n", stats->success_rate);
+    printf("Active Workers: %d\n", stats->workers_ct);
+    printf("Jobs Evicted: %d\n", stats->jobs_evicted);
+
+    int lookups = stats->cache_hits + stats->cache_misses;
+    printf("Cache Hits: %d / %d (%d%%)\n", stats->cache_hits, lookups, lookups > 0 ? stats->cache_hits * 100 / lookups : 0);
+    printf("Inputs Already On Worker: %d (%.1f MB not resent)\n", stats->inputs_reused, stats->input_bytes_saved / 1048576.0);
+
+    printf("\n=========================\n\n");
+
 }
 
 /*
- * manage_worker_statuses() -- iterate through all workers and handle non-busy/non-ready states
+ * check_job_timeouts() -- mark workers that have gone JOB_TIMEOUT_MS without a word while running a job
+ *
+ * A worker running a job sends a keepalive every WORKER_KEEPALIVE_MS, and any bytes from it (results included)
+ * count, so only a worker that has gone silent (hung, or cut off without a FIN) gets this far and we treat it
+ * as gone. The tick runs inside an epoll batch, so it's only marked here; drop_pending_workers() closes it and
+ * retries its jobs once the batch is done.
  */
-void manage_worker_statuses(struct Server *server){
+void check_job_timeouts(struct Server *server, int now_ms){
+    if (JOB_TIMEOUT_MS < 0) return;
+
     struct Worker *worker = server->workers->head;
+    while (worker != NULL){
+        struct Worker *next = worker->next;
 
-    for (worker; worker != NULL; worker = worker->next){
-        if (worker->status != W_READY && worker->status != W_BUSY){
-            manage_worker(server, worker);
+        // only the running prefix of inflight is on the clock; prefetched jobs get time_start when they move up
+        for (int i = 0; i < worker->inflight_count && i < worker->slots; i++){
+            struct Job *job = get_job_by_id(server->jobs, worker->inflight[i]);
+
+            if (job == NULL) continue;
+
+            // silent since whichever came last: the job starting or the worker's last bytes
+            int since = job->time_start > worker->conn.last_heard_ms ? job->time_start : worker->conn.last_heard_ms;
+            if (now_ms - since > JOB_TIMEOUT_MS){
+                printf("worker %d timed out on job %d\n", worker->id, job->job_id);
+                mark_worker_dropping(server, worker);
+                break;
+            }
         }
+        worker = next;
     }
 }
 
 /*
- * receive_client_packet() -- extracts the first 4 bytes of data stream from the client, then determines and returns the cmd_type id
+ * drop_pending_workers() -- disconnect every worker mark_worker_dropping() marked, between epoll batches
  */
-int receive_client_packet(int sockfd, unsigned char metadata[MAXJOBMETADATASIZE]){
-    int app_id;
-    int cmd_type;
-    int offset = 0;
+void drop_pending_workers(struct Server *server){
+    server->drop_pending = 0;
 
-    unsigned char buf[MAXBUFSIZE];
-    memset(buf, 0, MAXBUFSIZE);
+    struct Worker *worker = server->workers->head;
+    while (worker != NULL){
+        struct Worker *next = worker->next;
+        if (worker->dropping){
+            del_epoll_fd(server->epoll_fd, worker->id);
+            handle_worker_disconnection(server, worker->id);
+        }
+        worker = next;
+    }
+}
+
+/*
+ * snapshot_journal() -- once JOURNAL_SNAPSHOT_RECORDS have been logged, hand the journal every submitted job's state
+ * so replay can start from there instead of the beginning of time
+ */
+void snapshot_journal(struct Server *server){
+    unsigned char buf[MAXJOBCOMMANDSIZE + 128];
+    if (server->journal == NULL || server->journal->since_snapshot < JOURNAL_SNAPSHOT_RECORDS) return;
+    if (!journal_begin_snapshot(server->journal)) return;
+
+    packi32(buf, server->job_id_ct);
+    journal_snapshot_add(server->journal, JREC_NEXT_ID, buf, 4);
+
+    for (struct Job *job = server->jobs->head; job != NULL; job = job->next){
+        if (job->parent_id != -1) continue;
+        journal_snapshot_add(server->journal, JREC_JOB, buf, encode_job_state(job, buf));
+    }
+    journal_end_snapshot(server->journal);
+}
 
-    int bytes_received = recv(sockfd, buf, 4, 0);
-    printf("%d bytes received\n", bytes_received);
+/*
+ * handle_tick() -- periodic work, run from the timerfd instead of on every loop pass
+ */
+void handle_tick(struct Server *server){
+    if (read_epoll_timer(server->timer_fd) == 0) return;
 
-    app_id = unpacki16(buf+offset); offset += 2;
-    cmd_type = unpacki16(buf+offset); offset += 2;
-    memcpy(metadata, buf+offset, MAXJOBMETADATASIZE);
+    int now_ms = get_time_ms();
+
+    check_job_timeouts(server, now_ms);
+    server->stats->jobs_evicted += evict_done_jobs(server->jobs, now_ms, JOB_RETENTION_MS, JOB_RETENTION_MAX, release_job_blobs, server);
+    snapshot_journal(server);
+
+    if (STATS_INTERVAL_MS >= 0 && now_ms - server->last_stats_ms >= STATS_INTERVAL_MS){
+        print_stats(server->stats);
+        server->last_stats_ms = now_ms;
+    }
+}
+
+/*
+ * handle_client_header() -- check the app id and branch on the command type
+ */
+int handle_client_header(struct ClientConn *conn){
+    int offset = 0;
+    int app_id = unpacki16(conn->buf+offset); offset += 2;
+    conn->cmd_type = unpacki16(conn->buf+offset); offset += 2;
 
     if (app_id != APPID){
-        printf("incorrect app id: %d - %d\n", app_id, cmd_type);
+        printf("incorrect app id: %d - %d\n", app_id, conn->cmd_type);
         return -1;
     }
 
-    printf("job type id: %d, metadata: %ld bytes\n", cmd_type, strlen(metadata));
-    return cmd_type;
+    printf("client %d: command %d\n", conn->fd, conn->cmd_type);
+
+    if (conn->cmd_type == JOBSUBMITID){
+        conn_expect(conn, CONN_SPEC_HEADER, 8);
+        return 1;
+    }
+    if (conn->cmd_type == JOBSTATUSID || conn->cmd_type == JOBRESULTID){
+        conn_expect(conn, CONN_JOB_ID_LEN, 2);
+        return 1;
+    }
+    return -1;
 }
 
 /*
- * handle_client_request() -- accept client connection, parse request, and send response
+ * advance_client() -- run one step of the connection's state machine
  *
- * Handles JOBSUBMITID (new job), JOBSTATUSID (status query), and JOBRESULTID (get results) requests
+ * Returns 1 if the connection moved to a new state, 0 if it's waiting on the socket, -1 to drop it.
  */
-void handle_client_request(struct Server *server){
-    printf("\nClient request!\n");
+int advance_client(struct Server *server, struct ClientConn *conn){
+    int rv;
+    int job_id;
 
-    struct sockaddr_storage *their_addr = malloc(sizeof *their_addr);
-    socklen_t len_t = sizeof *their_addr;
+    if (conn->state == CONN_FILE_BODY){
+        rv = conn_recv_body(conn);
+        if (rv == 1) handle_job_submission(server, conn);
+        return rv;
+    }
+
+    if (conn->state == CONN_REPLY){
+        return conn_flush(conn);
+    }
+
+    if (conn->state == CONN_COMMIT){
+        return 0;
+    }
+
+    if ((rv = conn_fill(conn)) != 1) return rv;
+
+    switch (conn->state){
+        case CONN_HEADER:
+            return handle_client_header(conn);
+
+        case CONN_SPEC_HEADER:
+            return handle_job_spec(server, conn);
+
+        case CONN_SPEC:
+            memcpy(conn->job->job_spec, conn->buf, conn->need);
+            conn->job->job_spec[conn->need] = '\0';
+            conn_expect(conn, CONN_FILE_HEADER, 10);
+            return 1;
+
+        case CONN_FILE_HEADER:
+            if (handle_file_transfer(conn) == -1) return -1;
+            if (conn->file_remaining == 0) handle_job_submission(server, conn);
+            return 1;
+
+        case CONN_JOB_ID_LEN:
+            rv = unpacki16(conn->buf);
+            if (rv <= 0 || rv >= MAXBUFSIZE) return -1;
+            conn_expect(conn, CONN_JOB_ID, rv);
+            return 1;
+
+        case CONN_JOB_ID:
+            job_id = atoi((char *)conn->buf);
+            if (conn->cmd_type == JOBSTATUSID) handle_job_status(server, conn, job_id);
+            else handle_job_get_results(server, conn, job_id);
+            return 1;
+    }
+
+    return -1;
+}
+
+/*
+ * finish_reply() -- flush a staged reply; close the connection once it's out, or wait for EPOLLOUT if the socket is full
+ */
+void finish_reply(struct Server *server, struct ClientConn *conn){
+    int rv = conn_flush(conn);
+    if (rv == 0){
+        mod_epoll_fd(server->epoll_fd, conn->fd, EPOLLOUT);
+        return;
+    }
+    remove_client_conn(server->conns, conn);
+}
 
-    unsigned char metadata[MAXJOBMETADATASIZE];
-    unsigned char return_msg[MAXBUFSIZE+2];
-    int cmd_type;
+/*
+ * release_commits() -- the journal moved: send the submit replies whose job is now on disk
+ *
+ * Connections that went away while waiting (or whose fd now belongs to someone else) are skipped.
+ */
+void release_commits(struct Server *server){
+    unsigned long long durable = journal_durable(server->journal);
+    struct JobQueue *waits = server->commit_waits;
+
+    while (waits->count > 0){
+        struct ClientConn *conn = get_client_conn(server->conns, waits->ids[waits->head]);
 
-    int new_fd = accept(server->client_listener, (struct sockaddr*)their_addr,  &len_t);
-    cmd_type = receive_client_packet(new_fd, metadata);
+        if (conn != NULL && conn->state == CONN_COMMIT){
+            if (conn->commit_lsn > durable) break;
+            conn->state = CONN_REPLY;
+            finish_reply(server, conn);
+        }
+        pop_queue(waits);
+    }
+}
 
-    if (cmd_type == -1){
-        close(new_fd);
+/*
+ * handle_client_event() -- advance a client connection as far as the socket allows without blocking
+ *
+ * Fixed-size fields are chained within one event, but an upload body only gets one read per
+ * event so concurrent uploads take turns. Once the reply is fully flushed the connection closes;
+ * if the socket fills up first we switch to EPOLLOUT and finish on a later event. A reply held
+ * for the journal takes the socket out of the interest set; anything it reports meanwhile is an error.
+ */
+void handle_client_event(struct Server *server, struct ClientConn *conn){
+    int rv;
+
+    if (conn->state == CONN_COMMIT){
+        printf("client %d: dropped while waiting for the journal\n", conn->fd);
+        remove_client_conn(server->conns, conn);
         return;
     }
 
-    if (cmd_type == JOBSUBMITID){
-        packi16(return_msg, 0);
-        handle_job_submission(server, new_fd);
+    for (int steps = 0; steps < 8; steps++){
+        int body = conn->state == CONN_FILE_BODY;
+        rv = advance_client(server, conn);
+        if (rv != 1 || body) break;
     }
 
-    if (cmd_type == JOBSTATUSID){
-        packi16(return_msg, 0);
-        handle_job_status(server, new_fd);
+    if (rv == -1){
+        printf("client %d: dropped (state %d)\n", conn->fd, conn->state);
+        remove_client_conn(server->conns, conn);
+        return;
     }
 
-    if (cmd_type == JOBRESULTID){
-        handle_job_get_results(server, new_fd);
+    if (conn->state == CONN_COMMIT){
+        mod_epoll_fd(server->epoll_fd, conn->fd, 0);
+        return;
     }
-    
-    close(new_fd);
-    printf("\n");
+
+    if (conn->state == CONN_REPLY) finish_reply(server, conn);
+}
+
+/*
+ * handle_new_client() -- accept a client connection and register it, non-blocking, in the main epoll set
+ */
+void handle_new_client(struct Server *server){
+    struct sockaddr_in their_addr;
+    socklen_t len_t = sizeof their_addr;
+
+    int new_fd = accept(server->client_listener, (struct sockaddr*)&their_addr, &len_t);
+    if (new_fd == -1){
+        return;
+    }
+
+    set_nonblocking(new_fd);
+    add_client_conn(server->conns, new_fd, &their_addr);
+    add_epoll_fd(server->epoll_fd, new_fd);
 }
 
 /*
@@ -589,12 +1417,15 @@ void handle_new_worker(struct Server *server){
     if (new_fd == -1){
         return;
     }
+    set_nonblocking(new_fd);
     add_epoll_fd(server->epoll_fd, new_fd);
 
     struct Worker *new_worker = create_empty_worker();
     new_worker->id = new_fd;
+    wconn_init(&new_worker->conn, new_fd);
     add_worker(server->workers, new_worker);
     server->stats->workers_ct++;
+    server->dispatch_pending = 1;
 
     unsigned char buf[MAXBUFSIZE];
     int offset = 0;
@@ -602,27 +1433,8 @@ void handle_new_worker(struct Server *server){
     packi16(buf+offset, WPACKET_CONNECTED); offset += 2;
     packi16(buf+offset, new_worker->id); offset += 2;
 
-    send(new_fd, buf, offset, 0);
-}
-
-/*
- * print_stats() -- display formatted server statistics to stdout
- */
-void print_stats(struct Stats *stats){
-    if (stats->jobs_processed > 0){
-        stats->success_rate = stats->jobs_succeeded * 100 / stats->jobs_processed;
-    }
-    printf("\n\n===== CURRENT STATS =====\n\n");
-
-    printf("Jobs Processed: %d\n", stats->jobs_processed);
-    printf("Successful Jobs : %d\n", stats->jobs_succeeded);
-    printf("Failed Jobs: %d\n", stats->jobs_failed);
-    printf("Jobs In Queue: %d\n", stats->jobs_in_queue);
-    printf("Success Rate: %d%%\n", stats->success_rate);
-    printf("Active Workers: %d\n", stats->workers_ct);
-
-    printf("\n=========================\n\n");
-
+    wconn_queue(&new_worker->conn, buf, offset, -1, 0, 0);
+    flush_worker(server, new_worker);
 }
 
 /*
@@ -644,13 +1456,146 @@ int handle_input(int stdin_fd, struct Server *server){
         }
 
         if (strncmp(buffer, "queue", 5) == 0){
-            print_queue(server->queue);
+            print_scheduler(server->sched);
+        }
+
+        if (strncmp(buffer, "storage", 7) == 0){
+            print_blob_store(server->store);
+        }
+
+        if (strncmp(buffer, "journal", 7) == 0 && server->journal != NULL){
+            print_journal(server->journal);
         }
     }
 
     return 0;
 }
 
+/*
+ * replay_job_record() -- journal_replay_fn: rebuild the jobs table one record at a time
+ *
+ * Blob references are taken as records name them; the store holds off reclaiming anything until
+ * replay is over, so a blob that was dropped and stored again later in the log is still there.
+ */
+void replay_job_record(int type, unsigned char *payload, int len, void *arg){
+    struct Server *server = arg;
+    int job_id = unpacki32(payload);
+    struct Job *job = get_job_by_id(server->jobs, job_id);
+
+    if (type == JREC_NEXT_ID){
+        if (job_id > server->job_id_ct) server->job_id_ct = job_id;
+        return;
+    }
+
+    if (type == JREC_JOB){
+        if (job != NULL || len < 88) return;
+
+        job = create_blank_job();
+        int offset = 4;
+        job->job_id = job_id;
+        job->status = unpacki16(payload+offset); offset += 2;
+        job->retry_ct = unpacki16(payload+offset); offset += 2;
+        job->priority = unpacki16(payload+offset); offset += 2;
+        job->client_key = (unsigned long long)unpacki64(payload+offset); offset += 8;
+        job->file_type = unpacki16(payload+offset); offset += 2;
+        int has_input = payload[offset++];
+        int has_result = payload[offset++];
+
+        if (has_input) job->input = blob_get(server->store, payload+offset);
+        offset += SHA256_LEN;
+        if (has_result) job->result = blob_get(server->store, payload+offset);
+        offset += SHA256_LEN;
+
+        int spec_len = unpacki16(payload+offset); offset += 2;
+        if (spec_len > len - offset || spec_len >= MAXJOBCOMMANDSIZE) spec_len = 0;
+        memcpy(job->job_spec, payload+offset, spec_len);
+        job->job_spec[spec_len] = '\0';
+        strncpy(job->results, "Job in progress.", 17);
+
+        add_job(server->jobs, job);
+        if (job_id >= server->job_id_ct) server->job_id_ct = job_id + 1;
+        return;
+    }
+
+    if (job == NULL) return;
+
+    switch (type){
+        case JREC_ASSIGN:
+            job->status = J_IN_PROGRESS;
+            break;
+
+        case JREC_RETRY:
+            job->retry_ct++;
+            break;
+
+        case JREC_COMPLETE:
+            if (len < 4 + SHA256_LEN) break;
+            blob_unref(server->store, job->result);
+            job->result = blob_get(server->store, payload+4);
+            release_input(server, job);
+            job->status = J_SUCCESS;
+            break;
+
+        case JREC_FAIL:
+            release_input(server, job);
+            job->status = J_FAILURE;
+            break;
+
+        case JREC_EVICT:
+            release_job_blobs(job, server);
+            remove_job(server->jobs, job_id);
+            break;
+    }
+}
+
+/*
+ * recover_jobs() -- after replay: finished jobs start their retention clock over, and whatever was queued or running
+ * when the server went down is queued again (and re-split if it's big). A job whose blob didn't survive fails.
+ *
+ * The result cache starts cold; it only holds references, so nothing is lost but the hits.
+ */
+void recover_jobs(struct Server *server){
+    int now_ms = get_time_ms();
+    int requeued = 0;
+
+    for (struct Job *job = server->jobs->head; job != NULL; job = job->next){
+        if (job->parent_id != -1) continue; // chunks split_job() just created
+
+        if (job->status == J_SUCCESS && job->result == NULL) job->status = J_FAILURE;
+
+        if (job->status == J_SUCCESS){
+            release_input(server, job);
+            mark_job_done(server->jobs, job, now_ms);
+            continue;
+        }
+        if (job->status == J_FAILURE){
+            release_input(server, job);
+            strcpy(job->results, "job failed.");
+            mark_job_done(server->jobs, job, now_ms);
+            continue;
+        }
+        if (job->input == NULL){
+            fail_job(server, job);
+            continue;
+        }
+
+        job->status = J_IN_QUEUE;
+        job->worker_id = -1;
+        if (server->cache != NULL){
+            cache_make_key(job->job_spec, job->file_type, job->input->key, job->cache_key);
+            job->cache_keyed = 1;
+        }
+        if (!split_job(server, job, job->input->size)){
+            sched_add(server->sched, job->job_id, job->priority, job->client_key);
+            server->stats->jobs_in_queue++;
+        }
+        requeued++;
+    }
+
+    server->dispatch_pending = 1;
+    printf("recovered %d jobs, %d queued again, next job id %d\n", server->jobs->count, requeued, server->job_id_ct);
+}
+
 /*
  * setup_server_struct() -- create the base Server struct with the appropriate file descriptors, returns pointer to said struct
  */
@@ -660,11 +1605,11 @@ struct Server *setup_server_struct(int cfd, int wfd, int pfd){
     server->worker_listener = wfd;
     server->epoll_fd = pfd;
     server->job_id_ct = 0;
+    server->dispatch_pending = 0;
+    server->drop_pending = 0;
+    server->last_stats_ms = get_time_ms();
 
-    struct Jobs *jobs = malloc(sizeof *jobs);
-    jobs->count = 0;
-    jobs->head = NULL;
-    jobs->tail = NULL;
+    struct Jobs *jobs = create_jobs();
 
     struct Stats *stats = malloc(sizeof *stats);
     stats->jobs_failed = 0;
@@ -673,30 +1618,77 @@ struct Server *setup_server_struct(int cfd, int wfd, int pfd){
     stats->success_rate = 0;
     stats->workers_ct = 0;
     stats->jobs_in_queue = 0;
+    stats->jobs_evicted = 0;
+    stats->cache_hits = 0;
+    stats->cache_misses = 0;
+    stats->inputs_reused = 0;
+    stats->input_bytes_saved = 0;
 
-    struct Workers *workers = malloc(sizeof *workers);
-    workers->available_workers = 0;
-    workers->count = 0;
-    workers->head = NULL;
-    workers->tail = NULL;
+    struct Workers *workers = create_workers();
 
     server->stats = stats;
     server->jobs = jobs;
     server->workers = workers;
-    server->queue = create_queue();;
+    server->conns = create_client_conns();
+    server->sched = create_scheduler();
+    server->store = create_blob_store(JOURNAL);
+    server->cache = RESULT_CACHE_BYTES > 0 ? create_result_cache(RESULT_CACHE_BYTES, server->store) : NULL;
+    server->journal = NULL;
+    server->commit_waits = create_queue();
+
+    if (JOURNAL){
+        // server->journal is still NULL while replay runs, so nothing replayed gets logged again
+        server->journal = open_journal(JOURNAL_PATH, JOURNAL_SNAPSHOT_PATH, replay_job_record, server);
+        if (server->journal == NULL){
+            perror("server: journal");
+            exit(1);
+        }
+        recover_jobs(server);
+        blob_store_recovered(server->store);
+    }
 
     add_epoll_fd(pfd, 0);
     add_epoll_fd(pfd, cfd);
     add_epoll_fd(pfd, wfd);
+    add_epoll_fd(pfd, server->store->done_fd);
+    if (server->journal != NULL) add_epoll_fd(pfd, server->journal->notify_fd);
+    server->timer_fd = add_epoll_timer(pfd, SERVER_TICK_MS);
 
     return server;
 }
 
 /*
- * del_storage() -- clear the `worker_storage` directory content. Force wipes the job history. 
+ * clear_storage_dir() -- delete everything under dir, depth first. Returns 0, or -1 if something couldn't be removed
+ */
+int clear_storage_dir(char *dir){
+    char path[MAXFILEPATH + 256];
+    struct stat st;
+    int rv = 0;
+
+    DIR *d = opendir(dir);
+    if (d == NULL) return errno == ENOENT ? 0 : -1;
+
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL){
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) continue;
+        snprintf(path, sizeof path, "%s/%s", dir, ent->d_name);
+
+        if (lstat(path, &st) == 0 && S_ISDIR(st.st_mode)){
+            if (clear_storage_dir(path) == -1 || rmdir(path) == -1) rv = -1;
+        } else if (unlink(path) == -1){
+            rv = -1;
+        }
+    }
+    closedir(d);
+    return rv;
+}
+
+/*
+ * del_storage() -- clear the `server_storage` directory content. Force wipes the job history.
  */
 void del_storage(){
-    if (system("cd /home/ethan/network-learning/month3/week3/server_storage && rm -rf *") == 0) {
+    mkdir(STORAGE_DIR, 0755);
+    if (clear_storage_dir(STORAGE_DIR) == 0) {
         printf("All files deleted successfully.\n");
     } else {
         printf("Failed to delete files.\n");
@@ -710,34 +1702,49 @@ void handle_shutdown(struct Server *server){
     printf("\nshutting down...\n");
     close(server->client_listener);
     close(server->worker_listener);
+    close(server->timer_fd);
     close(server->epoll_fd);
-    del_storage();
+    if (!JOURNAL) del_storage(); // with a journal, the next start picks up from here
     exit(EXIT_SUCCESS);
     printf("goodbye.\n");
 }
 
 int main(){
     printf("starting server...\n");
+    signal(SIGPIPE, SIG_IGN); // sendfile() has no MSG_NOSIGNAL; a client hanging up mid-download must not kill us
     int client_fd = get_listening_socket(CLIENT_PORT);
     int worker_fd = get_listening_socket(WORKER_PORT);
     int epoll_fd = create_epoll();
 
+    if (JOURNAL) mkdir(STORAGE_DIR, 0755);
+    else del_storage(); // before setup, which creates the blob store's directories inside server_storage
     struct Server *server = setup_server_struct(client_fd, worker_fd, epoll_fd);
 
-    del_storage();
-
     // Event loop
     struct epoll_event events[MAXEPOLLEVENTS];
 
     printf("server setup complete. waiting for connections...\n\n");
     while (1) {
-        int nfds = epoll_wait(epoll_fd, events, MAXEPOLLEVENTS, 0);
+        int nfds = epoll_wait(epoll_fd, events, MAXEPOLLEVENTS, -1);
         if (nfds == -1) {
+            if (errno == EINTR) continue;
             perror("epoll_wait");
             break;
         }
 
         for (int i = 0; i < nfds; i++) {
+            struct ClientConn *conn = get_client_conn(server->conns, events[i].data.fd);
+            if (conn != NULL){
+                handle_client_event(server, conn);
+                continue;
+            }
+
+            struct Worker *worker = get_worker_by_id(server->workers, events[i].data.fd);
+            if (worker != NULL){
+                handle_worker_event(server, worker, events[i].events);
+                continue;
+            }
+
             if (events[i].events & EPOLLIN) {
                 int fd = events[i].data.fd;
                 if (fd == 0){
@@ -745,21 +1752,30 @@ int main(){
                     continue;
                 }
                 if (fd == client_fd){
-                    handle_client_request(server);
+                    handle_new_client(server);
                     continue;
                 }
                 if (fd == worker_fd){
                     handle_new_worker(server);
                     continue;
                 }
-
-                handle_worker_data(server, fd);
-
+                if (fd == server->timer_fd){
+                    handle_tick(server);
+                    continue;
+                }
+                if (fd == server->store->done_fd){
+                    blob_store_reap(server->store);
+                    continue;
+                }
+                if (server->journal != NULL && fd == server->journal->notify_fd){
+                    release_commits(server);
+                    continue;
+                }
             }
         }
 
-        check_queue(server);
-        manage_worker_statuses(server);
+        if (server->drop_pending) drop_pending_workers(server);
+        if (server->dispatch_pending) check_queue(server);
     }
 
     handle_shutdown(server);
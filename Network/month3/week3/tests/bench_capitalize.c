@@ -0,0 +1,194 @@
+/*
+ * bench_capitalize.c -- capitalize with text_upper() vs. the old fprintf("%c") loop
+ *
+ *   check      -- text_upper() on random bytes (all 256 values, every length 0-300 at every alignment 0-63,
+ *                 plus one large buffer), once per instruction set the CPU has, against islower()/toupper()
+ *                 byte by byte, both into a separate buffer and in place
+ *   kernels    -- text_upper() over a buffer in memory, GB/s
+ *   end to end -- job_capitalize() on a file in the page cache vs. the loop it replaced, results compared
+ *                 byte for byte
+ *
+ * The input is random bytes, so it has NULs, newlines and everything above 127 as well as letters.
+ * Exits 1 if any check fails.
+ *
+ * usage: ./bench_capitalize [MB]   (default 64; writes bench_capitalize*.txt in the current directory)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../utils/job_processing.h"
+
+#define RUNS 5
+
+static double now_s(){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static unsigned char *random_bytes(size_t len, unsigned int seed){
+    unsigned char *buf = malloc(len);
+    for (size_t i = 0; i < len; i++) buf[i] = rand_r(&seed);
+    return buf;
+}
+
+/*
+ * old_capitalize() -- job_capitalize() before text_upper()
+ */
+static int old_capitalize(FILE *results, FILE *content){
+    char content_read[MAXFILEREAD];
+    int bytes_read;
+
+    while ((bytes_read = fread(content_read, sizeof(char), MAXFILEREAD, content)) > 0){
+        for (int i = 0; i < bytes_read; i++){
+            if (islower(content_read[i])) {
+                fprintf(results, "%c", toupper(content_read[i]));
+                continue;
+            }
+            fprintf(results, "%c", content_read[i]);
+        }
+    }
+    return 1;
+}
+
+/*
+ * matches() -- 1 if out is src run through islower()/toupper() like old_capitalize() does (on a signed char)
+ */
+static int matches(const unsigned char *out, const unsigned char *src, size_t len){
+    for (size_t i = 0; i < len; i++){
+        char c = src[i];
+        unsigned char expect = islower(c) ? toupper(c) : c;
+        if (out[i] != expect) return 0;
+    }
+    return 1;
+}
+
+/*
+ * check_isa() -- the random-input checks for the active instruction set; 1 if all of them pass
+ */
+static int check_isa(){
+    int ok = 1;
+    unsigned char all[256], out[256 + 64 + 300];
+    for (int i = 0; i < 256; i++) all[i] = i;
+    text_upper(out, all, 256);
+    ok &= matches(out, all, 256);
+
+    unsigned char *src = random_bytes(64 + 300, 1209);
+    for (int align = 0; align < 64; align++){
+        for (size_t len = 0; len <= 300; len++){
+            memset(out, 0x5a, sizeof out);
+            text_upper(out + (63 - align), src + align, len);
+            ok &= matches(out + (63 - align), src + align, len);
+            ok &= out[63 - align + len] == 0x5a;
+
+            memcpy(out, src + align, len);
+            text_upper(out, out, len);
+            ok &= matches(out, src + align, len);
+        }
+    }
+    free(src);
+
+    size_t big = (16 << 20) + 13;
+    src = random_bytes(big, 1205);
+    unsigned char *dst = malloc(big);
+    text_upper(dst, src, big);
+    ok &= matches(dst, src, big);
+    free(dst);
+    free(src);
+    return ok;
+}
+
+static int check_and_bench_kernels(const unsigned char *buf, size_t len){
+    static const char *isas[] = {"scalar", "sse2", "avx2"};
+    unsigned char *out = malloc(len);
+    int ok = 1;
+
+    printf("kernels\n");
+    printf("%-8s %8s %10s\n", "isa", "check", "GB/s");
+    for (int i = 0; i < 3; i++){
+        if (!text_use_isa(isas[i])){
+            printf("%-8s (not supported on this CPU)\n", isas[i]);
+            continue;
+        }
+
+        int passed = check_isa();
+        ok &= passed;
+
+        double t0 = now_s();
+        for (int r = 0; r < RUNS; r++) text_upper(out, buf, len);
+        double secs = (now_s() - t0) / RUNS;
+
+        printf("%-8s %8s %10.2f\n", isas[i], passed ? "ok" : "FAILED", len / secs / 1e9);
+    }
+    printf("\n");
+
+    free(out);
+    return ok;
+}
+
+/*
+ * time_file_job() -- seconds per run of job from in_path to out_path
+ */
+static double time_file_job(int (*job)(FILE *, FILE *), const char *in_path, const char *out_path){
+    double t0 = now_s();
+    for (int r = 0; r < RUNS; r++){
+        FILE *content = fopen(in_path, "r");
+        FILE *results = fopen(out_path, "w");
+        job(results, content);
+        fclose(results);
+        fclose(content);
+    }
+    return (now_s() - t0) / RUNS;
+}
+
+static int same_files(const char *a, const char *b){
+    FILE *fa = fopen(a, "r"), *fb = fopen(b, "r");
+    int same = fa != NULL && fb != NULL;
+    int ca, cb;
+
+    while (same){
+        ca = fgetc(fa);
+        cb = fgetc(fb);
+        if (ca != cb) same = 0;
+        if (ca == EOF) break;
+    }
+    if (fa != NULL) fclose(fa);
+    if (fb != NULL) fclose(fb);
+    return same;
+}
+
+int main(int argc, char **argv){
+    size_t mb = 64;
+    if (argc == 2) mb = atol(argv[1]);
+    size_t len = mb << 20;
+
+    unsigned char *buf = random_bytes(len, 1209);
+    int ok = check_and_bench_kernels(buf, len);
+
+    const char *in_path = "bench_capitalize.txt";
+    FILE *f = fopen(in_path, "w");
+    if (f == NULL || fwrite(buf, 1, len, f) != len){
+        fprintf(stderr, "couldn't write %s\n", in_path);
+        return 1;
+    }
+    fclose(f);
+
+    if (!text_use_isa("avx2")) text_use_isa("sse2");
+    double old_secs = time_file_job(old_capitalize, in_path, "bench_capitalize_old.txt");
+    double new_secs = time_file_job(job_capitalize, in_path, "bench_capitalize_new.txt");
+    int same = same_files("bench_capitalize_old.txt", "bench_capitalize_new.txt");
+    ok &= same;
+
+    printf("end to end (%zu MB file in the page cache, kernels: %s), GB/s\n", mb, text_isa());
+    printf("%10s %10s %8s  %s\n", "old", "new", "speedup", "results");
+    printf("%10.3f %10.2f %7.0fx  %s\n", len / old_secs / 1e9, len / new_secs / 1e9, old_secs / new_secs, same ? "identical" : "DIFFER");
+
+    remove(in_path);
+    remove("bench_capitalize_old.txt");
+    remove("bench_capitalize_new.txt");
+    free(buf);
+    return ok ? 0 : 1;
+}
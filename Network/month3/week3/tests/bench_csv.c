@@ -0,0 +1,240 @@
+/*
+ * bench_csv.c -- the CSV index: text_csv_scan() and the csv jobs built on it
+ *
+ *   check      -- text_csv_scan() on random bytes from ",\"\n a" cut into random pieces (carrying in_quotes),
+ *                 once per instruction set the CPU has, against the scalar scan over the whole buffer
+ *   kernels    -- text_csv_scan() over a generated CSV in memory, GB/s
+ *   end to end -- get_size() vs. the old 100-byte counting loop it replaced, then parse_csv(), csvfilter and
+ *                 csvsort on a file in the page cache
+ *
+ * The CSV has 5 columns: an id, a name, a city (some of them quoted with a comma inside), a score and a note.
+ * Exits 1 if any check fails.
+ *
+ * usage: ./bench_csv [rows]   (default 2000000; writes bench_csv.csv in the current directory)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../utils/job_processing.h"
+
+#define RUNS 3
+
+static double now_s(){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static char *synthetic_csv(long rows, size_t *len){
+    static const char *cities[] = {"Portland", "Seattle", "Boston", "\"New York, NY\"", "Austin"};
+    size_t cap = 64 + rows * 64;
+    char *buf = malloc(cap);
+    unsigned int seed = 1209;
+
+    size_t n = sprintf(buf, "id,name,city,score,note\n");
+    for (long i = 0; i < rows; i++){
+        n += sprintf(buf + n, "%ld,user%d,%s,%d,note %ld\n", i, rand_r(&seed) % 100000, cities[rand_r(&seed) % 5],
+                     rand_r(&seed) % 1001, i % 97);
+    }
+    *len = n;
+    return buf;
+}
+
+/*
+ * old_get_size() -- get_size() before the index: every newline is a row and every comma before the first
+ * one a column, quotes or not
+ */
+static void old_get_size(FILE *fptr, int *rows, int *cols){
+    char content_read[MAXFILEREAD];
+    int bytes_read;
+
+    int total_newlines = 0;
+    *cols = 1;
+    char last_char = '\0';
+
+    while ((bytes_read = fread(content_read, sizeof(char), MAXFILEREAD, fptr)) > 0){
+        for (int i = 0; i < bytes_read; i++){
+            if (content_read[i] == '\n') {
+                total_newlines++;
+            }
+            else if (total_newlines <= 0 && content_read[i] == ',') {
+                (*cols)++;
+            }
+            last_char = content_read[i];
+        }
+    }
+
+    *rows = total_newlines;
+    if (last_char != '\n' && last_char != '\0') {
+        (*rows)++;
+    }
+}
+
+/*
+ * check_isa() -- random pieces of random structural bytes through the active scan vs. expect; 1 if they match
+ */
+static int check_isa(const unsigned char *buf, size_t len, const uint32_t *expect, size_t expect_n){
+    uint32_t *out = malloc((len + 1) * sizeof *out);
+    unsigned int seed = 1205;
+    size_t found = 0;
+    int in_quotes = 0;
+    int ok = 1;
+
+    for (size_t off = 0; off < len; ){
+        size_t piece = rand_r(&seed) % 4 == 0 ? 1 + rand_r(&seed) % 5000 : rand_r(&seed) % 200;
+        if (piece > len - off) piece = len - off;
+
+        size_t n = text_csv_scan(buf + off, piece, &in_quotes, out);
+        for (size_t k = 0; k < n && ok; k++){
+            ok = found + k < expect_n && off + out[k] == expect[found + k];
+        }
+        found += n;
+        off += piece;
+    }
+
+    free(out);
+    return ok && found == expect_n;
+}
+
+static int check_and_bench_kernels(const unsigned char *csv, size_t csv_len){
+    static const char *isas[] = {"scalar", "sse2", "avx2"};
+    static const char structural[] = ",\"\n a";
+    size_t len = (8 << 20) + 13;
+
+    unsigned char *buf = malloc(len);
+    unsigned int seed = 1209;
+    for (size_t i = 0; i < len; i++) buf[i] = structural[rand_r(&seed) % 5];
+
+    uint32_t *expect = malloc(len * sizeof *expect);
+    int in_quotes = 0;
+    text_use_isa("scalar");
+    size_t expect_n = text_csv_scan(buf, len, &in_quotes, expect);
+
+    uint32_t *out = malloc(CSV_SCAN_BYTES * sizeof *out);
+    int ok = 1;
+
+    printf("kernels\n");
+    printf("%-8s %8s %10s\n", "isa", "check", "GB/s");
+    for (int i = 0; i < 3; i++){
+        if (!text_use_isa(isas[i])){
+            printf("%-8s (not supported on this CPU)\n", isas[i]);
+            continue;
+        }
+
+        int passed = check_isa(buf, len, expect, expect_n);
+        ok &= passed;
+
+        double t0 = now_s();
+        for (int r = 0; r < RUNS; r++){
+            in_quotes = 0;
+            for (size_t base = 0; base < csv_len; base += CSV_SCAN_BYTES){
+                size_t n = csv_len - base < CSV_SCAN_BYTES ? csv_len - base : CSV_SCAN_BYTES;
+                text_csv_scan(csv + base, n, &in_quotes, out);
+            }
+        }
+        double secs = (now_s() - t0) / RUNS;
+
+        printf("%-8s %8s %10.2f\n", isas[i], passed ? "ok" : "FAILED", csv_len / secs / 1e9);
+    }
+    printf("\n");
+
+    free(out);
+    free(expect);
+    free(buf);
+    return ok;
+}
+
+/*
+ * time_job() -- seconds per run of a csv job on path, writing to a memstream; *out_len is the result length
+ */
+static double time_job(int (*job)(FILE *, FILE *, unsigned char *), const char *args, const char *path, size_t *out_len){
+    double t0 = now_s();
+    for (int r = 0; r < RUNS; r++){
+        unsigned char header[MAXBUFSIZE] = {0};
+        strcpy((char *)header, args);
+
+        char *out = NULL;
+        FILE *content = fopen(path, "r");
+        FILE *results = open_memstream(&out, out_len);
+        job(results, content, header);
+        fclose(results);
+        fclose(content);
+        free(out);
+    }
+    return (now_s() - t0) / RUNS;
+}
+
+static int csvsort_untiled(FILE *results, FILE *content, unsigned char *header){
+    return job_csvsort(results, content, header, NULL, 0, "./");
+}
+
+static void bench_end_to_end(const char *path, size_t len){
+    printf("end to end (%.0f MB file in the page cache, kernels: %s)\n", len / 1e6, text_isa());
+    printf("%-24s %10s %10s  %s\n", "", "seconds", "MB/s", "result");
+
+    double t0 = now_s();
+    int old_rows = 0, old_cols = 0;
+    for (int r = 0; r < RUNS; r++){
+        FILE *f = fopen(path, "r");
+        old_get_size(f, &old_rows, &old_cols);
+        fclose(f);
+    }
+    double secs = (now_s() - t0) / RUNS;
+    printf("%-24s %10.3f %10.0f  %d rows, %d columns\n", "old get_size()", secs, len / secs / 1e6, old_rows, old_cols);
+
+    long rows = 0;
+    int cols = 0;
+    t0 = now_s();
+    for (int r = 0; r < RUNS; r++){
+        FILE *f = fopen(path, "r");
+        get_size(f, &rows, &cols);
+        fclose(f);
+    }
+    secs = (now_s() - t0) / RUNS;
+    printf("%-24s %10.3f %10.0f  %ld rows, %d columns\n", "get_size()", secs, len / secs / 1e6, rows, cols);
+
+    t0 = now_s();
+    for (int r = 0; r < RUNS; r++){
+        struct CSV csv;
+        FILE *f = fopen(path, "r");
+        parse_csv(&csv, f);
+        free_csv(&csv);
+        fclose(f);
+    }
+    secs = (now_s() - t0) / RUNS;
+    printf("%-24s %10.3f %10.0f\n", "parse_csv()", secs, len / secs / 1e6);
+
+    size_t out_len;
+    secs = time_job(job_csvfilter, "city Portland", path, &out_len);
+    printf("%-24s %10.3f %10.0f  %zu bytes out\n", "csvfilter city Portland", secs, len / secs / 1e6, out_len);
+
+    secs = time_job(csvsort_untiled, "score", path, &out_len);
+    printf("%-24s %10.3f %10.0f  %zu bytes out\n", "csvsort score", secs, len / secs / 1e6, out_len);
+}
+
+int main(int argc, char **argv){
+    long rows = 2000000;
+    if (argc == 2) rows = atol(argv[1]);
+
+    size_t len;
+    char *csv = synthetic_csv(rows, &len);
+    int ok = check_and_bench_kernels((const unsigned char *)csv, len);
+
+    const char *path = "bench_csv.csv";
+    FILE *f = fopen(path, "w");
+    if (f == NULL || fwrite(csv, 1, len, f) != len){
+        fprintf(stderr, "couldn't write %s\n", path);
+        return 1;
+    }
+    fclose(f);
+
+    if (!text_use_isa("avx2")) text_use_isa("sse2");
+    bench_end_to_end(path, len);
+
+    remove(path);
+    free(csv);
+    return ok ? 0 : 1;
+}
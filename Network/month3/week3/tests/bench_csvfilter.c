@@ -0,0 +1,215 @@
+/*
+ * bench_csvfilter.c -- the streaming csvfilter vs. the index-everything one it replaced
+ *
+ *   kernels    -- text_compare_f64() on random doubles (some NaN) for every comparison, once per instruction
+ *                 set the CPU has, checked against the scalar version
+ *   read       -- fread() of the file into a small buffer and nothing else: the I/O floor
+ *   end to end -- the old job_csvfilter() (parse_csv(), then one exact match down a column) and the new one
+ *                 on the same test, then numeric, range, prefix and AND/OR tests the old one couldn't do,
+ *                 each in a child process so its peak resident memory (ru_maxrss) is its own
+ *
+ * The CSV has an id, an age (int), a score (float), a date and a city (string) per row. The old and new
+ * filters have to write the same bytes for the test they share. Exits 1 if any check fails.
+ *
+ * usage: ./bench_csvfilter [rows]   (default 10000000; writes bench_csvfilter.* in the current directory)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "../utils/job_processing.h"
+
+static double now_s(){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static int write_csv(const char *path, long rows, size_t *len){
+    static const char *cities[] = {"Portland", "Seattle", "Boston", "San Francisco", "San Jose", "Austin", "Albuquerque", "Albany"};
+    FILE *f = fopen(path, "w");
+    if (f == NULL) return -1;
+    unsigned int seed = 1209;
+
+    *len = fprintf(f, "id,age,score,when,city\n");
+    for (long i = 0; i < rows; i++){
+        *len += fprintf(f, "%ld,%d,%.3f,%04d-%02d-%02d,%s\n", i, rand_r(&seed) % 100, (rand_r(&seed) % 2000000 - 1000000) / 1000.0,
+                        1970 + rand_r(&seed) % 60, 1 + rand_r(&seed) % 12, 1 + rand_r(&seed) % 28, cities[rand_r(&seed) % 8]);
+    }
+    return fclose(f) == 0 ? 1 : -1;
+}
+
+static int check_and_bench_kernels(){
+    static const char *isas[] = {"scalar", "sse2", "avx2"};
+    size_t n = (1 << 20) + 3;
+    double *vals = malloc(n * sizeof *vals);
+    unsigned char *expect = malloc(6 * n), *mask = malloc(n);
+    unsigned int seed = 1205;
+    for (size_t i = 0; i < n; i++) vals[i] = rand_r(&seed) % 16 == 0 ? NAN : (rand_r(&seed) % 2001 - 1000) / 10.0;
+
+    text_use_isa("scalar");
+    for (int cmp = 0; cmp < 6; cmp++) text_compare_f64(vals, n, cmp, 12.5, expect + cmp * n);
+
+    int ok = 1;
+    printf("kernels (all six comparisons)\n");
+    printf("%-8s %8s %14s\n", "isa", "check", "Mvalues/s");
+    for (int i = 0; i < 3; i++){
+        if (!text_use_isa(isas[i])){
+            printf("%-8s (not supported on this CPU)\n", isas[i]);
+            continue;
+        }
+
+        int passed = 1;
+        for (int cmp = 0; cmp < 6; cmp++){
+            text_compare_f64(vals, n, cmp, 12.5, mask);
+            passed &= memcmp(mask, expect + cmp * n, n) == 0;
+        }
+        ok &= passed;
+
+        double t0 = now_s();
+        for (int r = 0; r < 20; r++){
+            for (int cmp = 0; cmp < 6; cmp++) text_compare_f64(vals, n, cmp, 12.5, mask);
+        }
+        double secs = now_s() - t0;
+        printf("%-8s %8s %14.0f\n", isas[i], passed ? "ok" : "FAILED", 20.0 * 6 * n / secs / 1e6);
+    }
+    printf("\n");
+
+    free(vals);
+    free(expect);
+    free(mask);
+    return ok;
+}
+
+/*
+ * old_csvfilter() -- job_csvfilter() before streaming: index the whole file, then exact matches on one column
+ */
+static int old_csvfilter(FILE *results, FILE *content, unsigned char *header){
+    char column[MAXFILEPATH], value[MAXFILEPATH];
+    strip_whitespace((char *)header);
+    extract_first_word(column, (char *)header);
+    extract_first_word(value, (char *)header);
+
+    struct CSV csv;
+    if (parse_csv(&csv, content) == -1) return -1;
+    int col = csv_find_column(&csv, column);
+    if (col == -1){
+        free_csv(&csv);
+        return -1;
+    }
+
+    csv_write_row(&csv, 0, results);
+    size_t len = strlen(value);
+    for (long i = 0; i < csv.rows; i++){
+        if (csv.columns[col].len[i] == len && memcmp(csv.data + csv.columns[col].off[i], value, len) == 0) csv_write_row(&csv, i, results);
+    }
+    free_csv(&csv);
+    return 1;
+}
+
+/*
+ * run_filter() -- a filter on path into out in a child process: its exit status, wall time and peak memory
+ */
+static int run_filter(int (*job)(FILE *, FILE *, unsigned char *), const char *spec, const char *path, const char *out, double *secs, double *peak_mb){
+    double t0 = now_s();
+    pid_t pid = fork();
+    if (pid == 0){
+        unsigned char header[MAXBUFSIZE] = {0};
+        strcpy((char *)header, spec);
+        FILE *content = fopen(path, "r");
+        FILE *results = fopen(out, "w");
+        int rv = job(results, content, header);
+        fclose(results);
+        fclose(content);
+        _exit(rv == 1 ? 0 : 1);
+    }
+
+    int status;
+    struct rusage usage;
+    if (pid == -1 || wait4(pid, &status, 0, &usage) == -1) return -1;
+    *secs = now_s() - t0;
+    *peak_mb = usage.ru_maxrss / 1024.0;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+static int same_file(const char *a, const char *b){
+    FILE *fa = fopen(a, "r"), *fb = fopen(b, "r");
+    static char buf_a[1 << 16], buf_b[1 << 16];
+    int same = fa != NULL && fb != NULL;
+
+    while (same){
+        size_t na = fread(buf_a, 1, sizeof buf_a, fa);
+        size_t nb = fread(buf_b, 1, sizeof buf_b, fb);
+        same = na == nb && memcmp(buf_a, buf_b, na) == 0;
+        if (na == 0) break;
+    }
+
+    if (fa != NULL) fclose(fa);
+    if (fb != NULL) fclose(fb);
+    return same;
+}
+
+static long file_size(const char *path){
+    struct stat st;
+    return stat(path, &st) == 0 ? st.st_size : -1;
+}
+
+int main(int argc, char **argv){
+    long rows = 10000000;
+    if (argc == 2) rows = atol(argv[1]);
+
+    int ok = check_and_bench_kernels();
+    if (!text_use_isa("avx2")) text_use_isa("sse2");
+
+    const char *path = "bench_csvfilter.csv";
+    size_t len;
+    if (write_csv(path, rows, &len) == -1){
+        fprintf(stderr, "couldn't write %s\n", path);
+        return 1;
+    }
+    printf("end to end (%ld rows, %.0f MB in the page cache, kernels: %s)\n", rows, len / 1e6, text_isa());
+    printf("%-44s %8s %8s %9s %10s\n", "", "seconds", "MB/s", "peak MB", "out MB");
+
+    static char block[1 << 20];
+    FILE *f = fopen(path, "r");
+    double t0 = now_s();
+    while (fread(block, 1, sizeof block, f) > 0);
+    double secs = now_s() - t0;
+    fclose(f);
+    printf("%-44s %8.2f %8.0f\n", "fread() only", secs, len / secs / 1e6);
+
+    double peak_mb;
+    int rv = run_filter(old_csvfilter, "city Portland", path, "bench_csvfilter.old", &secs, &peak_mb);
+    ok &= rv == 0;
+    printf("%-44s %8.2f %8.0f %9.0f %10.1f\n", "old: city Portland", secs, len / secs / 1e6, peak_mb, file_size("bench_csvfilter.old") / 1e6);
+
+    static const char *specs[] = {
+        "city Portland",
+        "age >= 50",
+        "score in -10..10",
+        "city ^= San",
+        "when < 1980-01-01",
+        "age < 10 and score > 0 or city = Austin",
+    };
+    for (int i = 0; i < 6; i++){
+        char label[64];
+        snprintf(label, sizeof label, "new: %s", specs[i]);
+        rv = run_filter(job_csvfilter, specs[i], path, "bench_csvfilter.new", &secs, &peak_mb);
+        int same = i > 0 || same_file("bench_csvfilter.old", "bench_csvfilter.new");
+        ok &= rv == 0 && same;
+        printf("%-44s %8.2f %8.0f %9.0f %10.1f%s\n", label, secs, len / secs / 1e6, peak_mb, file_size("bench_csvfilter.new") / 1e6,
+               rv != 0 ? "  FAILED" : same ? "" : "  DIFFERENT");
+    }
+
+    remove("bench_csvfilter.old");
+    remove("bench_csvfilter.new");
+    remove(path);
+    return ok ? 0 : 1;
+}
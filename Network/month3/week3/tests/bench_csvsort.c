@@ -0,0 +1,235 @@
+/*
+ * bench_csvsort.c -- csv_sort_rows() vs. the old strcmp() merge sort, on a generated CSV
+ *
+ *   old        -- the recursive merge sort job_csvsort() used to run, on one column (strcmp order)
+ *   typed      -- csv_sort_rows() on an int, a float, a date and a string column, and on two columns at once,
+ *                 each checked: every row has to be in order by the keys, and rows with equal keys in
+ *                 file order
+ *   threads    -- the string sort again with tile pools of 1, 2, 4, ... up to N threads
+ *   end to end -- job_csvsort() on the file in the page cache, parse and output included
+ *
+ * The CSV has an id, an age (int), a score (float), a date and a city (string) per row. Times are the
+ * sort alone (the CSV is indexed once up front) unless it says end to end. Exits 1 if any check fails.
+ *
+ * usage: ./bench_csvsort [rows] [threads]   (default 10000000 rows, one thread per CPU; writes bench_csvsort.csv)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../utils/job_processing.h"
+
+static double now_s(){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static char *synthetic_csv(long rows, size_t *len){
+    static const char *cities[] = {"Portland", "Seattle", "Boston", "San Francisco", "San Jose", "Austin", "Albuquerque", "Albany"};
+    size_t cap = 64 + rows * 80;
+    char *buf = malloc(cap);
+    unsigned int seed = 1209;
+
+    size_t n = sprintf(buf, "id,age,score,when,city\n");
+    for (long i = 0; i < rows; i++){
+        n += sprintf(buf + n, "%ld,%d,%.3f,%04d-%02d-%02d,%s%d\n", i, rand_r(&seed) % 100, (rand_r(&seed) % 2000000 - 1000000) / 1000.0,
+                     1970 + rand_r(&seed) % 60, 1 + rand_r(&seed) % 12, 1 + rand_r(&seed) % 28,
+                     cities[rand_r(&seed) % 8], rand_r(&seed) % 1000);
+    }
+    *len = n;
+    return buf;
+}
+
+/*
+ * old_cell_cmp(), old_merge(), old_mergesort() -- job_csvsort()'s sort before csv_sort_rows()
+ */
+static int old_cell_cmp(struct CSV *csv, int col, long a, long b){
+    size_t len_a, len_b;
+    const char *cell_a = csv_cell(csv, a, col, &len_a);
+    const char *cell_b = csv_cell(csv, b, col, &len_b);
+
+    int cmp = memcmp(cell_a, cell_b, len_a < len_b ? len_a : len_b);
+    if (cmp != 0) return cmp;
+    return len_a < len_b ? -1 : len_a > len_b;
+}
+
+static void old_merge(struct CSV *csv, int col, long *idx_arr, long *temp, long left, long middle, long right){
+    long i = left;
+    long j = middle+1;
+    long temp_idx = 0;
+
+    while (i <= middle && j <= right){
+        if (old_cell_cmp(csv, col, idx_arr[i], idx_arr[j]) > 0){
+            temp[temp_idx++] = idx_arr[i++];
+        } else {
+            temp[temp_idx++] = idx_arr[j++];
+        }
+    }
+
+    while (j <= right){
+        temp[temp_idx++] = idx_arr[j++];
+    }
+
+    while (i <= middle){
+        temp[temp_idx++] = idx_arr[i++];
+    }
+
+    memcpy(idx_arr + left, temp, temp_idx * sizeof *idx_arr);
+}
+
+static void old_mergesort(struct CSV *csv, int col, long *idx_arr, long *temp, long left, long right){
+    long middle = (left + right) / 2;
+
+    if (left >= right) return;
+
+    old_mergesort(csv, col, idx_arr, temp, left, middle);
+    old_mergesort(csv, col, idx_arr, temp, middle+1, right);
+    old_merge(csv, col, idx_arr, temp, left, middle, right);
+}
+
+/*
+ * value_cmp() -- compare two cells of a generated column the slow, obvious way
+ */
+static int value_cmp(struct CSV *csv, int col, int type, long a, long b){
+    if (type == CSV_TYPE_INT || type == CSV_TYPE_FLOAT){
+        char buf_a[64], buf_b[64];
+        size_t len_a, len_b;
+        const char *cell_a = csv_cell(csv, a, col, &len_a);
+        const char *cell_b = csv_cell(csv, b, col, &len_b);
+        snprintf(buf_a, sizeof buf_a, "%.*s", (int)len_a, cell_a);
+        snprintf(buf_b, sizeof buf_b, "%.*s", (int)len_b, cell_b);
+        double va = atof(buf_a), vb = atof(buf_b);
+        return va < vb ? -1 : va > vb;
+    }
+    // dates are all YYYY-MM-DD, so they compare as strings
+    return old_cell_cmp(csv, col, a, b);
+}
+
+/*
+ * check_order() -- 1 if rows is sorted by keys, with rows that tie on every key in increasing row order
+ */
+static int check_order(struct CSV *csv, struct CSVSortKey *keys, int nkeys, const long *rows, long count){
+    for (long i = 1; i < count; i++){
+        int cmp = 0;
+        for (int k = 0; k < nkeys && cmp == 0; k++){
+            cmp = value_cmp(csv, keys[k].col, keys[k].type, rows[i - 1], rows[i]);
+            if (keys[k].descending) cmp = -cmp;
+        }
+        if (cmp > 0 || (cmp == 0 && rows[i - 1] > rows[i])) return 0;
+    }
+    return 1;
+}
+
+static void fill_rows(long *rows, long count){
+    for (long i = 0; i < count; i++) rows[i] = i + 1;
+}
+
+/*
+ * time_sort() -- seconds to sort by spec on tiles, with the result checked into *ok
+ */
+static double time_sort(struct CSV *csv, const char *spec, long *rows, long count, struct TilePool *tiles, int *ok, int *types){
+    struct CSVSortKey keys[CSV_SORT_MAX_KEYS];
+    int nkeys = csv_parse_sort_keys(csv, spec, keys);
+    fill_rows(rows, count);
+
+    double t0 = now_s();
+    int rv = csv_sort_rows(csv, keys, nkeys, rows, count, tiles);
+    double secs = now_s() - t0;
+
+    int passed = rv == 1 && check_order(csv, keys, nkeys, rows, count);
+    *ok &= passed;
+    for (int k = 0; k < nkeys; k++) types[k] = keys[k].type;
+    if (!passed) printf("  %s: NOT SORTED\n", spec);
+    return secs;
+}
+
+int main(int argc, char **argv){
+    long count = 10000000;
+    int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (argc >= 2) count = atol(argv[1]);
+    if (argc >= 3) max_threads = atoi(argv[2]);
+
+    size_t len;
+    char *text = synthetic_csv(count, &len);
+    const char *path = "bench_csvsort.csv";
+    FILE *f = fopen(path, "w");
+    if (f == NULL || fwrite(text, 1, len, f) != len){
+        fprintf(stderr, "couldn't write %s\n", path);
+        return 1;
+    }
+    fclose(f);
+    free(text);
+
+    struct CSV csv;
+    f = fopen(path, "r");
+    if (parse_csv(&csv, f) == -1){
+        fprintf(stderr, "couldn't index %s\n", path);
+        return 1;
+    }
+    fclose(f);
+    printf("%ld rows, %.0f MB\n\n", count, len / 1e6);
+
+    long *rows = malloc(count * sizeof *rows);
+    long *temp = malloc(count * sizeof *temp);
+    int ok = 1;
+    int types[CSV_SORT_MAX_KEYS];
+
+    fill_rows(rows, count);
+    double t0 = now_s();
+    old_mergesort(&csv, csv_find_column(&csv, "age"), rows, temp, 0, count - 1);
+    double old_secs = now_s() - t0;
+    printf("old strcmp merge sort, age: %.2f s\n\n", old_secs);
+
+    static const char *specs[] = {"age", "score:asc", "when", "city:asc", "city:asc age"};
+    printf("typed, one thread\n");
+    printf("%-16s %-14s %10s %12s %8s\n", "spec", "types", "seconds", "Mrows/s", "vs old");
+    for (int i = 0; i < 5; i++){
+        double secs = time_sort(&csv, specs[i], rows, count, NULL, &ok, types);
+        char type_list[64];
+        snprintf(type_list, sizeof type_list, "%s%s%s", csv_type_name(types[0]), i == 4 ? "," : "", i == 4 ? csv_type_name(types[1]) : "");
+        printf("%-16s %-14s %10.3f %12.1f %7.1fx\n", specs[i], type_list, secs, count / secs / 1e6, old_secs / secs);
+    }
+
+    printf("\nstring sort (city:asc) vs. threads\n");
+    printf("%8s %10s %8s\n", "threads", "seconds", "speedup");
+    double one_secs = 0;
+    for (int threads = 1; threads <= max_threads; threads *= 2){
+        struct TilePool *tiles = threads > 1 ? create_tile_pool(threads) : NULL;
+        double secs = time_sort(&csv, "city:asc", rows, count, tiles, &ok, types);
+        if (threads == 1) one_secs = secs;
+        printf("%8d %10.3f %7.1fx\n", threads, secs, one_secs / secs);
+        // the pool's threads are detached and just stay idle
+    }
+
+    free(rows);
+    free(temp);
+    free_csv(&csv);
+
+    printf("\nend to end, job_csvsort()\n");
+    static const char *jobs[] = {"age", "city:asc age"};
+    for (int i = 0; i < 2; i++){
+        unsigned char header[MAXBUFSIZE] = {0};
+        strcpy((char *)header, jobs[i]);
+        char *out = NULL;
+        size_t out_len = 0;
+
+        FILE *content = fopen(path, "r");
+        FILE *results = open_memstream(&out, &out_len);
+        t0 = now_s();
+        int rv = job_csvsort(results, content, header, NULL, 0, "./");
+        fclose(results);
+        double secs = now_s() - t0;
+        fclose(content);
+        ok &= rv == 1 && out_len >= len;
+
+        printf("%-16s %10.3f s %10.0f MB/s\n", jobs[i], secs, len / secs / 1e6);
+        free(out);
+    }
+
+    remove(path);
+    return ok ? 0 : 1;
+}
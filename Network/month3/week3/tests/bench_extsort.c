@@ -0,0 +1,124 @@
+/*
+ * bench_extsort.c -- csvsort in memory vs. in spilled runs under shrinking memory budgets
+ *
+ * Sorts a generated CSV with job_csvsort() once with no budget (everything in memory) and then with budgets
+ * that force more and more runs, each in a child process so its peak resident memory (ru_maxrss) is its own.
+ * Every budget's output has to match the in-memory output byte for byte. Exits 1 if one doesn't.
+ *
+ * The CSV has an id, an age (int), a score (float), a date and a city (string) per row, as in bench_csvsort.
+ *
+ * usage: ./bench_extsort [rows] [spec]   (default 5000000 rows, "city:asc age"; writes bench_extsort.* here)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "../utils/job_processing.h"
+
+static double now_s(){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static int write_csv(const char *path, long rows, size_t *len){
+    static const char *cities[] = {"Portland", "Seattle", "Boston", "San Francisco", "San Jose", "Austin", "Albuquerque", "Albany"};
+    FILE *f = fopen(path, "w");
+    if (f == NULL) return -1;
+    unsigned int seed = 1209;
+
+    *len = fprintf(f, "id,age,score,when,city\n");
+    for (long i = 0; i < rows; i++){
+        *len += fprintf(f, "%ld,%d,%.3f,%04d-%02d-%02d,%s%d\n", i, rand_r(&seed) % 100, (rand_r(&seed) % 2000000 - 1000000) / 1000.0,
+                        1970 + rand_r(&seed) % 60, 1 + rand_r(&seed) % 12, 1 + rand_r(&seed) % 28,
+                        cities[rand_r(&seed) % 8], rand_r(&seed) % 1000);
+    }
+    return fclose(f) == 0 ? 1 : -1;
+}
+
+/*
+ * run_sort() -- job_csvsort() on path into out with a budget of mb MB (0 = none) in a child process.
+ * Returns its exit status; *secs and *peak_mb are its wall time and peak resident memory
+ */
+static int run_sort(const char *path, const char *out, const char *spec, long mb, double *secs, double *peak_mb){
+    double t0 = now_s();
+    pid_t pid = fork();
+    if (pid == 0){
+        unsigned char header[MAXBUFSIZE] = {0};
+        strcpy((char *)header, spec);
+        FILE *content = fopen(path, "r");
+        FILE *results = fopen(out, "w");
+        int rv = job_csvsort(results, content, header, NULL, mb << 20, "./");
+        fclose(results);
+        fclose(content);
+        _exit(rv == 1 ? 0 : 1);
+    }
+
+    int status;
+    struct rusage usage;
+    if (pid == -1 || wait4(pid, &status, 0, &usage) == -1) return -1;
+    *secs = now_s() - t0;
+    *peak_mb = usage.ru_maxrss / 1024.0;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+static int same_file(const char *a, const char *b){
+    FILE *fa = fopen(a, "r"), *fb = fopen(b, "r");
+    static char buf_a[1 << 16], buf_b[1 << 16];
+    int same = fa != NULL && fb != NULL;
+
+    while (same){
+        size_t na = fread(buf_a, 1, sizeof buf_a, fa);
+        size_t nb = fread(buf_b, 1, sizeof buf_b, fb);
+        same = na == nb && memcmp(buf_a, buf_b, na) == 0;
+        if (na == 0) break;
+    }
+
+    if (fa != NULL) fclose(fa);
+    if (fb != NULL) fclose(fb);
+    return same;
+}
+
+int main(int argc, char **argv){
+    long rows = 5000000;
+    const char *spec = "city:asc age";
+    if (argc >= 2) rows = atol(argv[1]);
+    if (argc >= 3) spec = argv[2];
+
+    const char *path = "bench_extsort.csv";
+    size_t len;
+    if (write_csv(path, rows, &len) == -1){
+        fprintf(stderr, "couldn't write %s\n", path);
+        return 1;
+    }
+    printf("%ld rows, %.0f MB, csvsort %s\n\n", rows, len / 1e6, spec);
+    printf("%-12s %10s %10s %12s  %s\n", "budget", "seconds", "MB/s", "peak MB", "output");
+
+    // 0 first: it's the reference the budgets are checked against
+    static const long budgets[] = {0, 1024, 256, 64, 16};
+    int ok = 1;
+    for (int i = 0; i < 5; i++){
+        char out[64], label[32];
+        snprintf(out, sizeof out, "bench_extsort.%ld.out", budgets[i]);
+        if (budgets[i] == 0) snprintf(label, sizeof label, "in memory");
+        else snprintf(label, sizeof label, "%ld MB", budgets[i]);
+
+        double secs = 0, peak_mb = 0;
+        int rv = run_sort(path, out, spec, budgets[i], &secs, &peak_mb);
+        int same = i == 0 || same_file(out, "bench_extsort.0.out");
+        ok &= rv == 0 && same;
+
+        printf("%-12s %10.2f %10.0f %12.0f  %s\n", label, secs, len / secs / 1e6, peak_mb,
+               rv != 0 ? "FAILED" : i == 0 ? "reference" : same ? "same" : "DIFFERENT");
+        if (i > 0) remove(out);
+    }
+
+    remove("bench_extsort.0.out");
+    remove(path);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,208 @@
+/*
+ * bench_image.c -- native image fast path vs. MagickWand for the simple transforms
+ *
+ *   kernels    -- each pixel kernel on a decoded image, once per instruction set the CPU has (scalar, ssse3, avx2),
+ *                 checked against the scalar output
+ *   end to end -- decode + transform + JPEG encode of the same input, native_image_job() vs. the MagickWand
+ *                 calls the worker used for these jobs (MagickReadImageBlob(), the op, MagickGetImageBlob())
+ *
+ * The input is a synthetic photo-like image (gradients plus noise) encoded with jpeg_encode().
+ * Output is megapixels per second.
+ *
+ * usage: ./bench_image [width] [height]   (default 3840 2160)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <wand/MagickWand.h>
+
+#include "../utils/native_image.h"
+
+#define KERNEL_RUNS 10
+#define E2E_RUNS 5
+
+static double now_s(){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static uint32_t *synthetic_image(int width, int height){
+    uint32_t *px = malloc((size_t)width * height * sizeof *px);
+    unsigned int seed = 1209;
+
+    for (int y = 0; y < height; y++){
+        for (int x = 0; x < width; x++){
+            int noise = rand_r(&seed) % 24;
+            uint32_t r = (x * 255 / width + noise) & 0xff;
+            uint32_t g = (y * 255 / height + noise) & 0xff;
+            uint32_t b = ((x + y) * 128 / (width + height) + 64 + noise) & 0xff;
+            px[(long)y * width + x] = r | g << 8 | b << 16 | 0xff000000u;
+        }
+    }
+    return px;
+}
+
+/*
+ * run_kernel() -- apply kernel k (0 flipx, 1 flipy, 2 rotate 90, 3 rotate 270, 4 rotate 180, 5 luma) to a copy of src in work/dst
+ */
+static uint32_t *run_kernel(int k, const uint32_t *src, uint32_t *work, uint32_t *dst, int width, int height){
+    long count = (long)width * height;
+    if (k == 2 || k == 3){
+        if (k == 2) kernel_rotate_90(src, dst, width, height);
+        else kernel_rotate_270(src, dst, width, height);
+        return dst;
+    }
+
+    memcpy(work, src, count * sizeof *work);
+    if (k == 0) kernel_flip_x(work, width, height);
+    if (k == 1) kernel_flip_y(work, width, height);
+    if (k == 4) kernel_rotate_180(work, width, height);
+    if (k == 5) kernel_luma(work, count);
+    return work;
+}
+
+static void bench_kernels(const uint32_t *src, int width, int height){
+    static const char *names[] = {"flipx", "flipy", "rotate 90", "rotate 270", "rotate 180", "grayscale"};
+    static const char *isas[] = {"scalar", "ssse3", "avx2"};
+    long count = (long)width * height;
+    size_t bytes = count * sizeof(uint32_t);
+
+    uint32_t *work = malloc(bytes), *dst = malloc(bytes);
+    uint32_t *expect[6];
+
+    kernel_use_isa("scalar");
+    for (int k = 0; k < 6; k++){
+        expect[k] = malloc(bytes);
+        memcpy(expect[k], run_kernel(k, src, work, dst, width, height), bytes);
+    }
+
+    printf("kernels, MPix/s (copy of the input included for in-place kernels)\n");
+    printf("%-8s", "isa");
+    for (int k = 0; k < 6; k++) printf(" %12s", names[k]);
+    printf("\n");
+
+    for (int i = 0; i < 3; i++){
+        if (!kernel_use_isa(isas[i])){
+            printf("%-8s (not supported on this CPU)\n", isas[i]);
+            continue;
+        }
+        printf("%-8s", isas[i]);
+        for (int k = 0; k < 6; k++){
+            double t0 = now_s();
+            uint32_t *out = NULL;
+            for (int r = 0; r < KERNEL_RUNS; r++) out = run_kernel(k, src, work, dst, width, height);
+            double secs = (now_s() - t0) / KERNEL_RUNS;
+
+            int same = memcmp(out, expect[k], bytes) == 0;
+            printf(" %10.0f%s", count / secs / 1e6, same ? "  " : " !");
+        }
+        printf("\n");
+    }
+    printf("(! = output differs from scalar)\n\n");
+
+    for (int k = 0; k < 6; k++) free(expect[k]);
+    free(work);
+    free(dst);
+}
+
+/*
+ * magick_job() -- the MagickWand path for one op, on an already created wand. Returns encoded bytes or 0 on failure
+ */
+static size_t magick_job(MagickWand *wand, int k, const unsigned char *input, size_t size){
+    ClearMagickWand(wand);
+    if (MagickReadImageBlob(wand, input, size) == MagickFalse) return 0;
+
+    MagickBooleanType ok = MagickTrue;
+    if (k == 0) ok = MagickFlopImage(wand);
+    if (k == 1) ok = MagickFlipImage(wand);
+    if (k == 2){
+        PixelWand *bg = NewPixelWand();
+        PixelSetColor(bg, "black");
+        ok = MagickRotateImage(wand, bg, 90);
+        DestroyPixelWand(bg);
+    }
+    if (k == 3) ok = MagickTransformImageColorspace(wand, GRAYColorspace);
+    if (ok == MagickFalse) return 0;
+
+    MagickSetImageFormat(wand, "JPEG");
+    size_t len = 0;
+    unsigned char *out = MagickGetImageBlob(wand, &len);
+    if (out == NULL) return 0;
+    MagickRelinquishMemory(out);
+    return len;
+}
+
+/*
+ * bench_end_to_end() -- the table goes to report, since native_image_job() logs its stages to stdout
+ */
+static void bench_end_to_end(FILE *report, const unsigned char *input, size_t size, int width, int height){
+    static const char *specs[] = {"flipx", "flipy", "rotate 90", "grayscale_filter"};
+    static const int types[] = {JTYPE_FLIPX, JTYPE_FLIPY, JTYPE_ROTATE, JTYPE_MONOCHROME};
+    double mpix = (double)width * height / 1e6;
+
+    MagickWandGenesis();
+    MagickWand *wand = NewMagickWand();
+
+    fprintf(report, "end to end (decode + op + encode, %zu byte input), MPix/s\n", size);
+    fprintf(report, "%-18s %12s %12s %12s %12s\n", "job", "native", "out bytes", "magick", "out bytes");
+
+    for (int k = 0; k < 4; k++){
+        unsigned char stage[1][MAXBUFSIZE];
+        memset(stage[0], 0, MAXBUFSIZE);
+        strcpy((char *)stage[0], k == 2 ? "90" : "");
+        int type = types[k];
+
+        unsigned char *out = NULL;
+        size_t len = 0;
+        double t0 = now_s();
+        for (int r = 0; r < E2E_RUNS; r++){
+            free(out);
+            if (native_image_job(stage, &type, 1, input, size, NATIVE_JPEG_QUALITY, &out, &len) != 1) len = 0;
+        }
+        double native = (now_s() - t0) / E2E_RUNS;
+        free(out);
+
+        size_t magick_len = 0;
+        t0 = now_s();
+        for (int r = 0; r < E2E_RUNS; r++) magick_len = magick_job(wand, k, input, size);
+        double magick = (now_s() - t0) / E2E_RUNS;
+
+        fprintf(report, "%-18s %12.1f %12zu", specs[k], mpix / native, len);
+        if (magick_len > 0) fprintf(report, " %12.1f %12zu\n", mpix / magick, magick_len);
+        else fprintf(report, " %12s %12s\n", "failed", "-");
+    }
+
+    DestroyMagickWand(wand);
+    MagickWandTerminus();
+}
+
+int main(int argc, char **argv){
+    int width = 3840, height = 2160;
+    if (argc == 3){
+        width = atoi(argv[1]);
+        height = atoi(argv[2]);
+    }
+
+    uint32_t *src = synthetic_image(width, height);
+    printf("%d x %d, kernels default to %s\n\n", width, height, kernel_isa());
+    bench_kernels(src, width, height);
+
+    unsigned char *input;
+    size_t size;
+    jpeg_encode(src, width, height, 0, NATIVE_JPEG_QUALITY, &input, &size);
+
+    if (!kernel_use_isa("avx2")) kernel_use_isa("ssse3");
+    fflush(stdout);
+    FILE *report = stdout;
+    stdout = fopen("/dev/null", "w");
+    bench_end_to_end(report, input, size, width, height);
+    fclose(stdout);
+    stdout = report;
+
+    free(input);
+    free(src);
+    return 0;
+}
@@ -0,0 +1,120 @@
+/*
+ * bench_job_queue.c -- ring buffer JobQueue vs. the old malloc-per-node linked list
+ *
+ * Two patterns, each run against both implementations:
+ *   burst  -- push N ids, then pop them all (submit burst drained by workers)
+ *   steady -- keep DEPTH ids queued and do N push+pop pairs (queue never empties)
+ *
+ * usage: ./bench_job_queue [N]   (default 20000000)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../utils/job_queue.h"
+
+#define DEPTH 1000
+
+/*
+ * ListQ / ListQueue -- the previous linked-list queue, kept here as the baseline
+ */
+struct ListQ {
+    int job_id;
+    struct ListQ *next;
+};
+
+struct ListQueue {
+    struct ListQ *head;
+    struct ListQ *tail;
+    int count;
+};
+
+static void list_add(struct ListQueue *queue, int job_id){
+    struct ListQ *job = malloc(sizeof *job);
+    job->job_id = job_id;
+    job->next = NULL;
+
+    if (queue->count == 0){
+        queue->head = queue->tail = job;
+        queue->count++;
+        return;
+    }
+
+    queue->tail->next = job;
+    queue->tail = job;
+    queue->count++;
+}
+
+static int list_pop(struct ListQueue *queue){
+    if (queue->count <= 0) return -1;
+
+    struct ListQ *head = queue->head;
+    int job_id = head->job_id;
+
+    if (queue->count == 1) queue->head = queue->tail = NULL;
+    else queue->head = head->next;
+
+    free(head);
+    queue->count--;
+    return job_id;
+}
+
+static double now_s(){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static void report(const char *name, int n, double secs){
+    printf("%-22s %8.2f ns/op %10.1f Mops/s\n", name, secs * 1e9 / n, n / secs / 1e6);
+}
+
+int main(int argc, char **argv){
+    int n = 20000000;
+    if (argc == 2) n = atoi(argv[1]);
+    long sink = 0;
+
+    printf("%d push+pop pairs per run\n\n", n);
+
+    // burst
+    struct ListQueue list = {NULL, NULL, 0};
+    double t0 = now_s();
+    for (int i = 0; i < n; i++) list_add(&list, i);
+    for (int i = 0; i < n; i++) sink += list_pop(&list);
+    report("burst  linked list", n, now_s() - t0);
+
+    struct JobQueue *ring = create_queue();
+    t0 = now_s();
+    for (int i = 0; i < n; i++) add_to_queue(ring, i);
+    for (int i = 0; i < n; i++) sink += pop_queue(ring);
+    report("burst  ring buffer", n, now_s() - t0);
+    free_queue(ring);
+
+    // steady state
+    for (int i = 0; i < DEPTH; i++) list_add(&list, i);
+    t0 = now_s();
+    for (int i = 0; i < n; i++){
+        list_add(&list, i);
+        sink += list_pop(&list);
+    }
+    report("steady linked list", n, now_s() - t0);
+
+    ring = create_queue();
+    for (int i = 0; i < DEPTH; i++) add_to_queue(ring, i);
+    t0 = now_s();
+    for (int i = 0; i < n; i++){
+        add_to_queue(ring, i);
+        sink += pop_queue(ring);
+    }
+    report("steady ring buffer", n, now_s() - t0);
+
+    // retries: pop then push the same id back to the front
+    t0 = now_s();
+    for (int i = 0; i < n; i++) push_front_queue(ring, pop_queue(ring));
+    report("retry  ring buffer", n, now_s() - t0);
+    free_queue(ring);
+
+    printf("\n(checksum %ld)\n", sink);
+    return 0;
+}
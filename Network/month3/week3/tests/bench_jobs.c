@@ -0,0 +1,90 @@
+/*
+ * bench_jobs.c -- microbenchmark for job lookups vs. job table size
+ *
+ * Fills a Jobs table with N sequential ids, then times random get_job_by_id() hits,
+ * misses, and a retention sweep. A plain linked-list walk (the pre-index lookup) is
+ * timed alongside for the smaller sizes so the difference is visible.
+ *
+ * usage: ./bench_jobs [MAXJOBS]   (default 262144, each struct Job is ~4 KB)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../utils/jobs.h"
+
+#define LOOKUPS 2000000
+#define LINEAR_MAX 16384
+
+static double now_ns(){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+/*
+ * linear_lookup() -- the old get_job_by_id(): walk the list from the head
+ */
+static struct Job *linear_lookup(struct Jobs *jobs, int job_id){
+    for (struct Job *cur = jobs->head; cur != NULL; cur = cur->next){
+        if (cur->job_id == job_id) return cur;
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv){
+    int max_jobs = 262144;
+    if (argc == 2) max_jobs = atoi(argv[1]);
+
+    unsigned int seed = 1209;
+    volatile long sink = 0;
+
+    printf("%10s %14s %14s %14s\n", "jobs", "hit ns/op", "miss ns/op", "linear ns/op");
+
+    for (int n = 1024; n <= max_jobs; n *= 4){
+        struct Jobs *jobs = create_jobs();
+        for (int i = 0; i < n; i++){
+            struct Job *job = create_blank_job();
+            job->job_id = i;
+            add_job(jobs, job);
+        }
+
+        double t0 = now_ns();
+        for (int i = 0; i < LOOKUPS; i++){
+            struct Job *job = get_job_by_id(jobs, rand_r(&seed) % n);
+            sink += job->job_id;
+        }
+        double hit = (now_ns() - t0) / LOOKUPS;
+
+        t0 = now_ns();
+        for (int i = 0; i < LOOKUPS; i++){
+            sink += get_job_by_id(jobs, n + rand_r(&seed) % n) == NULL;
+        }
+        double miss = (now_ns() - t0) / LOOKUPS;
+
+        double linear = 0;
+        if (n <= LINEAR_MAX){
+            int iters = LOOKUPS / n;
+            t0 = now_ns();
+            for (int i = 0; i < iters; i++){
+                sink += linear_lookup(jobs, rand_r(&seed) % n)->job_id;
+            }
+            linear = (now_ns() - t0) / iters;
+        }
+
+        if (linear > 0) printf("%10d %14.1f %14.1f %14.1f\n", n, hit, miss, linear);
+        else printf("%10d %14.1f %14.1f %14s\n", n, hit, miss, "-");
+
+        // retention sweep: mark everything done, then evict all of it
+        for (struct Job *cur = jobs->head; cur != NULL; cur = cur->next) mark_job_done(jobs, cur, 0);
+        t0 = now_ns();
+        int evicted = evict_done_jobs(jobs, 1, 0, -1, NULL, NULL);
+        printf("%10s evicted %d jobs in %.1f ms, %d left\n", "", evicted, (now_ns() - t0) / 1e6, jobs->count);
+
+        free(jobs->index);
+        free(jobs);
+    }
+
+    return 0;
+}
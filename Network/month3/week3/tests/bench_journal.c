@@ -0,0 +1,148 @@
+/*
+ * bench_journal.c -- what the job journal costs the event loop, and how group commit batches
+ *
+ *   per-record sync -- the naive journal: write() + fdatasync() for every record, on the caller's thread
+ *   burst           -- journal_append() as fast as possible, then wait for the committer to catch up
+ *   paced           -- journal_append() at a fixed submit rate (default 5000/s), like handle_job_submission()
+ *
+ * The paced run reports how much of each submit's time budget the append takes on the calling
+ * thread (that's what comes off submit throughput), and how long a submit's reply waits for its
+ * record to be durable. Records are the size of a typical JREC_JOB.
+ *
+ * usage: ./bench_journal [submits/s] [seconds]   (default 5000 3)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../utils/journal.h"
+
+#define BENCH_LOG "./bench_journal.log"
+#define BENCH_SNAP "./bench_journal.snap"
+#define RECORD_BYTES 100
+#define BURST_RECORDS 200000
+#define NAIVE_RECORDS 500
+
+static double now_s(){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static void no_replay(int type, unsigned char *payload, int len, void *arg){
+}
+
+static int cmp_double(const void *a, const void *b){
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static struct Journal *fresh_journal(){
+    remove(BENCH_LOG);
+    remove(BENCH_SNAP);
+    return open_journal(BENCH_LOG, BENCH_SNAP, no_replay, NULL);
+}
+
+/*
+ * bench_naive() -- one fdatasync() per record, the way a journal without group commit would do it
+ */
+static void bench_naive(unsigned char *payload){
+    remove(BENCH_LOG);
+    int fd = open(BENCH_LOG, O_WRONLY | O_CREAT | O_APPEND, 0644);
+
+    double t0 = now_s();
+    for (int i = 0; i < NAIVE_RECORDS; i++){
+        if (write(fd, payload, RECORD_BYTES) != RECORD_BYTES || fdatasync(fd) == -1) perror("write");
+    }
+    double secs = now_s() - t0;
+    close(fd);
+
+    printf("per-record sync   %8.0f records/s   %8.1f us on the caller per record\n", NAIVE_RECORDS / secs, secs / NAIVE_RECORDS * 1e6);
+}
+
+/*
+ * bench_burst() -- appends as fast as the caller can make them
+ */
+static void bench_burst(unsigned char *payload){
+    struct Journal *j = fresh_journal();
+
+    double t0 = now_s();
+    unsigned long long last = 0;
+    for (int i = 0; i < BURST_RECORDS; i++) last = journal_append(j, 1, payload, RECORD_BYTES);
+    double append_secs = now_s() - t0;
+
+    while (journal_durable(j) < last) usleep(100);
+    double secs = now_s() - t0;
+
+    printf("burst             %8.0f records/s   %8.3f us on the caller per record, all durable after %.3f s (%ld commits, %.0f records each)\n",
+           BURST_RECORDS / append_secs, append_secs / BURST_RECORDS * 1e6, secs, j->commits, (double)j->committed / j->commits);
+}
+
+/*
+ * bench_paced() -- one append every 1/rate s; commit latency is measured from append to journal_durable() seeing it
+ */
+static void bench_paced(unsigned char *payload, int rate, int seconds){
+    struct Journal *j = fresh_journal();
+    int total = rate * seconds;
+    double *appended = malloc(total * sizeof *appended);
+    double *latency = malloc(total * sizeof *latency);
+    double busy = 0;
+    int done = 0;
+
+    double t0 = now_s();
+    for (int i = 0; i < total; i++){
+        double due = t0 + (double)i / rate;
+        double t;
+        while ((t = now_s()) < due){
+            if (due - t > 100e-6) usleep(50);
+        }
+
+        double a = now_s();
+        journal_append(j, 1, payload, RECORD_BYTES);
+        appended[i] = a;
+        busy += now_s() - a;
+
+        // lsns start at 1, so record i is durable once durable >= i + 1
+        unsigned long long durable = journal_durable(j);
+        double seen = now_s();
+        while (done < total && (unsigned long long)done + 1 <= durable) latency[done] = seen - appended[done], done++;
+    }
+
+    while (done < total){
+        unsigned long long durable = journal_durable(j);
+        double seen = now_s();
+        while (done < total && (unsigned long long)done + 1 <= durable) latency[done] = seen - appended[done], done++;
+        usleep(50);
+    }
+    double secs = now_s() - t0;
+
+    qsort(latency, total, sizeof *latency, cmp_double);
+    double per_submit = busy / total;
+
+    printf("paced %5d/s     %8.0f records/s   %8.3f us on the caller per record = %.2f%% of the %.0f us budget per submit\n",
+           rate, total / secs, per_submit * 1e6, per_submit * rate * 100, 1e6 / rate);
+    printf("                  commit latency p50 %.2f ms, p99 %.2f ms, max %.2f ms; %ld commits (%.1f records each, %.0f fdatasync/s)\n",
+           latency[total / 2] * 1e3, latency[total * 99 / 100] * 1e3, latency[total - 1] * 1e3,
+           j->commits, (double)j->committed / j->commits, j->commits / secs);
+
+    free(appended);
+    free(latency);
+}
+
+int main(int argc, char **argv){
+    int rate = argc >= 2 ? atoi(argv[1]) : 5000;
+    int seconds = argc >= 3 ? atoi(argv[2]) : 3;
+
+    unsigned char payload[RECORD_BYTES];
+    for (int i = 0; i < RECORD_BYTES; i++) payload[i] = 'a' + i % 26;
+
+    bench_naive(payload);
+    bench_burst(payload);
+    bench_paced(payload, rate, seconds);
+
+    remove(BENCH_LOG);
+    remove(BENCH_SNAP);
+    return 0;
+}
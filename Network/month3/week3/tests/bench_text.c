@@ -0,0 +1,186 @@
+/*
+ * bench_text.c -- wordcount/charcount: the text kernels vs. the old 100-byte fread() loops
+ *
+ *   kernels    -- text_count() over the whole input in memory, once per instruction set the CPU has
+ *                 (scalar, sse2, avx2), checked against the scalar counts
+ *   blocks     -- the same input fed to text_count() in random-sized pieces (1 byte up to 1 MB), which
+ *                 has to give the same counts as one call
+ *   end to end -- job_wordcount() / job_charcount() on a file in the page cache vs. the loops they replaced
+ *
+ * The input is random words of 1-12 letters, separated by one space (sometimes several) with the odd
+ * newline and tab, which count as part of a word like they do in the jobs. Output is GB/s.
+ *
+ * usage: ./bench_text [MB]   (default 256; writes bench_text.txt in the current directory)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../utils/job_processing.h"
+
+#define RUNS 5
+
+static double now_s(){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static unsigned char *synthetic_text(size_t len){
+    unsigned char *buf = malloc(len);
+    unsigned int seed = 1209;
+    size_t i = 0;
+
+    while (i < len){
+        int word = 1 + rand_r(&seed) % 12;
+        for (int j = 0; j < word && i < len; j++) buf[i++] = 'a' + rand_r(&seed) % 26;
+
+        int r = rand_r(&seed) % 100;
+        if (i < len && r < 3) buf[i++] = '\n';
+        else if (i < len && r < 4) buf[i++] = '\t';
+
+        int gap = r < 90 ? 1 : 1 + rand_r(&seed) % 4;
+        for (int j = 0; j < gap && i < len; j++) buf[i++] = ' ';
+    }
+    return buf;
+}
+
+/*
+ * old_wordcount(), old_charcount() -- job_wordcount() and job_charcount() before the text kernels
+ */
+static int old_wordcount(FILE *results, FILE *content){
+    char content_read[MAXFILEREAD];
+    int bytes_read;
+    int wordcount = 0;
+    int seen_space = 1;
+
+    while ((bytes_read = fread(content_read, sizeof(char), MAXFILEREAD, content)) > 0){
+        for (int i = 0; i < bytes_read; i++){
+            if (content_read[i] == ' ') seen_space = 1;
+            else if (seen_space == 1) {
+                wordcount++;
+                seen_space = 0;
+            }
+        }
+    }
+
+    fprintf(results, "%d total words", wordcount);
+    return 1;
+}
+
+static int old_charcount(FILE *results, FILE *content){
+    char content_read[MAXFILEREAD];
+    int bytes_read;
+    int charcount = 0;
+
+    while ((bytes_read = fread(content_read, sizeof(char), MAXFILEREAD, content)) > 0){
+        for (int i = 0; i < bytes_read; i++){
+            if (content_read[i] != ' ') charcount++;
+        }
+    }
+
+    fprintf(results, "%d total characters", charcount);
+    return 1;
+}
+
+static void bench_kernels(const unsigned char *buf, size_t len){
+    static const char *isas[] = {"scalar", "sse2", "avx2"};
+    struct TextCounts expect;
+
+    text_use_isa("scalar");
+    text_counts_init(&expect);
+    text_count(&expect, buf, len);
+    printf("%zu bytes: %lld words, %lld characters\n\n", len, expect.words, expect.chars);
+
+    printf("kernels, GB/s\n");
+    printf("%-8s %10s %10s\n", "isa", "one call", "blocks");
+    for (int i = 0; i < 3; i++){
+        if (!text_use_isa(isas[i])){
+            printf("%-8s (not supported on this CPU)\n", isas[i]);
+            continue;
+        }
+
+        struct TextCounts counts;
+        double t0 = now_s();
+        for (int r = 0; r < RUNS; r++){
+            text_counts_init(&counts);
+            text_count(&counts, buf, len);
+        }
+        double secs = (now_s() - t0) / RUNS;
+        int same = counts.words == expect.words && counts.chars == expect.chars && counts.in_word == expect.in_word;
+
+        // piece sizes spread over every alignment and both sides of the 64-byte vector step
+        unsigned int seed = 1205;
+        text_counts_init(&counts);
+        t0 = now_s();
+        for (size_t off = 0; off < len; ){
+            size_t piece = rand_r(&seed) % 4 == 0 ? 1 + rand_r(&seed) % (1 << 20) : 1 + rand_r(&seed) % 200;
+            if (piece > len - off) piece = len - off;
+            text_count(&counts, buf + off, piece);
+            off += piece;
+        }
+        double block_secs = now_s() - t0;
+        int same_blocks = counts.words == expect.words && counts.chars == expect.chars && counts.in_word == expect.in_word;
+
+        printf("%-8s %8.2f%s %8.2f%s\n", isas[i], len / secs / 1e9, same ? "  " : " !", len / block_secs / 1e9, same_blocks ? "  " : " !");
+    }
+    printf("(! = counts differ from scalar)\n\n");
+}
+
+/*
+ * time_file_job() -- seconds per run of job on path, with its result text in out
+ */
+static double time_file_job(int (*job)(FILE *, FILE *), const char *path, char *out, size_t out_len){
+    double t0 = now_s();
+    for (int r = 0; r < RUNS; r++){
+        FILE *content = fopen(path, "r");
+        FILE *results = fmemopen(out, out_len, "w");
+        job(results, content);
+        fclose(results);
+        fclose(content);
+    }
+    return (now_s() - t0) / RUNS;
+}
+
+static void bench_end_to_end(const char *path, size_t len){
+    static const char *names[] = {"wordcount", "charcount"};
+    int (*old_jobs[])(FILE *, FILE *) = {old_wordcount, old_charcount};
+    int (*new_jobs[])(FILE *, FILE *) = {job_wordcount, job_charcount};
+
+    printf("end to end (file in the page cache, kernels: %s), GB/s\n", text_isa());
+    printf("%-10s %10s %10s %8s  %s\n", "job", "old", "new", "speedup", "result");
+    for (int k = 0; k < 2; k++){
+        char old_out[64] = {0}, new_out[64] = {0};
+        double old_secs = time_file_job(old_jobs[k], path, old_out, sizeof old_out - 1);
+        double new_secs = time_file_job(new_jobs[k], path, new_out, sizeof new_out - 1);
+
+        printf("%-10s %10.2f %10.2f %7.1fx  %s%s\n", names[k], len / old_secs / 1e9, len / new_secs / 1e9,
+               old_secs / new_secs, new_out, strcmp(old_out, new_out) == 0 ? "" : " (old says otherwise!)");
+    }
+}
+
+int main(int argc, char **argv){
+    size_t mb = 256;
+    if (argc == 2) mb = atol(argv[1]);
+    size_t len = mb << 20;
+
+    unsigned char *buf = synthetic_text(len);
+    bench_kernels(buf, len);
+
+    const char *path = "bench_text.txt";
+    FILE *f = fopen(path, "w");
+    if (f == NULL || fwrite(buf, 1, len, f) != len){
+        fprintf(stderr, "couldn't write %s\n", path);
+        return 1;
+    }
+    fclose(f);
+
+    if (!text_use_isa("avx2")) text_use_isa("sse2");
+    bench_end_to_end(path, len);
+
+    remove(path);
+    free(buf);
+    return 0;
+}
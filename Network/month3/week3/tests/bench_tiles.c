@@ -0,0 +1,136 @@
+/*
+ * bench_tiles.c -- scaling of the tiled image filters with the tile pool's thread count
+ *
+ * Runs charcoal_filter, stencil_filter and a Lanczos resize through process_job() (the same call a worker
+ * slot makes) with a tile pool of 1, 2, 4, ... up to N threads, and reports seconds per job and the speedup
+ * over one thread. A 1-thread pool takes the untiled path, so that column is the plain MagickWand cost.
+ *
+ * The input is a synthetic noisy gradient encoded with jpeg_encode() into bench_tiles_storage/content.jpg
+ * (in the current directory).
+ *
+ * usage: ./bench_tiles [max threads] [width] [height]   (default one per CPU, 6000 4000)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../utils/job_processing.h"
+
+#define RUNS 3
+
+static double now_s(){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static int write_input(const char *path, int width, int height){
+    uint32_t *px = malloc((size_t)width * height * sizeof *px);
+    unsigned int seed = 1209;
+
+    for (int y = 0; y < height; y++){
+        for (int x = 0; x < width; x++){
+            int noise = rand_r(&seed) % 24;
+            uint32_t r = (x * 255 / width + noise) & 0xff;
+            uint32_t g = (y * 255 / height + noise) & 0xff;
+            uint32_t b = ((x + y) * 128 / (width + height) + 64 + noise) & 0xff;
+            px[(long)y * width + x] = r | g << 8 | b << 16 | 0xff000000u;
+        }
+    }
+
+    unsigned char *jpeg;
+    size_t len;
+    int rv = jpeg_encode(px, width, height, 0, NATIVE_JPEG_QUALITY, &jpeg, &len);
+    free(px);
+    if (rv == -1) return -1;
+
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) return -1;
+    fwrite(jpeg, 1, len, f);
+    fclose(f);
+    free(jpeg);
+    return 1;
+}
+
+/*
+ * time_job() -- seconds per run of spec with this tile pool, or -1 if the job fails
+ */
+static double time_job(const char *spec, struct WandPool *wands, struct TilePool *tiles){
+    char dir[MAXFILEPATH] = "./bench_tiles_storage/";
+    char ext[MAXFILEEXT] = ".jpg";
+
+    double t0 = now_s();
+    for (int r = 0; r < RUNS; r++){
+        unsigned char header[MAXBUFSIZE];
+        memset(header, 0, MAXBUFSIZE);
+        strcpy((char *)header, spec);
+
+        struct JobResult result;
+        if (process_job(header, dir, ext, wands, tiles, 0, &result) != 1) return -1;
+        free_job_result(&result);
+    }
+    return (now_s() - t0) / RUNS;
+}
+
+int main(int argc, char **argv){
+    int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int width = 6000, height = 4000;
+    if (argc >= 2) max_threads = atoi(argv[1]);
+    if (argc == 4){
+        width = atoi(argv[2]);
+        height = atoi(argv[3]);
+    }
+    if (max_threads < 1) max_threads = 1;
+
+    mkdir("bench_tiles_storage", 0755);
+    if (write_input("bench_tiles_storage/content.jpg", width, height) == -1){
+        fprintf(stderr, "couldn't write bench_tiles_storage/content.jpg\n");
+        return 1;
+    }
+
+    static const char *specs[] = {"charcoal_filter 2 1", "stencil_filter", "scale 1.5", "resize 1920x1080"};
+    int nspecs = sizeof specs / sizeof *specs;
+
+    MagickWandGenesis();
+    struct WandPool *wands = create_wand_pool(1);
+
+    FILE *report = stdout;
+    fprintf(report, "%d x %d, seconds per job (speedup over 1 thread)\n", width, height);
+    fprintf(report, "%-8s", "threads");
+    for (int s = 0; s < nspecs; s++) fprintf(report, " %22s", specs[s]);
+    fprintf(report, "\n");
+    fflush(report);
+
+    // process_job() logs every stage to stdout
+    stdout = fopen("/dev/null", "w");
+
+    double base[sizeof specs / sizeof *specs];
+    for (int threads = 1; ; threads = threads * 2 < max_threads ? threads * 2 : max_threads){
+        struct TilePool *tiles = create_tile_pool(threads);
+        // as in worker.c
+        MagickSetResourceLimit(ThreadResource, threads > 1 ? 1 : max_threads);
+
+        fprintf(report, "%-8d", threads);
+        for (int s = 0; s < nspecs; s++){
+            double secs = time_job(specs[s], wands, tiles);
+            if (threads == 1) base[s] = secs;
+
+            if (secs < 0) fprintf(report, " %22s", "failed");
+            else fprintf(report, " %14.3f (%4.2fx)", secs, base[s] > 0 ? base[s] / secs : 0);
+        }
+        fprintf(report, "\n");
+        fflush(report);
+
+        // helper threads are detached and idle between batches; the pool is just left behind
+        if (threads == max_threads) break;
+    }
+
+    fclose(stdout);
+    stdout = report;
+    MagickWandTerminus();
+    return 0;
+}
@@ -0,0 +1,201 @@
+/*
+ * bench_transfer.c -- file <-> socket throughput over loopback TCP, copy loops vs. sendfile()/splice()
+ *
+ * Send side (a peer process drains the socket and acks at the end):
+ *   buffered -- the old loop: fread() 4 KB, send(), memset()
+ *   sendfile -- send_file_range()
+ *
+ * Receive side (a peer process sendfile()s the data in):
+ *   fopen/4KB -- the old loop: fopen(.., "ab") + fwrite + fclose per 4 KB read
+ *   read/write -- one descriptor, 64 KB read() + write()
+ *   engine    -- open_recv_file() + receive_file_body() (splice() with ZERO_COPY, adaptive pwrite() otherwise)
+ *
+ * usage: ./bench_transfer [MB]   (default 1024)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+
+#include "../utils/file_transfer.h"
+
+#define SRC_FILE "./bench_transfer.src"
+#define DST_FILE "./bench_transfer.dst"
+
+static int listener;
+static struct sockaddr_in listen_addr;
+
+static double now_s(){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static void report(const char *name, long bytes, double secs){
+    printf("%-22s %8.3f s %8.2f GB/s\n", name, secs, bytes / secs / 1e9);
+}
+
+/*
+ * make_source() -- write `bytes` of non-zero data to SRC_FILE
+ */
+static void make_source(long bytes){
+    static unsigned char block[1 << 20];
+    for (int i = 0; i < (int)sizeof block; i++) block[i] = 'a' + (i * 7) % 26;
+
+    FILE *f = fopen(SRC_FILE, "wb");
+    for (long done = 0; done < bytes; done += sizeof block) fwrite(block, 1, sizeof block, f);
+    fclose(f);
+}
+
+/*
+ * open_pair() -- fork a peer connected over loopback; the parent gets its end of the connection, the child runs peer()
+ */
+static int open_pair(void (*peer)(int, long), long bytes){
+    fflush(stdout);
+    if (fork() == 0){
+        close(listener);
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        connect(fd, (struct sockaddr *)&listen_addr, sizeof listen_addr);
+        peer(fd, bytes);
+        close(fd);
+        exit(0);
+    }
+
+    return accept(listener, NULL, NULL);
+}
+
+static void finish_pair(int fd){
+    close(fd);
+    wait(NULL);
+}
+
+// peers
+static void peer_drain(int fd, long bytes){
+    static unsigned char buf[1 << 20];
+    long total = 0;
+    while (total < bytes){
+        long rv = recv(fd, buf, sizeof buf, 0);
+        if (rv <= 0) break;
+        total += rv;
+    }
+    send(fd, "k", 1, 0);
+}
+
+static void peer_sendfile(int fd, long bytes){
+    int src = open(SRC_FILE, O_RDONLY);
+    off_t off = 0;
+    send_file_range(fd, src, &off, bytes);
+    close(src);
+}
+
+// send side
+static void send_buffered(int sockfd, long bytes){
+    unsigned char sdbuf[MAXBUFSIZE];
+    FILE *fs = fopen(SRC_FILE, "rb");
+    int n;
+
+    memset(sdbuf, 0, MAXBUFSIZE);
+    while ((n = fread(sdbuf, 1, MAXBUFSIZE, fs)) > 0){
+        send(sockfd, sdbuf, n, 0);
+        memset(sdbuf, 0, MAXBUFSIZE);
+    }
+    fclose(fs);
+}
+
+static void send_zero_copy(int sockfd, long bytes){
+    int src = open(SRC_FILE, O_RDONLY);
+    off_t off = 0;
+    send_file_range(sockfd, src, &off, bytes);
+    close(src);
+}
+
+static void bench_send(const char *name, void (*fn)(int, long), long bytes){
+    char ack;
+    int fd = open_pair(peer_drain, bytes);
+
+    double t0 = now_s();
+    fn(fd, bytes);
+    recv(fd, &ack, 1, MSG_WAITALL);
+    report(name, bytes, now_s() - t0);
+
+    finish_pair(fd);
+}
+
+// receive side
+static void recv_fopen_per_chunk(int sockfd, long bytes){
+    unsigned char buf[MAXBUFSIZE];
+    long total = 0;
+
+    fclose(fopen(DST_FILE, "wb"));
+    while (total < bytes){
+        long rv = read(sockfd, buf, MAXBUFSIZE);
+        if (rv <= 0) break;
+        FILE *f = fopen(DST_FILE, "ab");
+        fwrite(buf, 1, rv, f);
+        fclose(f);
+        total += rv;
+    }
+}
+
+static void recv_read_write(int sockfd, long bytes){
+    static unsigned char buf[1 << 16];
+    int fd = open(DST_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    long total = 0;
+
+    while (total < bytes){
+        long rv = read(sockfd, buf, sizeof buf);
+        if (rv <= 0) break;
+        write(fd, buf, rv);
+        total += rv;
+    }
+    close(fd);
+}
+
+static void recv_engine(int sockfd, long bytes){
+    int fd = open_recv_file(DST_FILE, bytes);
+
+    if (receive_file_body(sockfd, fd, bytes) != bytes) printf("  receive_file_body came up short\n");
+    close(fd);
+}
+
+static void bench_recv(const char *name, void (*fn)(int, long), long bytes){
+    int fd = open_pair(peer_sendfile, bytes);
+
+    double t0 = now_s();
+    fn(fd, bytes);
+    report(name, bytes, now_s() - t0);
+
+    finish_pair(fd);
+}
+
+int main(int argc, char **argv){
+    long mb = 1024;
+    if (argc == 2) mb = atol(argv[1]);
+    long bytes = mb << 20;
+
+    listener = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&listen_addr, 0, sizeof listen_addr);
+    listen_addr.sin_family = AF_INET;
+    listen_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof listen_addr;
+    bind(listener, (struct sockaddr *)&listen_addr, len);
+    getsockname(listener, (struct sockaddr *)&listen_addr, &len);
+    listen(listener, 4);
+
+    printf("%ld MB over loopback\n\n", mb);
+    make_source(bytes);
+
+    bench_send("send  buffered 4KB", send_buffered, bytes);
+    bench_send("send  sendfile", send_zero_copy, bytes);
+
+    bench_recv("recv  fopen/4KB", recv_fopen_per_chunk, bytes);
+    bench_recv("recv  read/write 64KB", recv_read_write, bytes);
+    bench_recv("recv  engine", recv_engine, bytes);
+
+    remove(SRC_FILE);
+    remove(DST_FILE);
+    return 0;
+}
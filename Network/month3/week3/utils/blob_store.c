@@ -0,0 +1,715 @@
+/*
+ * blob_store.c -- deduplicated, content-addressed storage for job inputs and results
+ *
+ * Every file the server keeps is a blob named by the SHA-256 of its contents, so a thousand
+ * uploads of the same image are stored once and shared through reference counts. Blobs of up
+ * to BLOB_SMALL_MAX bytes are appended to pack files instead of getting an inode each; larger
+ * ones are standalone files under BLOB_DIR. When the last reference goes, a standalone blob's
+ * file is unlinked and a packed blob just counts as dead space in its pack.
+ *
+ * A sealed pack that is mostly dead is rewritten by the compactor thread: it copies the pack's
+ * live blobs into a new pack while the event loop carries on reading the old one, then signals
+ * done_fd, and blob_store_reap() repoints the blobs and deletes the old file. Unlinks of large
+ * files go through the same thread, so nothing on the event loop waits on the filesystem to free
+ * extents. The index and every Blob are only ever touched by the main thread.
+ *
+ * Each packed blob is preceded by a [key 32][size 8] header, so the index can be rebuilt from
+ * the packs and BLOB_DIR alone when the server restarts on top of its old storage.
+ */
+
+#define _GNU_SOURCE
+#include "./blob_store.h"
+
+#include <ctype.h>
+
+#define BLOB_COPY_BUF (1 << 16)
+
+static struct Blob *find_blob(struct BlobStore *store, const unsigned char *key){
+    struct HashLRUNode *node = hash_lru_find(&store->index, key);
+    return node != NULL ? hash_lru_entry(node, struct Blob, node) : NULL;
+}
+
+/*
+ * pack_push() / pack_remove() -- keep a pack's blob list in sync with where blobs live
+ */
+static void pack_push(struct Pack *pack, struct Blob *blob){
+    blob->pack_prev = NULL;
+    blob->pack_next = pack->blobs;
+    if (pack->blobs != NULL) pack->blobs->pack_prev = blob;
+    pack->blobs = blob;
+}
+
+static void pack_remove(struct Pack *pack, struct Blob *blob){
+    if (blob->pack_prev != NULL) blob->pack_prev->pack_next = blob->pack_next;
+    else pack->blobs = blob->pack_next;
+
+    if (blob->pack_next != NULL) blob->pack_next->pack_prev = blob->pack_prev;
+}
+
+static void pack_header(unsigned char *buf, const unsigned char *key, long size){
+    memcpy(buf, key, SHA256_LEN);
+    packi64(buf + SHA256_LEN, size);
+}
+
+static void pack_path(int id, char path[MAXFILEPATH]){
+    snprintf(path, MAXFILEPATH, "%s/pack-%d", PACK_DIR, id);
+}
+
+static void standalone_path(const unsigned char *key, char path[MAXFILEPATH]){
+    char hex[SHA256_LEN * 2 + 1];
+    sha256_hex(key, hex);
+    snprintf(path, MAXFILEPATH, "%s/%s", BLOB_DIR, hex);
+}
+
+/*
+ * new_pack() -- allocate the next pack id (growing the table) and its empty Pack
+ */
+static struct Pack *new_pack(struct BlobStore *store){
+    if (store->next_pack >= store->packs_cap){
+        int cap = store->packs_cap * 2;
+        store->packs = realloc(store->packs, cap * sizeof *store->packs);
+        memset(store->packs + store->packs_cap, 0, (cap - store->packs_cap) * sizeof *store->packs);
+        store->packs_cap = cap;
+    }
+
+    struct Pack *pack = calloc(1, sizeof *pack);
+    pack->id = store->next_pack++;
+    store->packs[pack->id] = pack;
+    return pack;
+}
+
+/*
+ * queue_task() -- hand a task to the compactor thread
+ */
+static void queue_task(struct BlobStore *store, struct BlobTask *task){
+    task->next = NULL;
+
+    pthread_mutex_lock(&store->lock);
+    if (store->todo_tail != NULL) store->todo_tail->next = task;
+    else store->todo_head = task;
+    store->todo_tail = task;
+    pthread_cond_signal(&store->wake);
+    pthread_mutex_unlock(&store->lock);
+}
+
+static void queue_unlink(struct BlobStore *store, char *path){
+    struct BlobTask *task = calloc(1, sizeof *task);
+    task->type = BLOB_TASK_UNLINK;
+    snprintf(task->path, MAXFILEPATH, "%s", path);
+    queue_task(store, task);
+}
+
+/*
+ * drop_pack() -- forget a pack and have its file deleted in the background
+ */
+static void drop_pack(struct BlobStore *store, struct Pack *pack){
+    char path[MAXFILEPATH];
+    pack_path(pack->id, path);
+    queue_unlink(store, path);
+
+    store->packs[pack->id] = NULL;
+    free(pack);
+}
+
+/*
+ * maybe_compact() -- queue a rewrite of a sealed pack once at least BLOB_COMPACT_PCT of it is dead
+ *
+ * A pack with nothing alive is simply deleted. Otherwise the live blobs' offsets are snapshotted
+ * into the task and a placeholder pack is reserved for the copy. One compaction runs at a time.
+ */
+static void maybe_compact(struct BlobStore *store, struct Pack *pack){
+    if (store->compacting || pack->compacting || !pack->sealed) return;
+    if (pack->dead_bytes * 100 < pack->bytes * BLOB_COMPACT_PCT) return;
+
+    if (pack->blobs == NULL){
+        drop_pack(store, pack);
+        return;
+    }
+
+    int count = 0;
+    for (struct Blob *b = pack->blobs; b != NULL; b = b->pack_next) count++;
+
+    struct BlobTask *task = calloc(1, sizeof *task);
+    task->type = BLOB_TASK_COMPACT;
+    task->src_id = pack->id;
+    task->count = count;
+    task->blobs = malloc(count * sizeof *task->blobs);
+    task->src_offs = malloc(count * sizeof *task->src_offs);
+    task->lens = malloc(count * sizeof *task->lens);
+    task->dst_offs = malloc(count * sizeof *task->dst_offs);
+
+    // whole records, header included
+    int i = 0;
+    for (struct Blob *b = pack->blobs; b != NULL; b = b->pack_next, i++){
+        task->blobs[i] = b;
+        task->src_offs[i] = b->offset - BLOB_PACK_HEADER;
+        task->lens[i] = b->size + BLOB_PACK_HEADER;
+    }
+
+    struct Pack *dst = new_pack(store);
+    dst->sealed = 1;
+    dst->compacting = 1;
+    task->dst_id = dst->id;
+
+    pack->compacting = 1;
+    store->compacting = 1;
+    queue_task(store, task);
+}
+
+/*
+ * seal_active() -- stop appending to the active pack; the next small blob starts a new one
+ */
+static void seal_active(struct BlobStore *store){
+    struct Pack *pack = store->packs[store->active];
+    close(store->active_fd);
+    store->active_fd = -1;
+    store->active = -1;
+
+    pack->sealed = 1;
+    maybe_compact(store, pack);
+}
+
+/*
+ * pack_append() -- copy a small file, behind its header, to the end of the active pack
+ */
+static int pack_append(struct BlobStore *store, struct Blob *blob, char *path){
+    unsigned char buf[BLOB_PACK_HEADER + (BLOB_SMALL_MAX > 0 ? BLOB_SMALL_MAX : 1)];
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return -1;
+    long n = read(fd, buf + BLOB_PACK_HEADER, blob->size);
+    close(fd);
+    if (n != blob->size) return -1;
+
+    pack_header(buf, blob->key, blob->size);
+    n += BLOB_PACK_HEADER;
+
+    if (store->active == -1){
+        struct Pack *pack = new_pack(store);
+        char ppath[MAXFILEPATH];
+        pack_path(pack->id, ppath);
+
+        store->active_fd = open(ppath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (store->active_fd == -1){
+            perror("blob store: pack");
+            store->packs[pack->id] = NULL;
+            free(pack);
+            return -1;
+        }
+        store->active = pack->id;
+    }
+
+    struct Pack *pack = store->packs[store->active];
+    for (long done = 0; done < n; ){
+        long w = pwrite(store->active_fd, buf + done, n - done, pack->bytes + done);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return -1;
+        done += w;
+    }
+
+    blob->pack_id = pack->id;
+    blob->offset = pack->bytes + BLOB_PACK_HEADER;
+    pack->bytes += n;
+    pack_push(pack, blob);
+
+    if (pack->bytes >= BLOB_PACK_BYTES) seal_active(store);
+    return 1;
+}
+
+/*
+ * hash_file() -- SHA-256 of a file's contents
+ */
+static int hash_file(char *path, unsigned char key[SHA256_LEN]){
+    static unsigned char buf[BLOB_COPY_BUF];
+    struct Sha256 ctx;
+    long n;
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return -1;
+
+    sha256_init(&ctx);
+    while ((n = read(fd, buf, sizeof buf)) > 0) sha256_update(&ctx, buf, n);
+    close(fd);
+
+    if (n < 0) return -1;
+    sha256_final(&ctx, key);
+    return 1;
+}
+
+/*
+ * copy_range() -- copy len bytes between two files, in the kernel when it can
+ */
+static int copy_range(int src, off_t src_off, int dst, off_t dst_off, long len){
+    static __thread unsigned char buf[BLOB_COPY_BUF];
+
+    while (len > 0 && ZERO_COPY){
+        long n = copy_file_range(src, &src_off, dst, &dst_off, len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP)) break;
+        if (n <= 0) return -1;
+        len -= n;
+    }
+
+    while (len > 0){
+        long n = pread(src, buf, len < (long)sizeof buf ? len : (long)sizeof buf, src_off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+
+        for (long done = 0; done < n; ){
+            long w = pwrite(dst, buf + done, n - done, dst_off + done);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) return -1;
+            done += w;
+        }
+        src_off += n;
+        dst_off += n;
+        len -= n;
+    }
+
+    return 1;
+}
+
+/*
+ * run_compaction() -- copy the task's records back to back into the destination pack (compactor thread)
+ *
+ * The copy is flushed to disk before it's reported done, since the old pack is deleted right after.
+ */
+static void run_compaction(struct BlobTask *task){
+    char src_path[MAXFILEPATH], dst_path[MAXFILEPATH];
+    pack_path(task->src_id, src_path);
+    pack_path(task->dst_id, dst_path);
+
+    int src = open(src_path, O_RDONLY);
+    int dst = open(dst_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    off_t dst_off = 0;
+
+    task->failed = src == -1 || dst == -1;
+    for (int i = 0; i < task->count && !task->failed; i++){
+        task->dst_offs[i] = dst_off;
+        if (copy_range(src, task->src_offs[i], dst, dst_off, task->lens[i]) == -1) task->failed = 1;
+        dst_off += task->lens[i];
+    }
+    if (!task->failed && fdatasync(dst) == -1) task->failed = 1;
+
+    if (src != -1) close(src);
+    if (dst != -1) close(dst);
+}
+
+/*
+ * compactor_main() -- background thread: delete files and rewrite packs as tasks come in
+ */
+static void *compactor_main(void *arg){
+    struct BlobStore *store = arg;
+    uint64_t one = 1;
+
+    while (1){
+        pthread_mutex_lock(&store->lock);
+        while (store->todo_head == NULL) pthread_cond_wait(&store->wake, &store->lock);
+
+        struct BlobTask *task = store->todo_head;
+        store->todo_head = task->next;
+        if (store->todo_head == NULL) store->todo_tail = NULL;
+        pthread_mutex_unlock(&store->lock);
+
+        if (task->type == BLOB_TASK_UNLINK){
+            unlink(task->path);
+            free(task);
+            continue;
+        }
+
+        run_compaction(task);
+
+        pthread_mutex_lock(&store->lock);
+        task->next = store->done;
+        store->done = task;
+        pthread_mutex_unlock(&store->lock);
+
+        if (write(store->done_fd, &one, sizeof one) != sizeof one) perror("blob store: eventfd");
+    }
+
+    return NULL;
+}
+
+/*
+ * clear_dir() -- make sure dir exists and holds nothing from a previous run
+ */
+static void clear_dir(char *dir){
+    char path[MAXFILEPATH + 256];
+
+    mkdir(dir, 0755);
+    DIR *d = opendir(dir);
+    if (d == NULL) return;
+
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL){
+        if (ent->d_name[0] == '.') continue;
+        snprintf(path, sizeof path, "%s/%s", dir, ent->d_name);
+        unlink(path);
+    }
+    closedir(d);
+}
+
+/*
+ * hex_key() -- parse a standalone blob's file name back into its key. Returns -1 if it isn't one
+ */
+static int hex_key(const char *name, unsigned char key[SHA256_LEN]){
+    if (strlen(name) != SHA256_LEN * 2) return -1;
+
+    for (int i = 0; i < SHA256_LEN; i++){
+        unsigned int byte;
+        if (!isxdigit((unsigned char)name[2*i]) || !isxdigit((unsigned char)name[2*i+1])) return -1;
+        if (sscanf(name + 2*i, "%2x", &byte) != 1) return -1;
+        key[i] = byte;
+    }
+    return 1;
+}
+
+/*
+ * recover_blob() -- index a blob found on disk with no references; a second copy of a known key is just dead space
+ */
+static int recover_blob(struct BlobStore *store, unsigned char *key, long size, struct Pack *pack, off_t offset){
+    if (find_blob(store, key) != NULL) return 0;
+
+    struct Blob *blob = calloc(1, sizeof *blob);
+    memcpy(blob->key, key, SHA256_LEN);
+    blob->size = size;
+    blob->pack_id = pack != NULL ? pack->id : -1;
+    blob->offset = offset;
+    if (pack != NULL) pack_push(pack, blob);
+
+    hash_lru_insert(&store->index, &blob->node, blob->key);
+    store->bytes += size;
+    return 1;
+}
+
+/*
+ * recover_pack() -- walk a pack's record headers, stopping at the first one a crash left incomplete
+ */
+static void recover_pack(struct BlobStore *store, int id){
+    unsigned char hdr[BLOB_PACK_HEADER];
+    char path[MAXFILEPATH];
+    struct stat st;
+
+    pack_path(id, path);
+    int fd = open(path, O_RDONLY);
+    if (fd == -1 || fstat(fd, &st) == -1){
+        if (fd != -1) close(fd);
+        return;
+    }
+
+    while (store->next_pack <= id) new_pack(store);
+    struct Pack *pack = store->packs[id];
+    pack->sealed = 1;
+
+    off_t pos = 0;
+    while (pos + BLOB_PACK_HEADER <= st.st_size && pread(fd, hdr, BLOB_PACK_HEADER, pos) == BLOB_PACK_HEADER){
+        long size = unpacki64(hdr + SHA256_LEN);
+        if (size < 0 || size > BLOB_SMALL_MAX || pos + BLOB_PACK_HEADER + size > st.st_size) break;
+
+        if (!recover_blob(store, hdr, size, pack, pos + BLOB_PACK_HEADER)) pack->dead_bytes += BLOB_PACK_HEADER + size;
+        pos += BLOB_PACK_HEADER + size;
+    }
+    pack->bytes = pos;
+    close(fd);
+}
+
+/*
+ * recover_blobs() -- rebuild the index from PACK_DIR and BLOB_DIR, leaving out anything half-written
+ *
+ * Packs are read in id order, so when a crash interrupted a compaction the original pack's copy
+ * of each blob is the one indexed and the partial copy is all dead space.
+ */
+static void recover_blobs(struct BlobStore *store){
+    char path[MAXFILEPATH + 256];
+    unsigned char key[SHA256_LEN];
+    struct dirent *ent;
+    struct stat st;
+    int id, max_id = -1;
+
+    mkdir(PACK_DIR, 0755);
+    mkdir(BLOB_DIR, 0755);
+
+    DIR *d = opendir(PACK_DIR);
+    while (d != NULL && (ent = readdir(d)) != NULL){
+        if (sscanf(ent->d_name, "pack-%d", &id) == 1 && id > max_id) max_id = id;
+    }
+    if (d != NULL) closedir(d);
+
+    for (id = 0; id <= max_id; id++) recover_pack(store, id);
+    for (id = 0; id < store->next_pack; id++){
+        if (store->packs[id] != NULL && store->packs[id]->bytes == 0 && store->packs[id]->blobs == NULL) drop_pack(store, store->packs[id]);
+    }
+
+    d = opendir(BLOB_DIR);
+    while (d != NULL && (ent = readdir(d)) != NULL){
+        if (ent->d_name[0] == '.') continue;
+        snprintf(path, sizeof path, "%s/%s", BLOB_DIR, ent->d_name);
+
+        if (hex_key(ent->d_name, key) == -1 || stat(path, &st) == -1){
+            unlink(path);
+            continue;
+        }
+        recover_blob(store, key, st.st_size, NULL, 0);
+    }
+    if (d != NULL) closedir(d);
+
+    printf("blob store: recovered %d blobs (%ld bytes) in %d packs + standalone\n", store->index.count, store->bytes, store->next_pack);
+}
+
+/*
+ * create_blob_store() -- index (empty, or rebuilt from disk), staging emptied, compactor thread running
+ */
+struct BlobStore *create_blob_store(int recover){
+    struct BlobStore *store = calloc(1, sizeof *store);
+    hash_lru_init(&store->index, BLOB_MIN_BUCKETS);
+
+    store->packs_cap = 16;
+    store->packs = calloc(store->packs_cap, sizeof *store->packs);
+    store->active = -1;
+    store->active_fd = -1;
+
+    pthread_mutex_init(&store->lock, NULL);
+    pthread_cond_init(&store->wake, NULL);
+    store->done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    pthread_create(&store->compactor, NULL, compactor_main, store);
+    pthread_detach(store->compactor);
+
+    // without recovery, whatever a previous run left could never be found again
+    clear_dir(STAGING_DIR);
+    if (recover){
+        store->recovering = 1;
+        recover_blobs(store);
+    } else {
+        clear_dir(BLOB_DIR);
+        clear_dir(PACK_DIR);
+    }
+    return store;
+}
+
+/*
+ * blob_put_file() -- store a finished file under its content hash
+ *
+ * A duplicate only costs a reference: the new copy is deleted (in the background if it's big).
+ * Otherwise small files are appended to the active pack and big ones renamed into BLOB_DIR.
+ */
+struct Blob *blob_put_file(struct BlobStore *store, char *path, unsigned char *key){
+    unsigned char digest[SHA256_LEN];
+    struct stat st;
+
+    if (stat(path, &st) == -1) return NULL;
+    if (key == NULL){
+        if (hash_file(path, digest) == -1){
+            remove(path);
+            return NULL;
+        }
+        key = digest;
+    }
+
+    struct Blob *blob = find_blob(store, key);
+    if (blob != NULL){
+        blob->refs++;
+        store->dedup_hits++;
+        if (st.st_size <= BLOB_SMALL_MAX) remove(path);
+        else queue_unlink(store, path);
+        return blob;
+    }
+
+    blob = calloc(1, sizeof *blob);
+    memcpy(blob->key, key, SHA256_LEN);
+    blob->size = st.st_size;
+    blob->refs = 1;
+
+    if (blob->size <= BLOB_SMALL_MAX){
+        int rv = pack_append(store, blob, path);
+        remove(path);
+        if (rv == -1){
+            free(blob);
+            return NULL;
+        }
+    } else {
+        char dest[MAXFILEPATH];
+        standalone_path(key, dest);
+        blob->pack_id = -1;
+
+        if (rename(path, dest) == -1){
+            perror("blob store: rename");
+            remove(path);
+            free(blob);
+            return NULL;
+        }
+    }
+
+    hash_lru_insert(&store->index, &blob->node, blob->key);
+    store->bytes += blob->size;
+    return blob;
+}
+
+struct Blob *blob_get(struct BlobStore *store, unsigned char *key){
+    struct Blob *blob = find_blob(store, key);
+    if (blob != NULL) blob->refs++;
+    return blob;
+}
+
+/*
+ * blob_store_recovered() -- reclaim the blobs recovery found no owner for, then let compaction look at every pack
+ */
+void blob_store_recovered(struct BlobStore *store){
+    store->recovering = 0;
+
+    int n = 0;
+    struct Blob **orphans = malloc((store->index.count + 1) * sizeof *orphans);
+    for (struct HashLRUNode *node = store->index.lru_head; node != NULL; node = node->lru_next){
+        struct Blob *b = hash_lru_entry(node, struct Blob, node);
+        if (b->refs == 0) orphans[n++] = b;
+    }
+
+    for (int i = 0; i < n; i++){
+        orphans[i]->refs = 1;
+        blob_unref(store, orphans[i]);
+    }
+    free(orphans);
+
+    for (int i = 0; i < store->next_pack; i++){
+        if (store->packs[i] != NULL) maybe_compact(store, store->packs[i]);
+    }
+    if (n > 0) printf("blob store: reclaimed %d unreferenced blobs\n", n);
+}
+
+void blob_ref(struct Blob *blob){
+    blob->refs++;
+}
+
+/*
+ * blob_unref() -- release a reference, reclaiming the blob when it was the last
+ *
+ * A blob in a pack that's being compacted stays on the pack's list (with no references) until
+ * blob_store_reap() settles the compaction, because the finished task still points at it.
+ */
+void blob_unref(struct BlobStore *store, struct Blob *blob){
+    if (blob == NULL || --blob->refs > 0) return;
+    if (store->recovering) return; // blob_store_recovered() settles it once every reference is known
+
+    hash_lru_remove(&store->index, &blob->node);
+    store->bytes -= blob->size;
+
+    if (blob->pack_id == -1){
+        char path[MAXFILEPATH];
+        standalone_path(blob->key, path);
+        queue_unlink(store, path);
+        free(blob);
+        return;
+    }
+
+    struct Pack *pack = store->packs[blob->pack_id];
+    pack->dead_bytes += blob->size + BLOB_PACK_HEADER;
+    if (!pack->compacting){
+        pack_remove(pack, blob);
+        free(blob);
+    }
+    maybe_compact(store, pack);
+}
+
+/*
+ * blob_open() -- open the standalone file or pack holding the blob
+ *
+ * The fd stays valid even if a compaction deletes the pack while it's being read.
+ */
+int blob_open(struct Blob *blob, off_t *offset){
+    char path[MAXFILEPATH];
+    blob_path(blob, path);
+
+    *offset = blob->pack_id == -1 ? 0 : blob->offset;
+    return open(path, O_RDONLY);
+}
+
+void blob_path(struct Blob *blob, char path[MAXFILEPATH]){
+    if (blob->pack_id == -1) standalone_path(blob->key, path);
+    else pack_path(blob->pack_id, path);
+}
+
+/*
+ * blob_store_reap() -- settle finished compactions
+ *
+ * Live blobs move to the new pack; blobs that died while the copy ran are freed and counted as
+ * dead space there. The old pack is then deleted. If the copy failed, the old pack stays as it was.
+ */
+void blob_store_reap(struct BlobStore *store){
+    uint64_t n;
+    if (read(store->done_fd, &n, sizeof n) != sizeof n) return;
+
+    pthread_mutex_lock(&store->lock);
+    struct BlobTask *task = store->done;
+    store->done = NULL;
+    pthread_mutex_unlock(&store->lock);
+
+    int rescan = 0;
+    while (task != NULL){
+        struct BlobTask *next = task->next;
+        struct Pack *src = store->packs[task->src_id];
+        struct Pack *dst = store->packs[task->dst_id];
+
+        if (task->failed){
+            fprintf(stderr, "blob store: compacting pack %d failed, keeping it\n", src->id);
+            drop_pack(store, dst);
+            src->compacting = 0;
+
+            for (int i = 0; i < task->count; i++){
+                if (task->blobs[i]->refs > 0) continue;
+                pack_remove(src, task->blobs[i]);
+                free(task->blobs[i]);
+            }
+        } else {
+            for (int i = 0; i < task->count; i++){
+                struct Blob *b = task->blobs[i];
+                pack_remove(src, b);
+
+                if (b->refs == 0){
+                    dst->dead_bytes += task->lens[i];
+                    free(b);
+                    continue;
+                }
+                b->pack_id = dst->id;
+                b->offset = task->dst_offs[i] + BLOB_PACK_HEADER;
+                pack_push(dst, b);
+            }
+
+            dst->bytes = task->count > 0 ? task->dst_offs[task->count - 1] + task->lens[task->count - 1] : 0;
+            dst->compacting = 0;
+            printf("blob store: pack %d compacted into pack %d (%ld -> %ld bytes)\n", src->id, dst->id, src->bytes, dst->bytes);
+            drop_pack(store, src);
+            rescan = 1;
+        }
+
+        store->compacting = 0;
+        free(task->blobs);
+        free(task->src_offs);
+        free(task->lens);
+        free(task->dst_offs);
+        free(task);
+        task = next;
+    }
+
+    // packs that crossed the threshold while this one ran were skipped; pick the next one up
+    for (int i = 0; rescan && i < store->next_pack && !store->compacting; i++){
+        if (store->packs[i] != NULL) maybe_compact(store, store->packs[i]);
+    }
+}
+
+/*
+ * print_blob_store() -- blob totals, then each pack's size and dead space
+ */
+void print_blob_store(struct BlobStore *store){
+    printf("\n\n===== BLOB STORE =====\n\n");
+    printf("Blobs: %d (%ld bytes)\n", store->index.count, store->bytes);
+    printf("Dedup Hits: %ld\n", store->dedup_hits);
+
+    for (int i = 0; i < store->next_pack; i++){
+        struct Pack *pack = store->packs[i];
+        if (pack == NULL) continue;
+        printf("  pack %d: %ld bytes, %ld dead%s%s\n", pack->id, pack->bytes, pack->dead_bytes,
+               pack->sealed ? "" : " (active)", pack->compacting ? " (compacting)" : "");
+    }
+
+    printf("\n======================\n\n");
+}
@@ -0,0 +1,191 @@
+/*
+ * blob_store.h -- deduplicated, content-addressed storage for job inputs and results
+ */
+
+#ifndef BLOB_STORE_H
+#define BLOB_STORE_H
+
+#include "../common.h"
+#include "./sha256.h"
+#include "./buffer_manipulation.h"
+#include "./hash_lru.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+
+#define BLOB_MIN_BUCKETS 64
+#define BLOB_PACK_HEADER (SHA256_LEN + 8)  // [key 32][size 8] before each packed blob
+
+#define BLOB_TASK_UNLINK 0
+#define BLOB_TASK_COMPACT 1
+
+/*
+ * Blob -- one stored file, shared by every job (or cache entry) whose bytes hash to key
+ *
+ * key -- SHA-256 of the contents
+ * size -- length in bytes
+ * refs -- references held by jobs and the result cache; the blob is reclaimed when this hits 0
+ * pack_id -- pack file holding the bytes, -1 for a standalone file under BLOB_DIR
+ * offset -- where the bytes start in the pack, just past their header (0 for standalone blobs)
+ * node -- the blob's place in the store's index
+ * *pack_prev, *pack_next -- neighbours in the pack's list of blobs
+ */
+struct Blob {
+    unsigned char key[SHA256_LEN];
+    long size;
+    int refs;
+
+    int pack_id;
+    off_t offset;
+
+    struct HashLRUNode node;
+    struct Blob *pack_prev;
+    struct Blob *pack_next;
+};
+
+/*
+ * Pack -- append-only file of small blobs
+ *
+ * bytes -- bytes written to the pack so far, headers included
+ * dead_bytes -- bytes (with headers) belonging to blobs nobody references any more
+ * sealed -- set once the pack reached BLOB_PACK_BYTES; only sealed packs are appended to no more and can be compacted
+ * compacting -- set while the compactor is copying its live blobs out; blobs dying meanwhile stay on the list until it's done
+ * *blobs -- blobs stored in the pack
+ */
+struct Pack {
+    int id;
+    long bytes;
+    long dead_bytes;
+    int sealed;
+    int compacting;
+    struct Blob *blobs;
+};
+
+/*
+ * BlobTask -- work handed to the compactor thread
+ *
+ * type -- BLOB_TASK_UNLINK (delete path) or BLOB_TASK_COMPACT (copy live blobs of one pack into a new one)
+ * path -- file to delete
+ * src_id, dst_id -- pack being compacted and the pack it's rewritten into
+ * count, **blobs, *src_offs, *lens -- the live blobs' records (header + bytes) when the task was queued; the thread only reads the offsets, never the blobs
+ * *dst_offs -- where the thread put each record
+ * failed -- set by the thread if the copy didn't complete
+ */
+struct BlobTask {
+    int type;
+    char path[MAXFILEPATH];
+
+    int src_id;
+    int dst_id;
+    int count;
+    struct Blob **blobs;
+    off_t *src_offs;
+    long *lens;
+    off_t *dst_offs;
+    int failed;
+
+    struct BlobTask *next;
+};
+
+/*
+ * BlobStore -- blob index, pack files and the background compactor
+ *
+ * index -- blobs by key; index.count is the number of blobs. Recency isn't used, the list just walks every blob
+ * bytes -- total size of live blobs
+ * dedup_hits -- puts that found their content already stored
+ *
+ * **packs, packs_cap, next_pack -- packs by id (NULL once deleted)
+ * active, active_fd -- pack small blobs are appended to
+ * compacting -- set while a compaction is queued or running (one at a time)
+ * recovering -- set between create_blob_store(1) and blob_store_recovered(); blobs aren't reclaimed meanwhile
+ *
+ * compactor, lock, wake -- background thread and its task queue
+ * *todo_head, *todo_tail -- tasks waiting for the thread
+ * *done -- finished compactions, applied by blob_store_reap() on the main thread
+ * done_fd -- eventfd, readable when there's something in done
+ */
+struct BlobStore {
+    struct HashLRU index;
+    long bytes;
+    long dedup_hits;
+
+    struct Pack **packs;
+    int packs_cap;
+    int next_pack;
+    int active;
+    int active_fd;
+    int compacting;
+    int recovering;
+
+    pthread_t compactor;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    struct BlobTask *todo_head;
+    struct BlobTask *todo_tail;
+    struct BlobTask *done;
+    int done_fd;
+};
+
+/*
+ * create_blob_store() -- create the store and start the compactor. STAGING_DIR is always emptied; BLOB_DIR/PACK_DIR are
+ * wiped too unless recover is set, in which case their blobs are indexed with no references until blob_store_recovered()
+ */
+struct BlobStore *create_blob_store(int recover);
+
+/*
+ * blob_put_file() -- move the file at path into the store and return its blob with one reference taken for the caller.
+ * key is the contents' SHA-256 if the caller already has it, NULL to hash the file here.
+ * path is consumed either way (moved, packed, or deleted as a duplicate). Returns NULL if the file couldn't be stored
+ */
+struct Blob *blob_put_file(struct BlobStore *store, char *path, unsigned char *key);
+
+/*
+ * blob_get() -- look up a stored blob by key and take a reference to it. NULL if there's no such blob
+ */
+struct Blob *blob_get(struct BlobStore *store, unsigned char *key);
+
+/*
+ * blob_store_recovered() -- end recovery: reclaim every blob that nothing took a reference to
+ */
+void blob_store_recovered(struct BlobStore *store);
+
+/*
+ * blob_ref() -- take another reference to a blob
+ */
+void blob_ref(struct Blob *blob);
+
+/*
+ * blob_unref() -- drop a reference; the last one frees the blob's space (in the background for standalone files and packs)
+ */
+void blob_unref(struct BlobStore *store, struct Blob *blob);
+
+/*
+ * blob_open() -- open the file holding the blob's bytes read-only and set *offset to where they start. Returns the fd (caller closes) or -1
+ */
+int blob_open(struct Blob *blob, off_t *offset);
+
+/*
+ * blob_path() -- the file (standalone blob or pack) holding the blob's bytes
+ */
+void blob_path(struct Blob *blob, char path[MAXFILEPATH]);
+
+/*
+ * blob_store_reap() -- apply finished compactions; call when done_fd is readable
+ */
+void blob_store_reap(struct BlobStore *store);
+
+/*
+ * print_blob_store() -- print blob and pack usage
+ */
+void print_blob_store(struct BlobStore *store);
+
+#endif
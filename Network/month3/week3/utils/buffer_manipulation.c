@@ -45,7 +45,7 @@ int unpacki32(unsigned char *buf){
 
     //change unsigned numbers to signed
     if (i2 <= 0x7fffffffu) {i = i2; }
-    else {i = -1 - (0x7fffffff - i2);}
+    else {i = -1 - (int)(0xffffffffu - i2);}
 
     return i;
 }
@@ -56,7 +56,7 @@ long int unpacki64(unsigned char *buf){
 
     //change unsigned numbers to signed
     if (i2 <= 0x7fffffffffffffffUL) {i = i2; }
-    else {i = -1 - (0x7fffffffffffffffL - i2);}
+    else {i = -1 - (long int)(0xffffffffffffffffUL - i2);}
 
     return i;
 }
@@ -0,0 +1,183 @@
+/*
+ * client_conn.c -- non-blocking I/O helpers for the server's client connections
+ *
+ * Every client socket lives in the server's main epoll set. Each readiness event moves a
+ * connection forward by at most one read or one batch of sends, so a slow uploader only ever
+ * costs the event loop one syscall at a time instead of blocking it until the file is in.
+ * The protocol decisions (what each state means) live in server.c; this file only moves bytes.
+ */
+
+#include "./client_conn.h"
+
+/*
+ * create_client_conns() -- allocate an empty fd-indexed connection table
+ */
+struct ClientConns *create_client_conns(){
+    struct ClientConns *conns = malloc(sizeof *conns);
+    conns->cap = CONNS_MIN_CAP;
+    conns->by_fd = calloc(conns->cap, sizeof *conns->by_fd);
+    conns->count = 0;
+
+    return conns;
+}
+
+/*
+ * add_client_conn() -- allocate a connection for fd, growing the table if needed
+ */
+struct ClientConn *add_client_conn(struct ClientConns *conns, int fd, struct sockaddr_in *addr){
+    if (fd >= conns->cap){
+        int new_cap = conns->cap * 2;
+        while (new_cap <= fd) new_cap *= 2;
+
+        conns->by_fd = realloc(conns->by_fd, new_cap * sizeof *conns->by_fd);
+        memset(conns->by_fd + conns->cap, 0, (new_cap - conns->cap) * sizeof *conns->by_fd);
+        conns->cap = new_cap;
+    }
+
+    struct ClientConn *conn = malloc(sizeof *conn);
+    conn->fd = fd;
+    conn->cmd_type = -1;
+    conn->addr = *addr;
+    conn->job = NULL;
+    conn->file_fd = -1;
+    conn->file_off = 0;
+    conn->file_remaining = 0;
+    conn->hashing = 0;
+    conn->out_len = 0;
+    conn->out_sent = 0;
+    conn->commit_lsn = 0;
+    conn->send_fd = -1;
+    conn->send_off = 0;
+    conn->send_remaining = 0;
+    conn_expect(conn, CONN_HEADER, 4);
+
+    conns->by_fd[fd] = conn;
+    conns->count++;
+    return conn;
+}
+
+/*
+ * get_client_conn() -- look up a connection by fd
+ */
+struct ClientConn *get_client_conn(struct ClientConns *conns, int fd){
+    if (fd < 0 || fd >= conns->cap) return NULL;
+    return conns->by_fd[fd];
+}
+
+/*
+ * remove_client_conn() -- tear down a connection, wherever it is in the protocol
+ *
+ * A half-uploaded job never made it into the jobs table, so its file is deleted and the job freed here.
+ */
+void remove_client_conn(struct ClientConns *conns, struct ClientConn *conn){
+    if (conn->file_fd != -1) close(conn->file_fd);
+    if (conn->send_fd != -1) close(conn->send_fd);
+
+    if (conn->job != NULL){
+        if (conn->job->file_path[0] != '\0') remove(conn->job->file_path);
+        free(conn->job);
+    }
+
+    close(conn->fd);
+    conns->by_fd[conn->fd] = NULL;
+    conns->count--;
+    free(conn);
+}
+
+/*
+ * conn_expect() -- reset the field buffer and wait for `need` bytes in `state`
+ */
+void conn_expect(struct ClientConn *conn, int state, int need){
+    conn->state = state;
+    conn->need = need;
+    conn->have = 0;
+    memset(conn->buf, 0, MAXBUFSIZE);
+}
+
+/*
+ * conn_fill() -- one recv() toward the current field
+ *
+ * Only reads what the field still needs, so bytes belonging to the next state stay in the socket.
+ */
+int conn_fill(struct ClientConn *conn){
+    if (conn->have >= conn->need) return 1;
+
+    int rv = recv(conn->fd, conn->buf + conn->have, conn->need - conn->have, 0);
+    if (rv == 0) return -1;
+    if (rv < 0) return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+
+    conn->have += rv;
+    return conn->have >= conn->need;
+}
+
+/*
+ * conn_hash_range() -- feed len bytes of the upload, starting at off, to the connection's hash
+ *
+ * The body is spliced straight to disk, so the bytes are read back while they're still in the
+ * page cache. If that fails the blob store hashes the whole file itself once it's in.
+ */
+static void conn_hash_range(struct ClientConn *conn, off_t off, long len){
+    static unsigned char buf[1 << 16];
+
+    while (len > 0){
+        long n = pread(conn->file_fd, buf, len < (long)sizeof buf ? len : (long)sizeof buf, off);
+        if (n <= 0){
+            conn->hashing = 0;
+            return;
+        }
+        sha256_update(&conn->hash, buf, n);
+        off += n;
+        len -= n;
+    }
+}
+
+/*
+ * conn_recv_body() -- one read's worth of upload, written straight into the job's file (and hashed)
+ */
+int conn_recv_body(struct ClientConn *conn){
+    if (conn->file_remaining <= 0) return 1;
+
+    long rv = recv_file_chunk(conn->fd, conn->file_fd, &conn->file_off, conn->file_remaining);
+    if (rv == 0) return -1;
+    if (rv < 0) return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+
+    if (conn->hashing) conn_hash_range(conn, conn->file_off - rv, rv);
+    conn->file_remaining -= rv;
+    return conn->file_remaining <= 0;
+}
+
+/*
+ * conn_reply() -- stage reply bytes (and optionally a file to follow them) and enter CONN_REPLY
+ */
+void conn_reply(struct ClientConn *conn, unsigned char *data, int len, int send_fd, off_t send_off, long send_size){
+    if (len > MAXBUFSIZE) len = MAXBUFSIZE;
+
+    memcpy(conn->out, data, len);
+    conn->out_len = len;
+    conn->out_sent = 0;
+    conn->send_fd = send_fd;
+    conn->send_off = send_off;
+    conn->send_remaining = send_fd == -1 ? 0 : send_size;
+    conn->state = CONN_REPLY;
+}
+
+/*
+ * conn_flush() -- send the staged reply, then sendfile() the result file until the socket fills up
+ */
+int conn_flush(struct ClientConn *conn){
+    while (conn->out_sent < conn->out_len){
+        int rv = send(conn->fd, conn->out + conn->out_sent, conn->out_len - conn->out_sent, MSG_NOSIGNAL);
+        if (rv < 0) return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+        conn->out_sent += rv;
+    }
+
+    while (conn->send_remaining > 0){
+        long rv = send_file_chunk(conn->fd, conn->send_fd, &conn->send_off, conn->send_remaining);
+        if (rv == 0) return -1; // file shrank underneath us
+        if (rv < 0) return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+
+        conn->send_remaining -= rv;
+    }
+
+    return 1;
+}
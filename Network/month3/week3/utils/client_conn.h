@@ -0,0 +1,137 @@
+/*
+ * client_conn.h -- non-blocking client connections driven by a per-connection protocol state machine
+ */
+
+#ifndef CLIENT_CONN_H
+#define CLIENT_CONN_H
+
+// Main imports
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "../common.h"
+#include "./jobs.h"
+#include "./file_transfer.h"
+#include "./sha256.h"
+
+#define CONNS_MIN_CAP 64
+
+// connection states, in the order a submission walks through them
+#define CONN_HEADER 0       // [APPID 2][cmd 2]
+#define CONN_SPEC_HEADER 1  // [priority 2][uid 4][spec len 2]
+#define CONN_SPEC 2         // [spec]
+#define CONN_FILE_HEADER 3  // [file type 2][file size 8]
+#define CONN_FILE_BODY 4    // [file bytes]
+#define CONN_JOB_ID_LEN 5   // status/results: [id len 2]
+#define CONN_JOB_ID 6       // status/results: [id digits]
+#define CONN_REPLY 7        // flushing the reply (and optional file) back to the client
+#define CONN_COMMIT 8       // reply staged, held until the journal has the submitted job on disk
+
+/*
+ * ClientConn -- one accepted client socket and where it is in the protocol
+ *
+ * fd -- the client socket (non-blocking)
+ * state -- CONN_* state
+ * cmd_type -- JOBSUBMITID / JOBSTATUSID / JOBRESULTID once the header is in
+ * addr -- peer address, used for the scheduler's client key
+ *
+ * buf, need, have -- fixed-size protocol fields are collected here until `need` bytes have arrived
+ *
+ * *job -- job being submitted; not in the jobs table until its upload finishes
+ * file_fd, file_off, file_remaining -- destination file, write offset, and bytes still expected for an upload
+ * hash, hashing -- SHA-256 of the upload (its blob key), fed with each chunk as it lands (only while hashing is set)
+ *
+ * out, out_len, out_sent -- reply bytes queued for the client
+ * commit_lsn -- in CONN_COMMIT, the journal record the reply waits for
+ * send_fd, send_off, send_remaining -- file streamed after `out` (results download), -1 if none
+ */
+struct ClientConn {
+    int fd;
+    int state;
+    int cmd_type;
+    struct sockaddr_in addr;
+
+    unsigned char buf[MAXBUFSIZE];
+    int need;
+    int have;
+
+    struct Job *job;
+    int file_fd;
+    off_t file_off;
+    long file_remaining;
+    struct Sha256 hash;
+    int hashing;
+
+    unsigned char out[MAXBUFSIZE];
+    int out_len;
+    int out_sent;
+    unsigned long long commit_lsn;
+
+    int send_fd;
+    off_t send_off;
+    long send_remaining;
+};
+
+/*
+ * ClientConns -- open client connections indexed by fd
+ */
+struct ClientConns {
+    struct ClientConn **by_fd;
+    int cap;
+    int count;
+};
+
+/*
+ * create_client_conns() -- create an empty connection table
+ */
+struct ClientConns *create_client_conns();
+
+/*
+ * add_client_conn() -- create a connection for an accepted fd, starting in CONN_HEADER
+ */
+struct ClientConn *add_client_conn(struct ClientConns *conns, int fd, struct sockaddr_in *addr);
+
+/*
+ * get_client_conn() -- return the connection for fd, NULL if fd isn't a client connection
+ */
+struct ClientConn *get_client_conn(struct ClientConns *conns, int fd);
+
+/*
+ * remove_client_conn() -- close the socket and any open files, free an unfinished job, forget the connection
+ */
+void remove_client_conn(struct ClientConns *conns, struct ClientConn *conn);
+
+/*
+ * conn_expect() -- move to `state` and wait for the next `need` bytes in conn->buf
+ */
+void conn_expect(struct ClientConn *conn, int state, int need);
+
+/*
+ * conn_fill() -- read toward conn->need. Returns 1 once buf holds `need` bytes, 0 if more are needed, -1 on EOF/error
+ */
+int conn_fill(struct ClientConn *conn);
+
+/*
+ * conn_recv_body() -- move one read's worth of upload into conn->file_fd, feeding it to conn->hash if hashing.
+ * Returns 1 when the whole body is in, 0 if more is needed, -1 on EOF/error
+ */
+int conn_recv_body(struct ClientConn *conn);
+
+/*
+ * conn_reply() -- queue a reply and switch to CONN_REPLY; send_fd (or -1) is streamed after it for send_size bytes from send_off
+ */
+void conn_reply(struct ClientConn *conn, unsigned char *data, int len, int send_fd, off_t send_off, long send_size);
+
+/*
+ * conn_flush() -- push queued reply bytes. Returns 1 when everything is sent, 0 if the socket is full, -1 on error
+ */
+int conn_flush(struct ClientConn *conn);
+
+#endif
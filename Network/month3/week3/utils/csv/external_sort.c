@@ -0,0 +1,519 @@
+/*
+ * external_sort.c -- csvsort in bounded memory: sorted runs spilled to disk, then a loser tree merge
+ */
+
+#include <errno.h>
+
+#include "./external_sort.h"
+
+/*
+ * RunFile -- a sorted run on disk, records of [u32 key length][u32 row length][key][row text], written and
+ * then read back through buf
+ *
+ * fd -- the file, already unlinked; -1 once closed
+ * *buf, cap -- the write or read buffer
+ * used, len -- bytes waiting to be written; or the read position and the bytes read into buf
+ */
+struct RunFile {
+    int fd;
+    unsigned char *buf;
+    size_t cap;
+    size_t used;
+    size_t len;
+};
+
+/*
+ * MergeInput -- a run being merged and the record at its head
+ */
+struct MergeInput {
+    struct RunFile *run;
+    unsigned char *rec;
+    size_t cap;
+    uint32_t key_len;
+    uint32_t row_len;
+    int done;
+};
+
+static int run_open(struct RunFile *run, const char *dir, int id){
+    char path[MAXFILEPATH + 32];
+    snprintf(path, sizeof path, "%ssort-run-%d", dir, id);
+
+    run->buf = NULL;
+    run->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (run->fd == -1) return -1;
+    unlink(path);
+
+    run->buf = malloc(CSV_RUN_WRITE_BYTES);
+    run->cap = CSV_RUN_WRITE_BYTES;
+    run->used = run->len = 0;
+    return run->buf == NULL ? -1 : 1;
+}
+
+static void run_close(struct RunFile *run){
+    if (run->fd != -1) close(run->fd);
+    free(run->buf);
+    run->fd = -1;
+    run->buf = NULL;
+}
+
+static int write_all(int fd, const unsigned char *data, size_t n){
+    while (n > 0){
+        ssize_t put = write(fd, data, n);
+        if (put == -1 && errno == EINTR) continue;
+        if (put == -1) return -1;
+        data += put;
+        n -= put;
+    }
+    return 1;
+}
+
+static int run_put(struct RunFile *run, const void *data, size_t n){
+    if (run->used + n > run->cap){
+        if (write_all(run->fd, run->buf, run->used) == -1) return -1;
+        run->used = 0;
+        if (n > run->cap) return write_all(run->fd, data, n);
+    }
+    memcpy(run->buf + run->used, data, n);
+    run->used += n;
+    return 1;
+}
+
+/*
+ * run_finish() -- write out what's left of run and let go of its buffer, which would otherwise be held by
+ * every run waiting to be merged
+ */
+static int run_finish(struct RunFile *run){
+    int rv = write_all(run->fd, run->buf, run->used);
+    free(run->buf);
+    run->buf = NULL;
+    run->used = 0;
+    return rv;
+}
+
+/*
+ * run_rewind() -- start reading a finished run back from the top with a cap byte buffer
+ */
+static int run_rewind(struct RunFile *run, size_t cap){
+    if (lseek(run->fd, 0, SEEK_SET) == -1) return -1;
+
+    run->buf = malloc(cap);
+    run->cap = cap;
+    run->used = run->len = 0;
+    return run->buf == NULL ? -1 : 1;
+}
+
+/*
+ * run_get() -- the next n bytes of run into dst. 1, 0 if the run ends first, -1 if reading fails
+ */
+static int run_get(struct RunFile *run, void *dst, size_t n){
+    unsigned char *out = dst;
+
+    while (n > 0){
+        if (run->used == run->len){
+            ssize_t got = read(run->fd, run->buf, run->cap);
+            if (got == -1 && errno == EINTR) continue;
+            if (got <= 0) return got == 0 ? 0 : -1;
+            run->used = 0;
+            run->len = got;
+        }
+
+        size_t take = run->len - run->used < n ? run->len - run->used : n;
+        memcpy(out, run->buf + run->used, take);
+        run->used += take;
+        out += take;
+        n -= take;
+    }
+    return 1;
+}
+
+/*
+ * spill_run() -- count rows of csv, in order, as the records of run
+ */
+static int spill_run(struct RunFile *run, struct CSV *csv, const long *order, long count, const struct CSVSortKey *keys, int nkeys){
+    unsigned char *rec = NULL;
+    size_t rec_cap = 0;
+    int rv = 1;
+
+    for (long i = 0; i < count && rv == 1; i++){
+        long row = order[i];
+        size_t row_len = csv->cols - 1;
+        for (int j = 0; j < csv->cols; j++) row_len += csv->columns[j].len[row];
+
+        size_t need = 2 * sizeof(uint32_t) + csv_sort_key_bound(csv, row, keys, nkeys) + row_len;
+        if (row_len > UINT32_MAX || need > UINT32_MAX){
+            rv = -1;
+            break;
+        }
+        if (need > rec_cap){
+            unsigned char *grown = realloc(rec, 2 * need);
+            if (grown == NULL){
+                rv = -1;
+                break;
+            }
+            rec = grown;
+            rec_cap = 2 * need;
+        }
+
+        uint32_t lens[2];
+        lens[0] = csv_encode_sort_key(csv, row, keys, nkeys, rec + sizeof lens);
+        lens[1] = row_len;
+        memcpy(rec, lens, sizeof lens);
+
+        unsigned char *text = rec + sizeof lens + lens[0];
+        for (int j = 0; j < csv->cols; j++){
+            size_t len;
+            const char *cell = csv_cell(csv, row, j, &len);
+            if (j > 0) *text++ = ',';
+            memcpy(text, cell, len);
+            text += len;
+        }
+
+        rv = run_put(run, rec, text - rec);
+    }
+
+    free(rec);
+    return rv;
+}
+
+/*
+ * input_next() -- read the next record of in's run into in->rec. 1, 0 at the end of the run (in->done), -1 if
+ * it can't be read
+ */
+static int input_next(struct MergeInput *in){
+    uint32_t lens[2];
+    int got = run_get(in->run, lens, sizeof lens);
+    if (got != 1){
+        in->done = 1;
+        return got;
+    }
+
+    size_t need = (size_t)lens[0] + lens[1];
+    if (need > in->cap){
+        unsigned char *grown = realloc(in->rec, need);
+        if (grown == NULL) return -1;
+        in->rec = grown;
+        in->cap = need;
+    }
+    if (run_get(in->run, in->rec, need) != 1) return -1;
+
+    in->key_len = lens[0];
+    in->row_len = lens[1];
+    return 1;
+}
+
+/*
+ * input_less() -- whether input a's record goes before input b's: by key, then by input, so rows with equal
+ * keys keep the order of the runs. Finished inputs go after everything else
+ */
+static int input_less(const struct MergeInput *ins, int a, int b){
+    const struct MergeInput *in_a = &ins[a], *in_b = &ins[b];
+
+    if (in_a->done != in_b->done) return in_b->done;
+    if (!in_a->done){
+        uint32_t n = in_a->key_len < in_b->key_len ? in_a->key_len : in_b->key_len;
+        int cmp = memcmp(in_a->rec, in_b->rec, n);
+        if (cmp == 0) cmp = (in_a->key_len > in_b->key_len) - (in_a->key_len < in_b->key_len);
+        if (cmp != 0) return cmp < 0;
+    }
+    return a < b;
+}
+
+/*
+ * loser_build() -- play off the inputs under node t of a loser tree of k inputs (nodes 1..k-1, inputs at
+ * k..2k-1), leaving the loser of each match in its node. Returns the winner
+ */
+static int loser_build(const struct MergeInput *ins, int *tree, int k, int t){
+    if (t >= k) return t - k;
+
+    int a = loser_build(ins, tree, k, 2 * t);
+    int b = loser_build(ins, tree, k, 2 * t + 1);
+    if (input_less(ins, a, b)){
+        tree[t] = b;
+        return a;
+    }
+    tree[t] = a;
+    return b;
+}
+
+/*
+ * merge_runs() -- merge k runs, rewound already, into the run out, or as rows into results if out is NULL
+ */
+static int merge_runs(struct RunFile *runs, int k, struct RunFile *out, FILE *results){
+    struct MergeInput *ins = calloc(k, sizeof *ins);
+    int *tree = malloc(k * sizeof *tree);  // tree[0] is the winner
+    int rv = ins != NULL && tree != NULL ? 1 : -1;
+
+    for (int i = 0; i < k && rv == 1; i++){
+        ins[i].run = &runs[i];
+        if (input_next(&ins[i]) == -1) rv = -1;
+    }
+    if (rv == 1) tree[0] = loser_build(ins, tree, k, 1);
+
+    while (rv == 1 && !ins[tree[0]].done){
+        int w = tree[0];
+        struct MergeInput *in = &ins[w];
+
+        if (out != NULL){
+            uint32_t lens[2] = {in->key_len, in->row_len};
+            rv = run_put(out, lens, sizeof lens);
+            if (rv == 1) rv = run_put(out, in->rec, (size_t)in->key_len + in->row_len);
+        } else {
+            fwrite(in->rec + in->key_len, 1, in->row_len, results);
+            fputc('\n', results);
+        }
+        if (rv == 1 && input_next(in) == -1) rv = -1;
+
+        // the winner's next record replays its matches on the way up
+        for (int t = (w + k) / 2; t > 0; t /= 2){
+            if (input_less(ins, tree[t], w)){
+                int loser = w;
+                w = tree[t];
+                tree[t] = loser;
+            }
+        }
+        tree[0] = w;
+    }
+
+    if (ins != NULL){
+        for (int i = 0; i < k; i++) free(ins[i].rec);
+    }
+    free(ins);
+    free(tree);
+    return rv;
+}
+
+/*
+ * rewind_runs() -- get n runs ready to merge, sharing half the budget between their read buffers
+ */
+static int rewind_runs(struct RunFile *runs, int n, long budget){
+    size_t cap = budget / 2 / n;
+    if (cap < CSV_MERGE_BUFFER) cap = CSV_MERGE_BUFFER;
+    if (cap > CSV_MERGE_MAX_BUFFER) cap = CSV_MERGE_MAX_BUFFER;
+
+    for (int i = 0; i < n; i++){
+        if (run_rewind(&runs[i], cap) == -1) return -1;
+    }
+    return 1;
+}
+
+/*
+ * merge_all() -- merge *nruns runs into results: runs of consecutive runs first, as many passes as it takes
+ * to get down to the fan-in the budget allows. *runs and *nruns follow the passes
+ */
+static int merge_all(struct RunFile **runs, int *nruns, FILE *results, const char *dir, long budget, int *next_id){
+    int fanin = budget / (2 * CSV_MERGE_BUFFER);
+    if (fanin < 2) fanin = 2;
+    if (fanin > CSV_MERGE_MAX_FANIN) fanin = CSV_MERGE_MAX_FANIN;
+
+    while (*nruns > fanin){
+        int groups = (*nruns + fanin - 1) / fanin;
+        struct RunFile *merged = malloc(groups * sizeof *merged);
+        if (merged == NULL) return -1;
+
+        int done = 0, rv = 1;
+        for (int g = 0; g < groups && rv == 1; g++){
+            int lo = g * fanin;
+            int n = *nruns - lo < fanin ? *nruns - lo : fanin;
+
+            rv = run_open(&merged[g], dir, (*next_id)++);
+            done++;
+            if (rv == 1) rv = rewind_runs(*runs + lo, n, budget);
+            if (rv == 1) rv = merge_runs(*runs + lo, n, &merged[g], NULL);
+            if (rv == 1) rv = run_finish(&merged[g]);
+            for (int i = lo; i < lo + n; i++) run_close(&(*runs)[i]);
+        }
+
+        for (int i = 0; i < *nruns; i++) run_close(&(*runs)[i]);
+        free(*runs);
+        *runs = merged;
+        *nruns = done;
+        if (rv == -1) return -1;
+    }
+
+    if (rewind_runs(*runs, *nruns, budget) == -1) return -1;
+    return merge_runs(*runs, *nruns, NULL, results);
+}
+
+/*
+ * read_run() -- the next run's text into *text, *len: what was left over from the last one, then enough of
+ * content to make run_bytes, cut after the last newline outside quotes (grown until there is one). The
+ * partial row after it is kept in *carry for the next run. *eof once content has run out
+ */
+static int read_run(FILE *content, size_t run_bytes, char **carry, size_t *carry_len, char **text, size_t *len, int *eof){
+    size_t cap = run_bytes > 2 * *carry_len ? run_bytes : 2 * *carry_len;
+    char *buf = malloc(cap);
+    uint32_t *found = malloc(CSV_SCAN_BYTES * sizeof *found);
+    if (buf == NULL || found == NULL){
+        free(buf);
+        free(found);
+        return -1;
+    }
+
+    // the carry starts a row, so it starts outside quotes
+    if (*carry_len > 0) memcpy(buf, *carry, *carry_len);
+    size_t size = *carry_len, scanned = 0, cut = 0;
+    int in_quotes = 0;
+    free(*carry);
+    *carry = NULL;
+    *carry_len = 0;
+
+    for (;;){
+        size += fread(buf + size, 1, cap - size, content);
+        if (size < cap) *eof = 1;
+        if (ferror(content)) break;
+
+        while (scanned < size){
+            size_t n = size - scanned < CSV_SCAN_BYTES ? size - scanned : CSV_SCAN_BYTES;
+            size_t count = text_csv_scan((const unsigned char *)buf + scanned, n, &in_quotes, found);
+            for (size_t i = count; i > 0; i--){
+                if (buf[scanned + found[i - 1]] == '\n'){
+                    cut = scanned + found[i - 1] + 1;
+                    break;
+                }
+            }
+            scanned += n;
+        }
+        if (cut > 0 || *eof) break;
+
+        char *grown = realloc(buf, 2 * cap);
+        if (grown == NULL) break;
+        buf = grown;
+        cap *= 2;
+    }
+    free(found);
+
+    if (*eof) cut = size;
+    if (ferror(content) || (cut == 0 && !*eof)){
+        free(buf);
+        return -1;
+    }
+
+    if (cut < size){
+        *carry = malloc(size - cut);
+        if (*carry == NULL){
+            free(buf);
+            return -1;
+        }
+        memcpy(*carry, buf + cut, size - cut);
+        *carry_len = size - cut;
+    }
+    *text = buf;
+    *len = cut;
+    return 1;
+}
+
+long csv_sort_memory_estimate(FILE *content){
+    struct stat st;
+    int fd = fileno(content);
+    off_t pos = ftello(content);
+    if (fd == -1 || pos == -1 || fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) return -1;
+    if (st.st_size <= pos) return 0;
+
+    size_t size = st.st_size - pos;
+    size_t n = size < CSV_SAMPLE_BYTES ? size : CSV_SAMPLE_BYTES;
+    unsigned char *sample = malloc(n);
+    uint32_t *found = malloc(CSV_SCAN_BYTES * sizeof *found);
+    ssize_t got = sample != NULL && found != NULL ? pread(fd, sample, n, pos) : -1;
+
+    long cells = 0, rows = 0;
+    int in_quotes = 0;
+    for (ssize_t base = 0; base < got; base += CSV_SCAN_BYTES){
+        size_t len = got - base < CSV_SCAN_BYTES ? got - base : CSV_SCAN_BYTES;
+        size_t count = text_csv_scan(sample + base, len, &in_quotes, found);
+        cells += count;
+        for (size_t i = 0; i < count; i++) rows += sample[base + found[i]] == '\n';
+    }
+    free(sample);
+    free(found);
+    if (got <= 0) return size;
+
+    // an offset and a length per cell; a row number, and two string sort items, per row
+    double scale = (double)size / got;
+    return size + (long)(scale * (cells * (sizeof(size_t) + sizeof(uint32_t)) + rows * (sizeof(long) + 64)));
+}
+
+int csv_external_sort(FILE *results, FILE *content, const char *spec, const char *dir, long budget, struct TilePool *tiles){
+    size_t run_bytes = budget / CSV_RUN_SHARE;
+    if (run_bytes < CSV_MIN_RUN_BYTES) run_bytes = CSV_MIN_RUN_BYTES;
+
+    struct CSVSortKey keys[CSV_SORT_MAX_KEYS];
+    int nkeys = 0, cols = 0;
+    struct RunFile *runs = NULL;
+    int nruns = 0, runs_cap = 0, next_id = 0;
+    char *carry = NULL;
+    size_t carry_len = 0;
+    int eof = 0, rv = 1;
+
+    for (int first = 1; rv == 1 && !eof; first = 0){
+        char *text;
+        size_t len;
+        if (read_run(content, run_bytes, &carry, &carry_len, &text, &len, &eof) == -1){
+            rv = -1;
+            break;
+        }
+        if (len == 0 && !first){
+            free(text);
+            break;
+        }
+
+        // the first run has the header row: it decides the keys, their types and the columns of every run after it
+        struct CSV csv;
+        if (csv_index_buffer(&csv, text, len, cols) == -1){
+            rv = -1;
+            break;
+        }
+        if (first){
+            nkeys = csv_parse_sort_keys(&csv, spec, keys);
+            if (nkeys == -1){
+                free_csv(&csv);
+                rv = -1;
+                break;
+            }
+            for (int k = 0; k < nkeys; k++){
+                if (keys[k].type == CSV_TYPE_AUTO) keys[k].type = csv_column_type(&csv, keys[k].col);
+            }
+            cols = csv.cols;
+            csv_write_row(&csv, 0, results);
+        }
+
+        long count = csv.rows - first;
+        long *order = malloc((count > 0 ? count : 1) * sizeof *order);
+        if (order == NULL){
+            free_csv(&csv);
+            rv = -1;
+            break;
+        }
+        for (long i = 0; i < count; i++){
+            order[i] = i + first;
+        }
+
+        rv = csv_sort_rows(&csv, keys, nkeys, order, count, tiles);
+        if (rv == 1 && first && eof){
+            // it all fit in one run after all
+            csv_write_rows(&csv, order, count, results);
+        } else if (rv == 1){
+            if (nruns == runs_cap){
+                runs_cap = runs_cap > 0 ? 2 * runs_cap : 16;
+                struct RunFile *grown = realloc(runs, runs_cap * sizeof *runs);
+                rv = grown == NULL ? -1 : 1;
+                if (grown != NULL) runs = grown;
+            }
+            if (rv == 1){
+                rv = run_open(&runs[nruns], dir, next_id++);
+                nruns++;
+            }
+            if (rv == 1) rv = spill_run(&runs[nruns - 1], &csv, order, count, keys, nkeys);
+            if (rv == 1) rv = run_finish(&runs[nruns - 1]);
+        }
+
+        free(order);
+        free_csv(&csv);
+    }
+    free(carry);
+
+    if (rv == 1 && nruns > 0) rv = merge_all(&runs, &nruns, results, dir, budget, &next_id);
+
+    for (int i = 0; i < nruns; i++) run_close(&runs[i]);
+    free(runs);
+    return rv;
+}
@@ -0,0 +1,44 @@
+/*
+ * external_sort.h -- csvsort for inputs bigger than the memory it's allowed
+ */
+
+#ifndef EXTERNAL_SORT_H
+#define EXTERNAL_SORT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "./parse_csv.h"
+#include "./sort_csv.h"
+#include "../tile_pool.h"
+
+#define CSV_RUN_SHARE 8                 // a run's text is at most 1/8 of the budget; its index, keys and row order take the rest
+#define CSV_MIN_RUN_BYTES (1L << 20)
+#define CSV_MERGE_BUFFER (256L << 10)   // least read buffer a run gets while merging, out of half the budget: that sets the fan-in
+#define CSV_MERGE_MAX_BUFFER (4L << 20) // and the most, when there are only a few runs
+#define CSV_MERGE_MAX_FANIN 256         // runs merged at once at most, since each one is an open file
+#define CSV_RUN_WRITE_BYTES (1L << 20)  // a run is written out in blocks this big
+#define CSV_SAMPLE_BYTES (1L << 20)     // start of the input csv_sort_memory_estimate() looks at
+
+/*
+ * csv_sort_memory_estimate() -- about how much memory job_csvsort() needs to sort the rest of content in one go:
+ * the input plus its index, keys and row order, going by the rows and cells in its first CSV_SAMPLE_BYTES.
+ * -1 if content isn't a regular file (a chain stage's output, which is in memory already)
+ */
+long csv_sort_memory_estimate(FILE *content);
+
+/*
+ * csv_external_sort() -- csvsort within about budget bytes: runs of rows are sorted in memory with csv_sort_rows()
+ * and spilled to files in dir (unlinked from the start, so nothing is left behind), then merged with a loser
+ * tree straight into results, in more than one pass if there are too many runs to give each a buffer.
+ * spec is the csvsort arguments. A column's type is decided from the first run. Rows come out in the same
+ * order an in-memory sort puts them in; 1 on success, -1 if the spec is bad or memory or disk runs out
+ */
+int csv_external_sort(FILE *results, FILE *content, const char *spec, const char *dir, long budget, struct TilePool *tiles);
+
+#endif
@@ -0,0 +1,566 @@
+/*
+ * filter_csv.c -- csvfilter as a stream: the spec becomes a small program once, then runs over rows in batches
+ *
+ * The input is read CSV_FILTER_BLOCK at a time and text_csv_scan() finds its delimiters. Only the cells of
+ * columns a test reads are kept, a CSV_FILTER_BATCH of rows at a time, laid out by column. Each test then
+ * runs down its column for the whole batch into a byte mask -- numbers are parsed once per column and
+ * compared with text_compare_f64() -- and the program ANDs and ORs the masks. Rows that pass are written
+ * straight from the input when they already read the way csv_write_row() would write them, which is most
+ * rows, in runs of consecutive rows; the others are rewritten cell by cell.
+ */
+
+#include "./filter_csv.h"
+
+/*
+ * FilterToken -- a word of the spec, NUL-terminated in the filter's text; quoted ones are never operators
+ */
+struct FilterToken {
+    char *text;
+    int quoted;
+};
+
+/*
+ * FilterStream -- csv_filter_stream()'s state
+ *
+ * *buf, cap, size, eof -- the input not yet filtered, starting at a row; eof once content has run out
+ * *delims -- text_csv_scan() output for one CSV_SCAN_BYTES piece
+ * cols, *slot_of -- header columns; the batch slot each one's cells go to, -1 if no test reads it
+ * n -- rows in the batch
+ * *row_start, *row_end, *clean -- each row's bytes (row_end is its newline, or size) and whether they
+ * already read as csv_write_row() would write them: no cell opens with a space or a quote, none missing
+ * *cell_off[], *cell_len[] -- each slot's cells, as csv_cell() would return them
+ * *num[], parsed[] -- each slot's cells as numbers (NaN if not one), once a numeric test has asked
+ * *masks -- depth masks of CSV_FILTER_BATCH bytes
+ */
+struct FilterStream {
+    struct CSVFilter *filter;
+    FILE *results;
+
+    char *buf;
+    size_t cap;
+    size_t size;
+    int eof;
+    uint32_t *delims;
+
+    int cols;
+    int *slot_of;
+
+    long n;
+    size_t *row_start;
+    size_t *row_end;
+    unsigned char *clean;
+    size_t *cell_off[CSV_FILTER_MAX_TESTS];
+    size_t *cell_len[CSV_FILTER_MAX_TESTS];
+    double *num[CSV_FILTER_MAX_TESTS];
+    int parsed[CSV_FILTER_MAX_TESTS];
+    unsigned char *masks;
+};
+
+/*
+ * op_length() -- length of the comparison operator s starts with, 0 if none; *cmp is its CSV_CMP_*
+ */
+static int op_length(const char *s, int *cmp){
+    static const char *ops[] = {"!=", "<=", ">=", "^=", "==", "=", "<", ">"};
+    static const int cmps[] = {CSV_CMP_NE, CSV_CMP_LE, CSV_CMP_GE, CSV_CMP_PREFIX, CSV_CMP_EQ, CSV_CMP_EQ, CSV_CMP_LT, CSV_CMP_GT};
+
+    for (int i = 0; i < 8; i++){
+        size_t len = strlen(ops[i]);
+        if (strncmp(s, ops[i], len) == 0){
+            *cmp = cmps[i];
+            return len;
+        }
+    }
+    return 0;
+}
+
+/*
+ * add_token() -- copy len bytes of s into the filter's text as the next token
+ */
+static int add_token(struct CSVFilter *filter, size_t *used, const char *s, size_t len, int quoted, struct FilterToken *tokens, int *ntokens){
+    if (*ntokens == CSV_FILTER_MAX_TOKENS || *used + len + 1 > sizeof filter->text) return -1;
+
+    tokens[*ntokens].text = filter->text + *used;
+    tokens[*ntokens].quoted = quoted;
+    memcpy(filter->text + *used, s, len);
+    filter->text[*used + len] = '\0';
+    *used += len + 1;
+    (*ntokens)++;
+    return 1;
+}
+
+/*
+ * tokenize() -- cut spec at spaces into tokens, with "..." as one token and an operator inside a word
+ * ("Age>=30") split out of it. Returns the number of tokens, -1 if there are too many
+ */
+static int tokenize(struct CSVFilter *filter, const char *spec, struct FilterToken *tokens){
+    size_t used = 0;
+    int n = 0, cmp;
+
+    for (const char *s = spec; *s != '\0'; ){
+        if (*s == ' '){
+            s++;
+            continue;
+        }
+
+        if (*s == '"'){
+            const char *end = strchr(s + 1, '"');
+            if (end == NULL) end = s + strlen(s);
+            if (add_token(filter, &used, s + 1, end - s - 1, 1, tokens, &n) == -1) return -1;
+            s = *end == '"' ? end + 1 : end;
+            continue;
+        }
+
+        size_t len = strcspn(s, " ");
+        size_t at = strcspn(s, "=<>!^");
+        int op = at < len ? op_length(s + at, &cmp) : 0;
+        if (op == 0){
+            if (add_token(filter, &used, s, len, 0, tokens, &n) == -1) return -1;
+        } else {
+            if (at > 0 && add_token(filter, &used, s, at, 0, tokens, &n) == -1) return -1;
+            if (add_token(filter, &used, s + at, op, 0, tokens, &n) == -1) return -1;
+            if (at + op < len && add_token(filter, &used, s + at + op, len - at - op, 0, tokens, &n) == -1) return -1;
+        }
+        s += len;
+    }
+    return n;
+}
+
+/*
+ * is_word() -- whether token is word (any case) or symbol, and not in quotes
+ */
+static int is_word(const struct FilterToken *token, const char *word, const char *symbol){
+    return !token->quoted && (strcasecmp(token->text, word) == 0 || strcmp(token->text, symbol) == 0);
+}
+
+/*
+ * emit() -- append an instruction to the program
+ */
+static int emit(struct CSVFilter *filter, int op, int arg){
+    if (filter->nops == 2 * CSV_FILTER_MAX_TESTS) return -1;
+    filter->program[filter->nops].op = op;
+    filter->program[filter->nops].arg = arg;
+    filter->nops++;
+    return 1;
+}
+
+/*
+ * add_test() -- a test of col against value, and the instruction that pushes its mask
+ */
+static int add_test(struct CSVFilter *filter, int col, int cmp, const char *value){
+    if (filter->ntests == CSV_FILTER_MAX_TESTS) return -1;
+
+    struct CSVTest *test = &filter->tests[filter->ntests];
+    test->col = col;
+    test->cmp = cmp;
+    test->text = value;
+    test->len = strlen(value);
+    test->numeric = cmp != CSV_CMP_PREFIX && csv_cell_number(value, test->len, &test->number);
+
+    test->slot = -1;
+    for (int s = 0; s < filter->nslots; s++){
+        if (filter->slot_col[s] == col) test->slot = s;
+    }
+    if (test->slot == -1){
+        test->slot = filter->nslots;
+        filter->slot_col[filter->nslots++] = col;
+    }
+
+    return emit(filter, CSV_OP_TEST, filter->ntests++);
+}
+
+/*
+ * compile_test() -- the test starting at tokens[*pos]: its instructions, *pos moved past it
+ */
+static int compile_test(struct CSVFilter *filter, struct CSV *head, struct FilterToken *tokens, int ntokens, int *pos){
+    if (*pos + 2 > ntokens) return -1;
+
+    int col = csv_find_column(head, tokens[*pos].text);
+    struct FilterToken *next = &tokens[*pos + 1];
+    int cmp, len = next->quoted ? 0 : op_length(next->text, &cmp);
+    if (col == -1) return -1;
+
+    if (len > 0 && len == (int)strlen(next->text)){
+        if (*pos + 3 > ntokens) return -1;
+        *pos += 3;
+        return add_test(filter, col, cmp, tokens[*pos - 1].text);
+    }
+
+    char *range = *pos + 3 <= ntokens ? tokens[*pos + 2].text : NULL;
+    char *dots = range != NULL ? strstr(range, "..") : NULL;
+    if (is_word(next, "in", "in") && dots != NULL){
+        *pos += 3;
+
+        *dots = '\0';
+        const char *low = range, *high = dots + 2;
+        if (*low == '\0' && *high == '\0') return -1;
+        if (*low != '\0' && add_test(filter, col, CSV_CMP_GE, low) == -1) return -1;
+        if (*high != '\0' && add_test(filter, col, CSV_CMP_LE, high) == -1) return -1;
+        return *low != '\0' && *high != '\0' ? emit(filter, CSV_OP_AND, 0) : 1;
+    }
+
+    // "column value", all csvfilter used to take: exactly equal, even if value looks like a number
+    *pos += 2;
+    if (add_test(filter, col, CSV_CMP_EQ, next->text) == -1) return -1;
+    filter->tests[filter->ntests - 1].numeric = 0;
+    return 1;
+}
+
+int csv_filter_compile(struct CSVFilter *filter, struct CSV *head, const char *spec){
+    struct FilterToken tokens[CSV_FILTER_MAX_TOKENS];
+    filter->ntests = 0;
+    filter->nops = 0;
+    filter->nslots = 0;
+
+    int ntokens = tokenize(filter, spec, tokens);
+    if (ntokens <= 0) return -1;
+
+    // or of ands: each test after the first in a term is ANDed in, each term after the first ORed
+    int pos = 0;
+    for (int term = 0; ; term++){
+        for (int test = 0; ; test++){
+            if (compile_test(filter, head, tokens, ntokens, &pos) == -1) return -1;
+            if (test > 0 && emit(filter, CSV_OP_AND, 0) == -1) return -1;
+            if (pos == ntokens || !is_word(&tokens[pos], "and", "&&")) break;
+            pos++;
+        }
+        if (term > 0 && emit(filter, CSV_OP_OR, 0) == -1) return -1;
+        if (pos == ntokens || !is_word(&tokens[pos], "or", "||")) break;
+        pos++;
+    }
+    if (pos != ntokens) return -1;
+
+    int depth = 0;
+    filter->depth = 0;
+    for (int i = 0; i < filter->nops; i++){
+        depth += filter->program[i].op == CSV_OP_TEST ? 1 : -1;
+        if (depth > filter->depth) filter->depth = depth;
+    }
+    return 1;
+}
+
+/*
+ * run_test() -- mask[i] = whether row i of the batch passes test
+ */
+static void run_test(struct FilterStream *st, const struct CSVTest *test, unsigned char *mask){
+    const size_t *off = st->cell_off[test->slot], *len = st->cell_len[test->slot];
+    long n = st->n;
+
+    if (test->numeric){
+        double *num = st->num[test->slot];
+        if (!st->parsed[test->slot]){
+            for (long i = 0; i < n; i++){
+                if (!csv_cell_number(st->buf + off[i], len[i], &num[i])) num[i] = NAN;
+            }
+            st->parsed[test->slot] = 1;
+        }
+        text_compare_f64(num, n, test->cmp, test->number, mask);
+        return;
+    }
+
+    for (long i = 0; i < n; i++){
+        // compared without the opening quote, so "New York, NY" matches its cell
+        const char *cell = st->buf + off[i];
+        size_t cell_len = len[i];
+        if (cell_len > 0 && cell[0] == '"'){
+            cell++;
+            cell_len--;
+        }
+
+        if (test->cmp == CSV_CMP_EQ || test->cmp == CSV_CMP_NE){
+            int equal = cell_len == test->len && memcmp(cell, test->text, cell_len) == 0;
+            mask[i] = test->cmp == CSV_CMP_EQ ? equal : !equal;
+            continue;
+        }
+        if (test->cmp == CSV_CMP_PREFIX){
+            mask[i] = cell_len >= test->len && memcmp(cell, test->text, test->len) == 0;
+            continue;
+        }
+
+        int c = memcmp(cell, test->text, cell_len < test->len ? cell_len : test->len);
+        if (c == 0) c = (cell_len > test->len) - (cell_len < test->len);
+        if (test->cmp == CSV_CMP_LT) mask[i] = c < 0;
+        else if (test->cmp == CSV_CMP_LE) mask[i] = c <= 0;
+        else if (test->cmp == CSV_CMP_GT) mask[i] = c > 0;
+        else mask[i] = c >= 0;
+    }
+}
+
+/*
+ * write_row() -- row i of the batch cell by cell, the way csv_write_row() writes an indexed row
+ */
+static void write_row(struct FilterStream *st, long i){
+    const char *data = st->buf;
+    size_t start = st->row_start[i], end = st->row_end[i];
+    size_t field = start;
+    int col = 0, quoted = 0;
+
+    for (size_t p = start; p <= end; p++){
+        if (p < end){
+            if (data[p] == '"') quoted = !quoted;
+            if (data[p] != ',' || quoted) continue;
+        }
+
+        if (col < st->cols){
+            size_t from = field;
+            while (from < p && data[from] == ' ') from++;
+            size_t len = p - from;
+            if (len > 0 && data[from] == '"') len--;
+            if (col > 0) fputc(',', st->results);
+            fwrite(data + from, 1, len, st->results);
+        }
+        col++;
+        field = p + 1;
+    }
+
+    for (; col < st->cols; col++) fputc(',', st->results);
+    fputc('\n', st->results);
+}
+
+/*
+ * flush_batch() -- run the program over the batch and write the rows that pass
+ */
+static void flush_batch(struct FilterStream *st){
+    const struct CSVFilter *filter = st->filter;
+    long n = st->n;
+    if (n == 0) return;
+
+    int top = 0;
+    for (int k = 0; k < filter->nops; k++){
+        const struct CSVFilterOp *op = &filter->program[k];
+        if (op->op == CSV_OP_TEST){
+            run_test(st, &filter->tests[op->arg], st->masks + top * CSV_FILTER_BATCH);
+            top++;
+            continue;
+        }
+
+        top--;
+        unsigned char *a = st->masks + (top - 1) * CSV_FILTER_BATCH, *b = st->masks + top * CSV_FILTER_BATCH;
+        if (op->op == CSV_OP_AND) for (long i = 0; i < n; i++) a[i] &= b[i];
+        else for (long i = 0; i < n; i++) a[i] |= b[i];
+    }
+
+    // passing rows that can go out as they are go out in runs of consecutive ones
+    const unsigned char *pass = st->masks;
+    size_t run_start = 0, run_end = 0;
+    for (long i = 0; i < n; i++){
+        if (!pass[i]) continue;
+
+        if (st->clean[i] && st->row_end[i] < st->size){
+            if (run_end > run_start && run_end == st->row_start[i]){
+                run_end = st->row_end[i] + 1;
+                continue;
+            }
+            fwrite(st->buf + run_start, 1, run_end - run_start, st->results);
+            run_start = st->row_start[i];
+            run_end = st->row_end[i] + 1;
+            continue;
+        }
+
+        fwrite(st->buf + run_start, 1, run_end - run_start, st->results);
+        run_start = run_end = 0;
+        write_row(st, i);
+    }
+    fwrite(st->buf + run_start, 1, run_end - run_start, st->results);
+
+    st->n = 0;
+    memset(st->parsed, 0, sizeof st->parsed);
+}
+
+/*
+ * end_row() -- add the row in buf[start, end) with cols cells seen to the batch, running it once it's full
+ */
+static void end_row(struct FilterStream *st, size_t start, size_t end, int cols, int clean){
+    long i = st->n;
+
+    if (cols < st->cols){
+        // padded with empty cells
+        clean = 0;
+        for (int s = 0; s < st->filter->nslots; s++){
+            if (st->filter->slot_col[s] < cols) continue;
+            st->cell_off[s][i] = start;
+            st->cell_len[s][i] = 0;
+        }
+    }
+
+    st->row_start[i] = start;
+    st->row_end[i] = end;
+    st->clean[i] = clean;
+    if (++st->n == CSV_FILTER_BATCH) flush_batch(st);
+}
+
+/*
+ * filter_rows() -- batch every complete row in the buffer (at eof, a last one without a newline too).
+ * Returns where the rows left over start
+ */
+static size_t filter_rows(struct FilterStream *st){
+    const char *data = st->buf;
+    size_t size = st->size;
+    size_t row = 0, field = 0;
+    int col = 0, clean = 1, in_quotes = 0;
+
+    for (size_t base = 0; base < size; base += CSV_SCAN_BYTES){
+        size_t len = size - base < CSV_SCAN_BYTES ? size - base : CSV_SCAN_BYTES;
+        size_t count = text_csv_scan((const unsigned char *)data + base, len, &in_quotes, st->delims);
+
+        for (size_t k = 0; k < count; k++){
+            size_t at = base + st->delims[k];
+
+            if (col < st->cols){
+                int slot = st->slot_of[col];
+                if (field < at && (data[field] == ' ' || data[field] == '"')) clean = 0;
+                if (slot >= 0){
+                    size_t from = field;
+                    while (from < at && data[from] == ' ') from++;
+                    size_t cell_len = at - from;
+                    if (cell_len > 0 && data[from] == '"') cell_len--;
+                    st->cell_off[slot][st->n] = from;
+                    st->cell_len[slot][st->n] = cell_len;
+                }
+            } else clean = 0;
+            col++;
+            field = at + 1;
+
+            if (data[at] == '\n'){
+                end_row(st, row, at, col, clean);
+                row = field;
+                col = 0;
+                clean = 1;
+            }
+        }
+    }
+
+    // a last row with no newline after it (or an unterminated quote running to the end)
+    if (st->eof && (field < size || col > 0)){
+        if (col < st->cols){
+            int slot = st->slot_of[col];
+            if (field < size && (data[field] == ' ' || data[field] == '"')) clean = 0;
+            if (slot >= 0){
+                size_t from = field;
+                while (from < size && data[from] == ' ') from++;
+                size_t cell_len = size - from;
+                if (cell_len > 0 && data[from] == '"') cell_len--;
+                st->cell_off[slot][st->n] = from;
+                st->cell_len[slot][st->n] = cell_len;
+            }
+        } else clean = 0;
+        end_row(st, row, size, col + 1, clean);
+        row = size;
+    }
+    return row;
+}
+
+/*
+ * read_more() -- fill the rest of the buffer, doubling it first if a row already fills it
+ */
+static int read_more(struct FilterStream *st, FILE *content){
+    if (st->size == st->cap){
+        char *grown = realloc(st->buf, 2 * st->cap);
+        if (grown == NULL) return -1;
+        st->buf = grown;
+        st->cap *= 2;
+    }
+
+    st->size += fread(st->buf + st->size, 1, st->cap - st->size, content);
+    if (ferror(content)) return -1;
+    st->eof = feof(content);
+    return 1;
+}
+
+/*
+ * header_end() -- where the header row ends in the buffer (after its newline), 0 if it hasn't yet
+ */
+static size_t header_end(struct FilterStream *st){
+    int in_quotes = 0;
+    for (size_t base = 0; base < st->size; base += CSV_SCAN_BYTES){
+        size_t len = st->size - base < CSV_SCAN_BYTES ? st->size - base : CSV_SCAN_BYTES;
+        size_t count = text_csv_scan((const unsigned char *)st->buf + base, len, &in_quotes, st->delims);
+        for (size_t k = 0; k < count; k++){
+            if (st->buf[base + st->delims[k]] == '\n') return base + st->delims[k] + 1;
+        }
+    }
+    return st->eof ? st->size : 0;
+}
+
+/*
+ * start_stream() -- read up to the end of the header row, compile spec against it, write it out and set up
+ * the batch. Leaves the buffer starting at the first data row
+ */
+static int start_stream(struct FilterStream *st, FILE *content, const char *spec){
+    size_t end = 0;
+    while (end == 0 && !st->eof){
+        if (read_more(st, content) == -1) return -1;
+        end = header_end(st);
+    }
+    if (end == 0) return -1;
+
+    struct CSV head;
+    char *copy = malloc(end);
+    if (copy == NULL) return -1;
+    memcpy(copy, st->buf, end);
+    if (csv_index_buffer(&head, copy, end, 0) == -1) return -1;
+
+    int rv = csv_filter_compile(st->filter, &head, spec);
+    if (rv == 1) csv_write_row(&head, 0, st->results);
+    st->cols = head.cols;
+    free_csv(&head);
+    if (rv == -1) return -1;
+
+    memmove(st->buf, st->buf + end, st->size - end);
+    st->size -= end;
+
+    const struct CSVFilter *filter = st->filter;
+    st->slot_of = malloc(st->cols * sizeof *st->slot_of);
+    st->row_start = malloc(CSV_FILTER_BATCH * sizeof *st->row_start);
+    st->row_end = malloc(CSV_FILTER_BATCH * sizeof *st->row_end);
+    st->clean = malloc(CSV_FILTER_BATCH);
+    st->masks = malloc(filter->depth * CSV_FILTER_BATCH);
+    if (st->slot_of == NULL || st->row_start == NULL || st->row_end == NULL || st->clean == NULL || st->masks == NULL) return -1;
+
+    for (int j = 0; j < st->cols; j++) st->slot_of[j] = -1;
+    for (int s = 0; s < filter->nslots; s++){
+        st->slot_of[filter->slot_col[s]] = s;
+        st->cell_off[s] = malloc(CSV_FILTER_BATCH * sizeof *st->cell_off[s]);
+        st->cell_len[s] = malloc(CSV_FILTER_BATCH * sizeof *st->cell_len[s]);
+        st->num[s] = malloc(CSV_FILTER_BATCH * sizeof *st->num[s]);
+        if (st->cell_off[s] == NULL || st->cell_len[s] == NULL || st->num[s] == NULL) return -1;
+    }
+    return 1;
+}
+
+int csv_filter_stream(FILE *results, FILE *content, const char *spec){
+    struct CSVFilter *filter = malloc(sizeof *filter);
+    struct FilterStream st = {0};
+    st.filter = filter;
+    st.results = results;
+    st.cap = CSV_FILTER_BLOCK;
+    st.buf = malloc(st.cap);
+    st.delims = malloc(CSV_SCAN_BYTES * sizeof *st.delims);
+
+    int rv = filter != NULL && st.buf != NULL && st.delims != NULL ? 1 : -1;
+    if (rv == 1) rv = start_stream(&st, content, spec);
+
+    while (rv == 1){
+        size_t done = filter_rows(&st);
+        flush_batch(&st);
+        memmove(st.buf, st.buf + done, st.size - done);
+        st.size -= done;
+
+        if (st.eof) break;
+        rv = read_more(&st, content);
+    }
+
+    for (int s = 0; s < CSV_FILTER_MAX_TESTS; s++){
+        free(st.cell_off[s]);
+        free(st.cell_len[s]);
+        free(st.num[s]);
+    }
+    free(st.slot_of);
+    free(st.row_start);
+    free(st.row_end);
+    free(st.clean);
+    free(st.masks);
+    free(st.delims);
+    free(st.buf);
+    free(filter);
+    return rv;
+}
@@ -0,0 +1,105 @@
+/*
+ * filter_csv.h -- streaming csvfilter: row tests compiled once, run over batches of rows
+ */
+
+#ifndef FILTER_CSV_H
+#define FILTER_CSV_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+
+#include "./parse_csv.h"
+#include "./sort_csv.h"
+#include "../text_kernels.h"
+
+#define CSV_FILTER_MAX_TESTS 16       // comparisons one csvfilter can make (a range is two)
+#define CSV_FILTER_MAX_TOKENS 64
+#define CSV_FILTER_BLOCK (1L << 20)   // input read this much at a time; only a longer row makes it grow
+#define CSV_FILTER_BATCH 4096         // rows tested together, one test at a time: 32 KB of numbers per column
+
+// comparisons; a number constant compares cells as numbers, anything else as bytes
+#define CSV_CMP_EQ TEXT_CMP_EQ
+#define CSV_CMP_NE TEXT_CMP_NE
+#define CSV_CMP_LT TEXT_CMP_LT
+#define CSV_CMP_LE TEXT_CMP_LE
+#define CSV_CMP_GT TEXT_CMP_GT
+#define CSV_CMP_GE TEXT_CMP_GE
+#define CSV_CMP_PREFIX 6
+
+// filter program instructions, run on a stack of row masks
+#define CSV_OP_TEST 0  // push the mask of rows passing test arg
+#define CSV_OP_AND 1   // pop two masks, push their AND
+#define CSV_OP_OR 2    // pop two masks, push their OR
+
+/*
+ * CSVTest -- one column compared with a constant
+ *
+ * col -- the column; slot -- where a batch keeps its cells (tests on the same column share one)
+ * cmp -- CSV_CMP_*
+ * numeric -- the constant is a number: cells are read as numbers, and ones that aren't never pass
+ * number, *text, len -- the constant
+ */
+struct CSVTest {
+    int col;
+    int slot;
+    int cmp;
+    int numeric;
+    double number;
+    const char *text;
+    size_t len;
+};
+
+/*
+ * CSVFilterOp -- one instruction: op is CSV_OP_*, arg the test for CSV_OP_TEST
+ */
+struct CSVFilterOp {
+    int op;
+    int arg;
+};
+
+/*
+ * CSVFilter -- a compiled csvfilter expression
+ *
+ * tests, ntests -- every comparison in it
+ * program, nops -- postfix over the tests' masks; depth is the most masks it holds at once
+ * slot_col, nslots -- the columns the tests read, one slot each
+ * text -- the spec cut into tokens, which the tests' constants point into
+ */
+struct CSVFilter {
+    struct CSVTest tests[CSV_FILTER_MAX_TESTS];
+    int ntests;
+
+    struct CSVFilterOp program[2 * CSV_FILTER_MAX_TESTS];
+    int nops;
+    int depth;
+
+    int slot_col[CSV_FILTER_MAX_TESTS];
+    int nslots;
+
+    char text[2 * MAXBUFSIZE];
+};
+
+/*
+ * csv_filter_compile() -- compile a csvfilter spec against head's header row:
+ *
+ *   spec := test [and|or test ...]       (and binds tighter than or; && and || work too)
+ *   test := column op value | column in [low]..[high] | column value (the old form: equal to value)
+ *   op   := = != < <= > >= ^=            (^= is "starts with")
+ *
+ * Spaces around op can be left out ("Age>=30"); a column or value with spaces in it goes in double
+ * quotes. Returns 1, or -1 if it doesn't parse, names a column head doesn't have or has too many tests
+ */
+int csv_filter_compile(struct CSVFilter *filter, struct CSV *head, const char *spec);
+
+/*
+ * csv_filter_stream() -- the header row of content and every row below it the spec (see csv_filter_compile())
+ * passes, to results, as csv_write_row() would write them. Reads CSV_FILTER_BLOCK at a time, so memory
+ * stays the same however big the input. 1 on success, -1 if the spec is bad, content is empty or memory runs out
+ */
+int csv_filter_stream(FILE *results, FILE *content, const char *spec);
+
+#endif
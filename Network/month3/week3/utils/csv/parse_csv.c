@@ -1,179 +1,379 @@
 /*
- * parse_csv.c -- Two-pass CSV parser with chunked I/O and buffer boundary handling
+ * parse_csv.c -- Single-pass CSV indexer over a mapping of the file
  *
- * Parses CSV files into a 3D array structure (rows x columns x characters).
- * First pass counts dimensions, second pass allocates memory and populates data.
- * Handles quoted fields, embedded commas, and words split across read boundaries.
+ * The file is mapped (or read into one buffer when it can't be, like a chain stage's in-memory output)
+ * and text_csv_scan() finds every comma and newline outside quotes, 64 bytes at a time with SIMD masks.
+ * Each field between two of them becomes an (offset, length) pair in its column's arrays, so nothing is
+ * copied and there's no allocation per cell: the columns grow by doubling.
  */
 
 #include "./parse_csv.h"
 
 /*
- * get_size() -- count CSV dimensions (rows and columns) in first pass
+ * Indexer -- state while walking the delimiters
  *
- * Reads file in chunks, counting newlines for rows and commas in first row
- * for columns. Resets file position to start when done. Handles files
- * without trailing newlines.
+ * store -- index cells; without it only rows and header columns are counted
+ * header -- row 0 is the header and decides cols; otherwise cols was given and row 0 is like any other
+ * row, col -- cell the next field goes to
+ * *head_off, *head_len, head_cap -- header cells, collected until the header row ends and cols is known
+ * failed -- a cell was too long for a 32-bit length
  */
-void get_size(FILE *fptr, int *rows, int *cols){
-    char content_read[MAXFILEREAD];
-    int bytes_read;
-
-    int total_newlines = 0;
-    *cols = 1;
-    char last_char = '\0';
-
-    while ((bytes_read = fread(content_read, sizeof(char), MAXFILEREAD, fptr)) > 0){
-        for (int i = 0; i < bytes_read; i++){
-            if (content_read[i] == '\n') {
-                total_newlines++;
-            }
-            else if (total_newlines <= 0 && content_read[i] == ',') {
-                (*cols)++;
-            }
-            last_char = content_read[i];
+struct Indexer {
+    struct CSV *csv;
+    int store;
+    int header;
+
+    long row;
+    int col;
+
+    size_t *head_off;
+    uint32_t *head_len;
+    int head_cap;
+
+    int failed;
+};
+
+/*
+ * load_input() -- point csv->data at the rest of fptr, mapped if it's a regular file. -1 if it can't be read
+ */
+static int load_input(struct CSV *csv, FILE *fptr){
+    int fd = fileno(fptr);
+    off_t pos = ftello(fptr);
+    struct stat st;
+
+    csv->data = NULL;
+    csv->size = 0;
+    csv->map = NULL;
+    csv->map_len = 0;
+
+    if (fd != -1 && pos != -1 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)){
+        if (st.st_size <= pos) return 1;
+
+        // populated up front: one scan touches every page anyway, and faulting them in one at a time costs more
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        if (map != MAP_FAILED){
+            csv->map = map;
+            csv->map_len = st.st_size;
+            csv->data = (char *)map + pos;
+            csv->size = st.st_size - pos;
+            return 1;
         }
     }
 
+    size_t cap = TEXT_BLOCK_BYTES;
+    char *buf = malloc(cap);
+    size_t bytes_read;
+    if (buf == NULL) return -1;
 
+    while ((bytes_read = fread(buf + csv->size, 1, cap - csv->size, fptr)) > 0){
+        csv->size += bytes_read;
+        if (csv->size < cap) continue;
 
-    *rows = total_newlines;
-    if (last_char != '\n' && last_char != '\0') {
-        (*rows)++;
+        char *grown = realloc(buf, cap * 2);
+        if (grown == NULL){
+            free(buf);
+            return -1;
+        }
+        buf = grown;
+        cap *= 2;
     }
-    
-    fseek(fptr, 0, SEEK_SET);   
+
+    csv->data = buf;
+    return 1;
 }
 
 /*
- * populate_csv() -- second pass: parse and store CSV data with buffer boundary handling
- *
- * Reads file in chunks, handling:
- * - Quoted fields (commas inside quotes don't delimit)
- * - Words split across chunk boundaries (tempbuf carries partial words)
- * - Space handling (spaces within fields, not just delimiters)
- * - Final cells without trailing newline
- *
- * Uses tempbuf to preserve partial words when chunk ends mid-field.
- * Example: "Port" at end of chunk combines with "land" in next chunk → "Portland"
+ * grow_columns() -- make room for cap rows in every column
  */
-void populate_csv(struct CSV *csv, FILE *fptr){
-    char content[MAXFILEREAD];
-    int bytes_read;
-
-    int ignore_comma = 0;
-    int len_cur_word = 0;
-    int start_index = 0;
-    int reading_word = 0;
-
-    int row = 0;
-    int col = 0;
-
-    char tempbuf[MAXFILEREAD];
-    tempbuf[0] = '\0';
-
-    while ((bytes_read = fread(content, sizeof(char), MAXFILEREAD, fptr)) > 0){
-        for (int i = 0; i < bytes_read; i++){
-            if (content[i] == '"'){
-                if (ignore_comma) ignore_comma = 0;
-                else ignore_comma = 1;
-
-                if (reading_word == 0){
-                    start_index = i;
-                    reading_word = 1;
-                } else {
-                    len_cur_word++;
-                }
-                continue;
+static int grow_columns(struct CSV *csv, long cap){
+    for (int j = 0; j < csv->cols; j++){
+        size_t *off = realloc(csv->columns[j].off, cap * sizeof *off);
+        if (off != NULL) csv->columns[j].off = off;
+        uint32_t *len = realloc(csv->columns[j].len, cap * sizeof *len);
+        if (len != NULL) csv->columns[j].len = len;
+        if (off == NULL || len == NULL) return -1;
+    }
+    csv->cap = cap;
+    return 1;
+}
+
+/*
+ * set_cell() -- record a cell of the header row or, once the columns exist, of any other
+ */
+static void set_cell(struct Indexer *ix, size_t off, size_t len){
+    if (len > UINT32_MAX){
+        ix->failed = 1;
+        return;
+    }
+
+    if (ix->header){
+        if (ix->col == ix->head_cap){
+            int cap = ix->head_cap > 0 ? ix->head_cap * 2 : 16;
+            size_t *off = realloc(ix->head_off, cap * sizeof *off);
+            if (off != NULL) ix->head_off = off;
+            uint32_t *lens = realloc(ix->head_len, cap * sizeof *lens);
+            if (lens != NULL) ix->head_len = lens;
+            if (off == NULL || lens == NULL){
+                ix->failed = 1;
+                return;
             }
+            ix->head_cap = cap;
+        }
+        ix->head_off[ix->col] = off;
+        ix->head_len[ix->col] = len;
+        return;
+    }
 
-            if ((content[i] == '\n' || content[i] == ',') && ignore_comma == 0){
-                int buf_len = strlen(tempbuf);
-                csv->csv_data[row][col] = malloc(len_cur_word+buf_len+1);
+    if (ix->col < ix->csv->cols){
+        ix->csv->columns[ix->col].off[ix->row] = off;
+        ix->csv->columns[ix->col].len[ix->row] = len;
+    }
+}
 
-                if (buf_len > 0){
-                    memcpy(csv->csv_data[row][col], tempbuf, buf_len);
-                }
+/*
+ * add_field() -- the field in data[start, end): leading spaces are skipped, and one that opens with a quote
+ * drops its last byte
+ */
+static void add_field(struct Indexer *ix, size_t start, size_t end){
+    if (ix->store){
+        const char *data = ix->csv->data;
+        while (start < end && data[start] == ' ') start++;
 
-                memcpy(csv->csv_data[row][col]+buf_len, content+start_index, len_cur_word);
-                csv->csv_data[row][col][len_cur_word+buf_len] = '\0';
+        size_t len = end - start;
+        if (len > 0 && data[start] == '"') len--;
+        set_cell(ix, start, len);
+    }
+    ix->col++;
+}
 
-                len_cur_word = 0;
-                reading_word = 0;
+/*
+ * end_row() -- finish the row: the header row fixes cols and creates the columns, others are padded out
+ */
+static void end_row(struct Indexer *ix){
+    struct CSV *csv = ix->csv;
 
-                if (content[i] == '\n'){
-                    row++;
-                    col = 0;
-                } else {
-                    col++;
-                }
+    if (ix->header){
+        ix->header = 0;
+        csv->cols = ix->col;
+        if (ix->store && !ix->failed){
+            // a guess from the header's length; grow_columns() doubles from there
+            long guess = csv->size / (ix->head_off[ix->col - 1] + ix->head_len[ix->col - 1] + 1) + 16;
+            if (guess > CSV_INITIAL_ROWS) guess = CSV_INITIAL_ROWS;
+            csv->columns = calloc(csv->cols, sizeof *csv->columns);
+            if (csv->columns == NULL || grow_columns(csv, guess) == -1) ix->failed = 1;
 
-                tempbuf[0] = '\0';
-                continue;
+            for (int j = 0; j < csv->cols && !ix->failed; j++){
+                csv->columns[j].off[0] = ix->head_off[j];
+                csv->columns[j].len[0] = ix->head_len[j];
             }
+        }
+    } else if (ix->store){
+        for (int j = ix->col; j < csv->cols; j++){
+            csv->columns[j].off[ix->row] = 0;
+            csv->columns[j].len[ix->row] = 0;
+        }
+    }
 
-            if (content[i] == ' '){
-                if (reading_word) len_cur_word++;  // Spaces inside fields are part of the word
-                continue;
-            }
+    ix->row++;
+    ix->col = 0;
+    if (ix->store && !ix->failed && ix->row == csv->cap && grow_columns(csv, csv->cap * 2) == -1) ix->failed = 1;
+}
 
-            if (reading_word != 1){
-                start_index = i;
-                reading_word = 1;
-            }
+/*
+ * index_csv() -- walk every unquoted delimiter of csv->data once, indexing cells if store is set. With cols > 0
+ * there's no header row: every row has cols cells
+ */
+static int index_csv(struct CSV *csv, int store, int cols){
+    struct Indexer ix = {0};
+    ix.csv = csv;
+    ix.store = store;
+    ix.header = cols == 0;
+
+    csv->rows = 0;
+    csv->cols = cols > 0 ? cols : 1;
+    csv->columns = NULL;
+    csv->cap = 0;
+
+    if (!ix.header){
+        // a guess of 8 bytes a cell; grow_columns() doubles from there
+        long guess = csv->size / (8 * cols) + 16;
+        if (guess > CSV_INITIAL_ROWS) guess = CSV_INITIAL_ROWS;
+        csv->columns = calloc(cols, sizeof *csv->columns);
+        if (csv->columns == NULL || grow_columns(csv, guess) == -1) return -1;
+    }
 
-            len_cur_word++;
+    uint32_t *delims = malloc(CSV_SCAN_BYTES * sizeof *delims);
+    if (delims == NULL) return -1;
+
+    const unsigned char *data = (const unsigned char *)csv->data;
+    int in_quotes = 0;
+    size_t field = 0;
+
+    for (size_t base = 0; base < csv->size && !ix.failed; base += CSV_SCAN_BYTES){
+        size_t len = csv->size - base < CSV_SCAN_BYTES ? csv->size - base : CSV_SCAN_BYTES;
+        size_t n = text_csv_scan(data + base, len, &in_quotes, delims);
+
+        size_t k = 0;
+        for (; k < n && !ix.failed; k++){
+            // past the header, counting only needs the newlines
+            if (!store && !ix.header) break;
+
+            size_t at = base + delims[k];
+            add_field(&ix, field, at);
+            if (data[at] == '\n') end_row(&ix);
+            field = at + 1;
         }
-        // Save incomplete word to tempbuf for next chunk
-        if (len_cur_word > 0){
-            memcpy(tempbuf, content+start_index, len_cur_word);
-            tempbuf[len_cur_word] = '\0';
-            start_index = 0;
-            len_cur_word = 0;
+        for (; k < n && !store; k++){
+            size_t at = base + delims[k];
+            int newline = data[at] == '\n';
+            ix.row += newline;
+            ix.col = newline ? 0 : ix.col + 1;
+            field = at + 1;
         }
     }
-    // Handle final cell if file doesn't end with newline
-    int buf_len = strlen(tempbuf);
-    if ( buf_len > 0){
-        csv->csv_data[row][col] = malloc(buf_len+1);
-        memcpy(csv->csv_data[row][col], tempbuf, buf_len);
-        csv->csv_data[row][col][buf_len] = '\0';
+
+    // a last row with no newline after it (or an unterminated quote running to the end)
+    if (!ix.failed && (field < csv->size || ix.col > 0)){
+        add_field(&ix, field, csv->size);
+        end_row(&ix);
     }
+
+    csv->rows = ix.row;
+    free(ix.head_off);
+    free(ix.head_len);
+    free(delims);
+    return ix.failed ? -1 : 1;
 }
 
 /*
- * parse_csv() -- main entry point: allocate 3-level CSV structure and populate
+ * get_size() -- count CSV dimensions (rows and columns) without indexing
  *
- * Three-level malloc:
- *   Level 1: Array of row pointers
- *   Level 2: Array of column pointers per row
- *   Level 3: Individual cell strings (allocated in populate_csv)
+ * A row ends at every newline outside quotes, plus one for a last row without a trailing newline;
+ * columns are the fields of the first row.
+ */
+int get_size(FILE *fptr, long *rows, int *cols){
+    struct CSV csv;
+    if (load_input(&csv, fptr) == -1) return -1;
+
+    int rv = index_csv(&csv, 0, 0);
+    *rows = csv.rows;
+    *cols = csv.cols;
+    free_csv(&csv);
+    return rv;
+}
+
+/*
+ * parse_csv() -- main entry point: load the input and index every cell
  *
- * Access pattern: csv->csv_data[row][col] returns char*
+ * Access pattern: csv_cell(csv, row, col, &len)
  */
-void parse_csv(struct CSV *csv, FILE *fptr){
-    get_size(fptr, &csv->rows, &csv->cols);
-    int rows = csv->rows;
-    int cols = csv->cols;
+int parse_csv(struct CSV *csv, FILE *fptr){
+    if (load_input(csv, fptr) == -1) return -1;
+    if (index_csv(csv, 1, 0) == -1){
+        free_csv(csv);
+        return -1;
+    }
+    return 1;
+}
+
+int csv_index_buffer(struct CSV *csv, char *data, size_t size, int cols){
+    csv->data = data;
+    csv->size = size;
+    csv->map = NULL;
+    csv->map_len = 0;
 
-    csv->csv_data = malloc(rows * sizeof(char**));
-    for (int i = 0; i < rows; i++) {
-        csv->csv_data[i] = malloc(cols * sizeof(char*));
+    if (index_csv(csv, 1, cols) == -1){
+        free_csv(csv);
+        return -1;
     }
+    return 1;
+}
+
+void free_csv(struct CSV *csv){
+    if (csv->map != NULL) munmap(csv->map, csv->map_len);
+    else free((char *)csv->data);
 
-    populate_csv(csv, fptr);
+    if (csv->columns != NULL){
+        for (int j = 0; j < csv->cols; j++){
+            free(csv->columns[j].off);
+            free(csv->columns[j].len);
+        }
+        free(csv->columns);
+    }
+
+    csv->data = NULL;
+    csv->map = NULL;
+    csv->columns = NULL;
+}
+
+int csv_find_column(struct CSV *csv, const char *name){
+    size_t name_len = strlen(name);
+
+    for (int j = 0; j < csv->cols && csv->rows > 0; j++){
+        size_t len;
+        const char *cell = csv_cell(csv, 0, j, &len);
+        if (len == name_len && memcmp(cell, name, len) == 0) return j;
+    }
+    return -1;
+}
+
+void csv_write_row(struct CSV *csv, long row, FILE *out){
+    for (int j = 0; j < csv->cols; j++){
+        size_t len;
+        const char *cell = csv_cell(csv, row, j, &len);
+        if (j > 0) fputc(',', out);
+        fwrite(cell, 1, len, out);
+    }
+    fputc('\n', out);
+}
+
+void csv_write_rows(struct CSV *csv, const long *rows, long count, FILE *out){
+    char *buf = malloc(CSV_WRITE_BYTES);
+    size_t used = 0;
+
+    for (long i = 0; i < count; i++){
+        // rows come in any order, so start loading the cell positions of a row a little way ahead, and the
+        // text of one closer, before they're needed
+        if (i + 2 * CSV_PREFETCH_ROWS < count){
+            for (int j = 0; j < csv->cols; j++){
+                __builtin_prefetch(&csv->columns[j].off[rows[i + 2 * CSV_PREFETCH_ROWS]]);
+                __builtin_prefetch(&csv->columns[j].len[rows[i + 2 * CSV_PREFETCH_ROWS]]);
+            }
+        }
+        if (i + CSV_PREFETCH_ROWS < count){
+            for (int j = 0; j < csv->cols; j++) __builtin_prefetch(csv->data + csv->columns[j].off[rows[i + CSV_PREFETCH_ROWS]]);
+        }
+
+        size_t need = csv->cols;
+        for (int j = 0; j < csv->cols; j++) need += csv->columns[j].len[rows[i]];
+
+        if (buf == NULL || used + need > CSV_WRITE_BYTES){
+            if (used > 0) fwrite(buf, 1, used, out);
+            used = 0;
+        }
+        if (buf == NULL || need > CSV_WRITE_BYTES){
+            csv_write_row(csv, rows[i], out);
+            continue;
+        }
+
+        for (int j = 0; j < csv->cols; j++){
+            size_t len;
+            const char *cell = csv_cell(csv, rows[i], j, &len);
+            if (j > 0) buf[used++] = ',';
+            memcpy(buf + used, cell, len);
+            used += len;
+        }
+        buf[used++] = '\n';
+    }
+
+    if (used > 0) fwrite(buf, 1, used, out);
+    free(buf);
 }
 
 /*
  * print_csv() -- debug function to output CSV structure to stdout
  */
 void print_csv(struct CSV *csv){
-    printf("Rows: %d, Cols: %d\n", csv->rows, csv->cols);
-    for (int i = 0; i < csv->rows; i++) {
-        for (int j = 0; j < csv->cols; j++) {
-            printf("%s", csv->csv_data[i][j]);
-            if (j < csv->cols - 1) printf(",");
-        }
-        printf("\n");
-    }
-}
\ No newline at end of file
+    printf("Rows: %ld, Cols: %d\n", csv->rows, csv->cols);
+    for (long i = 0; i < csv->rows; i++) csv_write_row(csv, i, stdout);
+}
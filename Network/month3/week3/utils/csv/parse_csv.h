@@ -8,32 +8,88 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "../../common.h"
+#include "../text_kernels.h"
+
+// the input is scanned for delimiters CSV_SCAN_BYTES at a time, so their offsets fit a small buffer
+#define CSV_SCAN_BYTES (64 << 10)
+#define CSV_INITIAL_ROWS (1L << 20)  // most rows the columns start with room for, before doubling
+#define CSV_WRITE_BYTES (256 << 10)  // csv_write_rows() writes rows out in blocks this big
+#define CSV_PREFETCH_ROWS 8          // and starts loading a row's cells this many rows before it's written
+
+/*
+ * CSVColumn -- one column's cells, by row
+ *
+ * off[row], len[row] -- where the cell's text is in the CSV's data
+ */
+struct CSVColumn {
+    size_t *off;
+    uint32_t *len;
+};
 
 /*
- * struct CSV -- Three-level pointer structure for CSV data
+ * struct CSV -- the input plus the position of every cell in it; no cell is copied
  *
- * Access: csv->csv_data[row][col] returns char* (string)
- * Example: csv->csv_data[1][2] = "Portland" (row 1, column 2)
+ * *data, size -- the input: inside a read-only mapping of the file, or a malloc()ed copy if it couldn't be mapped
+ * *map, map_len -- the mapping to release, NULL if data is a copy
+ * rows, cols -- rows including the header row 0; columns in the header row
+ * *columns -- cols columns of rows cells each. Short rows are padded with empty cells, extra cells are dropped
+ * cap -- rows each column has room for
+ *
+ * A cell is its field with the leading spaces dropped. Commas and newlines between double quotes don't
+ * end a field and the quotes stay in the text, except that a field opening with a quote loses its last
+ * byte -- the closing quote, normally -- which is how the old copying parser always cut them.
+ * Example: csv_cell(csv, 1, 2, &len) = "Portland" (row 1, column 2)
  */
 struct CSV {
-    int rows;
+    const char *data;
+    size_t size;
+    void *map;
+    size_t map_len;
+
+    long rows;
     int cols;
-    char ***csv_data;
+    struct CSVColumn *columns;
+    long cap;
 };
 
-/* Count CSV dimensions without full parsing (resets file position) */
-void get_size(FILE *fptr, int *rows, int *cols);
+/* Count rows and header columns without indexing the cells. *cols is 1 for an empty input */
+int get_size(FILE *fptr, long *rows, int *cols);
 
-/* Parse CSV into structure with buffer boundary handling */
-void populate_csv(struct CSV *csv, FILE *fptr);
+/* Map (or read) the rest of fptr and index every cell. 1 on success, -1 if it can't be read or a cell is over 4 GB */
+int parse_csv(struct CSV *csv, FILE *fptr);
 
-/* Allocate CSV structure and parse file (main entry point) */
-void parse_csv(struct CSV *csv, FILE *fptr);
+/*
+ * Index size bytes of a malloc()ed buffer, which the CSV takes over. With cols 0 the first row is the header,
+ * as in parse_csv(); otherwise every row, row 0 included, is data with cols cells. 1 on success, -1 if not
+ */
+int csv_index_buffer(struct CSV *csv, char *data, size_t size, int cols);
+
+/* Unmap/free the input and the index */
+void free_csv(struct CSV *csv);
+
+/* Column whose header cell is name, -1 if there's none */
+int csv_find_column(struct CSV *csv, const char *name);
+
+/* Write row as its cells joined by commas, plus a newline */
+void csv_write_row(struct CSV *csv, long row, FILE *out);
+
+/* csv_write_row() for each of count rows, in the order given, a block at a time */
+void csv_write_rows(struct CSV *csv, const long *rows, long count, FILE *out);
 
 /* Debug output to stdout */
 void print_csv(struct CSV *csv);
 
-#endif
\ No newline at end of file
+/* Text and length of a cell (not NUL-terminated) */
+static inline const char *csv_cell(const struct CSV *csv, long row, int col, size_t *len){
+    *len = csv->columns[col].len[row];
+    return csv->data + csv->columns[col].off[row];
+}
+
+#endif
@@ -0,0 +1,547 @@
+/*
+ * sort_csv.c -- typed, multi-column sort of a CSV's rows
+ *
+ * Every cell of a sort column is turned into a 64-bit key once, so a comparison is an integer compare
+ * instead of a strcmp(). Ints, floats and dates get keys whose unsigned order is the value's order and
+ * are LSD radix sorted, a byte per pass. Strings get their first 16 bytes big-endian and their length as
+ * the key, so only two cells that agree on 16 bytes and are both longer are ever read again, and are merge
+ * sorted: runs of CSV_SORT_RUN rows first, then rounds of merges, each split across the tile pool's threads
+ * by merge path so the last few big merges still use all of them.
+ *
+ * Several columns are sorted least significant first, which works because every pass is stable.
+ */
+
+#include "./sort_csv.h"
+
+/*
+ * SortItem -- a row and its key for the column being sorted on
+ */
+struct SortItem {
+    uint64_t key;
+    long row;
+};
+
+/*
+ * StringItem -- a row and its string cell's key: hi, lo are its first 16 bytes big-endian, zero-padded
+ */
+struct StringItem {
+    uint64_t hi;
+    uint64_t lo;
+    long row;
+    uint32_t len;
+};
+
+static const char *type_names[] = {"auto", "int", "float", "date", "string"};
+
+const char *csv_type_name(int type){
+    return type_names[type];
+}
+
+/*
+ * typed_text() -- the part of a cell a number or date is read from: an opening quote and trailing spaces dropped
+ */
+static const char *typed_text(const char *cell, size_t *len){
+    if (*len > 0 && cell[0] == '"'){
+        cell++;
+        (*len)--;
+    }
+    while (*len > 0 && cell[*len - 1] == ' ') (*len)--;
+    return cell;
+}
+
+/*
+ * parse_int() -- an optional sign and 1-18 digits, so it can't overflow (longer ones are left to parse_float())
+ */
+static int parse_int(const char *s, size_t len, int64_t *out){
+    size_t i = 0;
+    int negative = 0;
+    if (len > 0 && (s[0] == '-' || s[0] == '+')){
+        negative = s[0] == '-';
+        i++;
+    }
+    if (i == len || len - i > 18) return 0;
+
+    int64_t v = 0;
+    for (; i < len; i++){
+        if (s[i] < '0' || s[i] > '9') return 0;
+        v = v * 10 + (s[i] - '0');
+    }
+    *out = negative ? -v : v;
+    return 1;
+}
+
+/*
+ * parse_float() -- a decimal number strtod() takes all of: digits, sign, point and exponent only, so no
+ * "inf", "nan" or hex. Up to 15 significant digits and 22 decimals without an exponent, the usual shape,
+ * are exact integers divided by an exact power of ten, which rounds the same as strtod() without calling it
+ */
+static int parse_float(const char *s, size_t len, double *out){
+    static const double powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    size_t i = 0;
+    int negative = 0;
+    if (len > 0 && (s[0] == '-' || s[0] == '+')){
+        negative = s[0] == '-';
+        i++;
+    }
+
+    uint64_t mantissa = 0;
+    int significant = 0, decimals = 0, point = 0, digits = 0;
+    for (; i < len; i++){
+        if (s[i] >= '0' && s[i] <= '9'){
+            if (mantissa > 0 || s[i] != '0') significant++;
+            mantissa = mantissa * 10 + (s[i] - '0');
+            decimals += point;
+            digits = 1;
+        } else if (s[i] == '.' && !point) point = 1;
+        else break;
+    }
+
+    if (i == len && digits && significant <= 15 && decimals <= 22){
+        *out = (negative ? -1.0 : 1.0) * ((double)mantissa / powers[decimals]);
+        return 1;
+    }
+
+    char buf[64];
+    if (len == 0 || len >= sizeof buf) return 0;
+
+    digits = 0;
+    for (i = 0; i < len; i++){
+        if (s[i] >= '0' && s[i] <= '9') digits = 1;
+        else if (strchr("+-.eE", s[i]) == NULL || s[i] == '\0') return 0;
+    }
+    if (!digits) return 0;
+
+    memcpy(buf, s, len);
+    buf[len] = '\0';
+    char *end;
+    *out = strtod(buf, &end);
+    return end == buf + len;
+}
+
+int csv_cell_number(const char *cell, size_t len, double *out){
+    cell = typed_text(cell, &len);
+    return parse_float(cell, len, out);
+}
+
+/*
+ * read_number() -- the value of the n digits at s, -1 if any of them isn't one
+ */
+static int read_number(const char *s, int n){
+    int v = 0;
+    for (int i = 0; i < n; i++){
+        if (s[i] < '0' || s[i] > '9') return -1;
+        v = v * 10 + (s[i] - '0');
+    }
+    return v;
+}
+
+/*
+ * parse_date() -- YYYY-MM-DD, optionally followed by ' ' or 'T' and HH:MM or HH:MM:SS, as a count that
+ * orders like the date (months are 31 days long, which doesn't matter for ordering). Always above 0
+ */
+static int parse_date(const char *s, size_t len, uint64_t *out){
+    if (len != 10 && len != 16 && len != 19) return 0;
+    if (s[4] != '-' || s[7] != '-') return 0;
+
+    int year = read_number(s, 4), month = read_number(s + 5, 2), day = read_number(s + 8, 2);
+    int hour = 0, minute = 0, second = 0;
+    if (len > 10){
+        if ((s[10] != ' ' && s[10] != 'T') || s[13] != ':') return 0;
+        hour = read_number(s + 11, 2);
+        minute = read_number(s + 14, 2);
+        if (len == 19){
+            if (s[16] != ':') return 0;
+            second = read_number(s + 17, 2);
+        }
+    }
+
+    if (year < 0 || month < 1 || month > 12 || day < 1 || day > 31) return 0;
+    if (hour < 0 || hour > 23 || minute < 0 || minute > 59 || second < 0 || second > 60) return 0;
+
+    *out = ((((((uint64_t)year * 12 + month - 1) * 31 + day - 1) * 24 + hour) * 60 + minute) * 61 + second) + 1;
+    return 1;
+}
+
+/*
+ * prefix_key() -- 8 bytes of cell from start, big-endian, zero-padded past its end
+ */
+static uint64_t prefix_key(const char *cell, size_t len, size_t start){
+    uint64_t key = 0;
+    for (size_t i = start; i < start + 8; i++) key = key << 8 | (i < len ? (unsigned char)cell[i] : 0);
+    return key;
+}
+
+/*
+ * cell_key() -- for a number or date cell, a key whose unsigned order is the order of the values; 0 (lowest)
+ * for an empty cell or one that doesn't parse
+ */
+static uint64_t cell_key(const struct CSV *csv, long row, int col, int type){
+    size_t len;
+    const char *cell = csv_cell(csv, row, col, &len);
+    cell = typed_text(cell, &len);
+
+    int64_t i;
+    double d;
+    uint64_t date;
+
+    if (type == CSV_TYPE_INT && parse_int(cell, len, &i)) return (uint64_t)i ^ (1ULL << 63);
+    if (type == CSV_TYPE_DATE && parse_date(cell, len, &date)) return date;
+    if (type == CSV_TYPE_FLOAT && (parse_int(cell, len, &i) ? (d = i, 1) : parse_float(cell, len, &d))){
+        // IEEE 754 bits order like the values once negatives are flipped and positives have the sign bit set
+        uint64_t bits;
+        memcpy(&bits, &d, sizeof bits);
+        return bits >> 63 ? ~bits : bits | 1ULL << 63;
+    }
+    return 0;
+}
+
+int csv_column_type(struct CSV *csv, int col){
+    int is_int = 1, is_float = 1, is_date = 1, seen = 0;
+
+    for (long row = 1; row < csv->rows && (is_int || is_float || is_date); row++){
+        size_t len;
+        const char *cell = csv_cell(csv, row, col, &len);
+        cell = typed_text(cell, &len);
+        if (len == 0) continue;
+        seen = 1;
+
+        int64_t i;
+        double d;
+        uint64_t date;
+        if (is_int && !parse_int(cell, len, &i)) is_int = 0;
+        if (is_float && !is_int && !parse_float(cell, len, &d)) is_float = 0;
+        if (is_date && !parse_date(cell, len, &date)) is_date = 0;
+    }
+
+    if (!seen) return CSV_TYPE_STRING;
+    if (is_int) return CSV_TYPE_INT;
+    if (is_float) return CSV_TYPE_FLOAT;
+    if (is_date) return CSV_TYPE_DATE;
+    return CSV_TYPE_STRING;
+}
+
+int csv_parse_sort_keys(struct CSV *csv, const char *spec, struct CSVSortKey keys[CSV_SORT_MAX_KEYS]){
+    char word[MAXBUFSIZE];
+    int n = 0;
+
+    while (*spec != '\0'){
+        while (*spec == ' ') spec++;
+        size_t len = strcspn(spec, " ");
+        if (len == 0) break;
+        if (n == CSV_SORT_MAX_KEYS) return -1;
+
+        memcpy(word, spec, len);
+        word[len] = '\0';
+        spec += len;
+
+        struct CSVSortKey *key = &keys[n++];
+        key->type = CSV_TYPE_AUTO;
+        key->descending = 1;
+
+        // column[:option[:option]]
+        char *option = strchr(word, ':');
+        if (option != NULL) *option++ = '\0';
+        while (option != NULL){
+            char *next = strchr(option, ':');
+            if (next != NULL) *next++ = '\0';
+
+            int known = 0;
+            for (int t = 0; t < 5; t++){
+                if (strcmp(option, type_names[t]) == 0){
+                    key->type = t;
+                    known = 1;
+                }
+            }
+            if (strcmp(option, "asc") == 0 || strcmp(option, "desc") == 0){
+                key->descending = option[0] == 'd';
+                known = 1;
+            }
+            if (!known) return -1;
+            option = next;
+        }
+
+        key->col = csv_find_column(csv, word);
+        if (key->col == -1) return -1;
+    }
+
+    return n > 0 ? n : -1;
+}
+
+/*
+ * radix_sort() -- stable LSD radix sort of items by key, a byte per pass through tmp, skipping the bytes
+ * every key has the same. The sorted items end up in items
+ */
+static void radix_sort(struct SortItem *items, struct SortItem *tmp, long count){
+    long counts[8][256] = {{0}};
+
+    for (long i = 0; i < count; i++){
+        uint64_t key = items[i].key;
+        for (int b = 0; b < 8; b++) counts[b][(key >> (b * 8)) & 0xff]++;
+    }
+
+    struct SortItem *src = items, *dst = tmp;
+    for (int b = 0; b < 8; b++){
+        long *c = counts[b];
+        if (c[(src[0].key >> (b * 8)) & 0xff] == count) continue;
+
+        long sum = 0;
+        for (int v = 0; v < 256; v++){
+            long n = c[v];
+            c[v] = sum;
+            sum += n;
+        }
+        for (long i = 0; i < count; i++) dst[c[(src[i].key >> (b * 8)) & 0xff]++] = src[i];
+
+        struct SortItem *swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    if (src != items) memcpy(items, src, count * sizeof *items);
+}
+
+/*
+ * StringSort -- a merge sort of one string column, shared by the tiles working on it
+ *
+ * *csv, col, descending -- what's compared
+ * *src, *dst -- the items and scratch space of the same size; every round merges from src into dst, then they swap
+ * count -- items
+ * width -- sorted length of the runs this round merges in pairs (0 while runs are being sorted)
+ * parts -- tiles each merge is split into
+ */
+struct StringSort {
+    const struct CSV *csv;
+    int col;
+    int descending;
+
+    struct StringItem *src;
+    struct StringItem *dst;
+    long count;
+
+    long width;
+    int parts;
+};
+
+/*
+ * item_cmp() -- <0, 0 or >0 as a goes before, with or after b in the sort's direction
+ */
+static inline int item_cmp(const struct StringSort *sort, const struct StringItem *a, const struct StringItem *b){
+    int cmp;
+    if (a->hi != b->hi) cmp = a->hi < b->hi ? -1 : 1;
+    else if (a->lo != b->lo) cmp = a->lo < b->lo ? -1 : 1;
+    else if (a->len <= 16 || b->len <= 16){
+        // the shorter cell is all there is of the longer one's first 16 bytes, so it's a prefix of it
+        cmp = (a->len > b->len) - (a->len < b->len);
+    } else {
+        size_t len_a, len_b;
+        const char *cell_a = csv_cell(sort->csv, a->row, sort->col, &len_a);
+        const char *cell_b = csv_cell(sort->csv, b->row, sort->col, &len_b);
+        cmp = memcmp(cell_a + 16, cell_b + 16, (len_a < len_b ? len_a : len_b) - 16);
+        if (cmp == 0) cmp = (len_a > len_b) - (len_a < len_b);
+    }
+    return sort->descending ? -cmp : cmp;
+}
+
+/*
+ * merge() -- stable merge of a[0..na) and b[0..nb) into out (ties go to a)
+ */
+static void merge(const struct StringSort *sort, const struct StringItem *a, long na, const struct StringItem *b, long nb, struct StringItem *out){
+    long i = 0, j = 0, k = 0;
+    while (i < na && j < nb){
+        if (item_cmp(sort, &b[j], &a[i]) < 0) out[k++] = b[j++];
+        else out[k++] = a[i++];
+    }
+    memcpy(out + k, a + i, (na - i) * sizeof *out);
+    memcpy(out + k + na - i, b + j, (nb - j) * sizeof *out);
+}
+
+/*
+ * co_rank() -- how many of the first k items of merge(a, b) come from a
+ */
+static long co_rank(const struct StringSort *sort, long k, const struct StringItem *a, long na, const struct StringItem *b, long nb){
+    long lo = k > nb ? k - nb : 0;
+    long hi = k < na ? k : na;
+
+    while (lo < hi){
+        long i = (lo + hi) / 2;
+        if (item_cmp(sort, &a[i], &b[k - i - 1]) <= 0) lo = i + 1;
+        else hi = i;
+    }
+    return lo;
+}
+
+/*
+ * sort_run() -- tile: sort run number tile, CSV_SORT_RUN items of src, with insertion sorts of 16 merged upward.
+ * The run ends up in src
+ */
+static int sort_run(void *arg, int tile){
+    struct StringSort *sort = arg;
+    long start = (long)tile * CSV_SORT_RUN;
+    long n = sort->count - start < CSV_SORT_RUN ? sort->count - start : CSV_SORT_RUN;
+    struct StringItem *items = sort->src + start, *tmp = sort->dst + start;
+
+    for (long lo = 0; lo < n; lo += 16){
+        long hi = lo + 16 < n ? lo + 16 : n;
+        for (long i = lo + 1; i < hi; i++){
+            struct StringItem item = items[i];
+            long j = i;
+            for (; j > lo && item_cmp(sort, &item, &items[j - 1]) < 0; j--) items[j] = items[j - 1];
+            items[j] = item;
+        }
+    }
+
+    struct StringItem *from = items, *to = tmp;
+    for (long width = 16; width < n; width *= 2){
+        for (long lo = 0; lo < n; lo += 2 * width){
+            long mid = lo + width < n ? lo + width : n;
+            long hi = lo + 2 * width < n ? lo + 2 * width : n;
+            merge(sort, from + lo, mid - lo, from + mid, hi - mid, to + lo);
+        }
+        struct StringItem *swap = from;
+        from = to;
+        to = swap;
+    }
+
+    if (from != items) memcpy(items, from, n * sizeof *items);
+    return 1;
+}
+
+/*
+ * merge_part() -- tile: part tile % parts of the merge of pair tile / parts this round. Each part writes its
+ * own slice of the output, with where it starts in both runs found by binary search
+ */
+static int merge_part(void *arg, int tile){
+    struct StringSort *sort = arg;
+    long pair = tile / sort->parts, part = tile % sort->parts;
+
+    long lo = pair * 2 * sort->width;
+    long mid = lo + sort->width < sort->count ? lo + sort->width : sort->count;
+    long hi = lo + 2 * sort->width < sort->count ? lo + 2 * sort->width : sort->count;
+    const struct StringItem *a = sort->src + lo, *b = sort->src + mid;
+    long na = mid - lo, nb = hi - mid;
+
+    long k0 = (na + nb) * part / sort->parts;
+    long k1 = (na + nb) * (part + 1) / sort->parts;
+    long i0 = co_rank(sort, k0, a, na, b, nb);
+    long i1 = co_rank(sort, k1, a, na, b, nb);
+
+    merge(sort, a + i0, i1 - i0, b + (k0 - i0), (k1 - i1) - (k0 - i0), sort->dst + lo + k0);
+    return 1;
+}
+
+/*
+ * string_sort() -- stable merge sort of items by their string cells; the sorted items end up in items
+ */
+static int string_sort(struct StringSort *sort, struct StringItem *items, struct StringItem *tmp, struct TilePool *tiles){
+    int threads = tiles != NULL && sort->count >= CSV_SORT_PARALLEL ? tiles->threads : 1;
+    if (threads == 1) tiles = NULL;
+
+    sort->src = items;
+    sort->dst = tmp;
+    sort->width = 0;
+    if (tile_pool_run(tiles, (int)((sort->count + CSV_SORT_RUN - 1) / CSV_SORT_RUN), sort_run, sort) == -1) return -1;
+
+    for (sort->width = CSV_SORT_RUN; sort->width < sort->count; sort->width *= 2){
+        long pairs = (sort->count + 2 * sort->width - 1) / (2 * sort->width);
+        // split merges so there are about two parts per thread, the last round included
+        sort->parts = pairs >= 2 * threads ? 1 : (2 * threads + pairs - 1) / pairs;
+        if (tile_pool_run(tiles, (int)(pairs * sort->parts), merge_part, sort) == -1) return -1;
+
+        struct StringItem *swap = sort->src;
+        sort->src = sort->dst;
+        sort->dst = swap;
+    }
+
+    if (sort->src != items) memcpy(items, sort->src, sort->count * sizeof *items);
+    return 1;
+}
+
+size_t csv_sort_key_bound(struct CSV *csv, long row, const struct CSVSortKey *keys, int nkeys){
+    size_t bound = 0;
+    for (int k = 0; k < nkeys; k++){
+        size_t len;
+        csv_cell(csv, row, keys[k].col, &len);
+        bound += keys[k].type == CSV_TYPE_STRING ? 2 * len + 2 : 8;
+    }
+    return bound;
+}
+
+size_t csv_encode_sort_key(struct CSV *csv, long row, const struct CSVSortKey *keys, int nkeys, unsigned char *out){
+    size_t n = 0;
+
+    for (int k = 0; k < nkeys; k++){
+        size_t start = n;
+
+        if (keys[k].type == CSV_TYPE_STRING){
+            // a 0 byte is escaped as 0 0xff and the string ends with 0 0, so no encoding is a prefix of another
+            // and memcmp() orders them like the strings
+            size_t len;
+            const char *cell = csv_cell(csv, row, keys[k].col, &len);
+            for (size_t i = 0; i < len; i++){
+                out[n++] = cell[i];
+                if (cell[i] == '\0') out[n++] = 0xff;
+            }
+            out[n++] = 0;
+            out[n++] = 0;
+        } else {
+            uint64_t key = cell_key(csv, row, keys[k].col, keys[k].type);
+            for (int b = 7; b >= 0; b--) out[n++] = key >> (b * 8);
+        }
+
+        // inverting every byte reverses the order
+        if (keys[k].descending){
+            for (size_t i = start; i < n; i++) out[i] = ~out[i];
+        }
+    }
+    return n;
+}
+
+int csv_sort_rows(struct CSV *csv, struct CSVSortKey *keys, int nkeys, long *rows, long count, struct TilePool *tiles){
+    if (count < 2) return 1;
+
+    // room for either kind of item, reused by every key
+    void *items = malloc(count * sizeof(struct StringItem));
+    void *tmp = malloc(count * sizeof(struct StringItem));
+    if (items == NULL || tmp == NULL){
+        free(items);
+        free(tmp);
+        return -1;
+    }
+
+    int rv = 1;
+    for (int k = nkeys - 1; k >= 0 && rv == 1; k--){
+        struct CSVSortKey *key = &keys[k];
+        if (key->type == CSV_TYPE_AUTO) key->type = csv_column_type(csv, key->col);
+
+        if (key->type == CSV_TYPE_STRING){
+            struct StringItem *strings = items;
+            for (long i = 0; i < count; i++){
+                size_t len;
+                const char *cell = csv_cell(csv, rows[i], key->col, &len);
+                strings[i].hi = prefix_key(cell, len, 0);
+                strings[i].lo = prefix_key(cell, len, 8);
+                strings[i].len = len;
+                strings[i].row = rows[i];
+            }
+
+            struct StringSort sort = {.csv = csv, .col = key->col, .descending = key->descending, .count = count};
+            rv = string_sort(&sort, strings, tmp, tiles);
+            for (long i = 0; i < count; i++) rows[i] = strings[i].row;
+        } else {
+            struct SortItem *values = items;
+            for (long i = 0; i < count; i++){
+                values[i].key = cell_key(csv, rows[i], key->col, key->type);
+                if (key->descending) values[i].key = ~values[i].key;
+                values[i].row = rows[i];
+            }
+
+            radix_sort(values, tmp, count);
+            for (long i = 0; i < count; i++) rows[i] = values[i].row;
+        }
+    }
+
+    free(items);
+    free(tmp);
+    return rv;
+}
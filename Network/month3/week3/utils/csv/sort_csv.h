@@ -0,0 +1,76 @@
+/*
+ * sort_csv.h -- typed, multi-column sort of a CSV's rows
+ */
+
+#ifndef SORT_CSV_H
+#define SORT_CSV_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "./parse_csv.h"
+#include "../tile_pool.h"
+
+#define CSV_SORT_MAX_KEYS 8          // columns one csvsort can sort by
+#define CSV_SORT_RUN 4096            // rows sorted on their own before merging: 64 KB of keys, about an L2's worth
+#define CSV_SORT_PARALLEL (1L << 16) // fewer rows than this are sorted on the calling thread alone
+
+// column types; a key's type is CSV_TYPE_AUTO until csv_column_type() has looked at its cells
+#define CSV_TYPE_AUTO 0
+#define CSV_TYPE_INT 1
+#define CSV_TYPE_FLOAT 2
+#define CSV_TYPE_DATE 3
+#define CSV_TYPE_STRING 4
+
+/*
+ * CSVSortKey -- one column to sort by
+ *
+ * col -- the column
+ * type -- CSV_TYPE_*, how its cells compare
+ * descending -- largest first
+ */
+struct CSVSortKey {
+    int col;
+    int type;
+    int descending;
+};
+
+/*
+ * csv_parse_sort_keys() -- keys from a csvsort spec: "column[:type][:asc|desc] ..." (most significant first),
+ * type one of int, float, date, string or auto (the default), and descending the default direction.
+ * Returns the number of keys, -1 if there are none or too many, a column isn't in the header row or an
+ * option isn't known
+ */
+int csv_parse_sort_keys(struct CSV *csv, const char *spec, struct CSVSortKey keys[CSV_SORT_MAX_KEYS]);
+
+/*
+ * csv_column_type() -- the narrowest type every non-empty cell of col below the header parses as: int, then
+ * float, then date (YYYY-MM-DD with an optional " HH:MM[:SS]" or "THH:MM[:SS]"), otherwise string
+ */
+int csv_column_type(struct CSV *csv, int col);
+
+/* Name of a CSV_TYPE_* */
+const char *csv_type_name(int type);
+
+/* The number in a cell, read the way a float column is (opening quote and trailing spaces dropped). 0 if it isn't one */
+int csv_cell_number(const char *cell, size_t len, double *out);
+
+/*
+ * csv_sort_rows() -- stable sort of the count row numbers in rows by keys, strings split across tiles' threads
+ * (tiles may be NULL). Empty cells, and cells that don't parse as their key's type, sort lowest. Rows that
+ * compare equal on every key keep their order. 1 on success, -1 if memory runs out
+ */
+int csv_sort_rows(struct CSV *csv, struct CSVSortKey *keys, int nkeys, long *rows, long count, struct TilePool *tiles);
+
+/*
+ * csv_encode_sort_key() -- row's values of keys (types already resolved) as bytes that memcmp() in the order
+ * csv_sort_rows() sorts rows in, for sorts that spill rows to disk. out needs csv_sort_key_bound() bytes.
+ * Returns the length
+ */
+size_t csv_encode_sort_key(struct CSV *csv, long row, const struct CSVSortKey *keys, int nkeys, unsigned char *out);
+
+/* Most bytes csv_encode_sort_key() writes for row */
+size_t csv_sort_key_bound(struct CSV *csv, long row, const struct CSVSortKey *keys, int nkeys);
+
+#endif
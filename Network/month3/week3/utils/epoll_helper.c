@@ -29,4 +29,68 @@ void add_epoll_fd(int epoll_fd, int new_fd){
         close(epoll_fd);
         exit(EXIT_FAILURE);
     }
-}
\ No newline at end of file
+}
+
+/*
+ * mod_epoll_fd() -- change the event mask of a registered file descriptor
+ */
+void mod_epoll_fd(int epoll_fd, int fd, unsigned int events){
+    struct epoll_event event;
+    event.events = events;
+    event.data.fd = fd;
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event) == -1) {
+        perror("epoll_ctl mod");
+    }
+}
+
+/*
+ * del_epoll_fd() -- stop monitoring a file descriptor (closing it does this too, but only once every dup is closed)
+ */
+void del_epoll_fd(int epoll_fd, int fd){
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL) == -1) {
+        perror("epoll_ctl del");
+    }
+}
+
+/*
+ * set_nonblocking() -- put a file descriptor into O_NONBLOCK mode
+ */
+int set_nonblocking(int fd){
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags == -1) return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/*
+ * add_epoll_timer() -- create a periodic timerfd firing every interval_ms and register it with epoll, returns its fd
+ */
+int add_epoll_timer(int epoll_fd, int interval_ms){
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd == -1) {
+        perror("timerfd_create");
+        exit(EXIT_FAILURE);
+    }
+
+    struct itimerspec spec;
+    spec.it_interval.tv_sec = interval_ms / 1000;
+    spec.it_interval.tv_nsec = (interval_ms % 1000) * 1000000L;
+    spec.it_value = spec.it_interval;
+
+    if (timerfd_settime(timer_fd, 0, &spec, NULL) == -1) {
+        perror("timerfd_settime");
+        exit(EXIT_FAILURE);
+    }
+
+    add_epoll_fd(epoll_fd, timer_fd);
+    return timer_fd;
+}
+
+/*
+ * read_epoll_timer() -- acknowledge a timerfd event, returns how many intervals elapsed since the last read
+ */
+unsigned long long read_epoll_timer(int timer_fd){
+    unsigned long long expirations = 0;
+    if (read(timer_fd, &expirations, sizeof expirations) != sizeof expirations) return 0;
+    return expirations;
+}
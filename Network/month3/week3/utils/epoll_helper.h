@@ -8,6 +8,7 @@
 #include <sys/socket.h>
 #include <netdb.h>
 #include <sys/epoll.h>
+#include <sys/timerfd.h>
 #include <netinet/in.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -22,4 +23,29 @@ int create_epoll();
  */
 void add_epoll_fd(int epoll_fd, int new_fd);
 
+/*
+ * mod_epoll_fd() -- change the event mask of a registered file descriptor (e.g. EPOLLIN -> EPOLLOUT)
+ */
+void mod_epoll_fd(int epoll_fd, int fd, unsigned int events);
+
+/*
+ * del_epoll_fd() -- stop monitoring a file descriptor
+ */
+void del_epoll_fd(int epoll_fd, int fd);
+
+/*
+ * set_nonblocking() -- put a file descriptor into O_NONBLOCK mode, returns -1 on failure
+ */
+int set_nonblocking(int fd);
+
+/*
+ * add_epoll_timer() -- register a periodic timerfd (every interval_ms) for read events and return it
+ */
+int add_epoll_timer(int epoll_fd, int interval_ms);
+
+/*
+ * read_epoll_timer() -- drain a readable timerfd, returns the number of expirations (0 if it wasn't ready)
+ */
+unsigned long long read_epoll_timer(int timer_fd);
+
 #endif
\ No newline at end of file
@@ -1,7 +1,12 @@
 /*
- * file_transfer.c -- Generic file send/receive functions using "FILE OK" sentinel protocol
+ * file_transfer.c -- Generic file send/receive functions shared by the client, server, and worker
+ *
+ * Bodies move with sendfile()/splice() when ZERO_COPY is set and the kernel allows it, read/send otherwise.
+ * Files are framed as [file type 2][file size 8][bytes]; the receiver reads the type and hands the rest to receive_file().
  */
 
+#define _GNU_SOURCE // splice(), F_SETPIPE_SZ, fallocate()
+
 #include "./file_transfer.h"
 
 /*
@@ -28,161 +33,324 @@ void get_file_extension(char *fname, char *ext){
 }
 
 /*
- * receive_file_text_based() -- receive file from socket in chunks until "FILE OK" marker detected
+ * send_file_chunk() -- one sendfile() worth of fd into sockfd, buffered pread()+send() if that isn't possible
+ *
+ * sendfile() hands the page cache straight to the socket, so forwarded uploads and returned results never
+ * pass through a user-space buffer. Some fd pairs (and some kernels) refuse it with EINVAL/ENOSYS; those
+ * chunks go through the old copy loop instead.
  */
-int receive_file_text_based(char *fname, int sockfd){
-    printf("receiving text file\n");
-    int total_bytes = 0;
-    int expected_bytes;
-    int bytes_read;
-    int epollfd = create_epoll();
-    struct epoll_event events[1];
+long send_file_chunk(int sockfd, int fd, off_t *offset, long count){
+    unsigned char buf[MAXBUFSIZE * 4];
+    long rv;
+
+    if (count > ZERO_COPY_CHUNK) count = ZERO_COPY_CHUNK;
+
+    if (ZERO_COPY){
+        do {
+            rv = sendfile(sockfd, fd, offset, count);
+        } while (rv < 0 && errno == EINTR);
+
+        if (rv >= 0 || (errno != EINVAL && errno != ENOSYS && errno != EOPNOTSUPP)) return rv;
+    }
+
+    if (count > (long)sizeof buf) count = sizeof buf;
 
-    unsigned char buf[MAXBUFSIZE];
-    add_epoll_fd(epollfd, sockfd);
+    long got = pread(fd, buf, count, *offset);
+    if (got <= 0) return got;
+
+    do {
+        rv = send(sockfd, buf, got, MSG_NOSIGNAL);
+    } while (rv < 0 && errno == EINTR);
+
+    if (rv > 0) *offset += rv;
+    return rv;
+}
+
+/*
+ * send_file_range() -- send_file_chunk() until count bytes are out (blocking sockets only)
+ */
+long send_file_range(int sockfd, int fd, off_t *offset, long count){
+    long total = 0;
+
+    while (total < count){
+        long rv = send_file_chunk(sockfd, fd, offset, count - total);
+        if (rv < 0) return -1;
+        if (rv == 0) break; // file is shorter than advertised
+        total += rv;
+    }
+
+    return total;
+}
 
-    fclose(fopen(fname, "w"));
+/*
+ * Receive engine
+ *
+ * Every receive path (worker inputs, worker results, client uploads and downloads) funnels into
+ * recv_file_chunk(): the destination is opened once and fallocate()d to the advertised size, then each
+ * call moves one socket read's worth into it. With ZERO_COPY the bytes go socket -> pipe -> file via
+ * splice(); otherwise they're read into a buffer that grows from RECV_BUF_MIN to RECV_BUF_MAX while
+ * reads keep filling it, and pwrite()n at the running offset. The pipe and buffer are per thread and
+ * reused across transfers, so memory stays constant however large the file is.
+ */
+static __thread int recv_pipe[2] = {-1, -1};
+static __thread int splice_broken;
+static __thread unsigned char *recv_buf;
+static __thread long recv_buf_len;
 
-    memset(buf, 0, MAXBUFSIZE);
-    if ((bytes_read = read(sockfd, buf, 8)) == 0){
+/*
+ * open_recv_file() -- open fname (truncated) and reserve size bytes of disk for it
+ *
+ * Opened read/write so the server can read an upload back while it's still arriving (result cache hashing).
+ */
+int open_recv_file(char *fname, long size){
+    int fd = open(fname, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1){
+        perror("receive: open");
         return -1;
     }
 
-    printf("bytes read: %d\n", bytes_read);
-    expected_bytes = unpacki64(buf);
-    printf("total expected bytes: %d\n", expected_bytes);
- 
-    while (1) {
-        if (total_bytes == expected_bytes) return 1;
-        else if (total_bytes > expected_bytes) return -1;
+    // KEEP_SIZE: blocks are reserved up front, but the file only grows as data actually lands
+    if (size > 0) fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, size);
+    return fd;
+}
 
-        int nfds = epoll_wait(epollfd, events, 1, 50);
-        if (nfds == -1) {
-            perror("epoll_wait");
-            break;
-        }
+/*
+ * write_all_at() -- pwrite() len bytes at *offset, advancing it
+ */
+static int write_all_at(int fd, unsigned char *buf, long len, off_t *offset){
+    while (len > 0){
+        long w = pwrite(fd, buf, len, *offset);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return -1;
+        buf += w;
+        len -= w;
+        *offset += w;
+    }
+    return 0;
+}
+
+/*
+ * splice_chunk() -- socket -> per-thread pipe -> fd. Returns bytes moved, 0 on EOF, -1 on error, -2 if splice() is unusable
+ */
+static long splice_chunk(int sockfd, int fd, off_t *offset, long count){
+    if (recv_pipe[0] == -1){
+        if (pipe(recv_pipe) == -1) return -2;
+        fcntl(recv_pipe[1], F_SETPIPE_SZ, ZERO_COPY_CHUNK); // best effort; the default 64 KB pipe still works
+    }
+
+    if (count > ZERO_COPY_CHUNK) count = ZERO_COPY_CHUNK;
+
+    long in;
+    do {
+        in = splice(sockfd, NULL, recv_pipe[1], NULL, count, SPLICE_F_MOVE | SPLICE_F_MORE);
+    } while (in < 0 && errno == EINTR);
+
+    if (in < 0 && (errno == EINVAL || errno == ENOSYS)) return -2; // nothing was consumed
+    if (in <= 0) return in;
 
-        for (int i = 0; i < nfds; i++) {
-            if (events[i].events & EPOLLIN) {
-                if ((bytes_read = read(sockfd, buf, MAXBUFSIZE)) == 0){
-                    return -1;
-                }
-                FILE *fptr = fopen(fname ,"a");
-
-                total_bytes += bytes_read;
-                fprintf(fptr, "%s", (char *)buf);
-                printf("total bytes received: %d - expected: %d\n", total_bytes, expected_bytes);   
-                fclose(fptr); // Always close the file
-                memset(buf, 0, MAXBUFSIZE);
-            }
+    for (long left = in; left > 0; ){
+        long out = splice(recv_pipe[0], NULL, fd, offset, left, SPLICE_F_MOVE);
+        if (out < 0 && errno == EINTR) continue;
+        if (out <= 0){
+            // the pipe now holds bytes we can't place; start the next transfer with a fresh one
+            close(recv_pipe[0]);
+            close(recv_pipe[1]);
+            recv_pipe[0] = recv_pipe[1] = -1;
+            return -1;
         }
+        left -= out;
     }
 
-    if (expected_bytes == total_bytes) return 1;
-    return -1;
+    return in;
 }
 
 /*
- * send_file_text_based() -- send file in MAXBUFSIZE chunks followed by "FILE OK" sentinel marker
+ * recv_file_chunk() -- one socket read's worth of file body into fd at *offset
  */
-int send_file_text_based(int sockfd, char *file_name){
-	printf("\nSending %s...\n", file_name);
-    FILE *fs = fopen(file_name, "r");
-    long file_size = get_file_size(fs);
-    unsigned char sdbuf[MAXBUFSIZE]; 
+long recv_file_chunk(int sockfd, int fd, off_t *offset, long count){
+    if (count <= 0) return 0;
 
-    if(fs == NULL){
-        printf("ERROR: File %s not found.\n", file_name);
-        return -1;
+    if (ZERO_COPY && !splice_broken){
+        long rv = splice_chunk(sockfd, fd, offset, count);
+        if (rv != -2) return rv;
+        splice_broken = 1;
     }
 
-    memset(sdbuf, 0, MAXBUFSIZE);
-    int fs_block_sz;
-    int bytes_sent;
-    int total_bytes = 0;
+    if (recv_buf == NULL){
+        recv_buf_len = RECV_BUF_MIN;
+        recv_buf = malloc(recv_buf_len);
+    }
 
-    packi16(sdbuf, TXT_FILE);
-    packi64(sdbuf+2, file_size);
-    if ((bytes_sent = send(sockfd, sdbuf, 10, 0)) <= 0){
-        fprintf(stderr, "ERROR: Failed to send file %s.\n", file_name);
+    long want = count < recv_buf_len ? count : recv_buf_len;
+    long rv;
+    do {
+        rv = read(sockfd, recv_buf, want);
+    } while (rv < 0 && errno == EINTR);
+    if (rv <= 0) return rv;
+
+    if (write_all_at(fd, recv_buf, rv, offset) == -1){
+        perror("receive: pwrite");
+        errno = EIO;
         return -1;
     }
-    printf("file id: %d, size: %ld\n", unpacki16(sdbuf), unpacki64(sdbuf+2));
-    memset(sdbuf, 0, MAXBUFSIZE);
 
-    while((fs_block_sz = fread(sdbuf, sizeof(char), MAXBUFSIZE, fs)) > 0)
-    {
-        if((bytes_sent = send(sockfd, sdbuf, fs_block_sz, 0)) < 0)
-        {
-            fprintf(stderr, "ERROR: Failed to send file %s.\n", file_name);
-            return -1;
+    // the socket had more than we asked for: read bigger next time
+    if (rv == recv_buf_len && recv_buf_len < RECV_BUF_MAX){
+        unsigned char *bigger = realloc(recv_buf, recv_buf_len * 2);
+        if (bigger != NULL){
+            recv_buf = bigger;
+            recv_buf_len *= 2;
         }
-        total_bytes += bytes_sent;
-        memset(sdbuf, 0, MAXBUFSIZE);
     }
 
-    printf("File %s was Sent! - %d bytes\n\n", file_name, total_bytes);
-    return 1;
+    return rv;
 }
 
 /*
- * receive_file_text_based() -- receive binary image file from socket in chunks (in binary mode)
- *
- * NOTE: Cannot rely on FILE OK marker, need to receive file size first.
+ * receive_file_body_at() -- recv_file_chunk() until size bytes are in fd from offset on (blocking sockets). Returns bytes received or -1
  */
-int receive_file_img_based(int sockfd, char *fname){
-    int total_bytes = 0;
-    int expected_bytes;
-    int bytes_read;
-    int epollfd = create_epoll();
-    struct epoll_event events[1];
+long receive_file_body_at(int sockfd, int fd, off_t offset, long size){
+    off_t end = offset + size;
+
+    while (offset < end){
+        long rv = recv_file_chunk(sockfd, fd, &offset, end - offset);
+        if (rv <= 0) return -1;
+    }
+
+    return size;
+}
+
+/*
+ * receive_file_body() -- receive_file_body_at() the start of fd
+ */
+long receive_file_body(int sockfd, int fd, long size){
+    return receive_file_body_at(sockfd, fd, 0, size);
+}
+
+/*
+ * receive_file() -- read the [file size 8] header, then stream the body into fname
+ */
+int receive_file(int sockfd, char *fname){
+    unsigned char buf[8];
+
+    if (recv(sockfd, buf, 8, MSG_WAITALL) != 8){
+        return -1;
+    }
+    long expected_bytes = unpacki64(buf);
+    printf("total expected bytes: %ld\n", expected_bytes);
 
+    int fd = open_recv_file(fname, expected_bytes);
+    if (fd == -1) return -1;
+
+    long total_bytes = receive_file_body(sockfd, fd, expected_bytes);
+    close(fd);
+
+    printf("total bytes received: %ld - expected: %ld\n", total_bytes, expected_bytes);
+    return total_bytes == expected_bytes ? 1 : -1;
+}
+
+/*
+ * receive_file_text_based() -- receive a text file ([file size 8][bytes]) into fname
+ */
+int receive_file_text_based(char *fname, int sockfd){
+    printf("receiving text file\n");
+    return receive_file(sockfd, fname);
+}
+
+/*
+ * receive_file_img_based() -- receive a .jpg ([file size 8][bytes]) into fname
+ */
+int receive_file_img_based(int sockfd, char *fname){
     if (strncmp(fname + (strlen(fname) - 3), "jpg", 3) > 0 ){
         printf("file extension invalid. IS: .%s NOT: .jpg\n", fname + (strlen(fname) - 3));
         return -1;
     }
 
-    unsigned char buf[MAXBUFSIZE];
-    add_epoll_fd(epollfd, sockfd);
-
-    fclose(fopen(fname, "wb"));
+    return receive_file(sockfd, fname);
+}
 
-    memset(buf, 0, MAXBUFSIZE);
-    if ((bytes_read = read(sockfd, buf, 8)) == 0){
+/*
+ * send_file_part() -- send len bytes of fd from offset as [file type 2][len 8][bytes], as if they were a whole file
+ */
+int send_file_part(int sockfd, int fd, int file_type, off_t offset, long len){
+    printf("\nSending [%ld, +%ld)...\n", (long)offset, len);
+    unsigned char sdbuf[10];
+
+    packi16(sdbuf, file_type);
+    packi64(sdbuf+2, len);
+    if (send(sockfd, sdbuf, 10, 0) <= 0 || send_file_range(sockfd, fd, &offset, len) != len){
+        fprintf(stderr, "ERROR: Failed to send file part.\n");
         return -1;
     }
-    expected_bytes = unpacki64(buf);
-    printf("total expected bytes: %d\n", expected_bytes);
 
-    while (1) {
-        if (total_bytes == expected_bytes) return 1;
-        else if (total_bytes > expected_bytes) return -1;
+    return 1;
+}
+
+/*
+ * send_file_buffer() -- send len bytes already in memory as [file type 2][len 8][bytes], for results that never touched the disk
+ */
+int send_file_buffer(int sockfd, int file_type, unsigned char *data, long len){
+    unsigned char sdbuf[10];
+
+    packi16(sdbuf, file_type);
+    packi64(sdbuf+2, len);
+    if (send(sockfd, sdbuf, 10, 0) != 10){
+        fprintf(stderr, "ERROR: Failed to send file buffer.\n");
+        return -1;
+    }
 
-        int nfds = epoll_wait(epollfd, events, 1, 50);
-        if (nfds == -1) {
-            perror("epoll_wait");
-            break;
+    long sent = 0;
+    while (sent < len){
+        long n = send(sockfd, data + sent, len - sent, 0);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0){
+            fprintf(stderr, "ERROR: Failed to send file buffer.\n");
+            return -1;
         }
+        sent += n;
+    }
 
-        for (int i = 0; i < nfds; i++) {
-            if (events[i].events & EPOLLIN) {
+    printf("Buffer was Sent! - %ld bytes\n\n", sent);
+    return 1;
+}
 
-                if ((bytes_read = read(sockfd, buf, MAXBUFSIZE)) == 0){
-                    return -1;
-                }
-                FILE *fptr = fopen(fname ,"ab");
+/*
+ * send_file_text_based() -- send a text file as [TXT_FILE 2][file size 8][bytes]
+ */
+int send_file_text_based(int sockfd, char *file_name){
+	printf("\nSending %s...\n", file_name);
+    FILE *fs = fopen(file_name, "r");
+    unsigned char sdbuf[MAXBUFSIZE]; 
 
-                total_bytes += bytes_read;
-                fwrite(buf, 1, bytes_read, fptr);
-                // printf("total bytes received: %d - expected: %d\n", total_bytes, expected_bytes);
-                fclose(fptr); // Always close the file
-                memset(buf, 0, MAXBUFSIZE);
-            }
-        }
+    if(fs == NULL){
+        printf("ERROR: File %s not found.\n", file_name);
+        return -1;
     }
 
-    if (total_bytes == expected_bytes) return 1;
-    return -1;
+    long file_size = get_file_size(fs);
+    memset(sdbuf, 0, MAXBUFSIZE);
+    int bytes_sent;
+
+    packi16(sdbuf, TXT_FILE);
+    packi64(sdbuf+2, file_size);
+    if ((bytes_sent = send(sockfd, sdbuf, 10, 0)) <= 0){
+        fprintf(stderr, "ERROR: Failed to send file %s.\n", file_name);
+        fclose(fs);
+        return -1;
+    }
+    printf("file id: %d, size: %ld\n", unpacki16(sdbuf), unpacki64(sdbuf+2));
+
+    off_t offset = 0;
+    long total_bytes = send_file_range(sockfd, fileno(fs), &offset, file_size);
+    fclose(fs);
+
+    if (total_bytes < 0){
+        fprintf(stderr, "ERROR: Failed to send file %s.\n", file_name);
+        return -1;
+    }
+
+    printf("File %s was Sent! - %ld bytes\n\n", file_name, total_bytes);
+    return 1;
 }
 
 /*
@@ -192,6 +360,12 @@ int receive_file_img_based(int sockfd, char *fname){
  */
 int send_file_img_based(int sockfd, char *fname){
 	printf("\nSending %s...\n", fname);
+
+    if (strncmp(fname + (strlen(fname) - 3), "jpg", 3) > 0 ){
+        printf("file extension invalid. IS: .%s NOT: .jpg\n", fname + (strlen(fname) - 3));
+        return -1;
+    }
+
     FILE *fs = fopen(fname, "rb");
 
     if(fs == NULL){
@@ -203,36 +377,26 @@ int send_file_img_based(int sockfd, char *fname){
     printf("file size: %ld\n", file_size);
     unsigned char sdbuf[MAXBUFSIZE];
 
-    if (strncmp(fname + (strlen(fname) - 3), "jpg", 3) > 0 ){
-        printf("file extension invalid. IS: .%s NOT: .jpg\n", fname + (strlen(fname) - 3));
-        return -1;
-    }
-
     memset(sdbuf, 0, MAXBUFSIZE);
-    int fs_block_sz;
     int bytes_sent;
-    int total_bytes = 0;
 
     packi16(sdbuf, IMG_FILE);
     packi64(sdbuf+2, file_size);
     if ((bytes_sent = send(sockfd, sdbuf, 10, 0)) <= 0){
         fprintf(stderr, "ERROR: Failed to send file %s.\n", fname);
+        fclose(fs);
         return -1;
     }
-    memset(sdbuf, 0, MAXBUFSIZE);
-    
-    while((fs_block_sz = fread(sdbuf, sizeof(char), MAXBUFSIZE, fs)) > 0)
-    {
-        if((bytes_sent = send(sockfd, sdbuf, fs_block_sz, 0)) < 0)
-        {
-            fprintf(stderr, "ERROR: Failed to send file %s.\n", fname);
-            return -1;
-        }
-        total_bytes += bytes_sent;
-        memset(sdbuf, 0, MAXBUFSIZE);
+
+    off_t offset = 0;
+    long total_bytes = send_file_range(sockfd, fileno(fs), &offset, file_size);
+    fclose(fs);
+
+    if (total_bytes < 0){
+        fprintf(stderr, "ERROR: Failed to send file %s.\n", fname);
+        return -1;
     }
 
-    printf("File %s was Sent! - %d bytes\n\n", fname, total_bytes);
+    printf("File %s was Sent! - %ld bytes\n\n", fname, total_bytes);
     return 1;
 }
-
@@ -12,6 +12,9 @@
 #include <netinet/in.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/sendfile.h>
 
 #include "../common.h"
 #include "./epoll_helper.h"
@@ -21,8 +24,56 @@ long get_file_size(FILE *file);
 
 void get_file_extension(char *fname, char *ext);
 
+/*
+ * send_file_chunk() -- move up to count bytes of fd (from *offset) into sockfd with one sendfile() call.
+ * Falls back to pread()+send() when zero-copy is off or unsupported for this fd pair.
+ * Returns bytes sent, 0 at end of file, -1 on error (errno set, EAGAIN for a full non-blocking socket)
+ */
+long send_file_chunk(int sockfd, int fd, off_t *offset, long count);
+
+/*
+ * send_file_range() -- send count bytes of fd starting at *offset on a blocking socket. Returns bytes sent or -1
+ */
+long send_file_range(int sockfd, int fd, off_t *offset, long count);
+
+/*
+ * open_recv_file() -- open fname once for a transfer and fallocate() size bytes for it. Returns the fd or -1
+ */
+int open_recv_file(char *fname, long size);
+
+/*
+ * recv_file_chunk() -- move one socket read's worth (at most count bytes) into fd at *offset, via splice() when possible.
+ * Works on blocking and non-blocking sockets. Returns bytes moved, 0 on EOF, -1 on error (errno set, EAGAIN if nothing was ready)
+ */
+long recv_file_chunk(int sockfd, int fd, off_t *offset, long count);
+
+/*
+ * receive_file_body_at() -- receive exactly size bytes from a blocking socket into fd, starting at offset. Returns bytes received or -1
+ */
+long receive_file_body_at(int sockfd, int fd, off_t offset, long size);
+
+/*
+ * receive_file_body() -- receive exactly size bytes from a blocking socket into fd. Returns bytes received or -1
+ */
+long receive_file_body(int sockfd, int fd, long size);
+
+/*
+ * receive_file() -- receive [file size 8][bytes] from a blocking socket into fname. Returns 1 on success, -1 otherwise
+ */
+int receive_file(int sockfd, char *fname);
+
 int receive_file_text_based(char *fname, int sockfd);
 
+/*
+ * send_file_part() -- send len bytes of fd from offset as a standalone [file type 2][len 8][bytes] file. Returns 1 or -1
+ */
+int send_file_part(int sockfd, int fd, int file_type, off_t offset, long len);
+
+/*
+ * send_file_buffer() -- send len bytes from memory as a [file type 2][len 8][bytes] file on a blocking socket. Returns 1 or -1
+ */
+int send_file_buffer(int sockfd, int file_type, unsigned char *data, long len);
+
 int send_file_text_based(int sockfd, char *file_name);
 
 int receive_file_img_based(int sockfd, char *fname);
@@ -0,0 +1,125 @@
+/*
+ * hash_lru.c -- the index behind the blob store, the result cache, the worker input cache and the server's
+ * view of which worker holds which input
+ *
+ * All of them key entries by SHA-256, which is already a uniform hash, so the key's first bytes pick the
+ * bucket with no further mixing. The node lives inside the entry, so indexing never allocates; users that
+ * don't evict just leave the recency order alone and use the list to walk every entry.
+ */
+
+#include "./hash_lru.h"
+
+static unsigned int bucket_of(const unsigned char *key, int nbuckets){
+    unsigned int h = (unsigned int)key[0] | key[1] << 8 | key[2] << 16 | (unsigned int)key[3] << 24;
+    return h & (nbuckets - 1);
+}
+
+static void lru_unlink(struct HashLRU *index, struct HashLRUNode *node){
+    if (node->lru_prev != NULL) node->lru_prev->lru_next = node->lru_next;
+    else index->lru_head = node->lru_next;
+
+    if (node->lru_next != NULL) node->lru_next->lru_prev = node->lru_prev;
+    else index->lru_tail = node->lru_prev;
+}
+
+static void lru_push_front(struct HashLRU *index, struct HashLRUNode *node){
+    node->lru_prev = NULL;
+    node->lru_next = index->lru_head;
+
+    if (index->lru_head != NULL) index->lru_head->lru_prev = node;
+    else index->lru_tail = node;
+    index->lru_head = node;
+}
+
+/*
+ * grow_buckets() -- double the bucket array and rehash every node into it, walking the recency list
+ */
+static void grow_buckets(struct HashLRU *index){
+    int nbuckets = index->nbuckets * 2;
+    struct HashLRUNode **buckets = calloc(nbuckets, sizeof *buckets);
+
+    for (struct HashLRUNode *node = index->lru_head; node != NULL; node = node->lru_next){
+        unsigned int b = bucket_of(node->key, nbuckets);
+        node->hash_next = buckets[b];
+        buckets[b] = node;
+    }
+
+    free(index->buckets);
+    index->buckets = buckets;
+    index->nbuckets = nbuckets;
+}
+
+/*
+ * hash_lru_init() -- zeroed buckets, empty list
+ */
+void hash_lru_init(struct HashLRU *index, int nbuckets){
+    index->nbuckets = nbuckets;
+    index->buckets = calloc(nbuckets, sizeof *index->buckets);
+    index->count = 0;
+    index->lru_head = NULL;
+    index->lru_tail = NULL;
+}
+
+/*
+ * hash_lru_free() -- drop the bucket array
+ */
+void hash_lru_free(struct HashLRU *index){
+    free(index->buckets);
+    index->buckets = NULL;
+    index->nbuckets = 0;
+}
+
+/*
+ * hash_lru_find() -- walk the key's bucket
+ */
+struct HashLRUNode *hash_lru_find(struct HashLRU *index, const unsigned char *key){
+    struct HashLRUNode *node = index->buckets[bucket_of(key, index->nbuckets)];
+
+    while (node != NULL && memcmp(node->key, key, SHA256_LEN) != 0) node = node->hash_next;
+    return node;
+}
+
+/*
+ * hash_lru_find_next() -- keep walking node's bucket for its key
+ */
+struct HashLRUNode *hash_lru_find_next(struct HashLRUNode *node){
+    struct HashLRUNode *next = node->hash_next;
+
+    while (next != NULL && memcmp(next->key, node->key, SHA256_LEN) != 0) next = next->hash_next;
+    return next;
+}
+
+/*
+ * hash_lru_insert() -- grow if there's already a node per bucket, then push onto the bucket and the list
+ */
+void hash_lru_insert(struct HashLRU *index, struct HashLRUNode *node, const unsigned char *key){
+    if (index->count >= index->nbuckets) grow_buckets(index);
+
+    node->key = key;
+    unsigned int b = bucket_of(key, index->nbuckets);
+    node->hash_next = index->buckets[b];
+    index->buckets[b] = node;
+    lru_push_front(index, node);
+    index->count++;
+}
+
+/*
+ * hash_lru_remove() -- unlink from the bucket chain and the list
+ */
+void hash_lru_remove(struct HashLRU *index, struct HashLRUNode *node){
+    struct HashLRUNode **link = &index->buckets[bucket_of(node->key, index->nbuckets)];
+    while (*link != node) link = &(*link)->hash_next;
+    *link = node->hash_next;
+
+    lru_unlink(index, node);
+    index->count--;
+}
+
+/*
+ * hash_lru_touch() -- move node to the front of the list
+ */
+void hash_lru_touch(struct HashLRU *index, struct HashLRUNode *node){
+    if (index->lru_head == node) return;
+    lru_unlink(index, node);
+    lru_push_front(index, node);
+}
@@ -0,0 +1,86 @@
+/*
+ * hash_lru.h -- intrusive index of SHA-256-keyed entries: chained hash buckets plus a recency list
+ */
+
+#ifndef HASH_LRU_H
+#define HASH_LRU_H
+
+#include "../common.h"
+#include "./sha256.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * hash_lru_entry() -- the struct a node is embedded in, from a pointer to its member
+ */
+#define hash_lru_entry(node, type, member) ((type *)((char *)(node) - offsetof(type, member)))
+
+/*
+ * HashLRUNode -- embedded in every indexed entry
+ *
+ * *key -- the entry's SHA-256 key, owned by the entry
+ * *hash_next -- next node in the same bucket
+ * *lru_prev, *lru_next -- neighbours in recency order, most recently used first
+ */
+struct HashLRUNode {
+    const unsigned char *key;
+
+    struct HashLRUNode *hash_next;
+    struct HashLRUNode *lru_prev;
+    struct HashLRUNode *lru_next;
+};
+
+/*
+ * HashLRU -- the index
+ *
+ * **buckets, nbuckets -- chained hash table, nbuckets is a power of two and doubles once count passes it
+ * count -- number of nodes
+ * *lru_head, *lru_tail -- most and least recently used nodes; every node is on the list, so it's also how to walk them all
+ */
+struct HashLRU {
+    struct HashLRUNode **buckets;
+    int nbuckets;
+    int count;
+
+    struct HashLRUNode *lru_head;
+    struct HashLRUNode *lru_tail;
+};
+
+/*
+ * hash_lru_init() -- an empty index starting at nbuckets buckets (a power of two)
+ */
+void hash_lru_init(struct HashLRU *index, int nbuckets);
+
+/*
+ * hash_lru_free() -- release the bucket array; the entries belong to the caller
+ */
+void hash_lru_free(struct HashLRU *index);
+
+/*
+ * hash_lru_find() -- the most recently inserted node with key, NULL if none
+ */
+struct HashLRUNode *hash_lru_find(struct HashLRU *index, const unsigned char *key);
+
+/*
+ * hash_lru_find_next() -- the next node after node with the same key, NULL if none (for indexes that allow duplicate keys)
+ */
+struct HashLRUNode *hash_lru_find_next(struct HashLRUNode *node);
+
+/*
+ * hash_lru_insert() -- index node under key (which has to outlive it) as the most recently used. Duplicate keys are allowed
+ */
+void hash_lru_insert(struct HashLRU *index, struct HashLRUNode *node, const unsigned char *key);
+
+/*
+ * hash_lru_remove() -- take node out of its bucket and the recency list
+ */
+void hash_lru_remove(struct HashLRU *index, struct HashLRUNode *node);
+
+/*
+ * hash_lru_touch() -- make node the most recently used
+ */
+void hash_lru_touch(struct HashLRU *index, struct HashLRUNode *node);
+
+#endif
@@ -0,0 +1,414 @@
+/*
+ * image_kernels.c -- SIMD pixel kernels for the native image fast path
+ *
+ * Every kernel has a scalar version and, on x86, SSSE3 and AVX2 versions compiled with target
+ * attributes, so the file builds without -mavx2 and the best set the CPU supports is picked at
+ * run time. All versions produce identical pixels.
+ *
+ * flips -- rows are reversed by swapping vectors from both ends and reversing the 32-bit lanes
+ * rotations -- 8x8 (AVX2) or 4x4 (SSE) tile transposes, walked in narrow, tall blocks so every
+ *     destination line is finished while it's still in cache. Square 64x64 blocks were much slower
+ *     for AVX2 on 4K frames: a 15360-byte row stride puts every fourth source row in the same L1
+ *     set, and 8-row tiles across 64 columns overran the set's ways
+ * luma -- maddubs/madd fixed-point dot product per pixel, broadcast back into R, G and B
+ */
+
+#include "./image_kernels.h"
+
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+#define LUMA_R 38
+#define LUMA_G 75
+#define LUMA_B 15
+
+/*
+ * KernelSet -- one implementation of every kernel
+ *
+ * reverse -- reverse n pixels in place
+ * swap -- swap n pixels between a and b
+ * rotate_90, rotate_270 -- rotate one tile-aligned region; edges are finished by the scalar loops
+ * luma -- grayscale count pixels in place
+ */
+struct KernelSet {
+    const char *isa;
+    void (*reverse)(uint32_t *px, long n);
+    void (*swap)(uint32_t *a, uint32_t *b, long n);
+    void (*rotate_90)(const uint32_t *src, uint32_t *dst, int width, int height, int x0, int y0, int x1, int y1);
+    void (*rotate_270)(const uint32_t *src, uint32_t *dst, int width, int height, int x0, int y0, int x1, int y1);
+    int tile;
+    void (*luma)(uint32_t *px, long count);
+};
+
+/*
+ * Scalar kernels, also used for whatever the vector loops leave over
+ */
+
+static void reverse_scalar(uint32_t *px, long n){
+    for (long i = 0, j = n - 1; i < j; i++, j--){
+        uint32_t t = px[i];
+        px[i] = px[j];
+        px[j] = t;
+    }
+}
+
+static void swap_scalar(uint32_t *a, uint32_t *b, long n){
+    for (long i = 0; i < n; i++){
+        uint32_t t = a[i];
+        a[i] = b[i];
+        b[i] = t;
+    }
+}
+
+/*
+ * rotate_90_scalar() -- clockwise: src (x, y) lands on dst row x, column height-1-y
+ */
+static void rotate_90_scalar(const uint32_t *src, uint32_t *dst, int width, int height, int x0, int y0, int x1, int y1){
+    for (int y = y0; y < y1; y++){
+        for (int x = x0; x < x1; x++) dst[(long)x * height + (height - 1 - y)] = src[(long)y * width + x];
+    }
+}
+
+/*
+ * rotate_270_scalar() -- counterclockwise: src (x, y) lands on dst row width-1-x, column y
+ */
+static void rotate_270_scalar(const uint32_t *src, uint32_t *dst, int width, int height, int x0, int y0, int x1, int y1){
+    for (int y = y0; y < y1; y++){
+        for (int x = x0; x < x1; x++) dst[(long)(width - 1 - x) * height + y] = src[(long)y * width + x];
+    }
+}
+
+static inline uint32_t luma_pixel(uint32_t p){
+    uint32_t y = (LUMA_R * (p & 0xff) + LUMA_G * ((p >> 8) & 0xff) + LUMA_B * ((p >> 16) & 0xff) + 64) >> 7;
+    return y * 0x010101u | 0xff000000u;
+}
+
+static void luma_scalar(uint32_t *px, long count){
+    for (long i = 0; i < count; i++) px[i] = luma_pixel(px[i]);
+}
+
+static const struct KernelSet scalar_set = {"scalar", reverse_scalar, swap_scalar, rotate_90_scalar, rotate_270_scalar, 1, luma_scalar};
+
+#ifdef KERNELS_X86
+
+/*
+ * SSSE3 kernels (4 pixels per vector)
+ */
+
+__attribute__((target("ssse3")))
+static void reverse_ssse3(uint32_t *px, long n){
+    long i = 0, j = n;
+    while (j - i >= 8){
+        __m128i a = _mm_loadu_si128((__m128i *)(px + i));
+        __m128i b = _mm_loadu_si128((__m128i *)(px + j - 4));
+        _mm_storeu_si128((__m128i *)(px + i), _mm_shuffle_epi32(b, 0x1b));
+        _mm_storeu_si128((__m128i *)(px + j - 4), _mm_shuffle_epi32(a, 0x1b));
+        i += 4;
+        j -= 4;
+    }
+    reverse_scalar(px + i, j - i);
+}
+
+__attribute__((target("ssse3")))
+static void swap_ssse3(uint32_t *a, uint32_t *b, long n){
+    long i = 0;
+    for (; i + 4 <= n; i += 4){
+        __m128i va = _mm_loadu_si128((__m128i *)(a + i));
+        __m128i vb = _mm_loadu_si128((__m128i *)(b + i));
+        _mm_storeu_si128((__m128i *)(a + i), vb);
+        _mm_storeu_si128((__m128i *)(b + i), va);
+    }
+    swap_scalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("ssse3")))
+static inline void transpose4(__m128i *r0, __m128i *r1, __m128i *r2, __m128i *r3){
+    __m128i t0 = _mm_unpacklo_epi32(*r0, *r1);
+    __m128i t1 = _mm_unpackhi_epi32(*r0, *r1);
+    __m128i t2 = _mm_unpacklo_epi32(*r2, *r3);
+    __m128i t3 = _mm_unpackhi_epi32(*r2, *r3);
+    *r0 = _mm_unpacklo_epi64(t0, t2);
+    *r1 = _mm_unpackhi_epi64(t0, t2);
+    *r2 = _mm_unpacklo_epi64(t1, t3);
+    *r3 = _mm_unpackhi_epi64(t1, t3);
+}
+
+/*
+ * rotate_90_ssse3() -- load a 4x4 tile bottom row first and transpose it: each result row is a finished dst row segment
+ */
+__attribute__((target("ssse3")))
+static void rotate_90_ssse3(const uint32_t *src, uint32_t *dst, int width, int height, int x0, int y0, int x1, int y1){
+    for (int y = y0; y < y1; y += 4){
+        for (int x = x0; x < x1; x += 4){
+            __m128i r0 = _mm_loadu_si128((__m128i *)(src + (long)(y + 3) * width + x));
+            __m128i r1 = _mm_loadu_si128((__m128i *)(src + (long)(y + 2) * width + x));
+            __m128i r2 = _mm_loadu_si128((__m128i *)(src + (long)(y + 1) * width + x));
+            __m128i r3 = _mm_loadu_si128((__m128i *)(src + (long)y * width + x));
+            transpose4(&r0, &r1, &r2, &r3);
+
+            uint32_t *out = dst + (long)x * height + (height - 4 - y);
+            _mm_storeu_si128((__m128i *)out, r0);
+            _mm_storeu_si128((__m128i *)(out + height), r1);
+            _mm_storeu_si128((__m128i *)(out + 2L * height), r2);
+            _mm_storeu_si128((__m128i *)(out + 3L * height), r3);
+        }
+    }
+}
+
+__attribute__((target("ssse3")))
+static void rotate_270_ssse3(const uint32_t *src, uint32_t *dst, int width, int height, int x0, int y0, int x1, int y1){
+    for (int y = y0; y < y1; y += 4){
+        for (int x = x0; x < x1; x += 4){
+            __m128i r0 = _mm_loadu_si128((__m128i *)(src + (long)y * width + x));
+            __m128i r1 = _mm_loadu_si128((__m128i *)(src + (long)(y + 1) * width + x));
+            __m128i r2 = _mm_loadu_si128((__m128i *)(src + (long)(y + 2) * width + x));
+            __m128i r3 = _mm_loadu_si128((__m128i *)(src + (long)(y + 3) * width + x));
+            transpose4(&r0, &r1, &r2, &r3);
+
+            uint32_t *out = dst + (long)(width - 1 - x) * height + y;
+            _mm_storeu_si128((__m128i *)out, r0);
+            _mm_storeu_si128((__m128i *)(out - height), r1);
+            _mm_storeu_si128((__m128i *)(out - 2L * height), r2);
+            _mm_storeu_si128((__m128i *)(out - 3L * height), r3);
+        }
+    }
+}
+
+__attribute__((target("ssse3")))
+static void luma_ssse3(uint32_t *px, long count){
+    const __m128i weights = _mm_set1_epi32(LUMA_R | LUMA_G << 8 | LUMA_B << 16);
+    const __m128i ones = _mm_set1_epi16(1);
+    const __m128i round = _mm_set1_epi32(64);
+    const __m128i spread = _mm_setr_epi8(0, 0, 0, -1, 4, 4, 4, -1, 8, 8, 8, -1, 12, 12, 12, -1);
+    const __m128i opaque = _mm_set1_epi32(0xff000000);
+
+    long i = 0;
+    for (; i + 4 <= count; i += 4){
+        __m128i p = _mm_loadu_si128((__m128i *)(px + i));
+        __m128i y = _mm_madd_epi16(_mm_maddubs_epi16(p, weights), ones);
+        y = _mm_srli_epi32(_mm_add_epi32(y, round), 7);
+        _mm_storeu_si128((__m128i *)(px + i), _mm_or_si128(_mm_shuffle_epi8(y, spread), opaque));
+    }
+    luma_scalar(px + i, count - i);
+}
+
+static const struct KernelSet ssse3_set = {"ssse3", reverse_ssse3, swap_ssse3, rotate_90_ssse3, rotate_270_ssse3, 4, luma_ssse3};
+
+/*
+ * AVX2 kernels (8 pixels per vector)
+ */
+
+__attribute__((target("avx2")))
+static void reverse_avx2(uint32_t *px, long n){
+    const __m256i rev = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+    long i = 0, j = n;
+    while (j - i >= 16){
+        __m256i a = _mm256_loadu_si256((__m256i *)(px + i));
+        __m256i b = _mm256_loadu_si256((__m256i *)(px + j - 8));
+        _mm256_storeu_si256((__m256i *)(px + i), _mm256_permutevar8x32_epi32(b, rev));
+        _mm256_storeu_si256((__m256i *)(px + j - 8), _mm256_permutevar8x32_epi32(a, rev));
+        i += 8;
+        j -= 8;
+    }
+    reverse_scalar(px + i, j - i);
+}
+
+__attribute__((target("avx2")))
+static void swap_avx2(uint32_t *a, uint32_t *b, long n){
+    long i = 0;
+    for (; i + 8 <= n; i += 8){
+        __m256i va = _mm256_loadu_si256((__m256i *)(a + i));
+        __m256i vb = _mm256_loadu_si256((__m256i *)(b + i));
+        _mm256_storeu_si256((__m256i *)(a + i), vb);
+        _mm256_storeu_si256((__m256i *)(b + i), va);
+    }
+    swap_scalar(a + i, b + i, n - i);
+}
+
+/*
+ * transpose8() -- 8x8 transpose of 32-bit lanes: two 4x4 transposes per 128-bit half, then swap the off-diagonal halves.
+ * Written out with named vectors, array indexing makes gcc keep the tile on the stack
+ */
+#define TRANSPOSE8(r0, r1, r2, r3, r4, r5, r6, r7) do { \
+    __m256i t0 = _mm256_unpacklo_epi32(r0, r1), t1 = _mm256_unpackhi_epi32(r0, r1); \
+    __m256i t2 = _mm256_unpacklo_epi32(r2, r3), t3 = _mm256_unpackhi_epi32(r2, r3); \
+    __m256i t4 = _mm256_unpacklo_epi32(r4, r5), t5 = _mm256_unpackhi_epi32(r4, r5); \
+    __m256i t6 = _mm256_unpacklo_epi32(r6, r7), t7 = _mm256_unpackhi_epi32(r6, r7); \
+    __m256i u0 = _mm256_unpacklo_epi64(t0, t2), u1 = _mm256_unpackhi_epi64(t0, t2); \
+    __m256i u2 = _mm256_unpacklo_epi64(t1, t3), u3 = _mm256_unpackhi_epi64(t1, t3); \
+    __m256i u4 = _mm256_unpacklo_epi64(t4, t6), u5 = _mm256_unpackhi_epi64(t4, t6); \
+    __m256i u6 = _mm256_unpacklo_epi64(t5, t7), u7 = _mm256_unpackhi_epi64(t5, t7); \
+    r0 = _mm256_permute2x128_si256(u0, u4, 0x20); r4 = _mm256_permute2x128_si256(u0, u4, 0x31); \
+    r1 = _mm256_permute2x128_si256(u1, u5, 0x20); r5 = _mm256_permute2x128_si256(u1, u5, 0x31); \
+    r2 = _mm256_permute2x128_si256(u2, u6, 0x20); r6 = _mm256_permute2x128_si256(u2, u6, 0x31); \
+    r3 = _mm256_permute2x128_si256(u3, u7, 0x20); r7 = _mm256_permute2x128_si256(u3, u7, 0x31); \
+} while (0)
+
+#define LOAD8(p) _mm256_loadu_si256((const __m256i *)(p))
+#define STORE8(p, v) _mm256_storeu_si256((__m256i *)(p), v)
+
+__attribute__((target("avx2")))
+static void rotate_90_avx2(const uint32_t *src, uint32_t *dst, int width, int height, int x0, int y0, int x1, int y1){
+    for (int y = y0; y < y1; y += 8){
+        for (int x = x0; x < x1; x += 8){
+            const uint32_t *in = src + (long)(y + 7) * width + x;
+            __m256i r0 = LOAD8(in), r1 = LOAD8(in - width), r2 = LOAD8(in - 2L * width), r3 = LOAD8(in - 3L * width);
+            __m256i r4 = LOAD8(in - 4L * width), r5 = LOAD8(in - 5L * width), r6 = LOAD8(in - 6L * width), r7 = LOAD8(in - 7L * width);
+            TRANSPOSE8(r0, r1, r2, r3, r4, r5, r6, r7);
+
+            uint32_t *out = dst + (long)x * height + (height - 8 - y);
+            STORE8(out, r0);
+            STORE8(out + height, r1);
+            STORE8(out + 2L * height, r2);
+            STORE8(out + 3L * height, r3);
+            STORE8(out + 4L * height, r4);
+            STORE8(out + 5L * height, r5);
+            STORE8(out + 6L * height, r6);
+            STORE8(out + 7L * height, r7);
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+static void rotate_270_avx2(const uint32_t *src, uint32_t *dst, int width, int height, int x0, int y0, int x1, int y1){
+    for (int y = y0; y < y1; y += 8){
+        for (int x = x0; x < x1; x += 8){
+            const uint32_t *in = src + (long)y * width + x;
+            __m256i r0 = LOAD8(in), r1 = LOAD8(in + width), r2 = LOAD8(in + 2L * width), r3 = LOAD8(in + 3L * width);
+            __m256i r4 = LOAD8(in + 4L * width), r5 = LOAD8(in + 5L * width), r6 = LOAD8(in + 6L * width), r7 = LOAD8(in + 7L * width);
+            TRANSPOSE8(r0, r1, r2, r3, r4, r5, r6, r7);
+
+            uint32_t *out = dst + (long)(width - 1 - x) * height + y;
+            STORE8(out, r0);
+            STORE8(out - height, r1);
+            STORE8(out - 2L * height, r2);
+            STORE8(out - 3L * height, r3);
+            STORE8(out - 4L * height, r4);
+            STORE8(out - 5L * height, r5);
+            STORE8(out - 6L * height, r6);
+            STORE8(out - 7L * height, r7);
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+static void luma_avx2(uint32_t *px, long count){
+    const __m256i weights = _mm256_set1_epi32(LUMA_R | LUMA_G << 8 | LUMA_B << 16);
+    const __m256i ones = _mm256_set1_epi16(1);
+    const __m256i round = _mm256_set1_epi32(64);
+    const __m256i spread = _mm256_setr_epi8(0, 0, 0, -1, 4, 4, 4, -1, 8, 8, 8, -1, 12, 12, 12, -1,
+                                            0, 0, 0, -1, 4, 4, 4, -1, 8, 8, 8, -1, 12, 12, 12, -1);
+    const __m256i opaque = _mm256_set1_epi32(0xff000000);
+
+    long i = 0;
+    for (; i + 8 <= count; i += 8){
+        __m256i p = _mm256_loadu_si256((__m256i *)(px + i));
+        __m256i y = _mm256_madd_epi16(_mm256_maddubs_epi16(p, weights), ones);
+        y = _mm256_srli_epi32(_mm256_add_epi32(y, round), 7);
+        _mm256_storeu_si256((__m256i *)(px + i), _mm256_or_si256(_mm256_shuffle_epi8(y, spread), opaque));
+    }
+    luma_scalar(px + i, count - i);
+}
+
+static const struct KernelSet avx2_set = {"avx2", reverse_avx2, swap_avx2, rotate_90_avx2, rotate_270_avx2, 8, luma_avx2};
+
+#endif
+
+static const struct KernelSet *active = &scalar_set;
+static pthread_once_t active_once = PTHREAD_ONCE_INIT;
+
+/*
+ * pick_kernels() -- the widest set this CPU runs
+ */
+static void pick_kernels(){
+#ifdef KERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) active = &avx2_set;
+    else if (__builtin_cpu_supports("ssse3")) active = &ssse3_set;
+#endif
+}
+
+static const struct KernelSet *kernels(){
+    pthread_once(&active_once, pick_kernels);
+    return active;
+}
+
+const char *kernel_isa(){
+    return kernels()->isa;
+}
+
+int kernel_use_isa(const char *isa){
+    kernels();
+    if (strcmp(isa, "scalar") == 0){
+        active = &scalar_set;
+        return 1;
+    }
+#ifdef KERNELS_X86
+    if (strcmp(isa, "ssse3") == 0 && __builtin_cpu_supports("ssse3")){
+        active = &ssse3_set;
+        return 1;
+    }
+    if (strcmp(isa, "avx2") == 0 && __builtin_cpu_supports("avx2")){
+        active = &avx2_set;
+        return 1;
+    }
+#endif
+    return 0;
+}
+
+void kernel_flip_x(uint32_t *px, int width, int height){
+    const struct KernelSet *k = kernels();
+    for (int y = 0; y < height; y++) k->reverse(px + (long)y * width, width);
+}
+
+void kernel_flip_y(uint32_t *px, int width, int height){
+    const struct KernelSet *k = kernels();
+    for (int y = 0, z = height - 1; y < z; y++, z--) k->swap(px + (long)y * width, px + (long)z * width, width);
+}
+
+void kernel_rotate_180(uint32_t *px, int width, int height){
+    kernels()->reverse(px, (long)width * height);
+}
+
+/*
+ * rotate_blocked() -- run a rotation block by block: whole tiles through the vector kernel, the ragged right and bottom edges through the scalar one
+ */
+static void rotate_blocked(const uint32_t *src, uint32_t *dst, int width, int height, int clockwise){
+    const struct KernelSet *k = kernels();
+    int tile = k->tile;
+    int full_w = width - width % tile;
+    int full_h = height - height % tile;
+
+    for (int by = 0; by < full_h; by += KERNEL_BLOCK_H){
+        int ey = by + KERNEL_BLOCK_H < full_h ? by + KERNEL_BLOCK_H : full_h;
+        for (int bx = 0; bx < full_w; bx += KERNEL_BLOCK_W){
+            int ex = bx + KERNEL_BLOCK_W < full_w ? bx + KERNEL_BLOCK_W : full_w;
+            if (clockwise) k->rotate_90(src, dst, width, height, bx, by, ex, ey);
+            else k->rotate_270(src, dst, width, height, bx, by, ex, ey);
+        }
+    }
+
+    if (clockwise){
+        rotate_90_scalar(src, dst, width, height, full_w, 0, width, height);
+        rotate_90_scalar(src, dst, width, height, 0, full_h, full_w, height);
+    } else {
+        rotate_270_scalar(src, dst, width, height, full_w, 0, width, height);
+        rotate_270_scalar(src, dst, width, height, 0, full_h, full_w, height);
+    }
+}
+
+void kernel_rotate_90(const uint32_t *src, uint32_t *dst, int width, int height){
+    rotate_blocked(src, dst, width, height, 1);
+}
+
+void kernel_rotate_270(const uint32_t *src, uint32_t *dst, int width, int height){
+    rotate_blocked(src, dst, width, height, 0);
+}
+
+void kernel_luma(uint32_t *px, long count){
+    kernels()->luma(px, count);
+}
@@ -0,0 +1,63 @@
+/*
+ * image_kernels.h -- SIMD pixel kernels for the native image fast path (flips, rotations, grayscale)
+ */
+
+#ifndef IMAGE_KERNELS_H
+#define IMAGE_KERNELS_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// rotations walk the image in KERNEL_BLOCK_W x KERNEL_BLOCK_H pixel blocks: 16 columns is one 64-byte line per
+// destination row, and the block's source lines (128 rows) still fit in L1 alongside them
+#define KERNEL_BLOCK_W 16
+#define KERNEL_BLOCK_H 128
+
+/*
+ * Pixels are 32-bit RGBX (R in the lowest byte), rows packed with no padding. Four bytes per pixel
+ * instead of three puts exactly one pixel in each 32-bit SIMD lane, so a flip is a lane reversal and
+ * a rotation a plain 32-bit transpose.
+ */
+
+/*
+ * kernel_flip_x() -- mirror each row in place (flipx)
+ */
+void kernel_flip_x(uint32_t *px, int width, int height);
+
+/*
+ * kernel_flip_y() -- swap rows top to bottom in place (flipy)
+ */
+void kernel_flip_y(uint32_t *px, int width, int height);
+
+/*
+ * kernel_rotate_180() -- rotate by 180 degrees in place
+ */
+void kernel_rotate_180(uint32_t *px, int width, int height);
+
+/*
+ * kernel_rotate_90() -- rotate src (width x height) clockwise into dst (height x width)
+ */
+void kernel_rotate_90(const uint32_t *src, uint32_t *dst, int width, int height);
+
+/*
+ * kernel_rotate_270() -- rotate src (width x height) counterclockwise into dst (height x width)
+ */
+void kernel_rotate_270(const uint32_t *src, uint32_t *dst, int width, int height);
+
+/*
+ * kernel_luma() -- replace each pixel's R, G and B with its BT.601 luma, (38R + 75G + 15B + 64) >> 7, in fixed point
+ */
+void kernel_luma(uint32_t *px, long count);
+
+/*
+ * kernel_isa() -- instruction set the kernels run with: "avx2", "ssse3" or "scalar"
+ */
+const char *kernel_isa();
+
+/*
+ * kernel_use_isa() -- force an instruction set (for benchmarks). Returns 0 if the CPU doesn't have it
+ */
+int kernel_use_isa(const char *isa);
+
+#endif
@@ -0,0 +1,111 @@
+/*
+ * input_cache.c -- worker-side input cache
+ *
+ * When several jobs run on the same input (flipx, then rotate, then grayscale on one photo),
+ * the worker keeps a hard link to the first copy it received under the input's content hash
+ * and tells the server, which then sends later jobs on that input with their spec only. Jobs
+ * get their own hard link to the cached file, so evicting an entry never pulls an input out
+ * from under a job that's still queued or running. Only the worker's main thread uses this.
+ */
+
+#include "./input_cache.h"
+
+#define ENTRY_PATH_LEN (MAXFILEPATH + SHA256_LEN * 2 + 2)
+
+static void entry_path(struct InputCache *cache, unsigned char key[SHA256_LEN], char path[ENTRY_PATH_LEN]){
+    char hex[SHA256_LEN * 2 + 1];
+    sha256_hex(key, hex);
+    snprintf(path, ENTRY_PATH_LEN, "%s%s", cache->dir, hex);
+}
+
+static struct InputCacheEntry *find_entry(struct InputCache *cache, unsigned char key[SHA256_LEN]){
+    struct HashLRUNode *node = hash_lru_find(&cache->index, key);
+    return node != NULL ? hash_lru_entry(node, struct InputCacheEntry, node) : NULL;
+}
+
+/*
+ * remove_entry() -- unindex an entry, delete its file and free it
+ */
+static void remove_entry(struct InputCache *cache, struct InputCacheEntry *entry){
+    hash_lru_remove(&cache->index, &entry->node);
+
+    char path[ENTRY_PATH_LEN];
+    entry_path(cache, entry->key, path);
+    unlink(path);
+
+    cache->bytes -= entry->size;
+    free(entry);
+}
+
+/*
+ * create_input_cache() -- allocate the index and make sure dir exists
+ */
+struct InputCache *create_input_cache(char *dir, long max_bytes){
+    struct InputCache *cache = malloc(sizeof *cache);
+    snprintf(cache->dir, MAXFILEPATH, "%s", dir);
+    (void)mkdir(cache->dir, 0755);
+
+    hash_lru_init(&cache->index, INPUT_CACHE_MIN_BUCKETS);
+    cache->bytes = 0;
+    cache->max_bytes = max_bytes;
+    cache->hits = 0;
+    cache->misses = 0;
+
+    return cache;
+}
+
+/*
+ * input_cache_get() -- link the cached copy to dest. An entry whose file can't be linked is dropped and counts as a miss
+ */
+int input_cache_get(struct InputCache *cache, unsigned char key[SHA256_LEN], char *dest){
+    struct InputCacheEntry *entry = find_entry(cache, key);
+    if (entry == NULL){
+        cache->misses++;
+        return 0;
+    }
+
+    char path[ENTRY_PATH_LEN];
+    entry_path(cache, key, path);
+    if (link(path, dest) == -1){
+        perror("input cache: link");
+        remove_entry(cache, entry);
+        cache->misses++;
+        return 0;
+    }
+
+    hash_lru_touch(&cache->index, &entry->node);
+    cache->hits++;
+    return 1;
+}
+
+/*
+ * input_cache_put() -- evict from the cold end until src fits, then link it in
+ */
+int input_cache_put(struct InputCache *cache, unsigned char key[SHA256_LEN], char *src, input_cache_dropped_fn dropped, void *arg){
+    struct stat st;
+    if (stat(src, &st) == -1 || st.st_size > cache->max_bytes || find_entry(cache, key) != NULL) return 0;
+
+    while (cache->index.lru_tail != NULL && cache->bytes + st.st_size > cache->max_bytes){
+        struct InputCacheEntry *cold = hash_lru_entry(cache->index.lru_tail, struct InputCacheEntry, node);
+        unsigned char old[SHA256_LEN];
+        memcpy(old, cold->key, SHA256_LEN);
+        remove_entry(cache, cold);
+        if (dropped != NULL) dropped(old, arg);
+    }
+
+    char path[ENTRY_PATH_LEN];
+    entry_path(cache, key, path);
+    unlink(path);
+    if (link(src, path) == -1){
+        perror("input cache: link");
+        return 0;
+    }
+
+    struct InputCacheEntry *entry = malloc(sizeof *entry);
+    memcpy(entry->key, key, SHA256_LEN);
+    entry->size = st.st_size;
+    hash_lru_insert(&cache->index, &entry->node, entry->key);
+
+    cache->bytes += entry->size;
+    return 1;
+}
@@ -0,0 +1,76 @@
+/*
+ * input_cache.h -- worker-side cache of job inputs by content hash, bounded by bytes with LRU eviction
+ */
+
+#ifndef INPUT_CACHE_H
+#define INPUT_CACHE_H
+
+#include "../common.h"
+#include "./sha256.h"
+#include "./hash_lru.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define INPUT_CACHE_MIN_BUCKETS 64
+
+/*
+ * InputCacheEntry -- one cached input, stored as <dir>/<hex key>
+ *
+ * key -- SHA-256 of the input (the server's blob key)
+ * size -- length in bytes
+ * node -- the entry's place in the cache's index
+ */
+struct InputCacheEntry {
+    unsigned char key[SHA256_LEN];
+    long size;
+
+    struct HashLRUNode node;
+};
+
+/*
+ * InputCache -- entries indexed by key and kept in LRU order
+ *
+ * dir -- directory holding the cached files
+ * index -- entries by key, most recently used first; index.count is the number of entries
+ * bytes, max_bytes -- total size of cached inputs and the budget they're evicted down to
+ * hits, misses -- lookups that found / didn't find their input
+ */
+struct InputCache {
+    char dir[MAXFILEPATH];
+
+    struct HashLRU index;
+
+    long bytes;
+    long max_bytes;
+
+    long hits;
+    long misses;
+};
+
+/*
+ * input_cache_dropped_fn -- called with the key of every entry input_cache_put() evicts
+ */
+typedef void (*input_cache_dropped_fn)(unsigned char key[SHA256_LEN], void *arg);
+
+/*
+ * create_input_cache() -- create an empty cache of at most max_bytes under dir (created if missing)
+ */
+struct InputCache *create_input_cache(char *dir, long max_bytes);
+
+/*
+ * input_cache_get() -- on a hit, hard-link the cached input to dest and mark it recently used. Returns 1 on a hit, 0 on a miss
+ */
+int input_cache_get(struct InputCache *cache, unsigned char key[SHA256_LEN], char *dest);
+
+/*
+ * input_cache_put() -- keep the file at src (left in place, the cache takes a hard link) under key, evicting least
+ * recently used entries to stay within budget and reporting each through dropped(). Returns 1 if it was cached, 0 if not
+ * (too big, already cached, or the link failed)
+ */
+int input_cache_put(struct InputCache *cache, unsigned char key[SHA256_LEN], char *src, input_cache_dropped_fn dropped, void *arg);
+
+#endif
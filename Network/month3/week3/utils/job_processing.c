@@ -12,7 +12,7 @@
  * This is shared by text, CSV, and image jobs.
  */
 int determine_job_type(unsigned char buf[MAXBUFSIZE], int size){
-    char keyword[size];
+    char keyword[size + 1];
     int i = 0;
     int type = -1;
 
@@ -114,7 +114,7 @@ void strip_whitespace(char *string){
         if (string[i] != ' ') break;
     }
 
-    memmove(string, string+i, len-i);
+    memmove(string, string+i, len-i+1);
 }
 
 /*
@@ -135,29 +135,58 @@ void extract_first_word(char *dest, char *orig){
     strip_whitespace(orig);
 }
 
+/*
+ * content_block_fn -- called on each block of a text job's input, in order
+ */
+typedef void (*content_block_fn)(void *arg, const unsigned char *buf, size_t len);
+
+/*
+ * stream_content() -- hand content from its current position on to fn: all of it in one block if it's a
+ * file that can be mmap()ed, otherwise TEXT_BLOCK_BYTES at a time (chain stages read memory streams, which
+ * have no fd). -1 if the block buffer can't be allocated
+ */
+static int stream_content(FILE *content, content_block_fn fn, void *arg){
+    int fd = fileno(content);
+    off_t pos = ftello(content);
+    struct stat st;
+
+    if (fd != -1 && pos != -1 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)){
+        if (st.st_size <= pos) return 1;
+
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED){
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            fn(arg, (unsigned char *)map + pos, st.st_size - pos);
+            munmap(map, st.st_size);
+            return 1;
+        }
+    }
+
+    unsigned char *block = malloc(TEXT_BLOCK_BYTES);
+    if (block == NULL) return -1;
+
+    size_t bytes_read;
+    while ((bytes_read = fread(block, 1, TEXT_BLOCK_BYTES, content)) > 0) fn(arg, block, bytes_read);
+
+    free(block);
+    return 1;
+}
+
+static void count_block(void *arg, const unsigned char *buf, size_t len){
+    text_count(arg, buf, len);
+}
+
 /*
  * job_wordcount() -- count words in content string
  *
  * Words are defined as sequences of non-space characters separated by spaces
  */
 int job_wordcount(FILE *results, FILE *content){
-    char content_read[MAXFILEREAD];
-    int bytes_read;
-    int wordcount = 0;
-    int seen_space = 1;
-
-    while ((bytes_read = fread(content_read, sizeof(char), MAXFILEREAD, content)) > 0){
-
-        for (int i = 0; i < bytes_read; i++){
-            if (content_read[i] == ' ') seen_space = 1;
-            else if (seen_space == 1) {
-                wordcount++;
-                seen_space = 0;
-            }
-        }
-    }
+    struct TextCounts counts;
+    text_counts_init(&counts);
+    if (stream_content(content, count_block, &counts) == -1) return -1;
 
-    fprintf(results, "%d total words", wordcount);
+    fprintf(results, "%lld total words", counts.words);
     return 1;
 }
 
@@ -165,17 +194,11 @@ int job_wordcount(FILE *results, FILE *content){
  * job_charcount() -- count non-space characters in content string
  */
 int job_charcount(FILE *results, FILE *content){
-    char content_read[MAXFILEREAD];
-    int bytes_read;
-    int charcount = 0;
-
-    while ((bytes_read = fread(content_read, sizeof(char), MAXFILEREAD, content)) > 0){
-        for (int i = 0; i < bytes_read; i++){
-            if (content_read[i] != ' ') charcount++;
-        }
-    }
+    struct TextCounts counts;
+    text_counts_init(&counts);
+    if (stream_content(content, count_block, &counts) == -1) return -1;
 
-    fprintf(results, "%d total characters", charcount);
+    fprintf(results, "%lld total characters", counts.chars);
     return 1;
 }
 
@@ -187,303 +210,399 @@ int job_echo(FILE *results, FILE *content){
     int bytes_read;
 
     while ((bytes_read = fread(content_read, sizeof(char), MAXFILEREAD, content)) > 0){
-        fprintf(results, "%s", content_read);
+        fwrite(content_read, sizeof(char), bytes_read, results);
     }
     return 1;
 }
 
 /*
- * job_capitalize() -- convert all lowercase letters in content to uppercase
+ * CapitalizeOut -- where job_capitalize()'s blocks go: converted into buf (TEXT_BLOCK_BYTES), then written to results
  */
-int job_capitalize(FILE *results, FILE *content){
-    char content_read[MAXFILEREAD];
-    int bytes_read;
+struct CapitalizeOut {
+    FILE *results;
+    unsigned char *buf;
+    int failed;
+};
 
-    while ((bytes_read = fread(content_read, sizeof(char), MAXFILEREAD, content)) > 0){
-        for (int i = 0; i < bytes_read; i++){
-            if (islower(content_read[i])) {
-                fprintf(results, "%c", toupper(content_read[i]));
-                continue;
-            }
-            fprintf(results, "%c", content_read[i]);
-        }
+static void capitalize_block(void *arg, const unsigned char *in, size_t len){
+    struct CapitalizeOut *out = arg;
+
+    for (size_t off = 0; off < len && !out->failed; off += TEXT_BLOCK_BYTES){
+        size_t n = len - off < TEXT_BLOCK_BYTES ? len - off : TEXT_BLOCK_BYTES;
+        text_upper(out->buf, in + off, n);
+        if (fwrite(out->buf, 1, n, out->results) != n) out->failed = 1;
     }
-    return 1;
+}
+
+/*
+ * job_capitalize() -- convert all lowercase letters in content to uppercase
+ *
+ * The input is converted a TEXT_BLOCK_BYTES block at a time into one buffer that stays in cache, and each
+ * block goes out in one fwrite(), which is bigger than the stream's buffer so it's a single write().
+ * Converting a private copy-on-write mapping in place and writing it all at once was about half as fast:
+ * every page it touches is a fault and a page copy.
+ */
+int job_capitalize(FILE *results, FILE *content){
+    struct CapitalizeOut out;
+    out.results = results;
+    out.buf = malloc(TEXT_BLOCK_BYTES);
+    out.failed = 0;
+    if (out.buf == NULL) return -1;
+
+    int rv = stream_content(content, capitalize_block, &out);
+    free(out.buf);
+    return rv == -1 || out.failed ? -1 : 1;
 }
 
 /*
  * job_csvstats() -- count CSV rows and columns, write to results
  *
- * Uses get_size() from parse_csv.c to count dimensions without full parsing.
+ * Uses get_size() from parse_csv.c to count dimensions without indexing the cells.
  * Output format: "N total entries, M columns"
  */
 int job_csvstats(FILE *results, FILE *content, unsigned char header[MAXBUFSIZE]){
-    int rows=0;
-    int cols=0;
+    long rows = 0;
+    int cols = 0;
 
-    get_size(content, &rows, &cols);
-    fprintf(results, "%d total entries, %d columns", rows, cols);
+    if (get_size(content, &rows, &cols) == -1) return -1;
+    fprintf(results, "%ld total entries, %d columns", rows, cols);
     return 1;
 }
 
 /*
- * job_csvsort_mergesort_helper() -- merge two sorted index subarrays
+ * job_csvsort() -- sort CSV rows by one or more columns, header row first
  *
- * Merges idx_arr[left..middle] and idx_arr[middle+1..right] based on
- * string comparison of csv[idx_arr[i]][col]. Sorts indices, not actual rows.
+ * Header format: "csvsort column[:type][:asc|desc] [column[:type][:asc|desc] ...]", most significant
+ * column first. Types are int, float, date or string; without one the column's cells decide (see
+ * csv_column_type()). Descending is the default, as it always was.
+ * Example: "csvsort City:asc Age:int" groups rows by City A-Z, oldest first within a city
  *
- * Note: Uses strcmp (lexicographic), so "9" > "100" because '9' > '1'.
- * Would need atoi() for proper numeric sorting.
+ * Index array strategy: sorts row numbers, not rows, then writes the rows out in that order.
+ * Big string sorts are split across tiles' threads. An input file that would take more than sort_memory
+ * bytes (0 = no limit) to sort in one go is sorted in runs spilled to dir instead (see csv_external_sort()).
  */
-void job_csvsort_mergesort_helper(char ***csv, int col, int *idx_arr, int left, int middle, int right){
-    int i = left;
-    int j = middle+1;
+int job_csvsort(FILE *results, FILE *content, unsigned char header[MAXBUFSIZE], struct TilePool *tiles, long sort_memory, const char *dir){
+    strip_whitespace((char *)header);
 
+    if (sort_memory > 0 && csv_sort_memory_estimate(content) > sort_memory){
+        printf("csvsort: input too big for %ld MB, sorting in runs.\n", sort_memory >> 20);
+        return csv_external_sort(results, content, (char *)header, dir, sort_memory, tiles);
+    }
 
-    int temp[right-left + 1];
-    int temp_idx = 0;
+    struct CSV csv;
+    if (parse_csv(&csv, content) == -1) return -1;
 
-    while (i <= middle && j <= right){
-        if (strcmp(csv[idx_arr[i]][col], csv[idx_arr[j]][col]) > 0){ // TODO: currently does not support strong string-integer comparison 
-            temp[temp_idx++] = idx_arr[i++];                        // (eg '32' < '5' with this scheme)
-        } else {
-            temp[temp_idx++] = idx_arr[j++]; 
-        }
+    struct CSVSortKey keys[CSV_SORT_MAX_KEYS];
+    int nkeys = csv_parse_sort_keys(&csv, (char *)header, keys);
+    if (nkeys == -1){  // Column not found or bad option
+        free_csv(&csv);
+        return -1;
     }
 
-    while (j <= right){
-        temp[temp_idx++] = idx_arr[j++];
+    // Rows 1..rows-1 (row 0 is the header)
+    long count = csv.rows - 1;
+    long *order = malloc(csv.rows * sizeof *order);
+    if (order == NULL){
+        free_csv(&csv);
+        return -1;
     }
-
-    while (i <= middle){
-        temp[temp_idx++] = idx_arr[i++];
+    for (long i = 0; i < count; i++){
+        order[i] = i + 1;
     }
 
-    // Copy merged result back to idx_arr
-    temp_idx = 0;
-    for (int i = left; i <= right; i++){
-        idx_arr[i] = temp[temp_idx++];
+    int rv = csv_sort_rows(&csv, keys, nkeys, order, count, tiles);
+    if (rv == 1){
+        csv_write_row(&csv, 0, results);
+        csv_write_rows(&csv, order, count, results);
     }
+
+    free(order);
+    free_csv(&csv);
+    return rv;
 }
 
 /*
- * job_csvsort_mergesort() -- recursive merge sort on index array
+ * job_csvfilter() -- filter CSV rows by tests on their columns
  *
- * Classic divide-and-conquer: sort left half, sort right half, merge.
- * Base case: single-element array is already sorted.
+ * Header format: "csvfilter test [and|or test ...]", a test being "column op value" (= != < <= > >= ^=),
+ * "column in low..high" or the old "column value" (equal). A value that's a number compares cells as
+ * numbers; and binds tighter than or. See csv_filter_compile().
+ * Example: "csvfilter City Portland" returns all rows where City="Portland"
+ * Example: "csvfilter Age >= 30 and City ^= San or Age in 18..21"
+ *
+ * Streams: rows are tested a batch at a time as the input is read, so memory doesn't grow with the file.
+ * Output is the header row, then the rows that pass.
  */
-void job_csvsort_mergesort(char ***csv, int col, int *idx_arr, int left, int right){
-    int middle = (left + right) / 2;
+int job_csvfilter(FILE *results, FILE *content, unsigned char header[MAXBUFSIZE]){
+    strip_whitespace((char *)header);
+    return csv_filter_stream(results, content, (char *)header);
+}
+
+/*
+ * create_wand_pool() -- empty pool that keeps up to cap idle wands
+ */
+struct WandPool *create_wand_pool(int cap){
+    struct WandPool *pool = malloc(sizeof *pool);
+    pool->cap = cap > 0 ? cap : 1;
+    pool->idle = malloc(pool->cap * sizeof *pool->idle);
+    pool->count = 0;
+    pthread_mutex_init(&pool->lock, NULL);
+    return pool;
+}
 
-    if (left >= right) return;
+/*
+ * wand_pool_get() -- an idle wand if there is one, a new one otherwise
+ */
+MagickWand *wand_pool_get(struct WandPool *pool){
+    MagickWand *wand = NULL;
 
-    // Recursively sort halves
-    job_csvsort_mergesort(csv, col, idx_arr, left, middle);
-    job_csvsort_mergesort(csv, col, idx_arr, middle+1, right);
+    if (pool != NULL){
+        pthread_mutex_lock(&pool->lock);
+        if (pool->count > 0) wand = pool->idle[--pool->count];
+        pthread_mutex_unlock(&pool->lock);
+    }
 
-    // Merge sorted halves
-    job_csvsort_mergesort_helper(csv, col, idx_arr, left, middle, right);
+    return wand != NULL ? wand : NewMagickWand();
 }
 
 /*
- * job_csvsort() -- sort CSV by specified column using index array strategy
- *
- * Parses column name from header, finds column index in CSV header row,
- * creates index array [1,2,3,...], sorts it based on column values,
- * outputs rows in sorted index order.
+ * wand_pool_put() -- drop the wand's images and keep it for the next job, or destroy it if the pool is full
+ */
+void wand_pool_put(struct WandPool *pool, MagickWand *wand){
+    ClearMagickWand(wand);
+
+    if (pool != NULL){
+        pthread_mutex_lock(&pool->lock);
+        if (pool->count < pool->cap){
+            pool->idle[pool->count++] = wand;
+            wand = NULL;
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    if (wand != NULL) DestroyMagickWand(wand);
+}
+
+/*
+ * free_job_result() -- release an in-memory result
+ */
+void free_job_result(struct JobResult *result){
+    if (result->data != NULL && result->magick) MagickRelinquishMemory(result->data);
+    else free(result->data);
+    result->data = NULL;
+    result->len = 0;
+}
+
+/*
+ * Tiled filters
  *
- * Index array strategy: Moves integers instead of entire rows (faster).
- * Example: idx_sort=[3,1,2] outputs rows in order: csv[3], csv[1], csv[2]
+ * Big images are cut into strips that run in parallel on the worker's tile pool. A strip for a
+ * neighbourhood filter (edge, blur) is cut with margin extra rows above and below, so every row
+ * it keeps sees the same neighbours it has in the whole image; the margins are cropped off again
+ * and the strips stacked back together. Resizes need no margins: Lanczos is separable, so rows
+ * are resized to the new width strip by strip, then columns to the new height, and each output
+ * pixel comes from the same filter taps as in a single MagickResizeImage().
  */
-int job_csvsort(FILE *results, FILE *content, unsigned char header[MAXBUFSIZE]){
-    strip_whitespace((char *)header);
 
-    char filter_keyword[MAXFILEPATH];
+/* One strip's work on its own wand, with up to two arguments. 1 on success, -1 on failure */
+typedef int (*tile_op_fn)(MagickWand *wand, double a, double b);
 
-    extract_first_word(filter_keyword, (char *)header);
+/*
+ * TiledPass -- one pass of a tile_op_fn over strips of a wand
+ *
+ * *src -- the image being cut up; strips only read it (each one clones it)
+ * **parts -- each strip's result, in order
+ * vertical -- 1 to cut columns instead of rows
+ * length, step -- size of the image across the cuts, and of each strip
+ * margin -- extra rows/columns a strip reads on both sides and crops off after op
+ * op, a, b -- the strip operation and its arguments
+ */
+struct TiledPass {
+    MagickWand *src;
+    MagickWand **parts;
 
-    struct CSV *csv = malloc(sizeof *csv);
-    csv->cols = 0;
-    csv->rows = 0;
-    parse_csv(csv, content);
+    int vertical;
+    int length;
+    int step;
+    int margin;
 
-    int col_idx = -1;
+    tile_op_fn op;
+    double a;
+    double b;
+};
 
-    for(int j = 0; j < csv->cols; j++){
-        if (strcmp(csv->csv_data[0][j], filter_keyword) == 0){
-            col_idx = j;
-            break;
-        }
-    }
-    if (col_idx == -1) return -1;  // Column not found
+/*
+ * tile_count() -- strips to cut an image of this many pixels and this length across the cuts into, 1 if it isn't worth it
+ */
+static int tile_count(struct TilePool *tiles, long pixels, int length){
+    if (tiles == NULL || tiles->threads < 2 || pixels < TILE_MIN_PIXELS) return 1;
 
-    // Initialize index array [1, 2, 3, ..., rows-1] (skip header row 0)
-    int idx_sort[csv->rows - 1];
-    for (int i = 1; i < csv->rows; i++){
-        idx_sort[i-1] = i;
-    }
+    int n = tiles->threads * TILES_PER_THREAD;
+    if (n > length / TILE_MIN_SPAN) n = length / TILE_MIN_SPAN;
+    return n < 1 ? 1 : n;
+}
 
-    for (int j = 0; j < csv->cols; j++){
-        if (j > 0) fprintf(results, ",");
-        fprintf(results, "%s", csv->csv_data[0][j]);
-    }
-    fprintf(results, "\n");
+/*
+ * crop_span() -- keep rows (or columns) [from, to) of wand, with the page reset so the strip starts at 0,0
+ */
+static int crop_span(MagickWand *wand, int vertical, int from, int to){
+    int width = MagickGetImageWidth(wand);
+    int height = MagickGetImageHeight(wand);
 
-    // Sort index array by column values (lexicographic comparison)
-    job_csvsort_mergesort(csv->csv_data, col_idx, idx_sort, 0, csv->rows - 2);
+    MagickBooleanType ok = vertical ? MagickCropImage(wand, to - from, height, from, 0) : MagickCropImage(wand, width, to - from, 0, from);
+    if (ok == MagickFalse) return -1;
+    MagickSetImagePage(wand, MagickGetImageWidth(wand), MagickGetImageHeight(wand), 0, 0);
+    return 1;
+}
 
-    // Output rows in sorted index order
-    for (int i = 0; i < csv->rows-1; i++){
-        for (int j = 0; j < csv->cols; j++){
-            if (j > 0) fprintf(results, ",");
-            fprintf(results, "%s", csv->csv_data[idx_sort[i]][j]);
-        }
-        fprintf(results, "\n");
+/*
+ * run_tile() -- tile_fn for the pool: cut strip tile (plus margins) out of a clone of src, run op, drop the margins
+ */
+static int run_tile(void *arg, int tile){
+    struct TiledPass *pass = arg;
+    int start = tile * pass->step;
+    int end = start + pass->step < pass->length ? start + pass->step : pass->length;
+    int lo = start - pass->margin > 0 ? start - pass->margin : 0;
+    int hi = end + pass->margin < pass->length ? end + pass->margin : pass->length;
+
+    MagickWand *wand = CloneMagickWand(pass->src);
+    if (crop_span(wand, pass->vertical, lo, hi) == -1 || pass->op(wand, pass->a, pass->b) == -1 ||
+        crop_span(wand, pass->vertical, start - lo, end - lo) == -1){
+        DestroyMagickWand(wand);
+        return -1;
     }
 
+    pass->parts[tile] = wand;
     return 1;
 }
 
 /*
- * job_csvfilter() -- filter CSV rows by column value match
- *
- * Header format: "csvfilter [column_name] [filter_value]"
- * Example: "csvfilter City Portland" returns all rows where City="Portland"
- *
- * Algorithm:
- * 1. Parse column name and filter value from header
- * 2. Parse CSV structure
- * 3. Find column index by searching header row
- * 4. Output header + matching rows only
+ * stitch() -- replace wand's image with parts joined top to bottom (or left to right for column strips)
  */
-int job_csvfilter(FILE *results, FILE *content, unsigned char header[MAXBUFSIZE]){
-    strip_whitespace((char *)header);
-
-    char filter_keyword[MAXFILEPATH];
-    char filter_key[MAXFILEPATH];
+static int stitch(MagickWand *wand, MagickWand **parts, int n, int vertical){
+    MagickWand *list = NewMagickWand();
+    for (int i = 0; i < n; i++) MagickAddImage(list, parts[i]);
+    MagickResetIterator(list);
+
+    MagickWand *joined = MagickAppendImages(list, vertical ? MagickFalse : MagickTrue);
+    DestroyMagickWand(list);
+    if (joined == NULL) return -1;
+
+    ClearMagickWand(wand);
+    MagickBooleanType ok = MagickAddImage(wand, joined);
+    DestroyMagickWand(joined);
+    return ok == MagickFalse ? -1 : 1;
+}
 
-    extract_first_word(filter_keyword, (char *)header);  // Column name
-    extract_first_word(filter_key, (char *)header);      // Value to match
+/*
+ * tiled_pass() -- run op over n strips of wand on the tile pool and stitch the results back into wand.
+ * With n == 1 op just runs on the whole image
+ */
+static int tiled_pass(MagickWand *wand, struct TilePool *tiles, int n, int vertical, int margin, tile_op_fn op, double a, double b){
+    if (n == 1) return op(wand, a, b);
+
+    struct TiledPass pass;
+    pass.src = wand;
+    pass.parts = calloc(n, sizeof *pass.parts);
+    pass.vertical = vertical;
+    pass.length = vertical ? MagickGetImageWidth(wand) : MagickGetImageHeight(wand);
+    pass.step = (pass.length + n - 1) / n;
+    pass.margin = margin;
+    pass.op = op;
+    pass.a = a;
+    pass.b = b;
+
+    // rounding the step up can leave the last strips empty
+    n = (pass.length + pass.step - 1) / pass.step;
+
+    int rv = tile_pool_run(tiles, n, run_tile, &pass);
+    if (rv == 1) rv = stitch(wand, pass.parts, n, vertical);
+
+    for (int i = 0; i < n; i++){
+        if (pass.parts[i] != NULL) DestroyMagickWand(pass.parts[i]);
+    }
+    free(pass.parts);
+    return rv;
+}
 
-    struct CSV *csv = malloc(sizeof *csv);
-    csv->cols = 0;
-    csv->rows = 0;
-    parse_csv(csv, content);
+static int tile_resize_rows(MagickWand *wand, double new_width, double unused){
+    return MagickResizeImage(wand, new_width, MagickGetImageHeight(wand), LanczosFilter, 1.0) == MagickFalse ? -1 : 1;
+}
 
-    int col_idx = -1;
+static int tile_resize_cols(MagickWand *wand, double unused, double new_height){
+    return MagickResizeImage(wand, MagickGetImageWidth(wand), new_height, LanczosFilter, 1.0) == MagickFalse ? -1 : 1;
+}
 
-    for(int j = 0; j < csv->cols; j++){
-        if (strcmp(csv->csv_data[0][j], filter_keyword) == 0){
-            col_idx = j;
-            break;
-        }
-    }
-    if (col_idx == -1) return -1;  // Column not found
-    
-    // Write header row
-    for (int j = 0; j < csv->cols; j++){
-        if (j > 0) fprintf(results, ",");
-        fprintf(results, "%s", csv->csv_data[0][j]);
-    }
-    fprintf(results, "\n");
-
-    // Write matching rows only
-    for (int i = 0; i < csv->rows; i++){
-        if (strcmp(csv->csv_data[i][col_idx], filter_key) == 0){
-            for (int j = 0; j < csv->cols; j++){
-                if (j > 0) fprintf(results, ",");
-                fprintf(results, "%s", csv->csv_data[i][j]);
-            }
-            fprintf(results, "\n");
-        }
-    }
+/*
+ * tile_charcoal() -- the neighbourhood half of MagickCharcoalImage(): grayscale, edge detect, blur.
+ * Its normalize step looks at the whole image, so it runs after the strips are stitched
+ */
+static int tile_charcoal(MagickWand *wand, double radius, double sigma){
+    if (MagickSetImageType(wand, GrayscaleType) == MagickFalse ||
+        MagickEdgeImage(wand, radius) == MagickFalse ||
+        MagickBlurImage(wand, radius, sigma) == MagickFalse) return -1;
+    return 1;
+}
 
+static int tile_stencil(MagickWand *wand, double unused_a, double unused_b){
+    if (MagickTransformImageColorspace(wand, GRAYColorspace) == MagickFalse ||
+        MagickEdgeImage(wand, 1) == MagickFalse ||
+        MagickNegateImage(wand, MagickFalse) == MagickFalse ||
+        MagickThresholdImage(wand, 0.7 * QuantumRange) == MagickFalse) return -1;
     return 1;
 }
 
 /*
- * job_scale() -- resize an image proportionally using a scale factor
- *
- * Header format: "scale 0.5"
+ * resize_to() -- Lanczos resize to new_width x new_height, tiled when the image is big enough
  */
-int job_scale(unsigned char header[MAXBUFSIZE], char* img_path, char *output_path){
-    printf("scaling\n");
-    MagickWand *magick_wand;
-    MagickBooleanType status;
+static int resize_to(MagickWand *magick_wand, int new_width, int new_height, struct TilePool *tiles){
+    int width = MagickGetImageWidth(magick_wand);
+    int height = MagickGetImageHeight(magick_wand);
+    long pixels = (long)width * height > (long)new_width * new_height ? (long)width * height : (long)new_width * new_height;
 
-    MagickWandGenesis();
-    magick_wand = NewMagickWand();
-
-    status = MagickReadImage(magick_wand, img_path);
-    if (status == MagickFalse){
-        fprintf(stderr, "Error reading file %s\n", img_path);
-        return 1;
+    int rows = tile_count(tiles, pixels, height);
+    if (rows == 1 || new_width <= 0 || new_height <= 0){
+        return MagickResizeImage(magick_wand, new_width, new_height, LanczosFilter, 1.0) == MagickFalse ? -1 : 1;
     }
 
-    int img_width = MagickGetImageWidth(magick_wand);
-    int img_height = MagickGetImageHeight(magick_wand);
-
-    printf("img dimensions: %d x %d (wxh)\n", img_width, img_height);
+    if (tiled_pass(magick_wand, tiles, rows, 0, 0, tile_resize_rows, new_width, 0) == -1) return -1;
+    return tiled_pass(magick_wand, tiles, tile_count(tiles, pixels, new_width), 1, 0, tile_resize_cols, 0, new_height);
+}
 
+/*
+ * img_scale() -- resize proportionally by the factor in args ("0.5")
+ */
+static int img_scale(MagickWand *magick_wand, unsigned char args[MAXBUFSIZE], struct TilePool *tiles){
     char factor_c[MAXFILEPATH];
-    strip_whitespace(header);
-    extract_first_word(factor_c, header);
+    strip_whitespace(args);
+    extract_first_word(factor_c, args);
 
     char *endptr;
     double scale_factor = strtod(factor_c, &endptr);
 
     printf("scale factor: %f\n", scale_factor);
 
-    status = MagickResizeImage(magick_wand, img_width*scale_factor, img_height*scale_factor, LanczosFilter, 1.0);
-    if (status == MagickFalse){
-        fprintf(stderr, "Failed to resize image %s\n", img_path);
-        return -1;
-    }
+    int img_width = MagickGetImageWidth(magick_wand);
+    int img_height = MagickGetImageHeight(magick_wand);
 
-    status = MagickWriteImage(magick_wand, output_path);
-    if (status == MagickFalse) {
-        fprintf(stderr, "Error writing image\n");
-        return 1;
+    if (resize_to(magick_wand, img_width*scale_factor, img_height*scale_factor, tiles) == -1){
+        fprintf(stderr, "Failed to scale image\n");
+        return -1;
     }
-
-    magick_wand = DestroyMagickWand(magick_wand);
-    MagickWandTerminus();
-
     return 1;
 }
 
 /*
- * job_resize() -- resize an image to exact width x height dimensions
- *
- * Header format: "resize 300x300"
+ * img_resize() -- resize to the exact WxH in args ("300x300")
  */
-int job_resize(unsigned char header[MAXBUFSIZE], char* img_path, char *output_path){
-    printf("resizing\n");
-    MagickWand *magick_wand;
-    MagickBooleanType status;
-
-    MagickWandGenesis();
-    magick_wand = NewMagickWand();
-
-    status = MagickReadImage(magick_wand, img_path);
-    if (status == MagickFalse){
-        fprintf(stderr, "Error reading file %s\n", img_path);
-        return -1;
-    }
-
-    int img_width = MagickGetImageWidth(magick_wand);
-    int img_height = MagickGetImageHeight(magick_wand);
-
-    printf("img dimensions: %d x %d (wxh)\n", img_width, img_height);
-
+static int img_resize(MagickWand *magick_wand, unsigned char args[MAXBUFSIZE], struct TilePool *tiles){
     char new_dimension[MAXFILEPATH];
-    strip_whitespace(header);
-    extract_first_word(new_dimension, header);
+    strip_whitespace(args);
+    extract_first_word(new_dimension, args);
 
     int i = 0;
     for (; i < strlen(new_dimension); i++){
         if (new_dimension[i] == 'x'){
-            new_dimension[i] == '\0';
             i++;
             break;
         }
@@ -494,336 +613,360 @@ int job_resize(unsigned char header[MAXBUFSIZE], char* img_path, char *output_pa
 
     printf("new dimensions: %d x %d\n", new_width, new_height);
 
-    status = MagickResizeImage(magick_wand, new_width, new_height, LanczosFilter, 1.0);
-    if (status == MagickFalse){
-        fprintf(stderr, "Failed to resize image %s\n", img_path);
+    if (resize_to(magick_wand, new_width, new_height, tiles) == -1){
+        fprintf(stderr, "Failed to resize image\n");
         return -1;
     }
-
-    status = MagickWriteImage(magick_wand, output_path);
-    if (status == MagickFalse) {
-        fprintf(stderr, "Error writing image\n");
-        return 1;
-    }
-
-    magick_wand = DestroyMagickWand(magick_wand);
-    MagickWandTerminus();
-
     return 1;
 }
 
 /*
- * job_filter_img() -- placeholder for a future generic image filter command
+ * img_filter() -- placeholder for a future generic filter; leaves the image as it is
  */
-int job_filter_img(unsigned char header[MAXBUFSIZE], char* img_path, char *output_path){
-    printf("filtering!\n");
-    return 0;
+static int img_filter(MagickWand *magick_wand, unsigned char args[MAXBUFSIZE], struct TilePool *tiles){
+    return 1;
 }
 
 /*
- * job_flipy_img() -- flip image vertically
+ * img_flipy() -- flip vertically
  */
-int job_flipy_img(unsigned char header[MAXBUFSIZE], char* img_path, char *output_path){
-    printf("flipping!\n");
-    MagickWand *magick_wand;
-    MagickBooleanType status;
-
-    MagickWandGenesis();
-    magick_wand = NewMagickWand();
-
-    status = MagickReadImage(magick_wand, img_path);
-    if (status == MagickFalse){
-        fprintf(stderr, "Error reading file %s\n", img_path);
+static int img_flipy(MagickWand *magick_wand, unsigned char args[MAXBUFSIZE], struct TilePool *tiles){
+    if (MagickFlipImage(magick_wand) == MagickFalse){
+        fprintf(stderr, "Failed to flip image\n");
         return -1;
     }
-
-    int img_width = MagickGetImageWidth(magick_wand);
-    int img_height = MagickGetImageHeight(magick_wand);
-
-    printf("img dimensions: %d x %d (wxh)\n", img_width, img_height);
-
-
-    status = MagickFlipImage(magick_wand);
-    if (status == MagickFalse){
-        fprintf(stderr, "Failed to resize image %s\n", img_path);
-        return -1;
-    }
-
-    status = MagickWriteImage(magick_wand, output_path);
-    if (status == MagickFalse) {
-        fprintf(stderr, "Error writing image\n");
-        return 1;
-    }
-
-    magick_wand = DestroyMagickWand(magick_wand);
-    MagickWandTerminus();
-
     return 1;
 }
 
 /*
- * job_flipx_img() -- flip image horizontally
+ * img_flipx() -- flip horizontally
  */
-int job_flipx_img(unsigned char header[MAXBUFSIZE], char* img_path, char *output_path){
-    printf("flipping!\n");
-    MagickWand *magick_wand;
-    MagickBooleanType status;
-
-    MagickWandGenesis();
-    magick_wand = NewMagickWand();
-
-    status = MagickReadImage(magick_wand, img_path);
-    if (status == MagickFalse){
-        fprintf(stderr, "Error reading file %s\n", img_path);
-        return -1;
-    }
-
-    int img_width = MagickGetImageWidth(magick_wand);
-    int img_height = MagickGetImageHeight(magick_wand);
-
-    printf("img dimensions: %d x %d (wxh)\n", img_width, img_height);
-
-
-    status = MagickFlopImage(magick_wand);
-    if (status == MagickFalse){
-        fprintf(stderr, "Failed to resize image %s\n", img_path);
+static int img_flipx(MagickWand *magick_wand, unsigned char args[MAXBUFSIZE], struct TilePool *tiles){
+    if (MagickFlopImage(magick_wand) == MagickFalse){
+        fprintf(stderr, "Failed to flip image\n");
         return -1;
     }
-
-    status = MagickWriteImage(magick_wand, output_path);
-    if (status == MagickFalse) {
-        fprintf(stderr, "Error writing image\n");
-        return 1;
-    }
-
-    magick_wand = DestroyMagickWand(magick_wand);
-    MagickWandTerminus();
-
     return 1;
 }
 
 /*
- * job_rotate_img() -- rotate image by a degree value from the header
- *
- * Header format: "rotate 90"
+ * img_rotate() -- rotate by the degrees in args ("90"), filling the corners black
  */
-int job_rotate_img(unsigned char header[MAXBUFSIZE], char* img_path, char *output_path){
-    printf("rotate\n");
-    MagickWand *magick_wand;
-    MagickBooleanType status;
+static int img_rotate(MagickWand *magick_wand, unsigned char args[MAXBUFSIZE], struct TilePool *tiles){
+    char degree[MAXFILEPATH];
+    strip_whitespace(args);
+    extract_first_word(degree, args);
 
-    MagickWandGenesis();
-    magick_wand = NewMagickWand();
+    char *endptr;
+    double degrees = strtod(degree, &endptr);
 
     PixelWand *bg = NewPixelWand();
     PixelSetColor(bg, "black");
+    MagickBooleanType status = MagickRotateImage(magick_wand, bg, degrees);
+    DestroyPixelWand(bg);
 
-    status = MagickReadImage(magick_wand, img_path);
     if (status == MagickFalse){
-        fprintf(stderr, "Error reading file %s\n", img_path);
+        fprintf(stderr, "Failed to rotate image\n");
         return -1;
     }
+    return 1;
+}
 
-    int img_width = MagickGetImageWidth(magick_wand);
-    int img_height = MagickGetImageHeight(magick_wand);
+/*
+ * img_charcoal() -- ImageMagick's charcoal effect with the radius and sigma in args. On big images the
+ * edge detect and blur run as strips and normalize/negate run once on the stitched result
+ */
+static int img_charcoal(MagickWand *magick_wand, unsigned char args[MAXBUFSIZE], struct TilePool *tiles){
+    char radius_s[MAXFILEPATH];
+    strip_whitespace(args);
+    extract_first_word(radius_s, args);
 
-    printf("img dimensions: %d x %d (wxh)\n", img_width, img_height);
+    char *endptr;
+    double radius = strtod(radius_s, &endptr);
 
-    char degree[MAXFILEPATH];
-    strip_whitespace(header);
-    extract_first_word(degree, header);
+    char sigma_s[MAXFILEPATH];
+    strip_whitespace(args);
+    extract_first_word(sigma_s, args);
 
-    char *endptr;
-    double degrees = strtod(degree, &endptr);
+    double sigma = strtod(sigma_s, &endptr);
 
-    status = MagickRotateImage(magick_wand, bg, degrees);
-    if (status == MagickFalse){
-        fprintf(stderr, "Failed to resize image %s\n", img_path);
-        return -1;
-    }
+    int width = MagickGetImageWidth(magick_wand);
+    int height = MagickGetImageHeight(magick_wand);
+    int n = tile_count(tiles, (long)width * height, height);
 
-    status = MagickWriteImage(magick_wand, output_path);
-    if (status == MagickFalse) {
-        fprintf(stderr, "Error writing image\n");
+    if (n == 1){
+        if (MagickCharcoalImage(magick_wand, radius, sigma) == MagickFalse){
+            fprintf(stderr, "Failed to apply charcoal filter\n");
+            return -1;
+        }
         return 1;
     }
 
-    magick_wand = DestroyMagickWand(magick_wand);
-    MagickWandTerminus();
+    // edge then blur: with radius 0 Magick sizes each kernel itself, the blur's out to where a gaussian tail drops under one quantum
+    int edge_reach = radius > 0 ? (int)ceil(radius) : 2;
+    int blur_reach = radius > 0 ? (int)ceil(radius) : (int)ceil(5 * sigma) + 2;
 
+    if (tiled_pass(magick_wand, tiles, n, 0, edge_reach + blur_reach + 2, tile_charcoal, radius, sigma) == -1 ||
+        MagickNormalizeImage(magick_wand) == MagickFalse ||
+        MagickNegateImage(magick_wand, MagickFalse) == MagickFalse ||
+        MagickSetImageType(magick_wand, GrayscaleType) == MagickFalse){
+        fprintf(stderr, "Failed to apply charcoal filter\n");
+        return -1;
+    }
     return 1;
 }
 
 /*
- * job_charcoal_img() -- apply ImageMagick's charcoal effect
- *
- * Header format: "charcoal_filter [radius] [sigma]"
+ * img_monochrome() -- convert to grayscale
  */
-int job_charcoal_img(unsigned char header[MAXBUFSIZE], char* img_path, char *output_path){
-    printf("charcoal\n");
-    MagickWand *magick_wand;
-    MagickBooleanType status;
+static int img_monochrome(MagickWand *magick_wand, unsigned char args[MAXBUFSIZE], struct TilePool *tiles){
+    if (MagickTransformImageColorspace(magick_wand, GRAYColorspace) == MagickFalse){
+        fprintf(stderr, "Failed to convert image to grayscale\n");
+        return -1;
+    }
+    return 1;
+}
 
-    MagickWandGenesis();
-    magick_wand = NewMagickWand();
+/*
+ * img_stencil() -- grayscale, edge detect, negate and threshold into a stencil
+ */
+static int img_stencil(MagickWand *magick_wand, unsigned char args[MAXBUFSIZE], struct TilePool *tiles){
+    int height = MagickGetImageHeight(magick_wand);
+    int n = tile_count(tiles, (long)MagickGetImageWidth(magick_wand) * height, height);
 
-    status = MagickReadImage(magick_wand, img_path);
-    if (status == MagickFalse){
-        fprintf(stderr, "Error reading file %s\n", img_path);
+    // the edge kernel reaches one pixel; everything else is per pixel
+    if (tiled_pass(magick_wand, tiles, n, 0, 3, tile_stencil, 0, 0) == -1){
+        fprintf(stderr, "Failed to apply stencil filter\n");
         return -1;
     }
+    return 1;
+}
 
-    int img_width = MagickGetImageWidth(magick_wand);
-    int img_height = MagickGetImageHeight(magick_wand);
+/*
+ * image_op_for() -- the wand operation behind an image job type, NULL for anything else
+ */
+static image_op_fn image_op_for(int job_type){
+    if (job_type == JTYPE_SCALE) return img_scale;
+    if (job_type == JTYPE_RESIZE) return img_resize;
+    if (job_type == JTYPE_FILTER) return img_filter;
+    if (job_type == JTYPE_FLIPX) return img_flipx;
+    if (job_type == JTYPE_FLIPY) return img_flipy;
+    if (job_type == JTYPE_ROTATE) return img_rotate;
+    if (job_type == JTYPE_CHARCOAL) return img_charcoal;
+    if (job_type == JTYPE_MONOCHROME) return img_monochrome;
+    if (job_type == JTYPE_STENCIL) return img_stencil;
+    return NULL;
+}
 
-    printf("img dimensions: %d x %d (wxh)\n", img_width, img_height);
+/*
+ * run_text_job() -- run one text/CSV job from content into results. -1 if job_type isn't a text job
+ */
+static int run_text_job(int job_type, FILE *results, FILE *content, unsigned char header[MAXBUFSIZE], struct TilePool *tiles, long sort_memory, const char *dir){
+    if (job_type == JTYPE_WORDCOUNT) return job_wordcount(results, content);
+    if (job_type == JTYPE_CHARCOUNT) return job_charcount(results, content);
+    if (job_type == JTYPE_ECHO) return job_echo(results, content);
+    if (job_type == JTYPE_CAPITALIZE) return job_capitalize(results, content);
+    if (job_type == JTYPE_CSVFILTER) return job_csvfilter(results, content, header);
+    if (job_type == JTYPE_CSVSORT) return job_csvsort(results, content, header, tiles, sort_memory, dir);
+    if (job_type == JTYPE_CSVSTATS) return job_csvstats(results, content, header);
+    return -1;
+}
 
-    char radius_s[MAXFILEPATH];
-    strip_whitespace(header);
-    extract_first_word(radius_s, header);
+/*
+ * parse_chain() -- cut a "stage | stage | ..." spec into stages, each left holding its arguments, with its job type in types[].
+ * Returns the number of stages, or -1 if there are too many or one isn't a known job
+ */
+static int parse_chain(unsigned char *spec, unsigned char stages[][MAXBUFSIZE], int types[]){
+    int n = 0;
+    char *cur = (char *)spec;
 
-    char *endptr;
-    double radius = strtod(radius_s, &endptr);
+    while (1){
+        char *bar = strchr(cur, '|');
+        int len = bar != NULL ? bar - cur : strlen(cur);
+        if (n == MAX_CHAIN_STAGES) return -1;
 
-    char sigma_s[MAXFILEPATH];
-    strip_whitespace(header);
-    extract_first_word(sigma_s, header);
+        while (len > 0 && *cur == ' ') cur++, len--;
+        while (len > 0 && cur[len-1] == ' ') len--;
 
-    double sigma = strtod(sigma_s, &endptr);
+        if (len == 0) return -1;
+        memset(stages[n], 0, MAXBUFSIZE);
+        memcpy(stages[n], cur, len);
+        types[n] = determine_job_type(stages[n], len);
+        if (types[n] == -1) return -1;
+        n++;
 
-    status = MagickCharcoalImage(magick_wand, radius, sigma);
-    if (status == MagickFalse){
-        fprintf(stderr, "Failed to resize image %s\n", img_path);
-        return -1;
+        if (bar == NULL) return n;
+        cur = bar + 1;
     }
+}
 
-    status = MagickWriteImage(magick_wand, output_path);
-    if (status == MagickFalse) {
-        fprintf(stderr, "Error writing image\n");
-        return 1;
+/*
+ * native_chain() -- 1 if every stage can skip ImageMagick (see native_image.h)
+ */
+static int native_chain(unsigned char stages[][MAXBUFSIZE], int types[], int n){
+    if (!NATIVE_IMAGE_KERNELS) return 0;
+    for (int i = 0; i < n; i++){
+        if (!native_supports(types[i], stages[i])) return 0;
     }
-
-    magick_wand = DestroyMagickWand(magick_wand);
-    MagickWandTerminus();
-
     return 1;
 }
 
 /*
- * job_monochrome_img() -- convert image to grayscale
+ * process_image_job() -- decode the input once, apply every stage to the same wand, encode once into result
  *
- * User-facing command keyword is "grayscale_filter".
+ * The input is mapped and decoded with MagickReadImageBlob(), and the encoded result stays in memory for the
+ * worker to send straight to the server, so neither goes through Magick's own file I/O or a results file.
+ * Chains of only flips, quarter turns and grayscale go through native_image_job() instead, falling back to
+ * Magick if stb_image can't decode the input.
  */
-int job_monochrome_img(unsigned char header[MAXBUFSIZE], char* img_path, char *output_path){
-    printf("mono\n");
-    MagickWand *magick_wand;
-    MagickBooleanType status;
-
-    MagickWandGenesis();
-    magick_wand = NewMagickWand();
+static int process_image_job(unsigned char stages[][MAXBUFSIZE], int types[], int n, char *img_path, struct WandPool *wands, struct TilePool *tiles, struct JobResult *result){
+    image_op_fn ops[MAX_CHAIN_STAGES];
+    for (int i = 0; i < n; i++){
+        if ((ops[i] = image_op_for(types[i])) == NULL) return WERR_INVALIDJOB;
+    }
 
-    status = MagickReadImage(magick_wand, img_path);
-    if (status == MagickFalse){
+    int fd = open(img_path, O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1 || st.st_size == 0){
         fprintf(stderr, "Error reading file %s\n", img_path);
+        if (fd != -1) close(fd);
         return -1;
     }
 
-    int img_width = MagickGetImageWidth(magick_wand);
-    int img_height = MagickGetImageHeight(magick_wand);
+    void *input = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (input == MAP_FAILED){
+        perror("mmap");
+        return -1;
+    }
+
+    if (native_chain(stages, types, n)){
+        int native = native_image_job(stages, types, n, input, st.st_size, NATIVE_JPEG_QUALITY, &result->data, &result->len);
+        if (native != 0){
+            munmap(input, st.st_size);
+            result->magick = 0;
+            return native;
+        }
+    }
 
-    printf("img dimensions: %d x %d (wxh)\n", img_width, img_height);
+    MagickWand *magick_wand = wand_pool_get(wands);
+    MagickBooleanType status = MagickReadImageBlob(magick_wand, input, st.st_size);
+    munmap(input, st.st_size);
 
-    status = MagickTransformImageColorspace(magick_wand, GRAYColorspace);
     if (status == MagickFalse){
-        fprintf(stderr, "Failed to resize image %s\n", img_path);
+        fprintf(stderr, "Error decoding file %s\n", img_path);
+        wand_pool_put(wands, magick_wand);
         return -1;
     }
 
-    status = MagickWriteImage(magick_wand, output_path);
-    if (status == MagickFalse) {
-        fprintf(stderr, "Error writing image\n");
-        return 1;
+    int rv = 1;
+    for (int i = 0; i < n && rv == 1; i++){
+        printf("stage %d/%d: %d x %d\n", i + 1, n, (int)MagickGetImageWidth(magick_wand), (int)MagickGetImageHeight(magick_wand));
+        rv = ops[i](magick_wand, stages[i], tiles);
+    }
+
+    if (rv == 1){
+        MagickSetImageFormat(magick_wand, "JPEG");
+        result->data = MagickGetImageBlob(magick_wand, &result->len);
+        result->magick = 1;
+        if (result->data == NULL || result->len == 0){
+            fprintf(stderr, "Error encoding image\n");
+            free_job_result(result);
+            rv = -1;
+        }
     }
 
-    magick_wand = DestroyMagickWand(magick_wand);
-    MagickWandTerminus();
-
-    return 1;
+    wand_pool_put(wands, magick_wand);
+    return rv;
 }
 
 /*
- * job_stencil_img() -- produce a grayscale edge-detected stencil effect
+ * process_text_chain() -- run the stages back to back, each reading the previous one's output from memory
+ *
+ * Only the first stage reads the input file and only the last writes the results file; everything in
+ * between stays in an open_memstream() buffer. Any image stage makes the whole chain WERR_INVALIDJOB.
  */
-int job_stencil_img(unsigned char header[MAXBUFSIZE], char* img_path, char *output_path){
-    printf("stencil\n");
-    MagickWand *magick_wand;
-    MagickBooleanType status;
-
-    MagickWandGenesis();
-    magick_wand = NewMagickWand();
-
-    status = MagickReadImage(magick_wand, img_path);
-    if (status == MagickFalse){
-        fprintf(stderr, "Error reading file %s\n", img_path);
-        return -1;
+static int process_text_chain(unsigned char stages[][MAXBUFSIZE], int types[], int n, FILE *results, FILE *content, struct TilePool *tiles, long sort_memory, const char *dir){
+    for (int i = 0; i < n; i++){
+        if (image_op_for(types[i]) != NULL) return WERR_INVALIDJOB;
     }
 
-    int img_width = MagickGetImageWidth(magick_wand);
-    int img_height = MagickGetImageHeight(magick_wand);
-
-    printf("img dimensions: %d x %d (wxh)\n", img_width, img_height);
+    FILE *in = content;
+    char *buf = NULL;
+    size_t len = 0;
+    int rv = 1;
 
-    status = MagickTransformImageColorspace(magick_wand, GRAYColorspace);
-    if (status == MagickFalse){
-        fprintf(stderr, "Failed to resize image %s\n", img_path);
-        return -1;
-    }
+    for (int i = 0; i < n && rv == 1; i++){
+        char *out_buf = NULL;
+        size_t out_len = 0;
+        FILE *out = i == n - 1 ? results : open_memstream(&out_buf, &out_len);
+        if (out == NULL){
+            rv = -1;
+            break;
+        }
 
-    status = MagickEdgeImage(magick_wand, 1);
-    if (status == MagickFalse){
-        fprintf(stderr, "Failed to resize image %s\n", img_path);
-        return -1;
-    }
+        if (n > 1) printf("stage %d/%d\n", i + 1, n);
+        rv = run_text_job(types[i], out, in, stages[i], tiles, sort_memory, dir);
 
-    status = MagickNegateImage(magick_wand, MagickFalse);
-    if (status == MagickFalse){
-        fprintf(stderr, "Failed to resize image %s\n", img_path);
-        return -1;
-    }
+        if (in != content) fclose(in);
+        in = content;
+        free(buf);
+        buf = NULL;
+        if (out == results) break;
 
-    status = MagickThresholdImage(magick_wand, 0.7 * QuantumRange);
-    if (status == MagickFalse) {
-        fprintf(stderr, "Error writing image\n");
-        return 1;
-    }
+        fclose(out);
+        buf = out_buf;
+        len = out_len;
 
-
-    status = MagickWriteImage(magick_wand, output_path);
-    if (status == MagickFalse) {
-        fprintf(stderr, "Error writing image\n");
-        return 1;
+        // fmemopen() won't take an empty buffer
+        in = len > 0 ? fmemopen(buf, len, "r") : fopen("/dev/null", "r");
+        if (in == NULL){
+            rv = -1;
+            break;
+        }
     }
 
-    magick_wand = DestroyMagickWand(magick_wand);
-    MagickWandTerminus();
-
-    return 1;
+    if (in != content && in != NULL) fclose(in);
+    free(buf);
+    return rv;
 }
 
-
 /*
  * process_job() -- route job to appropriate handler based on type
  *
- * Determines job type from content, calls appropriate job function, returns result or error code
+ * Determines job type from content, calls appropriate job function, returns result or error code.
+ * A spec with '|' in it is a chain ("resize 800x600 | grayscale_filter | rotate 90") of image stages or
+ * of text stages, run as one job; a single job is just a one-stage chain, and an image stage on a text
+ * input (or the other way round) is WERR_INVALIDJOB. Text jobs write results<ext> in dir; image jobs leave
+ * their encoded result in *result, with a wand from wands (may be NULL) and
+ * heavy filters on big images and big csvsorts split across tiles (may be NULL to run everything on the calling thread),
+ * and csvsorts bigger than sort_memory spilled to dir.
+ * Safe to call from several slot threads at once as long as each gets its own dir; image jobs
+ * expect the caller to have run MagickWandGenesis() once up front.
  */
-int process_job(unsigned char header[MAXBUFSIZE], char dir[MAXFILEPATH], char ext[MAXFILEEXT]){
-    int job_type = determine_job_type(header, strlen((char *)header));
-    int rv = 1;
+int process_job(unsigned char header[MAXBUFSIZE], char dir[MAXFILEPATH], char ext[MAXFILEEXT], struct WandPool *wands, struct TilePool *tiles, long sort_memory, struct JobResult *result){
+    unsigned char (*stages)[MAXBUFSIZE] = malloc(MAX_CHAIN_STAGES * sizeof *stages);
+    int types[MAX_CHAIN_STAGES];
+    int n = 1;
+
+    result->data = NULL;
+    result->len = 0;
+    result->magick = 0;
 
-    if (job_type == -1){
+    if (strchr((char *)header, '|') != NULL){
+        n = parse_chain(header, stages, types);
+    } else {
+        types[0] = determine_job_type(header, strlen((char *)header));
+        memcpy(stages[0], header, MAXBUFSIZE);
+        if (types[0] == -1) n = -1;
+    }
+
+    if (n == -1){
+        free(stages);
         return WERR_INVALIDJOB;
     }
 
+    int rv = 1;
     char fcontent[MAXFILEPATH];
     strcpy(fcontent, dir);
 
@@ -833,105 +976,21 @@ int process_job(unsigned char header[MAXBUFSIZE], char dir[MAXFILEPATH], char ex
     if (strcmp(ext, ".txt") == 0){
         printf("txt job.\n");
         strcat(fresults, "results.txt");
-        fclose(fopen(fresults, "w"));
         strcat(fcontent, "content.txt");
         FILE *results_file = fopen(fresults ,"w");
         FILE *content_file = fopen(fcontent ,"r");
 
-        if (job_type == JTYPE_WORDCOUNT){
-            FILE *results_file = fopen(fresults ,"w");
-            FILE *content_file = fopen(fcontent ,"r");
-            rv = job_wordcount(results_file, content_file);
-        } 
-        
-        else if (job_type == JTYPE_CHARCOUNT){
-            FILE *results_file = fopen(fresults ,"w");
-            FILE *content_file = fopen(fcontent ,"r");
-            rv = job_charcount(results_file, content_file);
-        }
-
-        else if (job_type == JTYPE_ECHO){
-            FILE *results_file = fopen(fresults ,"w");
-            FILE *content_file = fopen(fcontent ,"r");
-            rv = job_echo(results_file, content_file);
-        }
-
-        else if (job_type == JTYPE_CAPITALIZE){
-            FILE *results_file = fopen(fresults ,"w");
-            FILE *content_file = fopen(fcontent ,"r");
-            rv = job_capitalize(results_file, content_file);
-        }
-
-        else if (job_type == JTYPE_CSVFILTER){
-            FILE *results_file = fopen(fresults ,"w");
-            FILE *content_file = fopen(fcontent ,"r");
-            rv = job_csvfilter(results_file, content_file, header);
-        }
-
-        else if (job_type == JTYPE_CSVSORT){
-            FILE *results_file = fopen(fresults ,"w");
-            FILE *content_file = fopen(fcontent ,"r");
-            rv = job_csvsort(results_file, content_file, header);
-        }
-
-        else if (job_type == JTYPE_CSVSTATS){
-            FILE *results_file = fopen(fresults ,"w");
-            FILE *content_file = fopen(fcontent ,"r");
-            rv = job_csvstats(results_file, content_file, header);
-        }
+        rv = process_text_chain(stages, types, n, results_file, content_file, tiles, sort_memory, dir);
 
         fclose(results_file);
         fclose(content_file);
 
     } else if (strcmp(ext, ".jpg") == 0){
         printf("img job.\n");
-        strcat(fresults, "results.jpg");
-        fclose(fopen(fresults, "wb"));
         strcat(fcontent, "content.jpg");
-        FILE *results_file = fopen(fresults ,"wb");
-        FILE *content_file = fopen(fcontent ,"rb");
-
-        if (job_type == JTYPE_SCALE){
-            rv = job_scale(header, fcontent, fresults);
-        }
-
-        else if (job_type == JTYPE_RESIZE){
-            rv = job_resize(header, fcontent, fresults);
-        }
-
-        else if (job_type == JTYPE_FILTER){
-            rv = job_filter_img(header, fcontent, fresults);
-        }
-
-        else if (job_type == JTYPE_FLIPX){
-            rv = job_flipx_img(header, fcontent, fresults);
-        }
-
-        else if (job_type == JTYPE_FLIPY){
-            rv = job_flipy_img(header, fcontent, fresults);
-        }
-
-        else if (job_type == JTYPE_ROTATE){
-            rv = job_rotate_img(header, fcontent, fresults);
-        }
-
-        else if (job_type == JTYPE_CHARCOAL){
-            rv = job_charcoal_img(header, fcontent, fresults);
-        }
-
-        else if (job_type == JTYPE_MONOCHROME){
-            rv = job_monochrome_img(header, fcontent, fresults);
-        }
-
-        else if (job_type == JTYPE_STENCIL){
-            rv = job_stencil_img(header, fcontent, fresults);
-        }
-
-
-
-        fclose(results_file);
-        fclose(content_file);
+        rv = process_image_job(stages, types, n, fcontent, wands, tiles, result);
     }
+
+    free(stages);
     return rv;
 }
-
@@ -9,12 +9,60 @@
 #include "../common.h"
 #include "./file_transfer.h"
 #include "./csv/parse_csv.h"
+#include "./csv/sort_csv.h"
+#include "./csv/external_sort.h"
+#include "./csv/filter_csv.h"
+#include "./native_image.h"
+#include "./tile_pool.h"
+#include "./text_kernels.h"
 
 #include <stdio.h>
+#include <math.h>
 #include <ctype.h>
 #include <string.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <wand/MagickWand.h>
 
+#define MAX_CHAIN_STAGES 16  // stages in one "op | op | ..." spec
+
+/* One image operation applied to an already decoded wand, with the stage's arguments; heavy ones may split big images across tiles. 1 on success, -1 on failure */
+typedef int (*image_op_fn)(MagickWand *wand, unsigned char args[MAXBUFSIZE], struct TilePool *tiles);
+
+/*
+ * WandPool -- idle MagickWands shared by a worker's slot threads, so image jobs don't each build and tear down their own
+ *
+ * **idle, count, cap -- cleared wands ready for the next job, at most cap of them
+ * lock -- guards idle/count
+ */
+struct WandPool {
+    MagickWand **idle;
+    int count;
+    int cap;
+    pthread_mutex_t lock;
+};
+
+/*
+ * JobResult -- a result produced in memory instead of written to results<ext>
+ *
+ * *data, len -- the encoded bytes (NULL/0 if the job wrote its results file); release with free_job_result()
+ * magick -- 1 if data came from MagickGetImageBlob(), 0 if from the native path's malloc()
+ */
+struct JobResult {
+    unsigned char *data;
+    size_t len;
+    int magick;
+};
+
+/* Wand pool and in-memory results (image jobs) */
+struct WandPool *create_wand_pool(int cap);
+MagickWand *wand_pool_get(struct WandPool *pool);
+void wand_pool_put(struct WandPool *pool, MagickWand *wand);
+void free_job_result(struct JobResult *result);
+
 int determine_job_type(unsigned char buf[MAXBUFSIZE], int size);
 
 /* String parsing utilities for job argument extraction */
@@ -33,34 +81,10 @@ int job_capitalize(FILE *results, FILE *content);
 /* CSV job types (require CSV parsing) */
 int job_csvstats(FILE *results, FILE *content, unsigned char header[MAXBUFSIZE]);
 
-int job_csvsort(FILE *results, FILE *content, unsigned char header[MAXBUFSIZE]);
+int job_csvsort(FILE *results, FILE *content, unsigned char header[MAXBUFSIZE], struct TilePool *tiles, long sort_memory, const char *dir);
 
 int job_csvfilter(FILE *results, FILE *content, unsigned char header[MAXBUFSIZE]);
 
-/* Image job types operate on file paths because MagickWand works on image files, not FILE* streams. */
-int job_scale(unsigned char header[MAXBUFSIZE], char* img_path, char *output_path);
-
-int job_resize(unsigned char header[MAXBUFSIZE], char* img_path, char *output_path);
-
-/* Placeholder hook for a future generic filter command. */
-int job_filter_img(unsigned char header[MAXBUFSIZE], char* img_path, char *output_path);
-
-int job_flipy_img(unsigned char header[MAXBUFSIZE], char* img_path, char *output_path);
-
-int job_flipx_img(unsigned char header[MAXBUFSIZE], char* img_path, char *output_path);
-
-int job_rotate_img(unsigned char header[MAXBUFSIZE], char* img_path, char *output_path);
-
-int job_charcoal_img(unsigned char header[MAXBUFSIZE], char* img_path, char *output_path);
-
-int job_monochrome_img(unsigned char header[MAXBUFSIZE], char* img_path, char *output_path);
-
-int job_stencil_img(unsigned char header[MAXBUFSIZE], char* img_path, char *output_path);
-
-/* CSV sorting helpers (merge sort on index array) */
-void job_csvsort_mergesort(char ***csv, int col, int *idx_arr, int left, int right);
-void job_csvsort_mergesort_helper(char ***csv, int col, int *idx_arr, int left, int middle, int right);
-
-int process_job(unsigned char content[MAXBUFSIZE], char fname[MAXFILEPATH], char ext[MAXFILEEXT]);
+int process_job(unsigned char content[MAXBUFSIZE], char fname[MAXFILEPATH], char ext[MAXFILEEXT], struct WandPool *wands, struct TilePool *tiles, long sort_memory, struct JobResult *result);
 
 #endif
\ No newline at end of file
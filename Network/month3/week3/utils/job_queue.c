@@ -1,31 +1,40 @@
 /*
  * job_queue.c -- job queue logic
+ *
+ * Ring buffer of job ids. One allocation per doubling instead of one malloc/free per job,
+ * and the ids sit next to each other in memory.
  */
 
 #include "./job_queue.h"
 
 /*
- * create_jobq() -- create a job queue node with job_id initialized and next set to NULL
+ * grow_queue() -- double the slot array, unwrapping the contents so head starts at 0
  */
-struct JobQ *create_jobq(int job_id){
-    struct JobQ *jobq = malloc(sizeof *jobq);
-    jobq->job_id = job_id;
-    jobq->next = NULL;
+static void grow_queue(struct JobQueue *queue){
+    int new_cap = queue->cap * 2;
+    int *ids = malloc(new_cap * sizeof *ids);
+
+    int first = queue->cap - queue->head; // slots from head to the end of the old array
+    if (first > queue->count) first = queue->count;
+
+    memcpy(ids, queue->ids + queue->head, first * sizeof *ids);
+    memcpy(ids + first, queue->ids, (queue->count - first) * sizeof *ids);
 
-    return jobq;
+    free(queue->ids);
+    queue->ids = ids;
+    queue->cap = new_cap;
+    queue->head = 0;
 }
 
 /*
  * print_queue() -- display all jobs in queue with their positions for debugging
  */
 void print_queue(struct JobQueue *queue){
-    struct JobQ *job = queue->head;
-    int position = 1;
+    int mask = queue->cap - 1;
 
     printf("\n=== JOBS IN QUEUE ===\n");
-    for (job; job != NULL; job = job->next){
-        printf("%d: Job %d\n", position, job->job_id);
-        position++;
+    for (int i = 0; i < queue->count; i++){
+        printf("%d: Job %d\n", i + 1, queue->ids[(queue->head + i) & mask]);
     }
 
     if (queue->count == 0){
@@ -36,54 +45,59 @@ void print_queue(struct JobQueue *queue){
 }
 
 /*
- * create_queue() -- initialize an empty job queue
+ * create_queue() -- initialize an empty job queue with JOBQ_MIN_CAP slots
  */
 struct JobQueue *create_queue(){
     struct JobQueue *queue = malloc(sizeof *queue);
-    queue->head = NULL;
-    queue->tail = NULL;
+    queue->ids = malloc(JOBQ_MIN_CAP * sizeof *queue->ids);
+    queue->cap = JOBQ_MIN_CAP;
+    queue->head = 0;
     queue->count = 0;
 
     return queue;
 }
 
+/*
+ * free_queue() -- free the slot array and the queue itself
+ */
+void free_queue(struct JobQueue *queue){
+    free(queue->ids);
+    free(queue);
+}
+
 /*
  * add_to_queue() -- append a job to the tail of the queue
  */
 void add_to_queue(struct JobQueue *queue, int job_id){
-    struct JobQ *job = create_jobq(job_id);
+    if (queue->count == queue->cap) grow_queue(queue);
 
-    if (queue->count == 0){
-        queue->head = queue->tail = job;
-        queue->count++;
-        return;
-    }
+    queue->ids[(queue->head + queue->count) & (queue->cap - 1)] = job_id;
+    queue->count++;
+}
+
+/*
+ * push_front_queue() -- put a job in front of everything else in the queue
+ */
+void push_front_queue(struct JobQueue *queue, int job_id){
+    if (queue->count == queue->cap) grow_queue(queue);
 
-    queue->tail->next = job;
-    queue->tail = job;
+    queue->head = (queue->head - 1) & (queue->cap - 1);
+    queue->ids[queue->head] = job_id;
     queue->count++;
 }
 
 /*
  * pop_queue() -- remove and return the job_id from the head of the queue
  *
- * Frees the removed node's memory. Returns -1 if queue is empty.
+ * Returns -1 if queue is empty.
  */
 int pop_queue(struct JobQueue *queue){
     if (queue->count <= 0){
         return -1;
     }
 
-    int job_id = queue->head->job_id;
-    struct JobQ *head = queue->head;
-
-    if (queue->count == 1){
-        queue->head = queue->tail = NULL;
-    } else {
-        queue->head = head->next;
-    }
-
-    free(head);
+    int job_id = queue->ids[queue->head];
+    queue->head = (queue->head + 1) & (queue->cap - 1);
     queue->count--;
     return job_id;
-}
\ No newline at end of file
+}
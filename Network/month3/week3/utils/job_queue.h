@@ -10,43 +10,51 @@
 #include <stdio.h>
 #include <string.h>
 
-/*
- * JobQ -- extremely basic job queue node
- */
-struct JobQ {
-    int job_id;
-    struct JobQ *next;
-};
+#define JOBQ_MIN_CAP 16
 
 /*
- * JobQueue -- singly linked list-based queue implementation for jobs
+ * JobQueue -- growable ring buffer of job ids
+ *
+ * *ids -- slot array, capacity is always a power of two so wrapping is a mask
+ * cap -- number of slots
+ * head -- slot holding the first job in line
+ * count -- number of jobs in the queue
+ *
+ * The buffer doubles when it fills and never shrinks, so steady-state enqueue/dequeue
+ * does no allocation at all.
  */
 struct JobQueue {
-    struct JobQ *head;
-    struct JobQ *tail;
+    int *ids;
+    int cap;
+    int head;
     int count;
 };
 
 /*
- * create_jobq() -- create a jobq struct and return its pointer
+ * create_queue() -- create an empty JobQueue struct and return its pointer
  */
-struct JobQ *create_jobq(int job_id);
+struct JobQueue *create_queue();
 
 /*
- * create_queue() -- create an empty JobQueue struct and return its pointer
+ * free_queue() -- release a queue and its slot array
  */
-struct JobQueue *create_queue();
+void free_queue(struct JobQueue *queue);
 
 void print_queue(struct JobQueue *queue);
 
 /*
- * add_to_queue() -- add a new job to the job queue
+ * add_to_queue() -- add a new job to the back of the job queue
  */
 void add_to_queue(struct JobQueue *queue, int job_id);
 
+/*
+ * push_front_queue() -- add a job to the front of the queue so it is popped next (used for retries)
+ */
+void push_front_queue(struct JobQueue *queue, int job_id);
+
 /*
  * pop_queue() -- pop and return the id of the first job in line, returns -1 if empty
  */
 int pop_queue(struct JobQueue *queue);
 
-#endif
\ No newline at end of file
+#endif
@@ -1,9 +1,102 @@
 /*
  * jobs.c -- management and storage of jobs in the task queue server
+ *
+ * Jobs live in a doubly linked list (submission order) and are indexed by an
+ * open-addressing hash table keyed on job_id, so lookups stay O(1) no matter how
+ * many jobs the server has seen. Terminal jobs are also threaded onto a completed
+ * list so the retention policy can evict the oldest ones without scanning.
  */
 
  #include "./jobs.h"
 
+/*
+ * hash_job_id() -- fibonacci hash of a job id down to a slot in a table of size (mask + 1)
+ *
+ * Job ids are sequential, so a multiplicative hash spreads them across the table
+ * instead of clustering them into one long probe run.
+ */
+static unsigned int hash_job_id(int job_id, unsigned int mask){
+    uint32_t h = (uint32_t)job_id * 2654435769u;
+    return (h ^ (h >> 16)) & mask;
+}
+
+/*
+ * index_insert() -- place a job into the index, reusing the first tombstone on the probe path.
+ * Returns 1 if it took an empty slot, 0 if it reused a tombstone
+ */
+static int index_insert(struct JobSlot *index, int cap, struct Job *job){
+    unsigned int mask = cap - 1;
+    unsigned int i = hash_job_id(job->job_id, mask);
+
+    while (index[i].job != NULL){
+        i = (i + 1) & mask;
+    }
+
+    int was_empty = index[i].job_id == JOB_SLOT_EMPTY;
+    index[i].job_id = job->job_id;
+    index[i].job = job;
+    return was_empty;
+}
+
+/*
+ * index_resize() -- rebuild the index with new_cap slots, dropping every tombstone
+ */
+static void index_resize(struct Jobs *jobs, int new_cap){
+    struct JobSlot *index = malloc(new_cap * sizeof *index);
+    for (int i = 0; i < new_cap; i++){
+        index[i].job_id = JOB_SLOT_EMPTY;
+        index[i].job = NULL;
+    }
+
+    for (int i = 0; i < jobs->index_cap; i++){
+        if (jobs->index[i].job != NULL) index_insert(index, new_cap, jobs->index[i].job);
+    }
+
+    free(jobs->index);
+    jobs->index = index;
+    jobs->index_cap = new_cap;
+    jobs->index_used = jobs->count;
+}
+
+/*
+ * index_find() -- return the slot holding job_id, -1 if not present
+ *
+ * Tombstones keep the probe going, empty slots end it.
+ */
+static int index_find(struct Jobs *jobs, int job_id){
+    if (jobs->index_cap == 0) return -1;
+
+    unsigned int mask = jobs->index_cap - 1;
+    unsigned int i = hash_job_id(job_id, mask);
+
+    while (jobs->index[i].job_id != JOB_SLOT_EMPTY){
+        if (jobs->index[i].job_id == job_id && jobs->index[i].job != NULL) return i;
+        i = (i + 1) & mask;
+    }
+    return -1;
+}
+
+/*
+ * create_jobs() -- create an empty Jobs table (list + index) and return its pointer
+ */
+struct Jobs *create_jobs(){
+    struct Jobs *jobs = malloc(sizeof *jobs);
+    jobs->head = NULL;
+    jobs->tail = NULL;
+    jobs->count = 0;
+
+    jobs->index = NULL;
+    jobs->index_cap = 0;
+    jobs->index_used = 0;
+    index_resize(jobs, JOB_INDEX_MIN_CAP);
+
+    jobs->done_head = NULL;
+    jobs->done_tail = NULL;
+    jobs->done_count = 0;
+
+    return jobs;
+}
+
  /*
  * create_blank_job() -- create a 0-initialized job on the heap
  */
@@ -12,24 +105,54 @@ struct Job *create_blank_job(){
     job->job_id = -1;
     job->job_type = -1;
     job->retry_ct = 0;
+    job->priority = SCHED_DEFAULT_PRIORITY;
+    job->client_key = 0;
+    job->parent_id = -1;
+    job->chunk_off = 0;
+    job->chunk_len = 0;
+    job->chunks_total = 0;
+    job->chunks_done = 0;
+    job->split_count = 0;
+    job->cache_keyed = 0;
     job->status = J_IN_QUEUE;
     job->next = NULL;
+    job->prev = NULL;
+    job->done_next = NULL;
+    job->done_prev = NULL;
     job->time_start = -1;
+    job->time_end = -1;
     job->worker_id = -1;
     job->results[0] = '\0';
     job->file_path[0] = '\0';
+    job->file_type = -1;
+    job->input = NULL;
+    job->result = NULL;
 
     return job;
 }
 
 /*
- * add_job() -- add an initialized job to the jobs SLL
+ * add_job() -- append an initialized job to the jobs list and insert it into the index
+ *
+ * The index is kept at or below 50% load (tombstones included); when it fills up it is
+ * rebuilt at double the size, or at the same size if it's mostly tombstones.
  */
 void add_job(struct Jobs *jobs, struct Job *job){
     if (job == NULL){
         return;
     }
 
+    if ((jobs->index_used + 1) * 2 > jobs->index_cap){
+        int new_cap = jobs->index_cap;
+        if ((jobs->count + 1) * 4 > jobs->index_cap) new_cap *= 2;
+        index_resize(jobs, new_cap);
+    }
+    // a reused tombstone was already counted
+    jobs->index_used += index_insert(jobs->index, jobs->index_cap, job);
+
+    job->next = NULL;
+    job->prev = jobs->tail;
+
     if (jobs->count == 0){
         jobs->head = jobs->tail = job;
         jobs->count++;
@@ -43,38 +166,39 @@ void add_job(struct Jobs *jobs, struct Job *job){
 }
 
 /*
- * remove_job() -- remove a job from the SLL
+ * unlink_done() -- take a job out of the completed list if it is on it
  */
-void remove_job(struct Jobs *jobs, int job_id){
-    if (jobs->count == 0){
-        return;
-    }
+static void unlink_done(struct Jobs *jobs, struct Job *job){
+    if (job->time_end < 0) return;
 
-    struct Job *res = jobs->head;
-    struct Job *prev = NULL;
+    if (job->done_prev != NULL) job->done_prev->done_next = job->done_next;
+    else jobs->done_head = job->done_next;
 
-    if (jobs->count == 1){
-        if (jobs->head->job_id != job_id) return;
-        free(jobs->head);
-        jobs->head = jobs->tail = NULL;
-        jobs->count--;
-        return;
-    }
+    if (job->done_next != NULL) job->done_next->done_prev = job->done_prev;
+    else jobs->done_tail = job->done_prev;
 
-    for (res; res != NULL && res->job_id != job_id; res = res->next){
-        prev = res;
-    }
+    job->done_next = job->done_prev = NULL;
+    jobs->done_count--;
+}
 
-    if (res == NULL) return;
+/*
+ * remove_job() -- remove a job from the list, the index and the completed list, then free it
+ */
+void remove_job(struct Jobs *jobs, int job_id){
+    int slot = index_find(jobs, job_id);
+    if (slot == -1) return;
 
-    if (res == jobs->head){
-        jobs->head = res->next;
-    } else if (res == jobs->tail){
-        jobs->tail = prev;
-        prev->next = NULL;
-    } else {
-        prev->next = res->next;
-    }
+    struct Job *res = jobs->index[slot].job;
+    jobs->index[slot].job = NULL;
+    jobs->index[slot].job_id = JOB_SLOT_TOMBSTONE;
+
+    if (res->prev != NULL) res->prev->next = res->next;
+    else jobs->head = res->next;
+
+    if (res->next != NULL) res->next->prev = res->prev;
+    else jobs->tail = res->prev;
+
+    unlink_done(jobs, res);
 
     free(res);
     jobs->count--;
@@ -85,24 +209,62 @@ void remove_job(struct Jobs *jobs, int job_id){
  * get_job_by_id() -- return a pointer to the corresponding job given an id, NULL if not found
  */
 struct Job *get_job_by_id(struct Jobs *jobs, int job_id){
-    if (jobs->count != 0){
-        for (struct Job *cur = jobs->head; cur != NULL; cur = cur->next){
-            if (cur->job_id == job_id) return cur;
-        }
-    }
-    return NULL;
+    int slot = index_find(jobs, job_id);
+    if (slot == -1) return NULL;
+    return jobs->index[slot].job;
 }
 
 /*
  * get_job_status() -- return the status code of a job, given it's ID
  */
 int get_job_status(struct Jobs *jobs, int job_id){
-    if (jobs->count != 0){
-        for (struct Job *cur = jobs->head; cur != NULL; cur = cur->next){
-            if (cur->job_id == job_id) return cur->status;
-        }
+    struct Job *job = get_job_by_id(jobs, job_id);
+    if (job == NULL) return -1;
+    return job->status;
+}
+
+/*
+ * mark_job_done() -- stamp time_end and append the job to the completed list
+ *
+ * Jobs finish in roughly time order, so appending keeps the list sorted oldest-first
+ * and eviction only ever has to look at the head.
+ */
+void mark_job_done(struct Jobs *jobs, struct Job *job, int now_ms){
+    if (job->time_end >= 0) return; // already on the list
+
+    job->time_end = now_ms;
+    job->done_next = NULL;
+    job->done_prev = jobs->done_tail;
+
+    if (jobs->done_tail != NULL) jobs->done_tail->done_next = job;
+    else jobs->done_head = job;
+
+    jobs->done_tail = job;
+    jobs->done_count++;
+}
+
+/*
+ * evict_done_jobs() -- evict terminal jobs past their retention age or beyond the retention count
+ *
+ * A negative max_age_ms or max_done disables that half of the policy. Whatever the job still
+ * holds in storage is handed to release() before it goes.
+ */
+int evict_done_jobs(struct Jobs *jobs, int now_ms, int max_age_ms, int max_done, job_release_fn release, void *arg){
+    int evicted = 0;
+
+    while (jobs->done_head != NULL){
+        struct Job *oldest = jobs->done_head;
+
+        int too_old = max_age_ms >= 0 && now_ms - oldest->time_end >= max_age_ms;
+        int too_many = max_done >= 0 && jobs->done_count > max_done;
+        if (!too_old && !too_many) break;
+
+        if (release != NULL) release(oldest, arg);
+        remove_job(jobs, oldest->job_id);
+        evicted++;
     }
-    return -1;
+
+    return evicted;
 }
 
 /*
@@ -110,4 +272,4 @@ int get_job_status(struct Jobs *jobs, int job_id){
  */
 struct Job *get_job(unsigned char command[MAXJOBCOMMANDSIZE]){
     // TODO: setup modular job type extraction, identify starting job types and formatting
-}
\ No newline at end of file
+}
@@ -7,21 +7,42 @@
 
 // imports
 #include "../common.h"
+#include "./sha256.h"
 
 #include <stddef.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+
+struct Blob;
 
 /*
  * Job -- struct for containing Job data
  *
  * job_id -- id assigned by server to facilitate lookups
  * worker_id -- id of worker assigned to the job
- * 
+ *
  * status -- status code of task process
  * time_start -- time, since program start, that the job began
- * 
+ * time_end -- time the job reached a terminal status (J_SUCCESS/J_FAILURE), -1 until then
+ *
+ * file_path -- where the upload is staged until it's in the blob store (empty after that)
+ * file_type -- TXT_FILE or IMG_FILE; results have the same type as the input
+ * *input, *result -- blob store references to the input (until the job finishes) and the result (once it succeeds)
+ *
  * job_type -- job code type for the job being processed
- * *next -- pointer to the next job in the linked list
+ * priority -- scheduler level the job was submitted at (0 is most urgent)
+ * client_key -- submitting client, used by the scheduler for fair share
+ *
+ * parent_id -- for a chunk sub-job, the split job it belongs to (-1 otherwise)
+ * chunk_off, chunk_len -- for a chunk sub-job, its byte range of the parent's input
+ * chunks_total, chunks_done -- for a split job, how many sub-jobs it was cut into and how many have finished (0 if not split)
+ * split_count -- for a split wordcount/charcount, the sum of the chunk counts so far
+ *
+ * cache_key, cache_keyed -- result cache key, hashed while the input was uploaded (cache_keyed is 0 if there isn't one)
+ *
+ * *next, *prev -- neighbours in the jobs list
+ * *done_next, *done_prev -- neighbours in the completed (retention) list, oldest first
  */
 struct Job {
     int job_id;
@@ -33,32 +54,92 @@ struct Job {
     unsigned char job_spec[MAXJOBCOMMANDSIZE];
     char file_path[MAXFILEPATH];
     int time_start;
+    int time_end;
+
+    int file_type;
+    struct Blob *input;
+    struct Blob *result;
 
     int job_type;
+    int priority;
+    unsigned long long client_key;
+
+    int parent_id;
+    long chunk_off;
+    long chunk_len;
+    int chunks_total;
+    int chunks_done;
+    long long split_count;
+
+    unsigned char cache_key[SHA256_LEN];
+    int cache_keyed;
+
     struct Job *next;
+    struct Job *prev;
+
+    struct Job *done_next;
+    struct Job *done_prev;
+};
+
+/*
+ * JobSlot -- one entry of the open-addressing job index
+ *
+ * The id is stored next to the pointer so a probe never has to dereference the job.
+ * An empty slot has job == NULL and job_id == JOB_SLOT_EMPTY, a deleted one JOB_SLOT_TOMBSTONE.
+ */
+struct JobSlot {
+    int job_id;
+    struct Job *job;
 };
 
+#define JOB_SLOT_EMPTY -1
+#define JOB_SLOT_TOMBSTONE -2
+#define JOB_INDEX_MIN_CAP 64
+
 /*
- * Jobs -- simple linked list for managing multiple jobs
+ * Jobs -- linked list of jobs plus a hash index keyed on job_id
+ *
+ * *head, *tail -- jobs list in submission order
+ * count -- total number of jobs
+ *
+ * *index -- open-addressing table (linear probing), capacity is always a power of two
+ * index_cap -- number of slots in the index
+ * index_used -- live entries + tombstones, used to decide when to grow/rehash
+ *
+ * *done_head, *done_tail -- terminal jobs in the order they finished, used by the retention policy
+ * done_count -- number of jobs in the completed list
  */
 struct Jobs {
     struct Job *head;
     struct Job *tail;
     int count;
+
+    struct JobSlot *index;
+    int index_cap;
+    int index_used;
+
+    struct Job *done_head;
+    struct Job *done_tail;
+    int done_count;
 };
 
+/*
+ * create_jobs() -- create an empty Jobs table (list + index) and return its pointer
+ */
+struct Jobs *create_jobs();
+
 /*
  * create_blank_job() -- create a 0-initialized job on the heap
  */
 struct Job *create_blank_job();
 
 /*
- * add_job() -- add an initialized job to the jobs SLL
+ * add_job() -- add an initialized job to the jobs list and index
  */
 void add_job(struct Jobs *jobs, struct Job *job);
 
 /*
- * remove_job() -- remove a job from the SLL
+ * remove_job() -- remove a job from the list and index, and free it
  */
 void remove_job(struct Jobs *jobs, int job_id);
 
@@ -72,9 +153,25 @@ struct Job *get_job_by_id(struct Jobs *jobs, int job_id);
  */
 int get_job_status(struct Jobs *jobs, int job_id);
 
+/*
+ * mark_job_done() -- stamp time_end and append the job to the completed list so retention can evict it later
+ */
+void mark_job_done(struct Jobs *jobs, struct Job *job, int now_ms);
+
+/*
+ * job_release_fn -- called on each job retention is about to evict, so the owner can let go of what it holds (blobs)
+ */
+typedef void (*job_release_fn)(struct Job *job, void *arg);
+
+/*
+ * evict_done_jobs() -- remove terminal jobs older than max_age_ms, or beyond the newest max_done of them.
+ * release(job, arg) runs on each one first, if given. Returns the number of jobs evicted.
+ */
+int evict_done_jobs(struct Jobs *jobs, int now_ms, int max_age_ms, int max_done, job_release_fn release, void *arg);
+
 /*
  * get_job_type() -- given a command string, identify the corresponding job type, then create and return a pointer to the new job
  */
 struct Job *get_job(unsigned char command[MAXJOBCOMMANDSIZE]);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,422 @@
+/*
+ * journal.c -- write-ahead log of job lifecycle records with group commit and snapshots
+ *
+ * The event loop never waits on the disk: journal_append() just encodes a record into the
+ * pending buffer. The committer thread takes whatever piled up while its last fdatasync() ran,
+ * writes it in one go and syncs once, so the cost of a sync is shared by every record in the
+ * batch and the batch grows on its own as the submit rate goes up. Callers that must not
+ * acknowledge anything before it's durable (job submission) wait for journal_durable().
+ *
+ * Records are [len 4][crc 4][lsn 8][type 2][payload]. A crash can leave a torn record at the end
+ * of the log; replay stops at the first record whose length or CRC doesn't check out and cuts
+ * the file there. A snapshot is the full state written as ordinary records behind a mark that
+ * says which lsn it covers, so replay is "snapshot, then the log records past that lsn", and a
+ * crash between writing a snapshot and truncating the log just means some records get skipped.
+ * What the records mean is up to the caller; this file only frames, orders and syncs them.
+ */
+
+#define _GNU_SOURCE
+#include "./journal.h"
+
+static unsigned int crc_table[256];
+
+static void crc_init(){
+    for (unsigned int i = 0; i < 256; i++){
+        unsigned int c = i;
+        for (int k = 0; k < 8; k++) c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        crc_table[i] = c;
+    }
+}
+
+static unsigned int crc32(const unsigned char *data, long len){
+    unsigned int c = 0xFFFFFFFFu;
+    for (long i = 0; i < len; i++) c = crc_table[(c ^ data[i]) & 0xFF] ^ (c >> 8);
+    return c ^ 0xFFFFFFFFu;
+}
+
+static void buf_reserve(struct JournalBuf *b, long extra){
+    if (b->len + extra <= b->cap) return;
+
+    long cap = b->cap > 0 ? b->cap : JOURNAL_MIN_BUF;
+    while (cap < b->len + extra) cap *= 2;
+    b->data = realloc(b->data, cap);
+    b->cap = cap;
+}
+
+/*
+ * encode_record() -- append one framed record to b
+ */
+static void encode_record(struct JournalBuf *b, unsigned long long lsn, int type, unsigned char *payload, int len){
+    buf_reserve(b, JOURNAL_REC_HEADER + len);
+    unsigned char *rec = b->data + b->len;
+
+    packi32(rec, len);
+    packi64(rec + 8, lsn);
+    packi16(rec + 16, type);
+    if (len > 0) memcpy(rec + JOURNAL_REC_HEADER, payload, len);
+    packi32(rec + 4, crc32(rec + 8, JOURNAL_REC_HEADER - 8 + len));
+
+    b->len += JOURNAL_REC_HEADER + len;
+}
+
+/*
+ * decode_record() -- check the record at data[pos] and return its total length, or -1 if it's torn or corrupt
+ */
+static long decode_record(unsigned char *data, long size, long pos, unsigned long long *lsn, int *type, int *len){
+    if (size - pos < JOURNAL_REC_HEADER) return -1;
+
+    unsigned char *rec = data + pos;
+    *len = unpacki32(rec);
+    if (*len < 0 || *len > JOURNAL_MAX_PAYLOAD || size - pos - JOURNAL_REC_HEADER < *len) return -1;
+    if ((unsigned int)unpacki32(rec + 4) != crc32(rec + 8, JOURNAL_REC_HEADER - 8 + *len)) return -1;
+
+    *lsn = (unsigned long long)unpacki64(rec + 8);
+    *type = unpacki16(rec + 16);
+    return JOURNAL_REC_HEADER + *len;
+}
+
+/*
+ * read_whole() -- read a file into a malloc'd buffer. Returns NULL (size 0) if it doesn't exist or can't be read
+ */
+static unsigned char *read_whole(int fd, long *size){
+    struct stat st;
+    *size = 0;
+    if (fd == -1 || fstat(fd, &st) == -1 || st.st_size == 0) return NULL;
+
+    unsigned char *data = malloc(st.st_size);
+    long got = 0;
+    while (got < st.st_size){
+        long n = pread(fd, data + got, st.st_size - got, got);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        got += n;
+    }
+
+    *size = got;
+    return data;
+}
+
+/*
+ * fsync_dir_of() -- flush the directory entry of path, so a newly created or renamed file survives a crash
+ */
+static void fsync_dir_of(char *path){
+    char dir[MAXFILEPATH];
+    snprintf(dir, MAXFILEPATH, "%s", path);
+
+    char *slash = strrchr(dir, '/');
+    if (slash == NULL) strcpy(dir, ".");
+    else *slash = '\0';
+
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd == -1) return;
+    fsync(fd);
+    close(fd);
+}
+
+static void write_all(int fd, unsigned char *data, long len){
+    while (len > 0){
+        long n = write(fd, data, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0){
+            // past this point nothing we acknowledge would really be durable
+            perror("journal: write");
+            exit(1);
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+static void sync_journal(int fd){
+    if (fdatasync(fd) == -1){
+        perror("journal: fdatasync");
+        exit(1);
+    }
+}
+
+/*
+ * sync_files() -- flush data files the batch's records refer to, then their directories (once each)
+ *
+ * A file that's gone was deleted because nothing referred to it any more, so there's nothing to keep.
+ */
+static void sync_files(char paths[][MAXFILEPATH], int count){
+    for (int i = 0; i < count; i++){
+        int fd = open(paths[i], O_RDONLY);
+        if (fd == -1) continue;
+        fdatasync(fd);
+        close(fd);
+    }
+
+    for (int i = 0; i < count; i++){
+        char *slash = strrchr(paths[i], '/');
+        int len = slash == NULL ? 0 : slash - paths[i];
+        int seen = 0;
+
+        for (int k = 0; k < i && !seen; k++){
+            char *other = strrchr(paths[k], '/');
+            seen = (other == NULL ? 0 : other - paths[k]) == len && strncmp(paths[k], paths[i], len) == 0;
+        }
+        if (!seen) fsync_dir_of(paths[i]);
+    }
+}
+
+/*
+ * write_snapshot() -- write the snapshot next to its final name, sync it, then rename it into place
+ */
+static void write_snapshot(struct Journal *j, struct JournalBuf *snap){
+    char tmp[MAXFILEPATH + 4];
+    snprintf(tmp, sizeof tmp, "%s.tmp", j->snapshot_path);
+
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1){
+        perror("journal: snapshot");
+        exit(1);
+    }
+    write_all(fd, snap->data, snap->len);
+    sync_journal(fd);
+    close(fd);
+
+    if (rename(tmp, j->snapshot_path) == -1){
+        perror("journal: snapshot rename");
+        exit(1);
+    }
+    fsync_dir_of(j->snapshot_path);
+}
+
+/*
+ * committer_main() -- committer thread: take everything pending, sync what it refers to, write it, sync once
+ *
+ * With a snapshot in the batch, the records appended before it go to the old log first; once the
+ * snapshot is in place the log is truncated and the records appended after it start the new one.
+ */
+static void *committer_main(void *arg){
+    struct Journal *j = arg;
+    struct JournalBuf batch = {NULL, 0, 0};
+    static char paths[JOURNAL_MAX_SYNC][MAXFILEPATH];
+    uint64_t one = 1;
+
+    while (1){
+        pthread_mutex_lock(&j->lock);
+        while (j->pending.len == 0 && j->sync_count == 0 && !j->sync_all && j->snapshot == NULL){
+            j->idle = 1;
+            pthread_cond_wait(&j->wake, &j->lock);
+            j->idle = 0;
+        }
+
+        struct JournalBuf swap = batch;
+        batch = j->pending;
+        j->pending = swap;
+        j->pending.len = 0;
+
+        unsigned long long lsn = j->last_lsn;
+        int npaths = j->sync_count;
+        int sync_all = j->sync_all;
+        memcpy(paths, j->sync_paths, npaths * sizeof paths[0]);
+        j->sync_count = 0;
+        j->sync_all = 0;
+
+        struct JournalBuf *snap = j->snapshot;
+        long split = snap != NULL ? j->snapshot_split : batch.len;
+        j->snapshot = NULL;
+        pthread_mutex_unlock(&j->lock);
+
+        if (sync_all) syncfs(j->fd);
+        else sync_files(paths, npaths);
+
+        if (split > 0){
+            write_all(j->fd, batch.data, split);
+            sync_journal(j->fd);
+        }
+
+        if (snap != NULL){
+            write_snapshot(j, snap);
+            if (ftruncate(j->fd, 0) == -1) perror("journal: truncate");
+            free(snap->data);
+            free(snap);
+        }
+
+        if (batch.len > split){
+            write_all(j->fd, batch.data + split, batch.len - split);
+            sync_journal(j->fd);
+        }
+
+        pthread_mutex_lock(&j->lock);
+        if (split > 0 || batch.len > split){
+            j->commits++;
+            j->committed += lsn - j->durable_lsn;
+        }
+        j->durable_lsn = lsn;
+        if (snap != NULL) j->snapshotting = 0;
+        pthread_mutex_unlock(&j->lock);
+
+        if (write(j->notify_fd, &one, sizeof one) != sizeof one) perror("journal: eventfd");
+    }
+
+    return NULL;
+}
+
+/*
+ * replay_file() -- feed the records of data to replay() (skipping those up to skip_lsn) and return how many bytes were valid
+ *
+ * *last_lsn is raised to the highest lsn seen; *mark_lsn (if given) receives a snapshot mark's lsn.
+ */
+static long replay_file(unsigned char *data, long size, unsigned long long skip_lsn, unsigned long long *last_lsn,
+                        unsigned long long *mark_lsn, journal_replay_fn replay, void *arg){
+    unsigned long long lsn;
+    int type, len;
+    long pos = 0, n;
+
+    while ((n = decode_record(data, size, pos, &lsn, &type, &len)) > 0){
+        if (type == JOURNAL_SNAPSHOT_MARK){
+            if (mark_lsn != NULL) *mark_lsn = lsn;
+        } else if (lsn > skip_lsn){
+            replay(type, data + pos + JOURNAL_REC_HEADER, len, arg);
+        }
+
+        if (lsn > *last_lsn) *last_lsn = lsn;
+        pos += n;
+    }
+
+    return pos;
+}
+
+/*
+ * open_journal() -- replay snapshot + log, cut the log after its last good record, start the committer
+ */
+struct Journal *open_journal(char *path, char *snapshot_path, journal_replay_fn replay, void *arg){
+    crc_init();
+
+    int fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (fd == -1){
+        perror("journal: open");
+        return NULL;
+    }
+
+    struct Journal *j = calloc(1, sizeof *j);
+    j->fd = fd;
+    snprintf(j->snapshot_path, MAXFILEPATH, "%s", snapshot_path);
+
+    unsigned long long snap_lsn = 0, last_lsn = 0;
+    long size, valid;
+    unsigned char *data;
+
+    int sfd = open(snapshot_path, O_RDONLY);
+    data = read_whole(sfd, &size);
+    if (sfd != -1) close(sfd);
+    if (data != NULL){
+        valid = replay_file(data, size, 0, &last_lsn, &snap_lsn, replay, arg);
+        if (valid != size) fprintf(stderr, "journal: snapshot %s is damaged after %ld bytes\n", snapshot_path, valid);
+        free(data);
+    }
+
+    data = read_whole(fd, &size);
+    valid = replay_file(data, size, snap_lsn, &last_lsn, NULL, replay, arg);
+    free(data);
+    if (valid < size){
+        printf("journal: dropping %ld bytes of torn records at the end of %s\n", size - valid, path);
+        if (ftruncate(fd, valid) == -1) perror("journal: truncate");
+    }
+
+    j->next_lsn = last_lsn + 1;
+    j->last_lsn = last_lsn;
+    j->durable_lsn = last_lsn;
+    printf("journal: replayed up to lsn %llu (snapshot at %llu)\n", last_lsn, snap_lsn);
+
+    pthread_mutex_init(&j->lock, NULL);
+    pthread_cond_init(&j->wake, NULL);
+    j->notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    pthread_create(&j->committer, NULL, committer_main, j);
+    pthread_detach(j->committer);
+    return j;
+}
+
+/*
+ * journal_append() -- encode a record into the pending batch and wake the committer
+ */
+unsigned long long journal_append(struct Journal *j, int type, unsigned char *payload, int len){
+    unsigned long long lsn = j->next_lsn++;
+    j->since_snapshot++;
+
+    pthread_mutex_lock(&j->lock);
+    encode_record(&j->pending, lsn, type, payload, len);
+    j->last_lsn = lsn;
+    if (j->idle) pthread_cond_signal(&j->wake); // a busy committer picks it up with the next batch anyway
+    pthread_mutex_unlock(&j->lock);
+
+    return lsn;
+}
+
+/*
+ * journal_sync_file() -- remember path for the next commit; past JOURNAL_MAX_SYNC distinct files it syncs the whole filesystem instead
+ */
+void journal_sync_file(struct Journal *j, char *path){
+    pthread_mutex_lock(&j->lock);
+
+    int found = 0;
+    for (int i = 0; i < j->sync_count && !found; i++) found = strcmp(j->sync_paths[i], path) == 0;
+
+    if (!found && j->sync_count < JOURNAL_MAX_SYNC) snprintf(j->sync_paths[j->sync_count++], MAXFILEPATH, "%s", path);
+    else if (!found) j->sync_all = 1;
+    if (j->idle) pthread_cond_signal(&j->wake);
+
+    pthread_mutex_unlock(&j->lock);
+}
+
+unsigned long long journal_durable(struct Journal *j){
+    uint64_t n;
+    if (read(j->notify_fd, &n, sizeof n) == -1 && errno != EAGAIN) perror("journal: eventfd");
+
+    pthread_mutex_lock(&j->lock);
+    unsigned long long lsn = j->durable_lsn;
+    pthread_mutex_unlock(&j->lock);
+    return lsn;
+}
+
+/*
+ * journal_begin_snapshot() -- start a snapshot buffer with its mark, unless one is still on its way to disk
+ */
+int journal_begin_snapshot(struct Journal *j){
+    pthread_mutex_lock(&j->lock);
+    int busy = j->snapshotting;
+    pthread_mutex_unlock(&j->lock);
+    if (busy) return 0;
+
+    j->build = calloc(1, sizeof *j->build);
+    encode_record(j->build, j->next_lsn - 1, JOURNAL_SNAPSHOT_MARK, NULL, 0);
+    j->since_snapshot = 0;
+    return 1;
+}
+
+void journal_snapshot_add(struct Journal *j, int type, unsigned char *payload, int len){
+    encode_record(j->build, j->next_lsn - 1, type, payload, len);
+}
+
+void journal_end_snapshot(struct Journal *j){
+    pthread_mutex_lock(&j->lock);
+    j->snapshot = j->build;
+    j->snapshot_lsn = j->next_lsn - 1;
+    j->snapshot_split = j->pending.len;
+    j->snapshotting = 1;
+    pthread_cond_signal(&j->wake);
+    pthread_mutex_unlock(&j->lock);
+
+    j->build = NULL;
+}
+
+/*
+ * print_journal() -- how many commits the records took, i.e. how well group commit is batching
+ */
+void print_journal(struct Journal *j){
+    struct stat st;
+    long log_bytes = fstat(j->fd, &st) == 0 ? st.st_size : -1;
+
+    pthread_mutex_lock(&j->lock);
+    printf("\n\n===== JOURNAL =====\n\n");
+    printf("Durable LSN: %llu / %llu\n", j->durable_lsn, j->next_lsn - 1);
+    printf("Commits: %ld (%ld records, %.1f per commit)\n", j->commits, j->committed,
+           j->commits > 0 ? (double)j->committed / j->commits : 0.0);
+    printf("Log: %ld bytes, %ld records since last snapshot%s\n", log_bytes, j->since_snapshot, j->snapshotting ? " (snapshot in progress)" : "");
+    printf("\n===================\n\n");
+    pthread_mutex_unlock(&j->lock);
+}
@@ -0,0 +1,136 @@
+/*
+ * journal.h -- write-ahead log of job lifecycle records with group commit and snapshots
+ */
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "../common.h"
+#include "./buffer_manipulation.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+
+#define JOURNAL_REC_HEADER 18      // [len 4][crc 4][lsn 8][type 2], then len bytes of payload
+#define JOURNAL_MAX_PAYLOAD 65536
+#define JOURNAL_MIN_BUF (1 << 16)
+#define JOURNAL_MAX_SYNC 64        // distinct files waiting to be flushed with the next commit
+
+#define JOURNAL_SNAPSHOT_MARK 0    // first record of a snapshot file; its lsn is the last one the snapshot covers
+
+/*
+ * JournalBuf -- growable byte buffer of encoded records
+ */
+struct JournalBuf {
+    unsigned char *data;
+    long len;
+    long cap;
+};
+
+/*
+ * Journal -- the log file, the records waiting for the next commit, and the committer thread
+ *
+ * fd, snapshot_path -- journal file (append only) and where snapshots go
+ * next_lsn -- sequence number of the next record (main thread)
+ * since_snapshot -- records appended since the last snapshot was handed over (main thread)
+ * *build -- snapshot being assembled by the main thread between journal_begin_snapshot() and journal_end_snapshot()
+ *
+ * Shared with the committer thread, under lock:
+ * pending -- records not yet written
+ * last_lsn -- lsn of the last record in pending
+ * sync_paths, sync_count -- files whose data must be on disk before pending is (blob store files)
+ * sync_all -- too many of those to track; syncfs() instead
+ * *snapshot, snapshot_lsn, snapshot_split -- a finished snapshot covering records up to snapshot_lsn, and
+ *     how much of pending was appended before it (that part is written to the old log, the rest to the new one)
+ * snapshotting -- set from journal_end_snapshot() until the snapshot is on disk
+ * durable_lsn -- every record up to here is on disk
+ * commits, committed -- fdatasync()s of the journal so far and records they covered
+ *
+ * committer, lock, wake -- committer thread and its wakeup
+ * idle -- set while the committer is waiting on wake, so appends only signal when there's someone to wake
+ * notify_fd -- eventfd, readable when durable_lsn moved
+ */
+struct Journal {
+    int fd;
+    char snapshot_path[MAXFILEPATH];
+    unsigned long long next_lsn;
+    long since_snapshot;
+    struct JournalBuf *build;
+
+    struct JournalBuf pending;
+    unsigned long long last_lsn;
+    char sync_paths[JOURNAL_MAX_SYNC][MAXFILEPATH];
+    int sync_count;
+    int sync_all;
+    struct JournalBuf *snapshot;
+    unsigned long long snapshot_lsn;
+    long snapshot_split;
+    int snapshotting;
+    unsigned long long durable_lsn;
+    long commits;
+    long committed;
+
+    pthread_t committer;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int idle;
+    int notify_fd;
+};
+
+/*
+ * journal_replay_fn -- called for each record on open, oldest first: its type, payload and arg
+ */
+typedef void (*journal_replay_fn)(int type, unsigned char *payload, int len, void *arg);
+
+/*
+ * open_journal() -- open (or create) the journal at path with its snapshot at snapshot_path, replay the snapshot and
+ * then every later record through replay(), cut off a torn tail, and start the committer. NULL on failure
+ */
+struct Journal *open_journal(char *path, char *snapshot_path, journal_replay_fn replay, void *arg);
+
+/*
+ * journal_append() -- queue a record for the next group commit and return its lsn; it's durable once journal_durable() reaches it
+ */
+unsigned long long journal_append(struct Journal *j, int type, unsigned char *payload, int len);
+
+/*
+ * journal_sync_file() -- have path (and its directory) flushed before the next commit, for data the next records refer to
+ */
+void journal_sync_file(struct Journal *j, char *path);
+
+/*
+ * journal_durable() -- drain notify_fd and return the highest lsn known to be on disk
+ */
+unsigned long long journal_durable(struct Journal *j);
+
+/*
+ * journal_begin_snapshot() -- start assembling a snapshot of the state as of the last appended record.
+ * Returns 0 if the previous one is still being written
+ */
+int journal_begin_snapshot(struct Journal *j);
+
+/*
+ * journal_snapshot_add() -- add a record to the snapshot being assembled
+ */
+void journal_snapshot_add(struct Journal *j, int type, unsigned char *payload, int len);
+
+/*
+ * journal_end_snapshot() -- hand the snapshot to the committer, which writes it and then truncates the log
+ */
+void journal_end_snapshot(struct Journal *j);
+
+/*
+ * print_journal() -- print commit and batching counters
+ */
+void print_journal(struct Journal *j);
+
+#endif
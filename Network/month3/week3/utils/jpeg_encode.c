@@ -0,0 +1,409 @@
+/*
+ * jpeg_encode.c -- baseline JPEG encoder
+ *
+ * The decode side of the native image path is the vendored stb_image.h; this is the matching
+ * encoder. It writes sequential baseline JFIF with the example quantization tables from the JPEG
+ * spec (scaled by quality the way libjpeg does) and the spec's standard Huffman tables, so there's
+ * no optimization pass over the image. The forward DCT is the AAN float DCT, with its output scale
+ * folded into the quantization divisors.
+ */
+
+#include "./jpeg_encode.h"
+
+/* natural (row-major) index of each coefficient in zigzag order */
+static const unsigned char zigzag[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+};
+
+static const unsigned char luma_quant[64] = {
+    16, 11, 10, 16,  24,  40,  51,  61,
+    12, 12, 14, 19,  26,  58,  60,  55,
+    14, 13, 16, 24,  40,  57,  69,  56,
+    14, 17, 22, 29,  51,  87,  80,  62,
+    18, 22, 37, 56,  68, 109, 103,  77,
+    24, 35, 55, 64,  81, 104, 113,  92,
+    49, 64, 78, 87, 103, 121, 120, 101,
+    72, 92, 95, 98, 112, 100, 103,  99
+};
+
+static const unsigned char chroma_quant[64] = {
+    17, 18, 24, 47, 99, 99, 99, 99,
+    18, 21, 26, 66, 99, 99, 99, 99,
+    24, 26, 56, 99, 99, 99, 99, 99,
+    47, 66, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99
+};
+
+/* standard Huffman tables: code counts per length 1-16, then symbols */
+static const unsigned char dc_luma_bits[16] = {0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0};
+static const unsigned char dc_chroma_bits[16] = {0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0};
+static const unsigned char dc_vals[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+
+static const unsigned char ac_luma_bits[16] = {0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d};
+static const unsigned char ac_luma_vals[162] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+};
+
+static const unsigned char ac_chroma_bits[16] = {0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77};
+static const unsigned char ac_chroma_vals[162] = {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+    0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+    0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+    0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+};
+
+/* AAN DCT output scale per row/column */
+static const float aan_scale[8] = {1.0f, 1.387039845f, 1.306562965f, 1.175875602f, 1.0f, 0.785694958f, 0.541196100f, 0.275899379f};
+
+/*
+ * HuffTable -- code and code length per symbol
+ */
+struct HuffTable {
+    unsigned short code[256];
+    unsigned char size[256];
+};
+
+/*
+ * Component -- one channel being encoded
+ *
+ * qt -- quantization table in natural order, as written to DQT
+ * divisor -- 1 / (qt * AAN scale * 8), what a raw DCT output is multiplied by to quantize it
+ * *dc, *ac -- Huffman tables
+ * prev_dc -- last block's DC coefficient, DC is coded as a difference
+ */
+struct Component {
+    unsigned char qt[64];
+    float divisor[64];
+    const struct HuffTable *dc;
+    const struct HuffTable *ac;
+    int prev_dc;
+};
+
+#define MCU_MAX_BYTES 4096  // worst case for one MCU of entropy-coded data, stuffing included, with room to spare
+
+/*
+ * JpegWriter -- growing output buffer plus the entropy coder's pending bits
+ */
+struct JpegWriter {
+    unsigned char *data;
+    size_t len;
+    size_t cap;
+
+    uint64_t bits;
+    int nbits;
+};
+
+static void build_huff(struct HuffTable *table, const unsigned char bits[16], const unsigned char *vals){
+    int code = 0, k = 0;
+    memset(table, 0, sizeof *table);
+    for (int len = 1; len <= 16; len++){
+        for (int i = 0; i < bits[len - 1]; i++, k++){
+            table->code[vals[k]] = code++;
+            table->size[vals[k]] = len;
+        }
+        code <<= 1;
+    }
+}
+
+/*
+ * build_component() -- scale a base quantization table by quality (libjpeg's curve) and derive the divisors
+ */
+static void build_component(struct Component *comp, const unsigned char base[64], int quality, const struct HuffTable *dc, const struct HuffTable *ac){
+    int scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+
+    for (int i = 0; i < 64; i++){
+        int q = (base[i] * scale + 50) / 100;
+        comp->qt[i] = q < 1 ? 1 : q > 255 ? 255 : q;
+        comp->divisor[i] = 1.0f / (comp->qt[i] * aan_scale[i / 8] * aan_scale[i % 8] * 8.0f);
+    }
+    comp->dc = dc;
+    comp->ac = ac;
+    comp->prev_dc = 0;
+}
+
+/*
+ * reserve() -- make room for n more bytes; the entropy coder reserves a whole MCU up front and then writes unchecked
+ */
+static void reserve(struct JpegWriter *w, size_t n){
+    if (w->len + n <= w->cap) return;
+    while (w->len + n > w->cap) w->cap *= 2;
+    w->data = realloc(w->data, w->cap);
+}
+
+static void put_byte(struct JpegWriter *w, unsigned char byte){
+    reserve(w, 1);
+    w->data[w->len++] = byte;
+}
+
+static void put_word(struct JpegWriter *w, int word){
+    put_byte(w, word >> 8);
+    put_byte(w, word & 0xff);
+}
+
+/*
+ * put_bits() -- append the low n bits of value to the entropy-coded data, stuffing a 0 after every 0xff byte.
+ * Bits collect in a 64-bit word and are written out a byte at a time once 32 are pending, into space reserve()d per MCU
+ */
+static inline void put_bits(struct JpegWriter *w, unsigned int value, int n){
+    w->bits = w->bits << n | (value & ((1u << n) - 1));
+    w->nbits += n;
+    if (w->nbits < 32) return;
+
+    while (w->nbits >= 8){
+        unsigned char byte = w->bits >> (w->nbits - 8);
+        w->data[w->len++] = byte;
+        if (byte == 0xff) w->data[w->len++] = 0;
+        w->nbits -= 8;
+    }
+}
+
+/*
+ * flush_bits() -- write out whatever put_bits() is holding, padding the last byte with 1 bits
+ */
+static void flush_bits(struct JpegWriter *w){
+    reserve(w, 16);
+    if (w->nbits % 8) put_bits(w, 0x7f, 8 - w->nbits % 8);
+    while (w->nbits >= 8){
+        unsigned char byte = w->bits >> (w->nbits - 8);
+        w->data[w->len++] = byte;
+        if (byte == 0xff) w->data[w->len++] = 0;
+        w->nbits -= 8;
+    }
+}
+
+/*
+ * fdct_1d() -- one 8-point AAN float DCT pass, step 1 along a row or 8 down a column; fdct() runs rows then columns in place
+ */
+static void fdct_1d(float *d, int step){
+    float tmp0 = d[0] + d[7 * step], tmp7 = d[0] - d[7 * step];
+    float tmp1 = d[step] + d[6 * step], tmp6 = d[step] - d[6 * step];
+    float tmp2 = d[2 * step] + d[5 * step], tmp5 = d[2 * step] - d[5 * step];
+    float tmp3 = d[3 * step] + d[4 * step], tmp4 = d[3 * step] - d[4 * step];
+
+    float tmp10 = tmp0 + tmp3, tmp13 = tmp0 - tmp3;
+    float tmp11 = tmp1 + tmp2, tmp12 = tmp1 - tmp2;
+    d[0] = tmp10 + tmp11;
+    d[4 * step] = tmp10 - tmp11;
+
+    float z1 = (tmp12 + tmp13) * 0.707106781f;
+    d[2 * step] = tmp13 + z1;
+    d[6 * step] = tmp13 - z1;
+
+    tmp10 = tmp4 + tmp5;
+    tmp11 = tmp5 + tmp6;
+    tmp12 = tmp6 + tmp7;
+
+    float z5 = (tmp10 - tmp12) * 0.382683433f;
+    float z2 = 0.541196100f * tmp10 + z5;
+    float z4 = 1.306562965f * tmp12 + z5;
+    float z3 = tmp11 * 0.707106781f;
+    float z11 = tmp7 + z3, z13 = tmp7 - z3;
+
+    d[5 * step] = z13 + z2;
+    d[3 * step] = z13 - z2;
+    d[step] = z11 + z4;
+    d[7 * step] = z11 - z4;
+}
+
+static void fdct(float block[64]){
+    for (int i = 0; i < 8; i++) fdct_1d(block + i * 8, 1);
+    for (int i = 0; i < 8; i++) fdct_1d(block + i, 8);
+}
+
+/*
+ * magnitude() -- JPEG's (category, bits) coding of a coefficient: bit count of |v|, and v or its ones' complement
+ */
+static inline int magnitude(int v, unsigned int *bits){
+    int a = v < 0 ? -v : v;
+    *bits = v < 0 ? v - 1 : v;
+    return a ? 32 - __builtin_clz(a) : 0;
+}
+
+/*
+ * encode_block() -- DCT, quantize and Huffman-code one 8x8 block of level-shifted samples
+ */
+static void encode_block(struct JpegWriter *w, struct Component *comp, float block[64]){
+    int q[64];
+    unsigned int bits;
+
+    fdct(block);
+    for (int i = 0; i < 64; i++){
+        float v = block[zigzag[i]] * comp->divisor[zigzag[i]];
+        q[i] = (int)(v < 0 ? v - 0.5f : v + 0.5f);
+    }
+
+    int diff = q[0] - comp->prev_dc;
+    comp->prev_dc = q[0];
+    int n = magnitude(diff, &bits);
+    put_bits(w, comp->dc->code[n], comp->dc->size[n]);
+    if (n) put_bits(w, bits, n);
+
+    int last = 63;
+    while (last > 0 && q[last] == 0) last--;
+
+    int run = 0;
+    for (int i = 1; i <= last; i++){
+        if (q[i] == 0){
+            run++;
+            continue;
+        }
+        while (run >= 16){
+            put_bits(w, comp->ac->code[0xf0], comp->ac->size[0xf0]);
+            run -= 16;
+        }
+        n = magnitude(q[i], &bits);
+        int sym = run << 4 | n;
+        put_bits(w, comp->ac->code[sym], comp->ac->size[sym]);
+        put_bits(w, bits, n);
+        run = 0;
+    }
+    if (last < 63) put_bits(w, comp->ac->code[0x00], comp->ac->size[0x00]);
+}
+
+static void write_dqt(struct JpegWriter *w, int id, const unsigned char qt[64]){
+    put_word(w, 0xffdb);
+    put_word(w, 67);
+    put_byte(w, id);
+    for (int i = 0; i < 64; i++) put_byte(w, qt[zigzag[i]]);
+}
+
+static void write_dht(struct JpegWriter *w, int class_id, const unsigned char bits[16], const unsigned char *vals){
+    int count = 0;
+    for (int i = 0; i < 16; i++) count += bits[i];
+
+    put_word(w, 0xffc4);
+    put_word(w, 19 + count);
+    put_byte(w, class_id);
+    for (int i = 0; i < 16; i++) put_byte(w, bits[i]);
+    for (int i = 0; i < count; i++) put_byte(w, vals[i]);
+}
+
+/*
+ * write_headers() -- SOI, JFIF APP0, quantization tables, frame header, Huffman tables and scan header
+ */
+static void write_headers(struct JpegWriter *w, struct Component comps[3], int ncomps, int width, int height){
+    static const unsigned char jfif[14] = {'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0};
+
+    put_word(w, 0xffd8);
+    put_word(w, 0xffe0);
+    put_word(w, 16);
+    for (int i = 0; i < 14; i++) put_byte(w, jfif[i]);
+
+    write_dqt(w, 0, comps[0].qt);
+    if (ncomps == 3) write_dqt(w, 1, comps[1].qt);
+
+    put_word(w, 0xffc0);
+    put_word(w, 8 + 3 * ncomps);
+    put_byte(w, 8);
+    put_word(w, height);
+    put_word(w, width);
+    put_byte(w, ncomps);
+    for (int i = 0; i < ncomps; i++){
+        put_byte(w, i + 1);
+        put_byte(w, 0x11);
+        put_byte(w, i == 0 ? 0 : 1);
+    }
+
+    write_dht(w, 0x00, dc_luma_bits, dc_vals);
+    write_dht(w, 0x10, ac_luma_bits, ac_luma_vals);
+    if (ncomps == 3){
+        write_dht(w, 0x01, dc_chroma_bits, dc_vals);
+        write_dht(w, 0x11, ac_chroma_bits, ac_chroma_vals);
+    }
+
+    put_word(w, 0xffda);
+    put_word(w, 6 + 2 * ncomps);
+    put_byte(w, ncomps);
+    for (int i = 0; i < ncomps; i++){
+        put_byte(w, i + 1);
+        put_byte(w, i == 0 ? 0x00 : 0x11);
+    }
+    put_byte(w, 0);
+    put_byte(w, 63);
+    put_byte(w, 0);
+}
+
+/*
+ * jpeg_encode() -- blocks are read left to right, top to bottom, with the last row/column repeated past the image edge
+ */
+int jpeg_encode(const uint32_t *px, int width, int height, int gray, int quality, unsigned char **out, size_t *len){
+    if (width <= 0 || height <= 0 || width > JPEG_MAX_DIM || height > JPEG_MAX_DIM) return -1;
+    if (quality < 1) quality = 1;
+    if (quality > 100) quality = 100;
+
+    struct HuffTable dc_luma, ac_luma, dc_chroma, ac_chroma;
+    build_huff(&dc_luma, dc_luma_bits, dc_vals);
+    build_huff(&ac_luma, ac_luma_bits, ac_luma_vals);
+    build_huff(&dc_chroma, dc_chroma_bits, dc_vals);
+    build_huff(&ac_chroma, ac_chroma_bits, ac_chroma_vals);
+
+    struct Component comps[3];
+    int ncomps = gray ? 1 : 3;
+    build_component(&comps[0], luma_quant, quality, &dc_luma, &ac_luma);
+    build_component(&comps[1], chroma_quant, quality, &dc_chroma, &ac_chroma);
+    build_component(&comps[2], chroma_quant, quality, &dc_chroma, &ac_chroma);
+
+    struct JpegWriter w;
+    w.cap = (size_t)width * height / 4 + 1024;
+    w.data = malloc(w.cap);
+    w.len = 0;
+    w.bits = 0;
+    w.nbits = 0;
+
+    write_headers(&w, comps, ncomps, width, height);
+
+    float y[64], cb[64], cr[64];
+    for (int by = 0; by < height; by += 8){
+        for (int bx = 0; bx < width; bx += 8){
+            for (int row = 0; row < 8; row++){
+                const uint32_t *line = px + (long)(by + row < height ? by + row : height - 1) * width;
+                for (int col = 0; col < 8; col++){
+                    uint32_t p = line[bx + col < width ? bx + col : width - 1];
+                    float r = p & 0xff, g = (p >> 8) & 0xff, b = (p >> 16) & 0xff;
+                    int i = row * 8 + col;
+
+                    y[i] = 0.299f * r + 0.587f * g + 0.114f * b - 128.0f;
+                    cb[i] = -0.168736f * r - 0.331264f * g + 0.5f * b;
+                    cr[i] = 0.5f * r - 0.418688f * g - 0.081312f * b;
+                }
+            }
+
+            reserve(&w, MCU_MAX_BYTES);
+            encode_block(&w, &comps[0], y);
+            if (!gray){
+                encode_block(&w, &comps[1], cb);
+                encode_block(&w, &comps[2], cr);
+            }
+        }
+    }
+
+    flush_bits(&w);
+    put_word(&w, 0xffd9);
+
+    *out = w.data;
+    *len = w.len;
+    return 0;
+}
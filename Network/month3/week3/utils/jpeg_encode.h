@@ -0,0 +1,21 @@
+/*
+ * jpeg_encode.h -- baseline JPEG encoder for the native image fast path
+ */
+
+#ifndef JPEG_ENCODE_H
+#define JPEG_ENCODE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define JPEG_MAX_DIM 65535
+
+/*
+ * jpeg_encode() -- encode RGBX pixels (R in the lowest byte, rows packed) as a baseline JFIF at quality 1-100,
+ * 4:4:4 YCbCr, or a single luma channel if gray is set. On success *out is a malloc()ed buffer of *len bytes
+ * and 0 is returned; -1 if the image is empty or too large
+ */
+int jpeg_encode(const uint32_t *px, int width, int height, int gray, int quality, unsigned char **out, size_t *len);
+
+#endif
@@ -0,0 +1,99 @@
+/*
+ * native_image.c -- native fast path for the simple image transforms
+ *
+ * Flips, quarter-turn rotations and grayscale don't need anything from ImageMagick beyond decoding
+ * and encoding, and for those jobs MagickWand's per-pixel cache and generic transforms are most of
+ * the cost. Here the input is decoded straight into an RGBX buffer by the stb_image.h that's already
+ * vendored for the Graphics renderer, every stage runs in place on that buffer with the kernels in
+ * image_kernels.c, and jpeg_encode() writes the result.
+ */
+
+#include "./native_image.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#define STBI_ONLY_JPEG
+#define STBI_ONLY_PNG
+#define STBI_NO_STDIO
+#include "../../../../Graphics/phase4-textures-shadows/src/texture/stb_image.h"
+
+/*
+ * rotate_quarters() -- the degrees in args as clockwise quarter turns 0-3, or -1 if they aren't a multiple of 90
+ */
+static int rotate_quarters(unsigned char args[MAXBUFSIZE]){
+    char *endptr;
+    double degrees = strtod((char *)args, &endptr);
+    if (endptr == (char *)args) return -1;
+
+    long whole = (long)degrees;
+    if (degrees != (double)whole || whole % 90 != 0) return -1;
+    return (int)(((whole / 90) % 4 + 4) % 4);
+}
+
+int native_supports(int job_type, unsigned char args[MAXBUFSIZE]){
+    if (job_type == JTYPE_FLIPX || job_type == JTYPE_FLIPY || job_type == JTYPE_MONOCHROME || job_type == JTYPE_FILTER) return 1;
+    if (job_type == JTYPE_ROTATE) return rotate_quarters(args) != -1;
+    return 0;
+}
+
+/*
+ * native_rotate() -- rotate by quarter turns; 90 and 270 need a second buffer, which replaces the image's
+ */
+static int native_rotate(struct NativeImage *img, int quarters){
+    if (quarters == 0) return 1;
+    if (quarters == 2){
+        kernel_rotate_180(img->px, img->width, img->height);
+        return 1;
+    }
+
+    uint32_t *dst = malloc((size_t)img->width * img->height * sizeof *dst);
+    if (dst == NULL) return -1;
+
+    if (quarters == 1) kernel_rotate_90(img->px, dst, img->width, img->height);
+    else kernel_rotate_270(img->px, dst, img->width, img->height);
+
+    free(img->px);
+    img->px = dst;
+    int t = img->width;
+    img->width = img->height;
+    img->height = t;
+    return 1;
+}
+
+static int native_stage(struct NativeImage *img, int job_type, unsigned char args[MAXBUFSIZE]){
+    if (job_type == JTYPE_FLIPX) kernel_flip_x(img->px, img->width, img->height);
+    else if (job_type == JTYPE_FLIPY) kernel_flip_y(img->px, img->width, img->height);
+    else if (job_type == JTYPE_ROTATE) return native_rotate(img, rotate_quarters(args));
+    else if (job_type == JTYPE_MONOCHROME){
+        if (!img->gray) kernel_luma(img->px, (long)img->width * img->height);
+        img->gray = 1;
+    }
+    return 1;
+}
+
+int native_image_job(unsigned char stages[][MAXBUFSIZE], int types[], int n, const unsigned char *input, size_t size, int quality, unsigned char **out, size_t *len){
+    struct NativeImage img;
+    int channels;
+
+    if (size > 0x7fffffff) return 0;
+    img.px = (uint32_t *)stbi_load_from_memory(input, (int)size, &img.width, &img.height, &channels, 4);
+    if (img.px == NULL){
+        printf("native: %s, falling back\n", stbi_failure_reason());
+        return 0;
+    }
+    img.gray = channels < 3;
+
+    int rv = 1;
+    for (int i = 0; i < n && rv == 1; i++){
+        printf("stage %d/%d (native %s): %d x %d\n", i + 1, n, kernel_isa(), img.width, img.height);
+        rv = native_stage(&img, types[i], stages[i]);
+    }
+
+    if (rv == 1 && jpeg_encode(img.px, img.width, img.height, img.gray, quality, out, len) == -1){
+        fprintf(stderr, "Error encoding image\n");
+        rv = -1;
+    }
+
+    // stb_image allocates with malloc(), and native_rotate() swaps in its own malloc()ed buffer
+    free(img.px);
+    return rv;
+}
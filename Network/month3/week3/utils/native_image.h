@@ -0,0 +1,43 @@
+/*
+ * native_image.h -- image jobs that don't need ImageMagick, decoded with stb_image and run on the SIMD kernels
+ */
+
+#ifndef NATIVE_IMAGE_H
+#define NATIVE_IMAGE_H
+
+#include "../common.h"
+#include "./image_kernels.h"
+#include "./jpeg_encode.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * NativeImage -- a decoded image
+ *
+ * *px -- width * height RGBX pixels (see image_kernels.h)
+ * width, height -- dimensions
+ * gray -- R, G and B are equal everywhere, so it's encoded as one channel
+ */
+struct NativeImage {
+    uint32_t *px;
+    int width;
+    int height;
+    int gray;
+};
+
+/*
+ * native_supports() -- 1 if a stage of job_type with these arguments can run natively: flipx, flipy,
+ * grayscale_filter, filter, and rotate by a multiple of 90 degrees. args is left untouched
+ */
+int native_supports(int job_type, unsigned char args[MAXBUFSIZE]);
+
+/*
+ * native_image_job() -- decode input, apply every stage, encode a JPEG at quality into *out (malloc()ed, *len bytes).
+ * Every stage must have passed native_supports(). Returns 1 on success, 0 if stb_image can't decode the input
+ * (the caller should fall back to ImageMagick), -1 on failure
+ */
+int native_image_job(unsigned char stages[][MAXBUFSIZE], int types[], int n, const unsigned char *input, size_t size, int quality, unsigned char **out, size_t *len);
+
+#endif
@@ -0,0 +1,111 @@
+/*
+ * result_cache.c -- content-addressed result cache
+ *
+ * A job's key is the SHA-256 of what determines its output: the spec (whitespace-normalized),
+ * the input's file type and the input's content hash. Entries hold a reference to the result
+ * blob of the job that produced them, so caching and serving a hit never copy data; evicting an
+ * entry only drops the cache's reference, and jobs still holding the result keep theirs.
+ */
+
+#include "./result_cache.h"
+
+static struct CacheEntry *find_entry(struct ResultCache *cache, unsigned char key[SHA256_LEN]){
+    struct HashLRUNode *node = hash_lru_find(&cache->index, key);
+    return node != NULL ? hash_lru_entry(node, struct CacheEntry, node) : NULL;
+}
+
+/*
+ * evict_entry() -- drop an entry from both structures and release its result blob
+ */
+static void evict_entry(struct ResultCache *cache, struct CacheEntry *entry){
+    hash_lru_remove(&cache->index, &entry->node);
+    cache->bytes -= entry->blob->size;
+    blob_unref(cache->store, entry->blob);
+    free(entry);
+}
+
+/*
+ * create_result_cache() -- set up an empty index
+ */
+struct ResultCache *create_result_cache(long max_bytes, struct BlobStore *store){
+    struct ResultCache *cache = malloc(sizeof *cache);
+    hash_lru_init(&cache->index, CACHE_MIN_BUCKETS);
+    cache->bytes = 0;
+    cache->max_bytes = max_bytes;
+    cache->store = store;
+
+    return cache;
+}
+
+/*
+ * cache_make_key() -- hash the spec with runs of spaces collapsed and trailing spaces dropped, then the file type and input key
+ *
+ * Workers split the keyword off at the first ' ' and pull each argument out with leading spaces
+ * stripped, so "scale  0.5 " and "scale 0.5" run the same job and should share a key. A spec with
+ * leading spaces has no keyword as far as the worker is concerned, so it's hashed as is. The spec's
+ * terminator separates it from the file type and input, so no two different jobs hash the same bytes.
+ */
+void cache_make_key(unsigned char *spec, int file_type, unsigned char input_key[SHA256_LEN], unsigned char out[SHA256_LEN]){
+    struct Sha256 ctx;
+    unsigned char norm[MAXJOBCOMMANDSIZE];
+    int len = 0;
+    int pending_space = 0;
+
+    for (int i = 0; spec[i] != '\0' && len < MAXJOBCOMMANDSIZE - 2; i++){
+        if (spec[i] == ' ' && spec[0] != ' '){
+            pending_space = 1;
+            continue;
+        }
+        if (pending_space) norm[len++] = ' ';
+        pending_space = 0;
+        norm[len++] = spec[i];
+    }
+    norm[len++] = '\0';
+
+    unsigned char type[2] = {file_type >> 8, file_type & 0xff};
+
+    sha256_init(&ctx);
+    sha256_update(&ctx, norm, len);
+    sha256_update(&ctx, type, 2);
+    sha256_update(&ctx, input_key, SHA256_LEN);
+    sha256_final(&ctx, out);
+}
+
+/*
+ * cache_fetch() -- look up key and bump the entry to most recently used
+ */
+struct Blob *cache_fetch(struct ResultCache *cache, unsigned char key[SHA256_LEN]){
+    struct CacheEntry *entry = find_entry(cache, key);
+    if (entry == NULL) return NULL;
+
+    hash_lru_touch(&cache->index, &entry->node);
+
+    blob_ref(entry->blob);
+    return entry->blob;
+}
+
+/*
+ * cache_insert() -- add an entry for key, evicting from the LRU end until the blob fits
+ */
+int cache_insert(struct ResultCache *cache, unsigned char key[SHA256_LEN], struct Blob *blob){
+    if (blob->size > cache->max_bytes) return 0;
+
+    struct CacheEntry *entry = find_entry(cache, key);
+    if (entry != NULL){
+        hash_lru_touch(&cache->index, &entry->node);
+        return 0;
+    }
+
+    while (cache->index.lru_tail != NULL && cache->bytes + blob->size > cache->max_bytes){
+        evict_entry(cache, hash_lru_entry(cache->index.lru_tail, struct CacheEntry, node));
+    }
+
+    entry = malloc(sizeof *entry);
+    memcpy(entry->key, key, SHA256_LEN);
+    entry->blob = blob;
+    blob_ref(blob);
+    hash_lru_insert(&cache->index, &entry->node, entry->key);
+
+    cache->bytes += blob->size;
+    return 1;
+}
@@ -0,0 +1,71 @@
+/*
+ * result_cache.h -- content-addressed cache of job results, bounded by bytes with LRU eviction
+ */
+
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include "../common.h"
+#include "./sha256.h"
+#include "./blob_store.h"
+#include "./hash_lru.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define CACHE_MIN_BUCKETS 64
+
+/*
+ * CacheEntry -- one cached result
+ *
+ * key -- SHA-256 of (normalized spec, file type, input blob key), see cache_make_key()
+ * *blob -- the cached result; the entry holds a reference to it
+ * node -- the entry's place in the cache's index
+ */
+struct CacheEntry {
+    unsigned char key[SHA256_LEN];
+    struct Blob *blob;
+
+    struct HashLRUNode node;
+};
+
+/*
+ * ResultCache -- entries indexed by key and kept in LRU order
+ *
+ * index -- entries by key, most recently used first; index.count is the number of entries
+ * bytes, max_bytes -- total size of cached results and the budget they're evicted down to
+ * *store -- where the cached result blobs live
+ */
+struct ResultCache {
+    struct HashLRU index;
+
+    long bytes;
+    long max_bytes;
+
+    struct BlobStore *store;
+};
+
+/*
+ * create_result_cache() -- create an empty cache of at most max_bytes of result blobs from store
+ */
+struct ResultCache *create_result_cache(long max_bytes, struct BlobStore *store);
+
+/*
+ * cache_make_key() -- a job's cache key: its spec with spaces normalized, its input file type and its input's content hash
+ */
+void cache_make_key(unsigned char *spec, int file_type, unsigned char input_key[SHA256_LEN], unsigned char out[SHA256_LEN]);
+
+/*
+ * cache_fetch() -- on a hit, mark the entry recently used and return its result blob with a reference taken for the caller.
+ * NULL on a miss
+ */
+struct Blob *cache_fetch(struct ResultCache *cache, unsigned char key[SHA256_LEN]);
+
+/*
+ * cache_insert() -- cache a result blob under key (taking a reference), evicting least recently used entries to stay within budget.
+ * Returns 1 if it was cached, 0 if not (too big or already cached)
+ */
+int cache_insert(struct ResultCache *cache, unsigned char key[SHA256_LEN], struct Blob *blob);
+
+#endif
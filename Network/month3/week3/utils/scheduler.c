@@ -0,0 +1,240 @@
+/*
+ * scheduler.c -- priority levels + deficit round robin across submitting clients
+ *
+ * Every (client, level) pair gets its own flow with a FIFO of job ids. Flows with work
+ * waiting sit on their level's active ring. sched_pop() serves the most urgent non-empty
+ * level, letting the flow at the head of its ring dispatch up to SCHED_QUANTUM jobs before
+ * it rotates to the back. Both add and pop touch a constant number of flows.
+ */
+
+#include "./scheduler.h"
+
+/*
+ * hash_flow() -- mix a client key and level down to a slot index
+ */
+static unsigned int hash_flow(unsigned long long client_key, int level, unsigned int mask){
+    unsigned long long h = (client_key ^ ((unsigned long long)level << 56)) * 0x9E3779B97F4A7C15ull;
+    return (unsigned int)(h >> 32) & mask;
+}
+
+/*
+ * flows_resize() -- rebuild the flow table at new_cap slots
+ */
+static void flows_resize(struct Scheduler *sched, int new_cap){
+    struct SchedFlow **flows = calloc(new_cap, sizeof *flows);
+    unsigned int mask = new_cap - 1;
+
+    for (int i = 0; i < sched->flows_cap; i++){
+        struct SchedFlow *flow = sched->flows[i];
+        if (flow == NULL) continue;
+
+        unsigned int j = hash_flow(flow->client_key, flow->level, mask);
+        while (flows[j] != NULL) j = (j + 1) & mask;
+        flows[j] = flow;
+    }
+
+    free(sched->flows);
+    sched->flows = flows;
+    sched->flows_cap = new_cap;
+}
+
+/*
+ * get_flow() -- find the flow for (client_key, level), creating it if this client hasn't used the level before
+ */
+static struct SchedFlow *get_flow(struct Scheduler *sched, unsigned long long client_key, int level){
+    unsigned int mask = sched->flows_cap - 1;
+    unsigned int i = hash_flow(client_key, level, mask);
+
+    for (; sched->flows[i] != NULL; i = (i + 1) & mask){
+        struct SchedFlow *flow = sched->flows[i];
+        if (flow->client_key == client_key && flow->level == level) return flow;
+    }
+
+    struct SchedFlow *flow = malloc(sizeof *flow);
+    flow->client_key = client_key;
+    flow->level = level;
+    flow->deficit = 0;
+    flow->in_turn = 0;
+    flow->active = 0;
+    flow->queue = create_queue();
+    flow->next = NULL;
+
+    sched->flows[i] = flow;
+    sched->flows_count++;
+
+    if (sched->flows_count * 2 > sched->flows_cap) flows_resize(sched, sched->flows_cap * 2);
+    return flow;
+}
+
+/*
+ * drop_flow() -- remove a drained flow from the table and free it
+ *
+ * Backward-shift deletion: every flow after the hole in its probe run that could sit in the
+ * hole moves up into it, so lookups never need tombstones.
+ */
+static void drop_flow(struct Scheduler *sched, struct SchedFlow *flow){
+    unsigned int mask = sched->flows_cap - 1;
+    unsigned int hole = hash_flow(flow->client_key, flow->level, mask);
+    while (sched->flows[hole] != flow) hole = (hole + 1) & mask;
+
+    for (unsigned int j = (hole + 1) & mask; sched->flows[j] != NULL; j = (j + 1) & mask){
+        unsigned int home = hash_flow(sched->flows[j]->client_key, sched->flows[j]->level, mask);
+        // j's flow can move back only if its home isn't cyclically in (hole, j]
+        if (((j - home) & mask) < ((j - hole) & mask)) continue;
+        sched->flows[hole] = sched->flows[j];
+        hole = j;
+    }
+
+    sched->flows[hole] = NULL;
+    sched->flows_count--;
+    free_queue(flow->queue);
+    free(flow);
+}
+
+/*
+ * create_scheduler() -- initialize empty levels and flow table
+ */
+struct Scheduler *create_scheduler(){
+    struct Scheduler *sched = malloc(sizeof *sched);
+
+    for (int i = 0; i < SCHED_LEVELS; i++){
+        sched->levels[i].active_head = NULL;
+        sched->levels[i].active_tail = NULL;
+        sched->levels[i].depth = 0;
+        sched->levels[i].active_flows = 0;
+    }
+
+    sched->flows = NULL;
+    sched->flows_cap = 0;
+    sched->flows_count = 0;
+    flows_resize(sched, SCHED_MIN_FLOWS);
+
+    sched->count = 0;
+    return sched;
+}
+
+/*
+ * make_client_key() -- address in the high 32 bits, uid in the low 32
+ */
+unsigned long long make_client_key(unsigned int addr, unsigned int uid){
+    return ((unsigned long long)addr << 32) | uid;
+}
+
+/*
+ * sched_add() -- append job to the client's flow, putting the flow on the active ring if it was idle
+ */
+void sched_add(struct Scheduler *sched, int job_id, int level, unsigned long long client_key){
+    if (level < 0 || level >= SCHED_LEVELS) level = SCHED_DEFAULT_PRIORITY;
+
+    struct SchedFlow *flow = get_flow(sched, client_key, level);
+    struct SchedLevel *lvl = &sched->levels[level];
+
+    add_to_queue(flow->queue, job_id);
+    lvl->depth++;
+    sched->count++;
+
+    if (flow->active) return;
+
+    flow->active = 1;
+    flow->next = NULL;
+    if (lvl->active_tail != NULL) lvl->active_tail->next = flow;
+    else lvl->active_head = flow;
+    lvl->active_tail = flow;
+    lvl->active_flows++;
+}
+
+/*
+ * sched_add_front() -- push job to the front of the client's flow
+ *
+ * An idle flow is put at the head of the ring so the job dispatches next. An active flow
+ * keeps its place on the ring; the job just goes ahead of the flow's other jobs.
+ */
+void sched_add_front(struct Scheduler *sched, int job_id, int level, unsigned long long client_key){
+    if (level < 0 || level >= SCHED_LEVELS) level = SCHED_DEFAULT_PRIORITY;
+
+    struct SchedFlow *flow = get_flow(sched, client_key, level);
+    struct SchedLevel *lvl = &sched->levels[level];
+
+    push_front_queue(flow->queue, job_id);
+    lvl->depth++;
+    sched->count++;
+
+    if (flow->active) return;
+
+    flow->active = 1;
+    flow->next = lvl->active_head;
+    lvl->active_head = flow;
+    if (lvl->active_tail == NULL) lvl->active_tail = flow;
+    lvl->active_flows++;
+}
+
+/*
+ * sched_pop() -- dispatch from the highest non-empty level using deficit round robin
+ *
+ * The head flow is granted SCHED_QUANTUM credit when its turn starts. Each job costs one
+ * credit; once it runs out the flow rotates to the tail and the next flow starts its turn,
+ * so at most one rotation happens per call. A flow that drains leaves the ring and is freed,
+ * forfeiting any unused credit; the client's next job starts a fresh one.
+ */
+int sched_pop(struct Scheduler *sched){
+    for (int level = 0; level < SCHED_LEVELS; level++){
+        struct SchedLevel *lvl = &sched->levels[level];
+        if (lvl->active_head == NULL) continue;
+
+        struct SchedFlow *flow = lvl->active_head;
+        if (flow->in_turn && flow->deficit <= 0 && flow->next != NULL){
+            // turn over: rotate to the back of the ring
+            lvl->active_head = flow->next;
+            lvl->active_tail->next = flow;
+            lvl->active_tail = flow;
+            flow->next = NULL;
+            flow->in_turn = 0;
+            flow = lvl->active_head;
+        }
+
+        if (!flow->in_turn || flow->deficit <= 0){
+            flow->deficit += SCHED_QUANTUM;
+            flow->in_turn = 1;
+        }
+
+        int job_id = pop_queue(flow->queue);
+        flow->deficit--;
+        lvl->depth--;
+        sched->count--;
+
+        if (flow->queue->count == 0){
+            lvl->active_head = flow->next;
+            if (lvl->active_head == NULL) lvl->active_tail = NULL;
+            lvl->active_flows--;
+            drop_flow(sched, flow);
+        }
+
+        return job_id;
+    }
+
+    return -1;
+}
+
+/*
+ * print_scheduler() -- show queue depth per level and how many jobs each active client has waiting
+ */
+void print_scheduler(struct Scheduler *sched){
+    printf("\n=== JOBS IN QUEUE ===\n");
+
+    for (int level = 0; level < SCHED_LEVELS; level++){
+        struct SchedLevel *lvl = &sched->levels[level];
+        printf("priority %d: %d jobs, %d clients\n", level, lvl->depth, lvl->active_flows);
+
+        for (struct SchedFlow *flow = lvl->active_head; flow != NULL; flow = flow->next){
+            unsigned int addr = flow->client_key >> 32;
+            printf("    client %u.%u.%u.%u uid %u -- %d jobs\n", addr >> 24, (addr >> 16) & 0xff, (addr >> 8) & 0xff, addr & 0xff,
+                   (unsigned int)flow->client_key, flow->queue->count);
+        }
+    }
+
+    if (sched->count == 0){
+        printf("0 jobs in queue.\n");
+    }
+
+    printf("\n");
+}
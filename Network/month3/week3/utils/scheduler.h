@@ -0,0 +1,103 @@
+/*
+ * scheduler.h -- multi-level priority scheduler with per-client fair share
+ */
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "../common.h"
+#include "./job_queue.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define SCHED_MIN_FLOWS 16
+
+/*
+ * SchedFlow -- the jobs one client has waiting at one priority level
+ *
+ * client_key -- who submitted the jobs (see make_client_key())
+ * level -- priority level the flow belongs to
+ * deficit -- jobs the flow may still dispatch during its current turn
+ * in_turn -- set once the flow has been granted its quantum for the current turn
+ * active -- set while the flow is on its level's active ring
+ * *queue -- FIFO of job ids
+ * *next -- next flow on the active ring
+ */
+struct SchedFlow {
+    unsigned long long client_key;
+    int level;
+    int deficit;
+    int in_turn;
+    int active;
+    struct JobQueue *queue;
+    struct SchedFlow *next;
+};
+
+/*
+ * SchedLevel -- one priority level: a round-robin ring of flows that have jobs waiting
+ *
+ * depth -- total jobs waiting at this level
+ * active_flows -- number of flows on the ring
+ */
+struct SchedLevel {
+    struct SchedFlow *active_head;
+    struct SchedFlow *active_tail;
+    int depth;
+    int active_flows;
+};
+
+/*
+ * Scheduler -- strict priority between levels, deficit round robin between clients within a level
+ *
+ * Level 0 is the most urgent. Inside a level each client flow gets SCHED_QUANTUM jobs per turn,
+ * so one client with 10,000 queued jobs can't starve another with one.
+ *
+ * levels -- one ring per priority level
+ * **flows -- open-addressing table of the flows with jobs waiting, keyed on (client_key, level)
+ * flows_cap -- capacity of the flow table (power of two)
+ * flows_count -- number of flows in the table
+ * count -- total jobs waiting across all levels
+ */
+struct Scheduler {
+    struct SchedLevel levels[SCHED_LEVELS];
+
+    struct SchedFlow **flows;
+    int flows_cap;
+    int flows_count;
+
+    int count;
+};
+
+/*
+ * create_scheduler() -- create an empty scheduler and return its pointer
+ */
+struct Scheduler *create_scheduler();
+
+/*
+ * make_client_key() -- combine a client's IPv4 address and its self-reported user id into a flow key
+ */
+unsigned long long make_client_key(unsigned int addr, unsigned int uid);
+
+/*
+ * sched_add() -- queue a job for client_key at the given priority level (out-of-range levels use SCHED_DEFAULT_PRIORITY)
+ */
+void sched_add(struct Scheduler *sched, int job_id, int level, unsigned long long client_key);
+
+/*
+ * sched_add_front() -- like sched_add(), but the job jumps to the front of its client's queue
+ */
+void sched_add_front(struct Scheduler *sched, int job_id, int level, unsigned long long client_key);
+
+/*
+ * sched_pop() -- pop the next job id to dispatch, -1 if nothing is waiting
+ */
+int sched_pop(struct Scheduler *sched);
+
+/*
+ * print_scheduler() -- display per-level queue depth and per-client backlog
+ */
+void print_scheduler(struct Scheduler *sched);
+
+#endif
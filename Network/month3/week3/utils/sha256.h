@@ -0,0 +1,47 @@
+/*
+ * sha256.h -- streaming SHA-256, used to content-address job inputs and results
+ */
+
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define SHA256_LEN 32
+
+/*
+ * Sha256 -- running hash state
+ *
+ * state -- the eight 32-bit working words
+ * block, block_len -- input not yet filling a 64-byte block
+ * total -- bytes hashed so far
+ */
+struct Sha256 {
+    uint32_t state[8];
+    unsigned char block[64];
+    int block_len;
+    uint64_t total;
+};
+
+/*
+ * sha256_init() -- start a new hash
+ */
+void sha256_init(struct Sha256 *ctx);
+
+/*
+ * sha256_update() -- hash len more bytes
+ */
+void sha256_update(struct Sha256 *ctx, const unsigned char *data, long len);
+
+/*
+ * sha256_final() -- pad, finish and write the SHA256_LEN-byte digest to out
+ */
+void sha256_final(struct Sha256 *ctx, unsigned char out[SHA256_LEN]);
+
+/*
+ * sha256_hex() -- digest as 64 lowercase hex characters plus a terminator
+ */
+void sha256_hex(const unsigned char digest[SHA256_LEN], char out[SHA256_LEN * 2 + 1]);
+
+#endif
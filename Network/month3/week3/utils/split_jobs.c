@@ -0,0 +1,104 @@
+/*
+ * split_jobs.c -- scatter/gather for large text jobs
+ *
+ * wordcount, charcount and capitalize never look further than the current word, so a large
+ * input can be cut into chunks that run as separate sub-jobs on different workers. Counts are
+ * summed as chunk results arrive; capitalized chunks are the same length as their input, so
+ * each one is written straight into its slot of the parent's result file. The server owns the
+ * sub-job bookkeeping; this file only decides where to cut and how results merge.
+ */
+
+#include "./split_jobs.h"
+
+#define SPLIT_SCAN_BUF (1 << 16)
+
+/*
+ * split_job_type() -- match the spec's keyword against the splittable job types
+ *
+ * Only a bare keyword qualifies; the text jobs take no arguments, so anything after it means
+ * the spec isn't one we understand and it's left for the worker to judge.
+ */
+int split_job_type(unsigned char *spec){
+    if (strcmp((char *)spec, "wordcount") == 0) return JTYPE_WORDCOUNT;
+    if (strcmp((char *)spec, "charcount") == 0) return JTYPE_CHARCOUNT;
+    if (strcmp((char *)spec, "capitalize") == 0) return JTYPE_CAPITALIZE;
+    return -1;
+}
+
+/*
+ * next_word_boundary() -- first offset >= from, up to size, that directly follows a ' '
+ *
+ * job_wordcount() only treats ' ' as a separator, so cutting anywhere else could split a word
+ * in two and count it twice. Returns size if there's no space left in the input.
+ */
+static off_t next_word_boundary(int fd, off_t base, off_t from, long size){
+    unsigned char buf[SPLIT_SCAN_BUF];
+    off_t pos = from - 1;
+
+    while (pos < size){
+        long want = size - pos < SPLIT_SCAN_BUF ? size - pos : SPLIT_SCAN_BUF;
+        long n = pread(fd, buf, want, base + pos);
+        if (n <= 0) break;
+
+        unsigned char *space = memchr(buf, ' ', n);
+        if (space != NULL) return pos + (space - buf) + 1;
+        pos += n;
+    }
+
+    return size;
+}
+
+/*
+ * plan_split() -- pick chunk boundaries for a size-byte input
+ *
+ * Chunks grow past SPLIT_CHUNK_BYTES if the input would otherwise need more than max_chunks of
+ * them, and a short tail is folded into the last chunk rather than sent on its own. Only wordcount
+ * needs to cut after a space; charcount and capitalize work byte by byte and can cut anywhere.
+ */
+int plan_split(int fd, off_t base, long size, int job_type, off_t *offs, long *lens, int max_chunks){
+    long chunk = SPLIT_CHUNK_BYTES;
+    if (size / chunk >= max_chunks) chunk = size / max_chunks + 1;
+
+    int n = 0;
+    off_t start = 0;
+    while (start < size){
+        off_t end = start + chunk;
+        if (size - start <= chunk + chunk / 2 || n == max_chunks - 1) end = size;
+        else if (job_type == JTYPE_WORDCOUNT) end = next_word_boundary(fd, base, end, size);
+
+        offs[n] = start;
+        lens[n] = end - start;
+        n++;
+        start = end;
+    }
+
+    return n;
+}
+
+/*
+ * parse_split_count() -- read the leading number of a chunk's count result
+ */
+long long parse_split_count(unsigned char *result, int len){
+    long long count = 0;
+    int i = 0;
+
+    for (; i < len && result[i] >= '0' && result[i] <= '9'; i++){
+        count = count * 10 + (result[i] - '0');
+    }
+
+    return i == 0 ? -1 : count;
+}
+
+/*
+ * write_split_count() -- mirror job_wordcount()/job_charcount()'s output for the merged total
+ */
+int write_split_count(char *path, int job_type, long long count){
+    FILE *f = fopen(path, "w");
+    if (f == NULL) return -1;
+
+    if (job_type == JTYPE_WORDCOUNT) fprintf(f, "%lld total words", count);
+    else fprintf(f, "%lld total characters", count);
+
+    fclose(f);
+    return 1;
+}
@@ -0,0 +1,38 @@
+/*
+ * split_jobs.h -- scatter/gather for large text jobs: cutting an input into chunk sub-jobs and merging their results
+ */
+
+#ifndef SPLIT_JOBS_H
+#define SPLIT_JOBS_H
+
+#include "../common.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+
+/*
+ * split_job_type() -- return the JTYPE_* of spec if its results can be merged from chunks (wordcount, charcount, capitalize), -1 otherwise
+ */
+int split_job_type(unsigned char *spec);
+
+/*
+ * plan_split() -- cut the size-byte input at base in fd into at most max_chunks ranges of about SPLIT_CHUNK_BYTES each.
+ * Fills offs/lens (relative to base) and returns the number of chunks; 1 means the input isn't worth (or can't be) split
+ */
+int plan_split(int fd, off_t base, long size, int job_type, off_t *offs, long *lens, int max_chunks);
+
+/*
+ * parse_split_count() -- the count at the start of a wordcount/charcount result ("N total words"), -1 if there isn't one
+ */
+long long parse_split_count(unsigned char *result, int len);
+
+/*
+ * write_split_count() -- write the merged count to path in the same format a single worker would have used. Returns 1 or -1
+ */
+int write_split_count(char *path, int job_type, long long count);
+
+#endif
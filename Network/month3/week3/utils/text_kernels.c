@@ -0,0 +1,382 @@
+/*
+ * text_kernels.c -- SIMD byte kernels for the text jobs
+ *
+ * Like image_kernels.c, every kernel has a scalar version and, on x86, SSE2 and AVX2 versions compiled
+ * with target attributes, picked at run time. All versions produce identical counts.
+ *
+ * counting -- 64 bytes at a time: compare against ' ' and movemask into a 64-bit space mask S. Non-space
+ *     bytes are ~S, and a word starts wherever a non-space byte follows a space, ~S & (S << 1 | carry),
+ *     where carry is whether the previous block ended on a space. Both are then popcounts.
+ * upper -- a range compare: adding 128 - 'a' moves 'a'-'z' to the bottom 26 values of a signed byte, so one
+ *     signed compare finds them, and the 0x20 bit is cleared under that mask
+ * csv scan -- quote, comma and newline masks per 64 bytes. A prefix XOR of the quote mask marks the bytes
+ *     inside quotes (flipped if the previous block ended inside them), and the commas and newlines outside
+ *     are written out lowest bit first
+ * compare f64 -- 2 or 4 doubles against a constant per ordered compare (false on NaN), the movemask's bits
+ *     spread out to one byte each
+ */
+
+#include "./text_kernels.h"
+
+#include <stdint.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define TEXT_X86 1
+#include <immintrin.h>
+#endif
+
+/*
+ * TextKernelSet -- one implementation of every kernel
+ *
+ * count -- add len bytes to counts
+ * upper -- copy len bytes with 'a'-'z' capitalized
+ * csv_scan -- offsets of the unquoted ',' and '\n'
+ * compare_f64 -- a byte mask of the doubles that compare true against a constant
+ */
+struct TextKernelSet {
+    const char *isa;
+    void (*count)(struct TextCounts *counts, const unsigned char *buf, size_t len);
+    void (*upper)(unsigned char *dst, const unsigned char *src, size_t len);
+    size_t (*csv_scan)(const unsigned char *buf, size_t len, int *in_quotes, uint32_t *out);
+    void (*compare_f64)(const double *vals, size_t n, int cmp, double x, unsigned char *mask);
+};
+
+/*
+ * Scalar kernels, also used for whatever the vector loops leave over
+ */
+
+static void count_scalar(struct TextCounts *counts, const unsigned char *buf, size_t len){
+    long long words = 0, chars = 0;
+    int prev_space = !counts->in_word;
+
+    // branch free: on real text whether the next byte is a space is a coin toss for the predictor
+    for (size_t i = 0; i < len; i++){
+        int space = buf[i] == ' ';
+        chars += !space;
+        words += (!space) & prev_space;
+        prev_space = space;
+    }
+
+    counts->words += words;
+    counts->chars += chars;
+    counts->in_word = !prev_space;
+}
+
+static void upper_scalar(unsigned char *dst, const unsigned char *src, size_t len){
+    for (size_t i = 0; i < len; i++){
+        unsigned char c = src[i];
+        dst[i] = c ^ ((unsigned char)(c - 'a') < 26) << 5;
+    }
+}
+
+static size_t csv_scan_scalar(const unsigned char *buf, size_t len, int *in_quotes, uint32_t *out){
+    size_t n = 0;
+    int quoted = *in_quotes;
+
+    for (size_t i = 0; i < len; i++){
+        unsigned char c = buf[i];
+        if (c == '"') quoted = !quoted;
+        else if ((c == ',' || c == '\n') && !quoted) out[n++] = i;
+    }
+
+    *in_quotes = quoted;
+    return n;
+}
+
+static void compare_f64_scalar(const double *vals, size_t n, int cmp, double x, unsigned char *mask){
+    for (size_t i = 0; i < n; i++){
+        double v = vals[i];
+        if (cmp == TEXT_CMP_EQ) mask[i] = v == x;
+        else if (cmp == TEXT_CMP_NE) mask[i] = v < x || v > x;
+        else if (cmp == TEXT_CMP_LT) mask[i] = v < x;
+        else if (cmp == TEXT_CMP_LE) mask[i] = v <= x;
+        else if (cmp == TEXT_CMP_GT) mask[i] = v > x;
+        else mask[i] = v >= x;
+    }
+}
+
+static const struct TextKernelSet scalar_set = {"scalar", count_scalar, upper_scalar, csv_scan_scalar, compare_f64_scalar};
+
+#ifdef TEXT_X86
+
+/*
+ * COUNT_MASK() -- fold one 64-byte space mask into words/chars; space_carry is 1 if the byte before it was a space
+ */
+#define COUNT_MASK(spaces, space_carry, words, chars) do { \
+        uint64_t starts_ = ~(spaces) & ((spaces) << 1 | (space_carry)); \
+        (words) += __builtin_popcountll(starts_); \
+        (chars) += 64 - __builtin_popcountll(spaces); \
+        (space_carry) = (spaces) >> 63; \
+    } while (0)
+
+/*
+ * csv_scan_masks() -- emit the unquoted delimiters of one 64-byte block from its masks. quote_carry is all
+ * ones while inside quotes
+ */
+static inline size_t csv_scan_masks(uint64_t quotes, uint64_t delims, uint64_t *quote_carry, uint32_t base, uint32_t *out){
+    uint64_t inside = quotes;
+    inside ^= inside << 1;
+    inside ^= inside << 2;
+    inside ^= inside << 4;
+    inside ^= inside << 8;
+    inside ^= inside << 16;
+    inside ^= inside << 32;
+    inside ^= *quote_carry;
+    *quote_carry = (uint64_t)((int64_t)inside >> 63);
+
+    size_t n = 0;
+    for (uint64_t bits = delims & ~inside; bits != 0; bits &= bits - 1) out[n++] = base + __builtin_ctzll(bits);
+    return n;
+}
+
+/*
+ * SSE2 kernels -- popcnt came with SSE4.2, so this set is only used when the CPU has it
+ */
+
+__attribute__((target("sse2,popcnt")))
+static void count_sse2(struct TextCounts *counts, const unsigned char *buf, size_t len){
+    const __m128i space = _mm_set1_epi8(' ');
+    long long words = 0, chars = 0;
+    uint64_t carry = !counts->in_word;
+
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64){
+        uint64_t m0 = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(buf + i)), space));
+        uint64_t m1 = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(buf + i + 16)), space));
+        uint64_t m2 = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(buf + i + 32)), space));
+        uint64_t m3 = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(buf + i + 48)), space));
+        uint64_t spaces = m0 | m1 << 16 | m2 << 32 | m3 << 48;
+        COUNT_MASK(spaces, carry, words, chars);
+    }
+
+    counts->words += words;
+    counts->chars += chars;
+    if (i > 0) counts->in_word = !carry;
+    count_scalar(counts, buf + i, len - i);
+}
+
+__attribute__((target("sse2")))
+static void upper_sse2(unsigned char *dst, const unsigned char *src, size_t len){
+    const __m128i shift = _mm_set1_epi8((char)(128 - 'a'));
+    const __m128i limit = _mm_set1_epi8(-128 + 26);
+    const __m128i case_bit = _mm_set1_epi8(0x20);
+
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16){
+        __m128i c = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i lower = _mm_cmplt_epi8(_mm_add_epi8(c, shift), limit);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(c, _mm_and_si128(lower, case_bit)));
+    }
+    upper_scalar(dst + i, src + i, len - i);
+}
+
+__attribute__((target("sse2")))
+static uint64_t mask_sse2(const unsigned char *p, __m128i c){
+    uint64_t m0 = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), c));
+    uint64_t m1 = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 16)), c));
+    uint64_t m2 = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 32)), c));
+    uint64_t m3 = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 48)), c));
+    return m0 | m1 << 16 | m2 << 32 | m3 << 48;
+}
+
+__attribute__((target("sse2")))
+static size_t csv_scan_sse2(const unsigned char *buf, size_t len, int *in_quotes, uint32_t *out){
+    const __m128i quote = _mm_set1_epi8('"'), comma = _mm_set1_epi8(','), newline = _mm_set1_epi8('\n');
+    uint64_t carry = *in_quotes ? ~0ULL : 0;
+    size_t n = 0;
+
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64){
+        uint64_t delims = mask_sse2(buf + i, comma) | mask_sse2(buf + i, newline);
+        n += csv_scan_masks(mask_sse2(buf + i, quote), delims, &carry, i, out + n);
+    }
+
+    *in_quotes = carry != 0;
+    size_t tail = csv_scan_scalar(buf + i, len - i, in_quotes, out + n);
+    for (size_t k = n; k < n + tail; k++) out[k] += i;
+    return n + tail;
+}
+
+__attribute__((target("sse2")))
+static void compare_f64_sse2(const double *vals, size_t n, int cmp, double x, unsigned char *mask){
+    const __m128d c = _mm_set1_pd(x);
+
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2){
+        __m128d v = _mm_loadu_pd(vals + i);
+        __m128d m;
+        if (cmp == TEXT_CMP_EQ) m = _mm_cmpeq_pd(v, c);
+        else if (cmp == TEXT_CMP_NE) m = _mm_and_pd(_mm_cmpneq_pd(v, c), _mm_cmpord_pd(v, v));
+        else if (cmp == TEXT_CMP_LT) m = _mm_cmplt_pd(v, c);
+        else if (cmp == TEXT_CMP_LE) m = _mm_cmple_pd(v, c);
+        else if (cmp == TEXT_CMP_GT) m = _mm_cmpgt_pd(v, c);
+        else m = _mm_cmpge_pd(v, c);
+
+        int bits = _mm_movemask_pd(m);
+        mask[i] = bits & 1;
+        mask[i + 1] = bits >> 1;
+    }
+    compare_f64_scalar(vals + i, n - i, cmp, x, mask + i);
+}
+
+static const struct TextKernelSet sse2_set = {"sse2", count_sse2, upper_sse2, csv_scan_sse2, compare_f64_sse2};
+
+/*
+ * AVX2 kernels
+ */
+
+__attribute__((target("avx2,popcnt")))
+static void count_avx2(struct TextCounts *counts, const unsigned char *buf, size_t len){
+    const __m256i space = _mm256_set1_epi8(' ');
+    long long words = 0, chars = 0;
+    uint64_t carry = !counts->in_word;
+
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64){
+        uint64_t lo = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(buf + i)), space));
+        uint64_t hi = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(buf + i + 32)), space));
+        uint64_t spaces = lo | hi << 32;
+        COUNT_MASK(spaces, carry, words, chars);
+    }
+
+    counts->words += words;
+    counts->chars += chars;
+    if (i > 0) counts->in_word = !carry;
+    count_scalar(counts, buf + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static void upper_avx2(unsigned char *dst, const unsigned char *src, size_t len){
+    const __m256i shift = _mm256_set1_epi8((char)(128 - 'a'));
+    const __m256i limit = _mm256_set1_epi8(-128 + 26);
+    const __m256i case_bit = _mm256_set1_epi8(0x20);
+
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32){
+        __m256i c = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i lower = _mm256_cmpgt_epi8(limit, _mm256_add_epi8(c, shift));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_xor_si256(c, _mm256_and_si256(lower, case_bit)));
+    }
+    upper_scalar(dst + i, src + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t csv_scan_avx2(const unsigned char *buf, size_t len, int *in_quotes, uint32_t *out){
+    const __m256i quote = _mm256_set1_epi8('"'), comma = _mm256_set1_epi8(','), newline = _mm256_set1_epi8('\n');
+    uint64_t carry = *in_quotes ? ~0ULL : 0;
+    size_t n = 0;
+
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64){
+        __m256i lo = _mm256_loadu_si256((const __m256i *)(buf + i));
+        __m256i hi = _mm256_loadu_si256((const __m256i *)(buf + i + 32));
+        uint64_t quotes = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, quote)) |
+                          (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, quote)) << 32;
+        __m256i dlo = _mm256_or_si256(_mm256_cmpeq_epi8(lo, comma), _mm256_cmpeq_epi8(lo, newline));
+        __m256i dhi = _mm256_or_si256(_mm256_cmpeq_epi8(hi, comma), _mm256_cmpeq_epi8(hi, newline));
+        uint64_t delims = (uint32_t)_mm256_movemask_epi8(dlo) | (uint64_t)(uint32_t)_mm256_movemask_epi8(dhi) << 32;
+        n += csv_scan_masks(quotes, delims, &carry, i, out + n);
+    }
+
+    *in_quotes = carry != 0;
+    size_t tail = csv_scan_scalar(buf + i, len - i, in_quotes, out + n);
+    for (size_t k = n; k < n + tail; k++) out[k] += i;
+    return n + tail;
+}
+
+/*
+ * COMPARE_F64_AVX2() -- one compare_f64_avx2() loop; the predicate has to be a constant
+ */
+#define COMPARE_F64_AVX2(predicate) do { \
+        for (; i + 4 <= n; i += 4){ \
+            int bits_ = _mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(vals + i), c, (predicate))); \
+            memcpy(mask + i, &spread[bits_], 4); \
+        } \
+    } while (0)
+
+__attribute__((target("avx2")))
+static void compare_f64_avx2(const double *vals, size_t n, int cmp, double x, unsigned char *mask){
+    // spread[bits]: bit k of bits as byte k
+    static const uint32_t spread[16] = {
+        0x00000000, 0x00000001, 0x00000100, 0x00000101, 0x00010000, 0x00010001, 0x00010100, 0x00010101,
+        0x01000000, 0x01000001, 0x01000100, 0x01000101, 0x01010000, 0x01010001, 0x01010100, 0x01010101};
+    const __m256d c = _mm256_set1_pd(x);
+
+    size_t i = 0;
+    if (cmp == TEXT_CMP_EQ) COMPARE_F64_AVX2(_CMP_EQ_OQ);
+    else if (cmp == TEXT_CMP_NE) COMPARE_F64_AVX2(_CMP_NEQ_OQ);
+    else if (cmp == TEXT_CMP_LT) COMPARE_F64_AVX2(_CMP_LT_OQ);
+    else if (cmp == TEXT_CMP_LE) COMPARE_F64_AVX2(_CMP_LE_OQ);
+    else if (cmp == TEXT_CMP_GT) COMPARE_F64_AVX2(_CMP_GT_OQ);
+    else COMPARE_F64_AVX2(_CMP_GE_OQ);
+    compare_f64_scalar(vals + i, n - i, cmp, x, mask + i);
+}
+
+static const struct TextKernelSet avx2_set = {"avx2", count_avx2, upper_avx2, csv_scan_avx2, compare_f64_avx2};
+
+#endif
+
+static const struct TextKernelSet *active = &scalar_set;
+static pthread_once_t active_once = PTHREAD_ONCE_INIT;
+
+/*
+ * pick_kernels() -- the widest set this CPU runs
+ */
+static void pick_kernels(){
+#ifdef TEXT_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) active = &avx2_set;
+    else if (__builtin_cpu_supports("popcnt")) active = &sse2_set;
+#endif
+}
+
+static const struct TextKernelSet *kernels(){
+    pthread_once(&active_once, pick_kernels);
+    return active;
+}
+
+const char *text_isa(){
+    return kernels()->isa;
+}
+
+int text_use_isa(const char *isa){
+    kernels();
+    if (strcmp(isa, "scalar") == 0){
+        active = &scalar_set;
+        return 1;
+    }
+#ifdef TEXT_X86
+    if (strcmp(isa, "sse2") == 0 && __builtin_cpu_supports("popcnt")){
+        active = &sse2_set;
+        return 1;
+    }
+    if (strcmp(isa, "avx2") == 0 && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")){
+        active = &avx2_set;
+        return 1;
+    }
+#endif
+    return 0;
+}
+
+void text_counts_init(struct TextCounts *counts){
+    counts->words = 0;
+    counts->chars = 0;
+    counts->in_word = 0;
+}
+
+void text_count(struct TextCounts *counts, const unsigned char *buf, size_t len){
+    kernels()->count(counts, buf, len);
+}
+
+void text_upper(unsigned char *dst, const unsigned char *src, size_t len){
+    kernels()->upper(dst, src, len);
+}
+
+size_t text_csv_scan(const unsigned char *buf, size_t len, int *in_quotes, uint32_t *out){
+    return kernels()->csv_scan(buf, len, in_quotes, out);
+}
+
+void text_compare_f64(const double *vals, size_t n, int cmp, double x, unsigned char *mask){
+    kernels()->compare_f64(vals, n, cmp, x, mask);
+}
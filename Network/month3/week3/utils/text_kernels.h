@@ -0,0 +1,72 @@
+/*
+ * text_kernels.h -- SIMD byte kernels for the text and CSV jobs
+ */
+
+#ifndef TEXT_KERNELS_H
+#define TEXT_KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * TextCounts -- running totals of a text streamed through text_count() one block at a time
+ *
+ * words -- runs of non-space bytes (only ' ' separates words, as in job_wordcount())
+ * chars -- bytes that aren't ' '
+ * in_word -- the last byte counted wasn't a space, so a word running into the next block isn't counted twice
+ */
+struct TextCounts {
+    long long words;
+    long long chars;
+    int in_word;
+};
+
+/*
+ * text_counts_init() -- zero totals, positioned as if right after a space
+ */
+void text_counts_init(struct TextCounts *counts);
+
+/*
+ * text_count() -- add len bytes of buf to counts. Blocks can be cut anywhere; the totals come out the same
+ */
+void text_count(struct TextCounts *counts, const unsigned char *buf, size_t len);
+
+/*
+ * text_upper() -- copy len bytes from src to dst with 'a'-'z' turned into 'A'-'Z' and every other byte left
+ * alone, which is what islower()/toupper() do in the C locale the worker runs in. dst may be src
+ */
+void text_upper(unsigned char *dst, const unsigned char *src, size_t len);
+
+/*
+ * text_csv_scan() -- the offsets in buf of every ',' and '\n' outside double quotes, in order, into out (which needs
+ * room for len entries). A '"' anywhere opens or closes a quoted stretch; *in_quotes carries that across calls
+ * and starts at 0. Returns how many offsets were written
+ */
+size_t text_csv_scan(const unsigned char *buf, size_t len, int *in_quotes, uint32_t *out);
+
+// comparisons text_compare_f64() makes
+#define TEXT_CMP_EQ 0
+#define TEXT_CMP_NE 1
+#define TEXT_CMP_LT 2
+#define TEXT_CMP_LE 3
+#define TEXT_CMP_GT 4
+#define TEXT_CMP_GE 5
+
+/*
+ * text_compare_f64() -- mask[i] = 1 if vals[i] compares to x as cmp (TEXT_CMP_*) says, 0 if not, for n values.
+ * A NaN never matches, not even TEXT_CMP_NE, so cells that aren't numbers can be stored as NaN
+ */
+void text_compare_f64(const double *vals, size_t n, int cmp, double x, unsigned char *mask);
+
+/*
+ * text_isa() -- instruction set the kernels run with: "avx2", "sse2" or "scalar"
+ */
+const char *text_isa();
+
+/*
+ * text_use_isa() -- force an instruction set (for benchmarks). Returns 0 if the CPU doesn't have it
+ */
+int text_use_isa(const char *isa);
+
+#endif
@@ -0,0 +1,124 @@
+/*
+ * tile_pool.c -- parallel tiles for heavy image filters
+ *
+ * A batch is a parallel loop: tiles are handed out one at a time from its next counter, so a
+ * thread that finishes a cheap tile just takes another one. The thread that submits a batch
+ * works on it too instead of sleeping, which also means a batch still completes when every
+ * helper is busy with another slot's job.
+ */
+
+#include "./tile_pool.h"
+
+/*
+ * take_tile() -- hand out the next tile of the oldest batch, dropping the batch from the list once its last tile is out.
+ * Called with pool->lock held. NULL if there's nothing to do
+ */
+static struct TileBatch *take_tile(struct TilePool *pool, int *tile){
+    struct TileBatch *batch = pool->head;
+    if (batch == NULL) return NULL;
+
+    *tile = batch->next++;
+    if (batch->next == batch->count){
+        pool->head = batch->next_batch;
+        if (pool->head == NULL) pool->tail = NULL;
+    }
+    return batch;
+}
+
+/*
+ * finish_tile() -- record a tile's result and wake the submitter after the last one. Called with pool->lock held
+ */
+static void finish_tile(struct TileBatch *batch, int rv){
+    if (rv != 1) batch->failed++;
+    if (++batch->done == batch->count) pthread_cond_signal(&batch->finished);
+}
+
+static void *tile_thread(void *arg){
+    struct TilePool *pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    while (1){
+        int tile;
+        struct TileBatch *batch = take_tile(pool, &tile);
+        if (batch == NULL){
+            pthread_cond_wait(&pool->work, &pool->lock);
+            continue;
+        }
+
+        pthread_mutex_unlock(&pool->lock);
+        int rv = batch->fn(batch->arg, tile);
+        pthread_mutex_lock(&pool->lock);
+        finish_tile(batch, rv);
+    }
+    return NULL;
+}
+
+struct TilePool *create_tile_pool(int threads){
+    struct TilePool *pool = malloc(sizeof *pool);
+    pool->threads = threads < 1 ? 1 : threads;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pool->head = NULL;
+    pool->tail = NULL;
+
+    for (int i = 1; i < pool->threads; i++){
+        pthread_t thread;
+        pthread_create(&thread, NULL, tile_thread, pool);
+        pthread_detach(thread);
+    }
+    return pool;
+}
+
+int tile_pool_run(struct TilePool *pool, int count, tile_fn fn, void *arg){
+    if (count <= 0) return 1;
+
+    if (pool == NULL || pool->threads == 1 || count == 1){
+        int rv = 1;
+        for (int i = 0; i < count; i++){
+            if (fn(arg, i) != 1) rv = -1;
+        }
+        return rv;
+    }
+
+    struct TileBatch batch;
+    batch.fn = fn;
+    batch.arg = arg;
+    batch.count = count;
+    batch.next = 0;
+    batch.done = 0;
+    batch.failed = 0;
+    batch.next_batch = NULL;
+    pthread_cond_init(&batch.finished, NULL);
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->tail != NULL) pool->tail->next_batch = &batch;
+    else pool->head = &batch;
+    pool->tail = &batch;
+    pthread_cond_broadcast(&pool->work);
+
+    // work on our own batch until its tiles are all handed out, then wait for the stragglers
+    while (batch.next < batch.count){
+        int tile = batch.next++;
+        if (batch.next == batch.count){
+            struct TileBatch **link = &pool->head;
+            struct TileBatch *prev = NULL;
+            while (*link != &batch){
+                prev = *link;
+                link = &(*link)->next_batch;
+            }
+            *link = batch.next_batch;
+            if (pool->tail == &batch) pool->tail = prev;
+        }
+
+        pthread_mutex_unlock(&pool->lock);
+        int rv = fn(arg, tile);
+        pthread_mutex_lock(&pool->lock);
+        finish_tile(&batch, rv);
+    }
+
+    while (batch.done < batch.count) pthread_cond_wait(&batch.finished, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+
+    pthread_cond_destroy(&batch.finished);
+    return batch.failed == 0 ? 1 : -1;
+}
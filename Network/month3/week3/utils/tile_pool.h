@@ -0,0 +1,65 @@
+/*
+ * tile_pool.h -- thread pool that runs the tiles of one image job in parallel, shared by a worker's slots
+ */
+
+#ifndef TILE_POOL_H
+#define TILE_POOL_H
+
+#include <stdlib.h>
+#include <pthread.h>
+
+/* Process tile number tile of a batch. 1 on success, -1 on failure */
+typedef int (*tile_fn)(void *arg, int tile);
+
+/*
+ * TileBatch -- one tile_pool_run() call
+ *
+ * fn, *arg -- what each tile runs
+ * count -- tiles in the batch
+ * next -- next tile to hand out
+ * done, failed -- tiles finished / finished with -1
+ * finished -- signalled when done reaches count
+ * *next_batch -- next batch waiting for threads
+ */
+struct TileBatch {
+    tile_fn fn;
+    void *arg;
+
+    int count;
+    int next;
+    int done;
+    int failed;
+    pthread_cond_t finished;
+
+    struct TileBatch *next_batch;
+};
+
+/*
+ * TilePool -- helper threads plus the batches they're working through
+ *
+ * threads -- threads a batch can run on, counting the thread that called tile_pool_run()
+ * lock, work -- guard the batch list / signal that a batch was queued
+ * *head, *tail -- batches with tiles still to hand out, oldest first
+ */
+struct TilePool {
+    int threads;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    struct TileBatch *head;
+    struct TileBatch *tail;
+};
+
+/*
+ * create_tile_pool() -- start threads - 1 helper threads (the caller of tile_pool_run() is the last one)
+ */
+struct TilePool *create_tile_pool(int threads);
+
+/*
+ * tile_pool_run() -- run fn(arg, 0..count-1) across the pool and the calling thread and wait for all of them.
+ * Several threads may run batches at once; they share the helpers. A NULL pool runs every tile on the calling thread.
+ * Returns 1 if every tile succeeded, -1 if not
+ */
+int tile_pool_run(struct TilePool *pool, int count, tile_fn fn, void *arg);
+
+#endif
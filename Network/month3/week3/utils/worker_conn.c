@@ -0,0 +1,135 @@
+/*
+ * worker_conn.c -- non-blocking I/O helpers for the server's worker connections
+ *
+ * Worker sockets sit in the main epoll set like client sockets. Job specs and inputs go into a per-worker
+ * queue that drains as the socket takes it, and status packets and results are read a field or a chunk
+ * per readiness event, so a big input going out or a big result coming in never holds up the event loop.
+ * The protocol decisions live in server.c; this file only moves bytes.
+ */
+
+#include "./worker_conn.h"
+
+/*
+ * wconn_init() -- empty queue, no result in progress, waiting for a packet header
+ */
+void wconn_init(struct WorkerConn *conn, int fd){
+    conn->fd = fd;
+    conn->last_heard_ms = get_time_ms();
+    conn->result_job = -1;
+    conn->result_ok = 0;
+    conn->file_fd = -1;
+    conn->file_off = 0;
+    conn->file_remaining = 0;
+    conn->result_path[0] = '\0';
+    conn->out_head = NULL;
+    conn->out_tail = NULL;
+    conn->want_out = 0;
+    wconn_expect(conn, WCONN_HEADER, 4);
+}
+
+/*
+ * wconn_close() -- drop a half-received result and everything still queued
+ */
+void wconn_close(struct WorkerConn *conn){
+    if (conn->file_fd != -1) close(conn->file_fd);
+    if (conn->result_path[0] != '\0') remove(conn->result_path);
+    conn->file_fd = -1;
+    conn->result_path[0] = '\0';
+
+    while (conn->out_head != NULL){
+        struct WorkerSend *msg = conn->out_head;
+        conn->out_head = msg->next;
+        if (msg->send_fd != -1) close(msg->send_fd);
+        free(msg);
+    }
+    conn->out_tail = NULL;
+}
+
+/*
+ * wconn_expect() -- reset the field buffer and wait for `need` bytes in `state`
+ */
+void wconn_expect(struct WorkerConn *conn, int state, int need){
+    conn->state = state;
+    conn->need = need;
+    conn->have = 0;
+}
+
+/*
+ * wconn_fill() -- one recv() toward the current field
+ *
+ * Only reads what the field still needs, so bytes belonging to the next state stay in the socket.
+ */
+int wconn_fill(struct WorkerConn *conn){
+    if (conn->have >= conn->need) return 1;
+
+    int rv = recv(conn->fd, conn->buf + conn->have, conn->need - conn->have, 0);
+    if (rv == 0) return -1;
+    if (rv < 0) return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+
+    conn->have += rv;
+    conn->last_heard_ms = get_time_ms();
+    return conn->have >= conn->need;
+}
+
+/*
+ * wconn_recv_body() -- one read's worth of result, written straight into file_fd
+ */
+int wconn_recv_body(struct WorkerConn *conn){
+    if (conn->file_remaining <= 0) return 1;
+
+    long rv = recv_file_chunk(conn->fd, conn->file_fd, &conn->file_off, conn->file_remaining);
+    if (rv == 0) return -1;
+    if (rv < 0) return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+
+    conn->file_remaining -= rv;
+    conn->last_heard_ms = get_time_ms();
+    return conn->file_remaining <= 0;
+}
+
+/*
+ * wconn_queue() -- copy data into a new message at the back of the queue; send_fd now belongs to the queue
+ */
+void wconn_queue(struct WorkerConn *conn, unsigned char *data, int len, int send_fd, off_t send_off, long send_size){
+    struct WorkerSend *msg = malloc(sizeof *msg + len);
+    memcpy(msg->data, data, len);
+    msg->len = len;
+    msg->sent = 0;
+    msg->send_fd = send_fd;
+    msg->send_off = send_off;
+    msg->send_remaining = send_fd == -1 ? 0 : send_size;
+    msg->next = NULL;
+
+    if (conn->out_tail != NULL) conn->out_tail->next = msg;
+    else conn->out_head = msg;
+    conn->out_tail = msg;
+}
+
+/*
+ * wconn_flush() -- send queued messages in order, sendfile()ing each one's file after its data, until the socket fills up
+ */
+int wconn_flush(struct WorkerConn *conn){
+    while (conn->out_head != NULL){
+        struct WorkerSend *msg = conn->out_head;
+
+        while (msg->sent < msg->len){
+            int rv = send(conn->fd, msg->data + msg->sent, msg->len - msg->sent, MSG_NOSIGNAL);
+            if (rv < 0) return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+            msg->sent += rv;
+        }
+
+        while (msg->send_remaining > 0){
+            long rv = send_file_chunk(conn->fd, msg->send_fd, &msg->send_off, msg->send_remaining);
+            if (rv == 0) return -1; // file shrank underneath us
+            if (rv < 0) return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+
+            msg->send_remaining -= rv;
+        }
+
+        conn->out_head = msg->next;
+        if (conn->out_head == NULL) conn->out_tail = NULL;
+        if (msg->send_fd != -1) close(msg->send_fd);
+        free(msg);
+    }
+
+    return 1;
+}
@@ -0,0 +1,122 @@
+/*
+ * worker_conn.h -- non-blocking worker connections: an incoming packet state machine and an outgoing queue
+ */
+
+#ifndef WORKER_CONN_H
+#define WORKER_CONN_H
+
+// Main imports
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "../common.h"
+#include "./file_transfer.h"
+#include "./time_custom.h"
+
+// worker connection states, i.e. what the next bytes from the worker are
+#define WCONN_HEADER 0         // [APPID 2][packet type 2]
+#define WCONN_CONNECTED 1      // [slots 2][prefetch 2]
+#define WCONN_STATUS 2         // [status 2][errcode 2][job_id 4]
+#define WCONN_INPUT_CACHE 3    // [op 2][key 32]
+#define WCONN_RESULT_HEADER 4  // [file type 2][file size 8], right behind a W_SUCCESS status
+#define WCONN_RESULT_BODY 5    // [file bytes], written to file_fd
+#define WCONN_RESULT_COUNT 6   // [file bytes] of a counting chunk, collected in buf to be parsed
+
+/*
+ * WorkerSend -- one message queued for a worker: data, then optionally a file range (closed once it's sent)
+ *
+ * len, sent -- bytes of data, and how many are already out
+ * send_fd, send_off, send_remaining -- file streamed after data, -1 if none
+ */
+struct WorkerSend {
+    int len;
+    int sent;
+
+    int send_fd;
+    off_t send_off;
+    long send_remaining;
+
+    struct WorkerSend *next;
+    unsigned char data[];
+};
+
+/*
+ * WorkerConn -- where a worker socket is in the protocol, both ways
+ *
+ * fd -- the worker socket (non-blocking)
+ * state -- WCONN_* state
+ * buf, need, have -- fixed-size fields are collected here until `need` bytes have arrived
+ * last_heard_ms -- when the worker last sent anything at all (packets, keepalives, result bytes)
+ *
+ * result_job -- job whose results are arriving, -1 if they're being thrown away
+ * result_ok -- cleared when the results can't be used, so they're read off the socket and dropped
+ * file_fd, file_off, file_remaining -- where the result body goes and how much of it is still expected
+ * result_path -- staging file the body is going to, empty if it goes somewhere that isn't ours to delete
+ *
+ * *out_head, *out_tail -- messages waiting for the socket to drain, oldest first
+ * want_out -- EPOLLOUT is in the socket's interest set
+ */
+struct WorkerConn {
+    int fd;
+    int state;
+    unsigned char buf[MAXBUFSIZE];
+    int need;
+    int have;
+    int last_heard_ms;
+
+    int result_job;
+    int result_ok;
+    int file_fd;
+    off_t file_off;
+    long file_remaining;
+    char result_path[MAXFILEPATH];
+
+    struct WorkerSend *out_head;
+    struct WorkerSend *out_tail;
+    int want_out;
+};
+
+/*
+ * wconn_init() -- start a connection for fd in WCONN_HEADER with nothing queued
+ */
+void wconn_init(struct WorkerConn *conn, int fd);
+
+/*
+ * wconn_close() -- close (and delete, if it's a staging file) a half-received result and free every queued message,
+ * closing their files; the socket is the caller's
+ */
+void wconn_close(struct WorkerConn *conn);
+
+/*
+ * wconn_expect() -- move to `state` and wait for the next `need` bytes in conn->buf
+ */
+void wconn_expect(struct WorkerConn *conn, int state, int need);
+
+/*
+ * wconn_fill() -- read toward conn->need. Returns 1 once buf holds `need` bytes, 0 if more are needed, -1 on EOF/error
+ */
+int wconn_fill(struct WorkerConn *conn);
+
+/*
+ * wconn_recv_body() -- move one read's worth of result body into conn->file_fd.
+ * Returns 1 when the whole body is in, 0 if more is needed, -1 on EOF/error
+ */
+int wconn_recv_body(struct WorkerConn *conn);
+
+/*
+ * wconn_queue() -- queue len bytes of data, then send_size bytes of send_fd from send_off (send_fd -1 for none)
+ */
+void wconn_queue(struct WorkerConn *conn, unsigned char *data, int len, int send_fd, off_t send_off, long send_size);
+
+/*
+ * wconn_flush() -- push queued messages. Returns 1 when the queue is empty, 0 if the socket is full, -1 on error
+ */
+int wconn_flush(struct WorkerConn *conn);
+
+#endif
@@ -1,9 +1,93 @@
 /*
  * workers.c -- worker utilities for the server
+ *
+ * Workers are looked up by fd through a flat array, and every W_READY worker sits on an
+ * intrusive ready list, so finding a worker for a job never has to scan anything.
+ * A worker with several slots stays on the ready list until all of them, plus its prefetch depth, are taken.
+ * The inputs each worker has cached are indexed by key, so the workers that could run a job
+ * without being sent its input are a bucket walk away.
  */
 
 #include "./workers.h"
 
+/*
+ * ready_push() -- append a worker to the tail of the ready list
+ */
+static void ready_push(struct Workers *workers, struct Worker *worker){
+    if (worker->in_ready) return;
+
+    worker->ready_next = NULL;
+    worker->ready_prev = workers->ready_tail;
+
+    if (workers->ready_tail != NULL) workers->ready_tail->ready_next = worker;
+    else workers->ready_head = worker;
+
+    workers->ready_tail = worker;
+    worker->in_ready = 1;
+    workers->available_workers++;
+}
+
+/*
+ * ready_unlink() -- remove a worker from the ready list if it is on it
+ */
+static void ready_unlink(struct Workers *workers, struct Worker *worker){
+    if (!worker->in_ready) return;
+
+    if (worker->ready_prev != NULL) worker->ready_prev->ready_next = worker->ready_next;
+    else workers->ready_head = worker->ready_next;
+
+    if (worker->ready_next != NULL) worker->ready_next->ready_prev = worker->ready_prev;
+    else workers->ready_tail = worker->ready_prev;
+
+    worker->ready_next = worker->ready_prev = NULL;
+    worker->in_ready = 0;
+    workers->available_workers--;
+}
+
+/*
+ * unlink_cached() -- take an entry out of the index and its worker's list, and free it
+ */
+static void unlink_cached(struct Workers *workers, struct CachedInput *entry){
+    hash_lru_remove(&workers->inputs, &entry->node);
+
+    struct Worker *worker = entry->worker;
+    if (entry->worker_prev != NULL) entry->worker_prev->worker_next = entry->worker_next;
+    else worker->cached = entry->worker_next;
+    if (entry->worker_next != NULL) entry->worker_next->worker_prev = entry->worker_prev;
+
+    worker->cached_count--;
+    free(entry);
+}
+
+static struct CachedInput *find_cached(struct Workers *workers, struct Worker *worker, const unsigned char *key){
+    for (struct HashLRUNode *node = hash_lru_find(&workers->inputs, key); node != NULL; node = hash_lru_find_next(node)){
+        struct CachedInput *entry = hash_lru_entry(node, struct CachedInput, node);
+        if (entry->worker == worker) return entry;
+    }
+    return NULL;
+}
+
+/*
+ * create_workers() -- allocate an empty Workers struct with a zeroed fd array
+ */
+struct Workers *create_workers(){
+    struct Workers *workers = malloc(sizeof *workers);
+    workers->head = NULL;
+    workers->tail = NULL;
+    workers->count = 0;
+
+    workers->by_fd_cap = WORKERS_MIN_CAP;
+    workers->by_fd = calloc(workers->by_fd_cap, sizeof *workers->by_fd);
+
+    workers->ready_head = NULL;
+    workers->ready_tail = NULL;
+    workers->available_workers = 0;
+
+    hash_lru_init(&workers->inputs, WORKERS_MIN_BUCKETS);
+
+    return workers;
+}
+
 /*
  * create_empty_worker() -- allocate and initialize a worker struct with default values
  */
@@ -12,21 +96,51 @@ struct Worker *create_empty_worker(){
     worker->id = -1;
     worker->jobs_completed = 0;
     worker->next = NULL;
+    worker->prev = NULL;
     worker->status = W_READY;
-    worker->cur_job_id = -1;
     worker->errcode = 1;
 
+    worker->slots = 1;
+    worker->prefetch = 0;
+    worker->inflight_cap = 1;
+    worker->inflight = malloc(worker->inflight_cap * sizeof *worker->inflight);
+    worker->inflight_count = 0;
+
+    worker->in_ready = 0;
+    worker->ready_next = NULL;
+    worker->ready_prev = NULL;
+
+    worker->cached = NULL;
+    worker->cached_count = 0;
+
+    worker->dropping = 0;
+
     return worker;
 }
 
 /*
- * add_worker() -- add a worker to the workers SLL
+ * add_worker() -- add a worker to the workers list and fd array, growing the array if the fd doesn't fit
  */
 void add_worker(struct Workers *workers, struct Worker *worker){
-    if (worker == NULL){
+    if (worker == NULL || worker->id < 0){
         return;
     }
 
+    if (worker->id >= workers->by_fd_cap){
+        int new_cap = workers->by_fd_cap * 2;
+        while (new_cap <= worker->id) new_cap *= 2;
+
+        workers->by_fd = realloc(workers->by_fd, new_cap * sizeof *workers->by_fd);
+        memset(workers->by_fd + workers->by_fd_cap, 0, (new_cap - workers->by_fd_cap) * sizeof *workers->by_fd);
+        workers->by_fd_cap = new_cap;
+    }
+    workers->by_fd[worker->id] = worker;
+
+    if (worker->status == W_READY) ready_push(workers, worker);
+
+    worker->next = NULL;
+    worker->prev = workers->tail;
+
     if (workers->count == 0){
         workers->head = workers->tail = worker;
         workers->count++;
@@ -40,64 +154,170 @@ void add_worker(struct Workers *workers, struct Worker *worker){
 }
 
 /*
- * remove_worker() -- remove a worker from the SLL by worker_id and free its memory
+ * remove_worker() -- remove a worker by worker_id and free its memory
  */
 void remove_worker(struct Workers *workers, int worker_id){
-    if (workers->count == 0){
-        return;
-    }
-
-    struct Worker *res = workers->head;
-    struct Worker *prev = NULL;
-
-    if (workers->count == 1){
-        if (workers->head->id != worker_id) return;
-        free(workers->head);
-        workers->head = workers->tail = NULL;
-        workers->count--;
-        return;
-    }
+    struct Worker *res = get_worker_by_id(workers, worker_id);
+    if (res == NULL) return;
 
-    for (res; res != NULL && res->id != worker_id; res = res->next){
-        prev = res;
-    }
+    ready_unlink(workers, res);
+    workers->by_fd[worker_id] = NULL;
+    while (res->cached != NULL) unlink_cached(workers, res->cached);
 
-    if (res == NULL) return;
+    if (res->prev != NULL) res->prev->next = res->next;
+    else workers->head = res->next;
 
-    if (res == workers->head){
-        workers->head = res->next;
-    } else if (res == workers->tail){
-        workers->tail = prev;
-        prev->next = NULL;
-    } else {
-        prev->next = res->next;
-    }
+    if (res->next != NULL) res->next->prev = res->prev;
+    else workers->tail = res->prev;
 
+    wconn_close(&res->conn);
+    free(res->inflight);
     free(res);
     workers->count--;
     return;
 }
 
 /*
- * get_worker_by_id() -- find and return worker with matching worker_id, NULL if not found
+ * get_worker_by_id() -- return worker with matching worker_id, NULL if not found
  */
 struct Worker *get_worker_by_id(struct Workers *workers, int worker_id){
-    if (workers->count != 0){
-        for (struct Worker *cur = workers->head; cur != NULL; cur = cur->next){
-            if (cur->id == worker_id) return cur;
-        }
-    }
-    return NULL;
+    if (worker_id < 0 || worker_id >= workers->by_fd_cap) return NULL;
+    return workers->by_fd[worker_id];
 }
 
 /*
- * get_available_worker() -- find and return first worker with W_READY status, NULL if none available
+ * get_available_worker() -- return the worker at the head of the ready list, NULL if none available
  */
 struct Worker *get_available_worker(struct Workers *workers){
-    if (workers->count != 0){
-        for (struct Worker *cur = workers->head; cur != NULL; cur = cur->next){
-            if (cur->status == W_READY) return cur;
-        }
+    return workers->ready_head;
+}
+
+/*
+ * get_idle_worker() -- walk the ready list for a free slot
+ */
+struct Worker *get_idle_worker(struct Workers *workers){
+    for (struct Worker *worker = workers->ready_head; worker != NULL; worker = worker->ready_next){
+        if (worker->inflight_count < worker->slots) return worker;
     }
     return NULL;
 }
+
+/*
+ * set_worker_status() -- set a worker's status and move it on/off the ready list to match
+ */
+void set_worker_status(struct Workers *workers, struct Worker *worker, int status){
+    worker->status = status;
+
+    if (status == W_READY) ready_push(workers, worker);
+    else ready_unlink(workers, worker);
+}
+
+/*
+ * refresh_status() -- W_READY while the worker can take another job, W_BUSY otherwise
+ */
+static void refresh_status(struct Workers *workers, struct Worker *worker){
+    set_worker_status(workers, worker, worker->inflight_count < worker->slots + worker->prefetch ? W_READY : W_BUSY);
+}
+
+/*
+ * set_worker_slots() -- resize the in-flight set for a new slot count and prefetch depth
+ */
+void set_worker_slots(struct Workers *workers, struct Worker *worker, int slots, int prefetch){
+    if (slots < 1) slots = 1;
+    if (prefetch < 0) prefetch = 0;
+    worker->slots = slots;
+    worker->prefetch = prefetch;
+
+    if (slots + prefetch > worker->inflight_cap){
+        worker->inflight_cap = slots + prefetch;
+        worker->inflight = realloc(worker->inflight, worker->inflight_cap * sizeof *worker->inflight);
+    }
+
+    refresh_status(workers, worker);
+}
+
+/*
+ * worker_add_job() -- append job_id to the in-flight set
+ *
+ * A worker that still has room goes to the back of the ready list, so dispatch spreads jobs
+ * across workers instead of filling one worker's slots before touching the next.
+ */
+void worker_add_job(struct Workers *workers, struct Worker *worker, int job_id){
+    if (worker->inflight_count == worker->inflight_cap){
+        worker->inflight_cap *= 2;
+        worker->inflight = realloc(worker->inflight, worker->inflight_cap * sizeof *worker->inflight);
+    }
+    worker->inflight[worker->inflight_count++] = job_id;
+
+    ready_unlink(workers, worker);
+    refresh_status(workers, worker);
+}
+
+/*
+ * worker_has_job() -- scan the in-flight set for job_id
+ */
+int worker_has_job(struct Worker *worker, int job_id){
+    for (int i = 0; i < worker->inflight_count; i++){
+        if (worker->inflight[i] == job_id) return 1;
+    }
+    return 0;
+}
+
+/*
+ * worker_remove_job() -- remove job_id from the in-flight set, keeping dispatch order (it holds at most a few ids, a scan is fine)
+ */
+int worker_remove_job(struct Workers *workers, struct Worker *worker, int job_id){
+    for (int i = 0; i < worker->inflight_count; i++){
+        if (worker->inflight[i] != job_id) continue;
+
+        worker->inflight_count--;
+        memmove(worker->inflight + i, worker->inflight + i + 1, (worker->inflight_count - i) * sizeof *worker->inflight);
+        refresh_status(workers, worker);
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * worker_cache_add() -- index key under the worker unless it's already there
+ */
+void worker_cache_add(struct Workers *workers, struct Worker *worker, unsigned char key[SHA256_LEN]){
+    if (find_cached(workers, worker, key) != NULL) return;
+
+    struct CachedInput *entry = malloc(sizeof *entry);
+    memcpy(entry->key, key, SHA256_LEN);
+    entry->worker = worker;
+    hash_lru_insert(&workers->inputs, &entry->node, entry->key);
+
+    entry->worker_prev = NULL;
+    entry->worker_next = worker->cached;
+    if (worker->cached != NULL) worker->cached->worker_prev = entry;
+    worker->cached = entry;
+
+    worker->cached_count++;
+}
+
+/*
+ * worker_cache_drop() -- forget the worker's entry for key, if any
+ */
+void worker_cache_drop(struct Workers *workers, struct Worker *worker, unsigned char key[SHA256_LEN]){
+    struct CachedInput *entry = find_cached(workers, worker, key);
+    if (entry != NULL) unlink_cached(workers, entry);
+}
+
+/*
+ * get_worker_holding() -- walk key's entries for ready holders
+ */
+struct Worker *get_worker_holding(struct Workers *workers, unsigned char key[SHA256_LEN], int idle_only){
+    struct Worker *best = NULL;
+
+    for (struct HashLRUNode *node = hash_lru_find(&workers->inputs, key); node != NULL; node = hash_lru_find_next(node)){
+        struct CachedInput *entry = hash_lru_entry(node, struct CachedInput, node);
+        if (!entry->worker->in_ready) continue;
+        if (idle_only && entry->worker->inflight_count >= entry->worker->slots) continue;
+        if (best == NULL || entry->worker->inflight_count < best->inflight_count) best = entry->worker;
+    }
+
+    return best;
+}
@@ -6,66 +6,185 @@
 #define WORKERS_H
 
 #include "../common.h"
+#include "./sha256.h"
+#include "./hash_lru.h"
+#include "./worker_conn.h"
 
 #include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
+
+#define WORKERS_MIN_CAP 64
+#define WORKERS_MIN_BUCKETS 64
+
+struct Worker;
+
+/*
+ * CachedInput -- an input a worker advertised as being in its input cache
+ *
+ * key -- the input blob's key
+ * *worker -- the worker holding it
+ * node -- the entry's place in the Workers' input index
+ * *worker_prev, *worker_next -- neighbours in the worker's list of cached inputs
+ */
+struct CachedInput {
+    unsigned char key[SHA256_LEN];
+    struct Worker *worker;
+
+    struct HashLRUNode node;
+    struct CachedInput *worker_prev;
+    struct CachedInput *worker_next;
+};
 
 /*
  * Worker -- struct for server managment of workers
  *
- * id -- unique worker id
- * status -- current status of the worker (ready, busy, failure, etc.)
+ * id -- unique worker id (the worker's socket fd)
+ * status -- W_READY while the worker can take another job, W_BUSY once slots + prefetch are in flight. Kept in sync by worker_add_job()/worker_remove_job()
  * jobs_completed -- total number of successful jobs completed by the worker
+ * slots -- jobs the worker runs at once, advertised in its WPACKET_CONNECTED reply (1 until then)
+ * prefetch -- jobs sent ahead of time on top of slots, also advertised in the reply (0 until then)
+ * *inflight, inflight_count, inflight_cap -- ids of the jobs currently assigned to the worker, in dispatch order.
+ *     The worker starts jobs first-come first-served, so the first `slots` entries are running and the rest are prefetched
+ * *next, *prev -- neighbours in the list of all workers
+ * *ready_next, *ready_prev -- neighbours in the ready list, only meaningful while in_ready is set
+ * *cached, cached_count -- inputs in the worker's input cache, as far as its WPACKET_INPUT_CACHE packets say
+ * conn -- the socket's protocol state: packets being read and messages waiting to go out
+ * dropping -- set when a running job outlasts JOB_TIMEOUT_MS or the socket fails mid-dispatch; the worker is
+ *     taken off the ready list and its events are ignored until the server drops it after the current epoll batch
  */
 struct Worker {
     int id;
     int status;
     int jobs_completed;
-    int cur_job_id;
     int errcode;
+
+    int slots;
+    int prefetch;
+    int *inflight;
+    int inflight_count;
+    int inflight_cap;
     unsigned char cur_job_results[MAXRESULTSIZE];
 
     struct Worker *next;
+    struct Worker *prev;
+
+    int in_ready;
+    struct Worker *ready_next;
+    struct Worker *ready_prev;
+
+    struct CachedInput *cached;
+    int cached_count;
+
+    struct WorkerConn conn;
+    int dropping;
 };
 
 /*
- * Workers -- SLL data structure for server management of multiple workers
+ * Workers -- list of workers, an fd-indexed lookup array, and an intrusive ready list
  *
  * *head -- pointer to the first worker in the list
  * *tail -- pointer to the last worker in the list
  * count -- total number of workers
- * available_workers -- total number of available workers
+ *
+ * **by_fd -- by_fd[id] points at the worker with that id, NULL if none
+ * by_fd_cap -- length of by_fd, grown to fit the largest fd seen
+ *
+ * *ready_head, *ready_tail -- W_READY workers, oldest-ready first so dispatch rotates through them
+ * available_workers -- total number of available (W_READY) workers, i.e. length of the ready list
+ *
+ * inputs -- every worker's cached inputs by key (one entry per worker holding it), so the workers holding
+ *     a job's input are found without asking each one
  */
 struct Workers {
     struct Worker *head;
     struct Worker *tail;
     int count;
+
+    struct Worker **by_fd;
+    int by_fd_cap;
+
+    struct Worker *ready_head;
+    struct Worker *ready_tail;
     int available_workers;
+
+    struct HashLRU inputs;
 };
 
+/*
+ * create_workers() -- create an empty Workers struct and return its pointer
+ */
+struct Workers *create_workers();
+
 /*
  * create_empty_worker() -- initialize a worker struct and return a pointer to it
  */
 struct Worker *create_empty_worker();
 
 /*
- * add_worker() -- add a worker to the SLL 
+ * add_worker() -- add a worker to the list and fd array, and to the ready list if it's W_READY
  */
 void add_worker(struct Workers *workers, struct Worker *worker);
 
 /*
- * remove_worker() -- remove a worker from the SLL given its ID
+ * remove_worker() -- remove a worker given its ID and free it, along with anything still queued for it
  */
 void remove_worker(struct Workers *workers, int worker_id);
 
 /*
- * get_worker_by_id() -- given an id, search through the SLL and return a pointer to the corresponding worker, NULL if not found
+ * get_worker_by_id() -- return a pointer to the worker with the given id, NULL if not found
  */
 struct Worker *get_worker_by_id(struct Workers *workers, int worker_id);
 
 /*
- * get_available_worker() -- search through the SLL and return a pointer to the first W_READY worker, NULL if not found
+ * get_available_worker() -- return the longest-ready W_READY worker, NULL if none
  */
 struct Worker *get_available_worker(struct Workers *workers);
 
-#endif
\ No newline at end of file
+/*
+ * get_idle_worker() -- return the longest-ready worker with a slot free (not just prefetch room), NULL if none
+ */
+struct Worker *get_idle_worker(struct Workers *workers);
+
+/*
+ * set_worker_status() -- update a worker's status, keeping the ready list and available_workers in sync
+ */
+void set_worker_status(struct Workers *workers, struct Worker *worker, int status);
+
+/*
+ * set_worker_slots() -- set how many jobs the worker runs at once (minimum 1) and how many more it may have queued, then refresh its status
+ */
+void set_worker_slots(struct Workers *workers, struct Worker *worker, int slots, int prefetch);
+
+/*
+ * worker_add_job() -- record job_id as in flight on the worker; it goes W_BUSY once slots + prefetch jobs are in flight
+ */
+void worker_add_job(struct Workers *workers, struct Worker *worker, int job_id);
+
+/*
+ * worker_has_job() -- 1 if job_id is in the worker's in-flight set, 0 otherwise
+ */
+int worker_has_job(struct Worker *worker, int job_id);
+
+/*
+ * worker_remove_job() -- drop job_id from the worker's in-flight set. Returns 1 if it was there, 0 otherwise
+ */
+int worker_remove_job(struct Workers *workers, struct Worker *worker, int job_id);
+
+/*
+ * worker_cache_add() -- record that the worker has key in its input cache
+ */
+void worker_cache_add(struct Workers *workers, struct Worker *worker, unsigned char key[SHA256_LEN]);
+
+/*
+ * worker_cache_drop() -- record that the worker no longer has key
+ */
+void worker_cache_drop(struct Workers *workers, struct Worker *worker, unsigned char key[SHA256_LEN]);
+
+/*
+ * get_worker_holding() -- return a W_READY worker that has key in its input cache, the one with the fewest jobs in flight if several do.
+ * With idle_only, only one with a slot free. NULL if none
+ */
+struct Worker *get_worker_holding(struct Workers *workers, unsigned char key[SHA256_LEN], int idle_only);
+
+#endif
@@ -1,5 +1,12 @@
 /*
  * worker.c -- Worker process for receiving and executing file-based jobs from server
+ *
+ * The main thread owns the server socket: it receives each job's spec and input file into a
+ * per-job directory and queues it. A pool of slot threads (-s SLOTS) runs the queued jobs and
+ * sends each one's status and results back under send_lock.
+ *
+ * Inputs are kept in an input cache by content hash (-c MB), and every key added or evicted is
+ * advertised to the server, which sends later jobs on a cached input with their spec only.
  */
 
 // Main imports
@@ -14,6 +21,8 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <pthread.h>
+#include <getopt.h>
 
 // custom imports
 #include "./common.h"
@@ -21,15 +30,48 @@
 #include "./utils/job_processing.h"
 #include "./utils/file_transfer.h"
 #include "./utils/epoll_helper.h"
+#include "./utils/input_cache.h"
+#include "./utils/time_custom.h"
+
+/*
+ * Task -- one job received from the server, waiting for or running on a slot
+ *
+ * job_id -- server-side job id, echoed back in the status packet
+ * spec -- job spec (command + args)
+ * dir -- per-job storage directory holding content<ext> and results<ext>
+ * ext -- input/result extension (.txt or .jpg)
+ * result -- image jobs' encoded output, kept in memory and sent from there instead of from results.jpg
+ */
+struct Task {
+    int job_id;
+    unsigned char spec[MAXBUFSIZE];
+    char dir[MAXFILEPATH];
+    char ext[MAXFILEEXT];
+    struct JobResult result;
+
+    struct Task *next;
+};
 
 /*
- * Self -- worker state struct tracking current status and server connection
+ * Self -- worker state struct tracking slots, the task queue, and the server connection
  *
  * jobs_completed -- total jobs successfully processed
  * id -- unique worker ID assigned by server
- * status -- current worker status (W_READY, W_BUSY, W_FAILURE, W_SUCCESS)
- * errcode -- error code for failed jobs
+ * status -- W_READY while a slot is free, W_BUSY when every slot is running a job
+ * errcode -- error code of the last failed job
+ * dir -- this worker's storage directory; each job gets its own subdirectory
  * servfd -- socket file descriptor for server connection
+ *
+ * slots -- jobs run at once, one pool thread per slot (advertised to the server on connect)
+ * prefetch -- extra jobs the server may send while every slot is busy (also advertised), so a freed slot starts immediately
+ * running -- slots currently running a job
+ * *task_head, *task_tail -- jobs received but not yet picked up by a slot
+ * lock, task_ready -- guard/signal the task queue and the counters above
+ * send_lock -- held while a slot writes a status packet (and its result file) so replies don't interleave
+ *
+ * *inputs -- inputs received so far by content hash, NULL if started with -c 0. Main thread only
+ * *wands -- MagickWands reused across image jobs, one per slot
+ * *tiles -- threads (-t) that heavy filters on big images split their work across, shared by every slot
  */
 struct Self {
     int jobs_completed;
@@ -38,9 +80,22 @@ struct Self {
     int errcode;
 
     char dir[MAXFILEPATH];
-    char ext[MAXFILEEXT];
 
     int servfd;
+
+    int slots;
+    int prefetch;
+    int running;
+    struct Task *task_head;
+    struct Task *task_tail;
+    pthread_mutex_t lock;
+    pthread_cond_t task_ready;
+    pthread_mutex_t send_lock;
+
+    struct InputCache *inputs;
+    struct WandPool *wands;
+    struct TilePool *tiles;
+    long sort_memory;
 };
 
 /*
@@ -111,109 +166,290 @@ void reset_storage(int id){
 }
 
 /*
- * handle_job_failure() -- notify server of job failure and send error code
+ * remove_task_dir() -- delete a finished job's content/results files and its directory
  */
-void handle_job_failure(struct Self *self){
-    printf("job failed.\n");
-    self->status = W_FAILURE;
+void remove_task_dir(struct Task *task){
+    char path[MAXFILEPATH+20];
+
+    sprintf(path, "%scontent%s", task->dir, task->ext);
+    remove(path);
+    sprintf(path, "%sresults%s", task->dir, task->ext);
+    remove(path);
+    rmdir(task->dir);
+}
+
+/*
+ * send_job_status() -- send [APPID][WPACKET_STATUS][status 2][errcode 2][job_id 4]. Caller holds send_lock
+ */
+void send_job_status(struct Self *self, int job_id, int status, int errcode){
     unsigned char update[MAXBUFSIZE];
     int offset = 0;
 
     packi16(update+offset, APPID); offset += 2;
     packi16(update+offset, WPACKET_STATUS); offset += 2;
-    packi16(update+offset, self->status); offset += 2;
-    packi16(update+offset, self->errcode); offset += 2;
+    packi16(update+offset, status); offset += 2;
+    packi16(update+offset, errcode); offset += 2;
+    packi32(update+offset, job_id); offset += 4;
     send(self->servfd, update, offset, 0);
 }
 
+/*
+ * handle_job_failure() -- notify server of job failure and send error code
+ */
+void handle_job_failure(struct Self *self, struct Task *task, int errcode){
+    printf("job %d failed.\n", task->job_id);
+
+    pthread_mutex_lock(&self->send_lock);
+    send_job_status(self, task->job_id, W_FAILURE, errcode);
+    pthread_mutex_unlock(&self->send_lock);
+
+    pthread_mutex_lock(&self->lock);
+    self->errcode = errcode;
+    pthread_mutex_unlock(&self->lock);
+}
+
 /*
  * handle_job_success() -- notify server of job completion and send results
  */
-void handle_job_success(struct Self *self){
-    printf("job complete.\n");
-    self->errcode = 1;
-    self->status = W_SUCCESS;
-    unsigned char update[MAXBUFSIZE];
+void handle_job_success(struct Self *self, struct Task *task){
     char file_path[MAXFILEPATH+15];
+
+    sprintf(file_path, "%sresults%s", task->dir, task->ext);
+
+    // a W_SUCCESS status promises a file right behind it, so a job that produced none is reported as failed
+    if (task->result.data == NULL && access(file_path, R_OK) != 0){
+        handle_job_failure(self, task, WERR_UNKNOWN);
+        return;
+    }
+
+    pthread_mutex_lock(&self->send_lock);
+    send_job_status(self, task->job_id, W_SUCCESS, 1);
+
+    if (task->result.data != NULL) send_file_buffer(self->servfd, IMG_FILE, task->result.data, task->result.len);
+    else if (strcmp(task->ext, ".txt") == 0) send_file_text_based(self->servfd, file_path);
+    else if (strcmp(task->ext, ".jpg") == 0) send_file_img_based(self->servfd, file_path);
+    pthread_mutex_unlock(&self->send_lock);
+
+    printf("job %d complete.\n", task->job_id);
+
+    pthread_mutex_lock(&self->lock);
+    self->jobs_completed++;
+    pthread_mutex_unlock(&self->lock);
+}
+
+/*
+ * run_task() -- process one job on the calling slot thread and report the outcome
+ */
+void run_task(struct Self *self, struct Task *task){
+    int rv = process_job(task->spec, task->dir, task->ext, self->wands, self->tiles, self->sort_memory, &task->result);
+    if (rv <= -1){
+        printf("errcode %d\n", rv);
+        handle_job_failure(self, task, rv);
+    } else {
+        handle_job_success(self, task);
+    }
+
+    free_job_result(&task->result);
+    remove_task_dir(task);
+}
+
+/*
+ * slot_main() -- pool thread: take the oldest queued task, run it, repeat
+ */
+void *slot_main(void *arg){
+    struct Self *self = arg;
+
+    while (1){
+        pthread_mutex_lock(&self->lock);
+        while (self->task_head == NULL) pthread_cond_wait(&self->task_ready, &self->lock);
+
+        struct Task *task = self->task_head;
+        self->task_head = task->next;
+        if (self->task_head == NULL) self->task_tail = NULL;
+
+        self->running++;
+        self->status = self->running < self->slots ? W_READY : W_BUSY;
+        pthread_mutex_unlock(&self->lock);
+
+        run_task(self, task);
+        free(task);
+
+        pthread_mutex_lock(&self->lock);
+        self->running--;
+        self->status = W_READY;
+        pthread_mutex_unlock(&self->lock);
+    }
+
+    return NULL;
+}
+
+/*
+ * queue_task() -- hand a fully received job to the slot pool
+ */
+void queue_task(struct Self *self, struct Task *task){
+    task->next = NULL;
+
+    pthread_mutex_lock(&self->lock);
+    if (self->task_tail != NULL) self->task_tail->next = task;
+    else self->task_head = task;
+    self->task_tail = task;
+    pthread_cond_signal(&self->task_ready);
+    pthread_mutex_unlock(&self->lock);
+}
+
+/*
+ * send_input_cache() -- tell the server an input was added to or dropped from the cache: [APPID][WPACKET_INPUT_CACHE][op 2][key 32]
+ */
+void send_input_cache(struct Self *self, int op, unsigned char key[SHA256_LEN]){
+    unsigned char packet[6 + SHA256_LEN];
     int offset = 0;
 
-    packi16(update+offset, APPID); offset += 2;
-    packi16(update+offset, WPACKET_STATUS); offset += 2;
-    packi16(update+offset, self->status); offset += 2;
-    packi16(update+offset, self->errcode); offset += 2;
-    send(self->servfd, update, offset, 0);
+    packi16(packet+offset, APPID); offset += 2;
+    packi16(packet+offset, WPACKET_INPUT_CACHE); offset += 2;
+    packi16(packet+offset, op); offset += 2;
+    memcpy(packet+offset, key, SHA256_LEN); offset += SHA256_LEN;
 
-    sprintf(file_path, "%sresults%s", self->dir, self->ext);
+    pthread_mutex_lock(&self->send_lock);
+    send(self->servfd, packet, offset, 0);
+    pthread_mutex_unlock(&self->send_lock);
+}
 
-    if (strcmp(self->ext, ".txt") == 0) send_file_text_based(self->servfd, file_path);
-    else if (strcmp(self->ext, ".jpg") == 0) send_file_img_based(self->servfd, file_path);
+/*
+ * input_dropped() -- input_cache_put() evicted key
+ */
+void input_dropped(unsigned char key[SHA256_LEN], void *arg){
+    send_input_cache(arg, ICACHE_DROPPED, key);
 }
 
 /*
- * handle_job_assignment() -- process incoming job, execute it, and report results
+ * handle_job_assignment() -- receive a job's spec and input file, then queue it for a slot
  *
- * Sets status to W_BUSY, processes the job content, reports success/failure to server
+ * Packet: [job_id 4][spec len 2][spec][input mode 2][input key 32][file type 2], then [file size 8][bytes]
+ * unless the mode is INPUT_CACHED, in which case the input is linked in from the input cache. The server
+ * sends up to slots + prefetch jobs, so the next job's input lands here while the slots are still busy
+ * and the queue never holds more than `prefetch` waiting jobs.
  */
 void handle_job_assignment(struct Self *self){
-    self->status = W_BUSY;
-    // sleep(5);
-
     unsigned char buf[MAXBUFSIZE];
     memset(buf, 0, MAXBUFSIZE);
-    if (read(self->servfd, buf, 2) <= 0) return;
+    if (recv(self->servfd, buf, 6, MSG_WAITALL) != 6) return;
 
-    int spec_size = unpacki16(buf);
-    memset(buf, 0, MAXBUFSIZE);
-    if (read(self->servfd, buf, spec_size) <= 0) return;
+    struct Task *task = malloc(sizeof *task);
+    memset(task->spec, 0, MAXBUFSIZE);
+    task->job_id = unpacki32(buf);
+    int spec_size = unpacki16(buf+4);
 
-    unsigned char file_type[MAXBUFSIZE];
-    if (read(self->servfd, file_type, 2) <= 0) return;
-    int file_type_id = unpacki16(file_type);
+    // from here on the server has the job down as ours: every way out has to report it, or it waits on it forever
+    if (spec_size <= 0 || spec_size >= MAXBUFSIZE || recv(self->servfd, task->spec, spec_size, MSG_WAITALL) != spec_size){
+        handle_job_failure(self, task, WERR_INVALIDJOB);
+        free(task);
+        return;
+    }
+
+    unsigned char input[4 + SHA256_LEN];
+    if (recv(self->servfd, input, sizeof input, MSG_WAITALL) != sizeof input){
+        handle_job_failure(self, task, WERR_UNKNOWN);
+        free(task);
+        return;
+    }
+    int input_mode = unpacki16(input);
+    unsigned char *key = input + 2;
+    int file_type_id = unpacki16(input + 2 + SHA256_LEN);
+
+    if (snprintf(task->dir, MAXFILEPATH, "%sjob-%d/", self->dir, task->job_id) >= MAXFILEPATH){
+        // a cut-off directory could be another job's: fail this one, still reading its input off the socket
+        printf("job %d: job directory too long\n", task->job_id);
+        if (input_mode != INPUT_CACHED) receive_file(self->servfd, "/dev/null");
+        handle_job_failure(self, task, WERR_INVALIDJOB);
+        free(task);
+        return;
+    }
+    (void)mkdir(task->dir, 0755);
 
-    char fname[MAXFILEPATH];
-    strcpy(fname, self->dir);
+    char fname[MAXFILEPATH+15];
+    strcpy(fname, task->dir);
+    int rv = -1;
 
     if (file_type_id == TXT_FILE){
-        strcpy(self->ext, ".txt");
+        strcpy(task->ext, ".txt");
         strcat(fname, "content.txt");
-        fclose(fopen(fname, "w"));
-        receive_file_text_based(fname, self->servfd);
     } else if (file_type_id == IMG_FILE){
-        strcpy(self->ext, ".jpg");
+        strcpy(task->ext, ".jpg");
         strcat(fname, "content.jpg");
-        fclose(fopen(fname, "wb"));
-        receive_file_img_based(self->servfd, fname);
+    } else {
+        printf("job %d: unknown file type %d\n", task->job_id, file_type_id);
+        if (input_mode != INPUT_CACHED) receive_file(self->servfd, "/dev/null");
+        handle_job_failure(self, task, WERR_INVALIDJOB);
+        rmdir(task->dir);
+        free(task);
+        return;
     }
-    
 
-    int rv = process_job(buf, self->dir, self->ext);
-    if (rv <= -1){
-        printf("errcode %d\n", rv);
-        self->errcode = rv;
-        handle_job_failure(self);
-        self->errcode = 1;
-        self->status = W_READY;
+    if (input_mode == INPUT_CACHED){
+        // evicted after the server last heard from us: it re-sends the job with its input
+        if (self->inputs == NULL || !input_cache_get(self->inputs, key, fname)){
+            printf("job %d: input no longer cached\n", task->job_id);
+            handle_job_failure(self, task, WERR_INPUTMISSING);
+            remove_task_dir(task);
+            free(task);
+            return;
+        }
+        queue_task(self, task);
         return;
     }
 
-    self->jobs_completed++;
-    handle_job_success(self);
-    self->status = W_READY;
+    if (file_type_id == TXT_FILE) rv = receive_file_text_based(fname, self->servfd);
+    else rv = receive_file_img_based(self->servfd, fname);
+
+    if (rv != 1){
+        handle_job_failure(self, task, WERR_UNKNOWN);
+        remove_task_dir(task);
+        free(task);
+        return;
+    }
+
+    if (input_mode == INPUT_SENT && self->inputs != NULL && input_cache_put(self->inputs, key, fname, input_dropped, self)){
+        send_input_cache(self, ICACHE_ADDED, key);
+    }
+
+    queue_task(self, task);
 }
 
 /*
- * handle_status_update() -- send current worker status to server
+ * handle_status_update() -- send current worker status to server (not tied to a job, so job_id is -1)
  */
 void handle_status_update(struct Self *self){
-    unsigned char update[MAXBUFSIZE];
-    int offset = 0;
-
-    packi16(update+offset, APPID); offset += 2;
-    packi16(update+offset, WPACKET_STATUS); offset += 2;
-    packi16(update+offset, self->status); offset += 2;
-    packi16(update+offset, self->errcode); offset += 2;
+    pthread_mutex_lock(&self->lock);
+    int status = self->status;
+    int errcode = self->errcode;
+    pthread_mutex_unlock(&self->lock);
+
+    pthread_mutex_lock(&self->send_lock);
+    send_job_status(self, -1, status, errcode);
+    pthread_mutex_unlock(&self->send_lock);
+}
 
-    send(self->servfd, update, offset, 0);
+/*
+ * send_keepalive() -- [APPID][WPACKET_KEEPALIVE] once WORKER_KEEPALIVE_MS has passed since the last one, if a slot is
+ * running a job; a long job would otherwise look the same as a hung worker to the server's JOB_TIMEOUT_MS
+ */
+void send_keepalive(struct Self *self, int *last_sent_ms){
+    int now_ms = get_time_ms();
+    if (now_ms - *last_sent_ms < WORKER_KEEPALIVE_MS) return;
+
+    pthread_mutex_lock(&self->lock);
+    int running = self->running;
+    pthread_mutex_unlock(&self->lock);
+    if (running == 0) return;
+
+    unsigned char packet[4];
+    packi16(packet, APPID);
+    packi16(packet+2, WPACKET_KEEPALIVE);
+
+    pthread_mutex_lock(&self->send_lock);
+    send(self->servfd, packet, sizeof packet, 0);
+    pthread_mutex_unlock(&self->send_lock);
+    *last_sent_ms = now_ms;
 }
 
 /*
@@ -232,7 +468,6 @@ void handle_server_data(struct Self *self, unsigned char buf[MAXBUFSIZE]){
 
     if (packetid == WPACKET_NEWJOB){
         printf("received new job. processing...\n");
-        (void)unpacki16(buf+offset); offset += 2;
         handle_job_assignment(self);
     }
 
@@ -251,7 +486,55 @@ void handle_shutdown(int serverfd, int epollfd, int id){
     exit(EXIT_SUCCESS);
 }
 
-int main(){
+/*
+ * parse_options() -- read -s SLOTS (0 = one per online CPU), -p PREFETCH, -c INPUT_CACHE_MB, -t TILE_THREADS
+ * (0 = one per online CPU) and -m SORT_MEMORY_MB from the command line
+ */
+void parse_options(int argc, char **argv, int *slots, int *prefetch, int *cache_mb, int *tile_threads, int *sort_mb){
+    int opt;
+    *slots = WORKER_DEFAULT_SLOTS;
+    *prefetch = WORKER_DEFAULT_PREFETCH;
+    *cache_mb = WORKER_DEFAULT_INPUT_CACHE_MB;
+    *tile_threads = WORKER_DEFAULT_TILE_THREADS;
+    *sort_mb = WORKER_DEFAULT_SORT_MEMORY_MB;
+
+    while ((opt = getopt(argc, argv, "s:p:c:t:m:")) != -1){
+        if (opt == 's'){
+            *slots = atoi(optarg);
+            continue;
+        }
+        if (opt == 'p'){
+            *prefetch = atoi(optarg);
+            continue;
+        }
+        if (opt == 'c'){
+            *cache_mb = atoi(optarg);
+            continue;
+        }
+        if (opt == 't'){
+            *tile_threads = atoi(optarg);
+            continue;
+        }
+        if (opt == 'm'){
+            *sort_mb = atoi(optarg);
+            continue;
+        }
+        printf("usage: ./worker [-s SLOTS] [-p PREFETCH] [-c INPUT_CACHE_MB] [-t TILE_THREADS] [-m SORT_MEMORY_MB]\n");
+        exit(1);
+    }
+
+    if (*slots <= 0) *slots = sysconf(_SC_NPROCESSORS_ONLN);
+    if (*slots <= 0) *slots = 1;
+    if (*prefetch < 0) *prefetch = 0;
+    if (*cache_mb < 0) *cache_mb = 0;
+    if (*tile_threads <= 0) *tile_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (*tile_threads <= 0) *tile_threads = 1;
+    if (*sort_mb < 0) *sort_mb = 0;
+}
+
+int main(int argc, char **argv){
+    int slots, prefetch, cache_mb, tile_threads, sort_mb;
+    parse_options(argc, argv, &slots, &prefetch, &cache_mb, &tile_threads, &sort_mb);
 
     printf("\nConnecting to server...\n");
     int sockfd = get_socket();
@@ -265,24 +548,76 @@ int main(){
     self->id = -1;
     self->servfd = sockfd;
     self->errcode = 1;
-
+    self->slots = slots;
+    self->prefetch = prefetch;
+    self->sort_memory = (long)sort_mb << 20;
+    self->running = 0;
+    self->task_head = NULL;
+    self->task_tail = NULL;
+    pthread_mutex_init(&self->lock, NULL);
+    pthread_cond_init(&self->task_ready, NULL);
+    pthread_mutex_init(&self->send_lock, NULL);
+
+    // handshake: [APPID][WPACKET_CONNECTED][id 2] in, [APPID][WPACKET_CONNECTED][slots 2][prefetch 2] back
     unsigned char buf[MAXBUFSIZE];
-    recv(sockfd, buf, MAXBUFSIZE, 0);
+    if (recv(sockfd, buf, 6, MSG_WAITALL) != 6){
+        printf("server closed the connection.\n");
+        exit(EXIT_FAILURE);
+    }
     self->id = unpacki16(buf+4);
-    printf("ID: %d\nwaiting for jobs...", self->id);
+
+    int offset = 0;
+    packi16(buf+offset, APPID); offset += 2;
+    packi16(buf+offset, WPACKET_CONNECTED); offset += 2;
+    packi16(buf+offset, self->slots); offset += 2;
+    packi16(buf+offset, self->prefetch); offset += 2;
+    send(sockfd, buf, offset, 0);
+
+    printf("ID: %d (%d slots, prefetch %d, %d tile threads)\nwaiting for jobs...", self->id, self->slots, self->prefetch, tile_threads);
     fflush(stdout);
 
     sprintf(self->dir, "./worker_storage/worker-%d/", self->id);
     (void)mkdir(self->dir, 0755);
 
+    self->inputs = NULL;
+    if (cache_mb > 0){
+        char cache_dir[MAXFILEPATH];
+        if (snprintf(cache_dir, MAXFILEPATH, "%sinput-cache/", self->dir) >= MAXFILEPATH){
+            printf("input cache directory too long.\n");
+            exit(EXIT_FAILURE);
+        }
+        self->inputs = create_input_cache(cache_dir, (long)cache_mb << 20);
+    }
+
+    // one MagickWand environment for every slot, and wands that outlive the jobs using them
+    MagickWandGenesis();
+    self->wands = create_wand_pool(self->slots);
+
+    // tiles are the parallelism for big filters, and Magick's own OpenMP threads run inside every strip. Up to
+    // tile_threads - 1 pool threads plus every slot can be in Magick at once, so each gets its share of the CPUs.
+    // That share applies to all Magick work, which is why tiling is off unless -t asks for it
+    self->tiles = create_tile_pool(tile_threads);
+    if (tile_threads > 1){
+        long magick_threads = sysconf(_SC_NPROCESSORS_ONLN) / (tile_threads - 1 + self->slots);
+        MagickSetResourceLimit(ThreadResource, magick_threads > 1 ? magick_threads : 1);
+    }
+
+    for (int i = 0; i < self->slots; i++){
+        pthread_t thread;
+        pthread_create(&thread, NULL, slot_main, self);
+        pthread_detach(thread);
+    }
+
     struct epoll_event events[MAXEPOLLEVENTS];
+    int keepalive_ms = get_time_ms();
     while (1) {
 
-        int nfds = epoll_wait(epollfd, events, MAXEPOLLEVENTS, 2000);
+        int nfds = epoll_wait(epollfd, events, MAXEPOLLEVENTS, WORKER_KEEPALIVE_MS);
         if (nfds == -1) {
             perror("epoll_wait");
             break;
         }
+        send_keepalive(self, &keepalive_ms);
 
         for (int i = 0; i < nfds; i++) {
             if (events[i].events & EPOLLIN) {
@@ -295,8 +630,8 @@ int main(){
                 unsigned char buffer[MAXBUFSIZE];
                 memset(buffer, 0, sizeof buffer);
 
-                int rv = read(fd, buffer, 6);
-                if (rv == 0) {
+                int rv = recv(fd, buffer, 4, MSG_WAITALL);
+                if (rv <= 0) {
                     printf("server disconnected.\n");
                     handle_shutdown(sockfd, epollfd, self->id);
                 }
@@ -304,12 +639,7 @@ int main(){
                 printf("\n");
             }
         }
-
-        if (self->status == W_READY){
-            //printf(".");
-            //fflush(stdout);
-        }
     }
 
     close(sockfd);
-}
\ No newline at end of file
+}